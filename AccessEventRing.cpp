@@ -0,0 +1,34 @@
+#include "AccessEventRing.h"
+
+/**
+ * Adds an event. Producers must be serialized (by the state lock).
+ */
+void AccessEventRing::push(AccessTracer::Space space, bool write, uint32_t addr, uint32_t value)
+{
+  const size_t head = m_head.load(std::memory_order_relaxed);
+  if (head - m_tail.load(std::memory_order_acquire) >= CAPACITY)
+  {
+    m_dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  m_events[head % CAPACITY] = Event { space, write, addr, value };
+  m_head.store(head + 1, std::memory_order_release);
+}
+
+/**
+ * Removes up to max of the oldest events, returning the number removed. Must
+ * only be called by the consumer thread.
+ */
+size_t AccessEventRing::pop(Event* events, size_t max)
+{
+  const size_t tail = m_tail.load(std::memory_order_relaxed);
+  const size_t head = m_head.load(std::memory_order_acquire);
+  size_t count = 0;
+  while ((count < max) && (tail + count != head))
+  {
+    events[count] = m_events[(tail + count) % CAPACITY];
+    count++;
+  }
+  m_tail.store(tail + count, std::memory_order_release);
+  return count;
+}
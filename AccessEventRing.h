@@ -0,0 +1,43 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include "AccessTracer.h"
+
+/**
+ * Carries reads and writes of ECU state (RAM, sampled values, snapshot pages
+ * and error memory) from whichever thread holds the state lock to a single
+ * consumer, for clients of the control API that subscribe to them. The ring
+ * has a fixed size, so pushing never allocates; if the consumer falls
+ * behind, new events are dropped and counted.
+ *
+ * Events are only pushed while the ring is enabled, so that nothing is
+ * recorded unless someone is subscribed.
+ */
+class AccessEventRing
+{
+public:
+  static constexpr size_t CAPACITY = 1 << 14;
+
+  struct Event
+  {
+    AccessTracer::Space space;
+    bool write;
+    uint32_t addr;
+    uint32_t value;
+  };
+
+  void setEnabled(bool enabled) { m_enabled.store(enabled, std::memory_order_relaxed); }
+  bool enabled() const { return m_enabled.load(std::memory_order_relaxed); }
+  void push(AccessTracer::Space space, bool write, uint32_t addr, uint32_t value);
+  size_t pop(Event* events, size_t max);
+  uint32_t takeDropped() { return m_dropped.exchange(0, std::memory_order_relaxed); }
+
+private:
+  std::atomic<bool> m_enabled { false };
+  std::atomic<size_t> m_head { 0 };
+  std::atomic<size_t> m_tail { 0 };
+  std::atomic<uint32_t> m_dropped { 0 };
+  std::array<Event,CAPACITY> m_events;
+};
@@ -0,0 +1,294 @@
+#include "AccessTracer.h"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include <QFile>
+#include <QList>
+#include <QSaveFile>
+#include <QStringList>
+
+namespace
+{
+  const char* const SPACE_NAMES[AccessTracer::NUM_SPACES] = { "ram", "value", "snapshot", "errmem", "raw" };
+  const char* const HEAT_CHARS = ".:-=+*#%@";
+  constexpr int HEAT_LEVELS = 9;
+  constexpr int HISTOGRAM_BAR_WIDTH = 40;
+
+  QString hex(uint32_t val, int width)
+  {
+    return QString("%1").arg(val, width, 16, QChar('0'));
+  }
+}
+
+AccessTracer::Bank::Bank()
+{
+  clear();
+}
+
+void AccessTracer::Bank::clear()
+{
+  for (int i = 0; i < BANK_SIZE / 64; i++)
+  {
+    readBits[i].store(0, std::memory_order_relaxed);
+    writeBits[i].store(0, std::memory_order_relaxed);
+  }
+  for (int i = 0; i < BANK_SIZE; i++)
+  {
+    reads[i].store(0, std::memory_order_relaxed);
+    writes[i].store(0, std::memory_order_relaxed);
+    firstAccess[i].store(0, std::memory_order_relaxed);
+  }
+}
+
+AccessTracer::EcuTrace::EcuTrace(AccessTracer* tracer, int ecuId) :
+  m_tracer(tracer),
+  m_ecuId(ecuId),
+  m_banks(new Bank[NUM_SPACES * NUM_BANKS])
+{
+}
+
+void AccessTracer::EcuTrace::record(Space space, uint16_t addr, bool write)
+{
+  Bank& b = bank(static_cast<int>(space), addr >> 8);
+  const int i = addr & 0xff;
+
+  std::atomic<uint64_t>* bits = write ? b.writeBits : b.readBits;
+  bits[i / 64].fetch_or(1ULL << (i % 64), std::memory_order_relaxed);
+  (write ? b.writes : b.reads)[i].fetch_add(1, std::memory_order_relaxed);
+
+  if (b.firstAccess[i].load(std::memory_order_relaxed) == 0)
+  {
+    uint32_t expected = 0;
+    const uint32_t seq = m_tracer->m_sequence.fetch_add(1, std::memory_order_relaxed) + 1;
+    b.firstAccess[i].compare_exchange_strong(expected, seq, std::memory_order_relaxed);
+  }
+}
+
+/**
+ * Returns the trace for an ECU, creating it if necessary. This takes a lock
+ * (and allocates the ECU's banks the first time), so it should be called when
+ * WSDC32 starts talking to an ECU rather than per frame.
+ */
+AccessTracer::EcuTrace* AccessTracer::ecu(int ecuId)
+{
+  std::lock_guard<std::mutex> lock(m_ecuMutex);
+  std::unique_ptr<EcuTrace>& trace = m_ecus[ecuId];
+  if (!trace)
+  {
+    trace.reset(new EcuTrace(this, ecuId));
+  }
+  return trace.get();
+}
+
+/**
+ * Clears all recorded accesses, to start a new capture session.
+ */
+void AccessTracer::reset()
+{
+  std::lock_guard<std::mutex> lock(m_ecuMutex);
+  for (auto& ecu : m_ecus)
+  {
+    for (int i = 0; i < NUM_SPACES * NUM_BANKS; i++)
+    {
+      ecu.second->m_banks[i].clear();
+    }
+  }
+  m_sequence.store(0, std::memory_order_relaxed);
+}
+
+const char* AccessTracer::spaceName(Space space)
+{
+  return SPACE_NAMES[static_cast<int>(space)];
+}
+
+/**
+ * Calls func for every location that has been accessed, in order of ECU,
+ * address space, and address.
+ */
+template <typename Func>
+void AccessTracer::forEachEntry(Func func) const
+{
+  std::lock_guard<std::mutex> lock(m_ecuMutex);
+  for (const auto& ecu : m_ecus)
+  {
+    for (int s = 0; s < NUM_SPACES; s++)
+    {
+      for (int b = 0; b < NUM_BANKS; b++)
+      {
+        const Bank* bank = &ecu.second->bank(s, b);
+        for (int word = 0; word < BANK_SIZE / 64; word++)
+        {
+          uint64_t touched = bank->readBits[word].load(std::memory_order_relaxed) |
+                             bank->writeBits[word].load(std::memory_order_relaxed);
+          while (touched)
+          {
+            const int i = (word * 64) + __builtin_ctzll(touched);
+            touched &= touched - 1;
+            func(Entry { ecu.first, static_cast<Space>(s), static_cast<uint16_t>((b << 8) | i),
+                         bank->reads[i].load(std::memory_order_relaxed),
+                         bank->writes[i].load(std::memory_order_relaxed),
+                         bank->firstAccess[i].load(std::memory_order_relaxed) });
+          }
+        }
+      }
+    }
+  }
+}
+
+/**
+ * Saves the trace as CSV, one accessed location per line, for diffing.
+ */
+bool AccessTracer::saveCSV(const QString& path) const
+{
+  QSaveFile file(path);
+  if (!file.open(QIODevice::WriteOnly | QIODevice::Text))
+  {
+    return false;
+  }
+
+  QTextStream out(&file);
+  out << "ecu,space,address,reads,writes,first\n";
+  forEachEntry([&out](const Entry& e)
+  {
+    out << QString("%1,%2,0x%3,%4,%5,%6\n").arg(e.ecuId, 4, 10, QChar('0')).arg(spaceName(e.space)).
+      arg(hex(e.addr, 4)).arg(e.reads).arg(e.writes).arg(e.firstAccess);
+  });
+  out.flush();
+  return file.commit();
+}
+
+/**
+ * Writes a human-readable report of the trace: for each ECU, a heatmap of
+ * every bank that was touched (one character per location, on a log scale of
+ * its access count), the locations ordered by access count, and the
+ * locations in the order they were first accessed.
+ */
+void AccessTracer::writeReport(QTextStream& out) const
+{
+  std::map<int,std::vector<Entry>> byEcu;
+  forEachEntry([&byEcu](const Entry& e) { byEcu[e.ecuId].push_back(e); });
+
+  for (auto& ecu : byEcu)
+  {
+    std::vector<Entry>& entries = ecu.second;
+    out << QString("ECU %1: %2 locations accessed\n\n").arg(ecu.first, 4, 10, QChar('0')).arg(entries.size());
+
+    // Heatmap, 16 locations per row, for each bank with any accesses
+    out << "Heatmap (' ' untouched, '.' once ... '@' 256+ times; 'w' marks rows with writes)\n";
+    size_t pos = 0;
+    while (pos < entries.size())
+    {
+      const Space space = entries[pos].space;
+      const int bankIndex = entries[pos].addr >> 8;
+      char cells[BANK_SIZE];
+      bool rowWritten[BANK_SIZE / 16] = {};
+      std::fill(cells, cells + BANK_SIZE, ' ');
+
+      for (; (pos < entries.size()) && (entries[pos].space == space) && ((entries[pos].addr >> 8) == bankIndex); pos++)
+      {
+        const Entry& e = entries[pos];
+        const uint32_t count = e.reads + e.writes;
+        const int level = std::min(HEAT_LEVELS - 1, static_cast<int>(std::log2(std::max<uint32_t>(count, 1))));
+        cells[e.addr & 0xff] = HEAT_CHARS[level];
+        rowWritten[(e.addr & 0xff) / 16] |= (e.writes > 0);
+      }
+
+      out << QString("  %1 bank %2\n").arg(spaceName(space)).arg(hex(bankIndex, 2));
+      out << "             0123456789abcdef\n";
+      for (int row = 0; row < BANK_SIZE / 16; row++)
+      {
+        out << QString("    %1 %2  ").arg(hex((bankIndex << 8) | (row << 4), 4)).arg(rowWritten[row] ? 'w' : ' ') <<
+          QString::fromLatin1(cells + (row * 16), 16) << "\n";
+      }
+    }
+    out << "\n";
+
+    // Histogram, most accessed first
+    std::vector<Entry> sorted = entries;
+    std::stable_sort(sorted.begin(), sorted.end(), [](const Entry& a, const Entry& b)
+      { return (a.reads + a.writes) > (b.reads + b.writes); });
+    const double maxCount = sorted.empty() ? 1 : (sorted.front().reads + sorted.front().writes);
+    out << "Access counts\n";
+    for (const Entry& e : sorted)
+    {
+      const int bar = std::max(1, static_cast<int>(HISTOGRAM_BAR_WIDTH * (e.reads + e.writes) / maxCount));
+      out << QString("  %1 %2  r %3  w %4  ").arg(spaceName(e.space), -8).arg(hex(e.addr, 4)).
+        arg(e.reads, 8).arg(e.writes, 8) << QString(bar, QChar('#')) << "\n";
+    }
+    out << "\n";
+
+    // First-access order
+    std::sort(sorted.begin(), sorted.end(), [](const Entry& a, const Entry& b)
+      { return a.firstAccess < b.firstAccess; });
+    out << "First access order\n";
+    for (const Entry& e : sorted)
+    {
+      out << QString("  %1  %2 %3\n").arg(e.firstAccess, 6).arg(spaceName(e.space), -8).arg(hex(e.addr, 4));
+    }
+    out << "\n";
+  }
+}
+
+static bool loadCSV(const QString& path, std::map<QString,std::pair<uint32_t,uint32_t>>& counts)
+{
+  QFile file(path);
+  if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+  {
+    return false;
+  }
+
+  while (!file.atEnd())
+  {
+    const QStringList fields = QString::fromUtf8(file.readLine()).trimmed().split(',');
+    if ((fields.size() == 6) && (fields[0] != "ecu"))
+    {
+      counts[fields[0] + " " + fields[1] + " " + fields[2]] = std::make_pair(fields[3].toUInt(), fields[4].toUInt());
+    }
+  }
+  return true;
+}
+
+/**
+ * Compares two traces saved with saveCSV(), listing the locations that were
+ * only accessed in one of them, and those whose read or write counts differ.
+ */
+bool AccessTracer::diff(const QString& pathA, const QString& pathB, QTextStream& out)
+{
+  std::map<QString,std::pair<uint32_t,uint32_t>> a;
+  std::map<QString,std::pair<uint32_t,uint32_t>> b;
+  if (!loadCSV(pathA, a) || !loadCSV(pathB, b))
+  {
+    return false;
+  }
+
+  QStringList onlyA;
+  QStringList onlyB;
+  QStringList changed;
+  for (const auto& entry : a)
+  {
+    const auto other = b.find(entry.first);
+    if (other == b.end())
+    {
+      onlyA.append(QString("  %1  r %2  w %3").arg(entry.first).arg(entry.second.first).arg(entry.second.second));
+    }
+    else if (other->second != entry.second)
+    {
+      changed.append(QString("  %1  r %2 -> %3  w %4 -> %5").arg(entry.first).
+        arg(entry.second.first).arg(other->second.first).arg(entry.second.second).arg(other->second.second));
+    }
+  }
+  for (const auto& entry : b)
+  {
+    if (a.find(entry.first) == a.end())
+    {
+      onlyB.append(QString("  %1  r %2  w %3").arg(entry.first).arg(entry.second.first).arg(entry.second.second));
+    }
+  }
+
+  out << QString("Only in %1 (%2):\n").arg(pathA).arg(onlyA.size()) << onlyA.join("\n") << "\n\n";
+  out << QString("Only in %1 (%2):\n").arg(pathB).arg(onlyB.size()) << onlyB.join("\n") << "\n\n";
+  out << QString("Different counts (%1):\n").arg(changed.size()) << changed.join("\n") << "\n";
+  out.flush();
+  return true;
+}
+
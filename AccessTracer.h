@@ -0,0 +1,107 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <QString>
+#include <QTextStream>
+
+/**
+ * Records which locations WSDC32 reads and writes in each ECU, to help map
+ * the memory layout of modules that the simulator doesn't know yet. Every
+ * access sets a bit in a per-bank bitmap and bumps a counter, and the first
+ * access to each location is stamped with a sequence number, so that a
+ * capture session can be dumped as a heatmap, an address histogram, or the
+ * order in which locations were first touched. Traces saved as CSV can be
+ * diffed against each other, e.g. to see which locations a screen in WSDC32
+ * reads that another one doesn't.
+ *
+ * Locations are grouped into address spaces: ECU RAM, sampled value IDs,
+ * snapshot pages, error memory bytes, and "raw" addresses from requests whose
+ * mapping onto RAM isn't known. Each space is split into banks of 256
+ * locations. All of an ECU's banks are allocated when its trace is first
+ * asked for, so that recording an access never allocates.
+ *
+ * Recording only uses relaxed atomics, so a trace can be dumped from another
+ * thread while accesses are still being recorded (the dump just may not be
+ * a consistent snapshot).
+ */
+class AccessTracer
+{
+public:
+  enum class Space : uint8_t
+  {
+    RAM,
+    Value,
+    Snapshot,
+    ErrorMemory,
+    Raw
+  };
+
+  static constexpr int NUM_SPACES = 5;
+  static constexpr int BANK_SIZE = 256;
+  static constexpr int NUM_BANKS = 256;
+
+  struct Bank
+  {
+    std::atomic<uint64_t> readBits[BANK_SIZE / 64];
+    std::atomic<uint64_t> writeBits[BANK_SIZE / 64];
+    std::atomic<uint32_t> reads[BANK_SIZE];
+    std::atomic<uint32_t> writes[BANK_SIZE];
+    std::atomic<uint32_t> firstAccess[BANK_SIZE];
+
+    Bank();
+    void clear();
+  };
+
+  /**
+   * Access counts for one ECU. Pointers to these remain valid for the life
+   * of the tracer (reset() clears them rather than freeing them), so the
+   * recording thread looks up the one for an ECU when WSDC32 starts talking
+   * to it, and holds on to it.
+   */
+  class EcuTrace
+  {
+  public:
+    EcuTrace(AccessTracer* tracer, int ecuId);
+
+    void recordRead(Space space, uint16_t addr) { record(space, addr, false); }
+    void recordWrite(Space space, uint16_t addr) { record(space, addr, true); }
+
+  private:
+    friend class AccessTracer;
+    AccessTracer* m_tracer;
+    int m_ecuId;
+    std::unique_ptr<Bank[]> m_banks;
+
+    void record(Space space, uint16_t addr, bool write);
+    Bank& bank(int space, int bankIndex) const { return m_banks[(space * NUM_BANKS) + bankIndex]; }
+  };
+
+  EcuTrace* ecu(int ecuId);
+  void reset();
+  bool saveCSV(const QString& path) const;
+  void writeReport(QTextStream& out) const;
+
+  static bool diff(const QString& pathA, const QString& pathB, QTextStream& out);
+  static const char* spaceName(Space space);
+
+private:
+  struct Entry
+  {
+    int ecuId;
+    Space space;
+    uint16_t addr;
+    uint32_t reads;
+    uint32_t writes;
+    uint32_t firstAccess;
+  };
+
+  std::atomic<uint32_t> m_sequence { 0 };
+  mutable std::mutex m_ecuMutex;
+  std::map<int,std::unique_ptr<EcuTrace>> m_ecus;
+
+  template <typename Func> void forEachEntry(Func func) const;
+};
+
@@ -0,0 +1,283 @@
+#include "AllocCheck.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <map>
+#include <vector>
+#include "TesterSim.h"
+
+#ifdef SD2SIM_ALLOC_STATS
+
+// glibc's own allocator entry points, which the replacements below forward to
+extern "C"
+{
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void __libc_free(void* ptr);
+}
+
+namespace
+{
+thread_local uint64_t s_allocCount = 0;
+}
+
+extern "C" void* malloc(size_t size)
+{
+  s_allocCount++;
+  return __libc_malloc(size);
+}
+
+extern "C" void* calloc(size_t count, size_t size)
+{
+  s_allocCount++;
+  return __libc_calloc(count, size);
+}
+
+extern "C" void* realloc(void* ptr, size_t size)
+{
+  if (size > 0)
+  {
+    s_allocCount++;
+  }
+  return __libc_realloc(ptr, size);
+}
+
+extern "C" void free(void* ptr)
+{
+  __libc_free(ptr);
+}
+
+bool AllocCheck::enabled()
+{
+  return true;
+}
+
+uint64_t AllocCheck::count()
+{
+  return s_allocCount;
+}
+
+#else
+
+bool AllocCheck::enabled()
+{
+  return false;
+}
+
+uint64_t AllocCheck::count()
+{
+  return 0;
+}
+
+#endif
+
+namespace
+{
+constexpr uint8_t PIPE = 2;
+constexpr uint16_t ECU_ID = 90; // KWP71
+constexpr int WARMUP_PASSES = 2;
+constexpr int MEASURED_PASSES = 8;
+constexpr int WRITE_CHUNK = 100;
+constexpr int WARMUP_WRITES = 8;
+constexpr int MEASURED_WRITES = 200;
+constexpr int WARMUP_READS = 4;
+constexpr int MEASURED_READS = 150;
+constexpr int LOG_TAKE_INTERVAL = 16;
+const char* FILE_PATH = "/FN0/ALLOC.BIN";
+
+// How far ahead of the clock scheduled frames are collected, so that each
+// reply goes out without waiting for the Tester's response time
+constexpr std::chrono::seconds SCHEDULE_LOOKAHEAD(5);
+
+struct CommandStats
+{
+  int warmupFrames = 0;
+  uint64_t warmupAllocs = 0;
+  int frames = 0;
+  uint64_t allocs = 0;
+};
+
+/**
+ * Builds a request frame from WSDC32 for the given command and payload.
+ */
+std::vector<uint8_t> request(uint8_t cmd, const std::vector<uint8_t>& payload)
+{
+  std::vector<uint8_t> frame = { 0x50, 0x00, 0x00, 0x00, 0x00, PIPE, cmd };
+  frame.insert(frame.end(), payload.begin(), payload.end());
+  frame[1] = (frame.size() - 1) >> 8;
+  frame[2] = (frame.size() - 1) & 0xff;
+  return frame;
+}
+}
+
+/**
+ * Feeds frames to the simulator through one end of a socket pair, as WSDC32
+ * would, counting the allocations made while each one is received, handled,
+ * scheduled and written out. The log is taken every so often, as the GUI
+ * would.
+ */
+class AllocCheck::Session
+{
+public:
+  std::map<uint8_t,CommandStats> stats;
+  bool ok = true;
+
+  Session()
+  {
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, m_fds) == 0)
+    {
+      fcntl(m_fds[0], F_SETFL, fcntl(m_fds[0], F_GETFL) | O_NONBLOCK);
+      fcntl(m_fds[1], F_SETFL, fcntl(m_fds[1], F_GETFL) | O_NONBLOCK);
+      m_sim.m_sockFd = m_fds[0];
+    }
+    else
+    {
+      ok = false;
+    }
+  }
+
+  ~Session()
+  {
+    for (int fd : m_fds)
+    {
+      if (fd >= 0)
+      {
+        close(fd);
+      }
+    }
+  }
+
+  void send(const std::vector<uint8_t>& frame, bool measured)
+  {
+    if (!ok)
+    {
+      return;
+    }
+
+    const uint64_t before = AllocCheck::count();
+    ok = (write(m_fds[1], frame.data(), frame.size()) == static_cast<ssize_t>(frame.size())) &&
+         m_sim.receiveBytes() && m_sim.processReceivedFrames() && ok;
+    m_sim.m_scheduler.collectDue(FrameScheduler::Clock::now() + SCHEDULE_LOOKAHEAD, m_sim.m_output);
+    ok = (m_sim.m_output.flush(m_sim.m_sockFd) == OutputQueue::FlushResult::Done) && ok;
+    const uint64_t allocs = AllocCheck::count() - before;
+
+    // Whatever was sent back is read and discarded
+    while (read(m_fds[1], m_replyBuf, sizeof(m_replyBuf)) > 0)
+    {
+    }
+
+    CommandStats& cmdStats = stats[frame[6]];
+    if (measured)
+    {
+      cmdStats.frames++;
+      cmdStats.allocs += allocs;
+    }
+    else
+    {
+      cmdStats.warmupFrames++;
+      cmdStats.warmupAllocs += allocs;
+    }
+
+    if (++m_framesSinceTake >= LOG_TAKE_INTERVAL)
+    {
+      m_sim.takeLog();
+      m_framesSinceTake = 0;
+    }
+  }
+
+private:
+  TesterSim m_sim;
+  int m_fds[2] = { -1, -1 };
+  uint8_t m_replyBuf[4096];
+  int m_framesSinceTake = 0;
+};
+
+/**
+ * Runs the scripted session and prints the allocation counts per command.
+ * Returns false if any frame after the warm-up allocated (or counting isn't
+ * compiled in).
+ */
+bool AllocCheck::run(QTextStream& out)
+{
+  if (!enabled())
+  {
+    out << "Allocation counting isn't compiled in; rebuild with 'qmake CONFIG+=alloc_stats'\n";
+    return false;
+  }
+
+  // Everything sent is built before anything is counted
+  const std::vector<uint8_t> startAppl = request(0x0B, { ECU_ID >> 8, ECU_ID & 0xff, PIPE });
+  const std::vector<uint8_t> slowInit = request(0x11, { 0x10 });
+  const std::vector<uint8_t> keepAlive = request(0x09, {});
+  std::vector<std::vector<uint8_t>> ramReads;
+  for (int i = 0; i < 64; i++)
+  {
+    const uint16_t addr = i * 0x35;
+    ramReads.push_back(request(0x13, { 0x01, 0x10, static_cast<uint8_t>(addr >> 8), static_cast<uint8_t>(addr) }));
+  }
+  const std::vector<uint8_t> path(FILE_PATH, FILE_PATH + strlen(FILE_PATH));
+  const std::vector<uint8_t> openForWriting = request(0x20, path);
+  const std::vector<uint8_t> openForReading = request(0x23, path);
+  const std::vector<uint8_t> closeFile = request(0x1E, {});
+  std::vector<uint8_t> chunk = { 0x00, 0x00, 0x00, 0x00 };
+  for (int i = 0; i < WRITE_CHUNK; i++)
+  {
+    chunk.push_back(i);
+  }
+  const std::vector<uint8_t> writeToFile = request(0x21, chunk);
+  const std::vector<uint8_t> readFromFile = request(0x24, { 0x00, 0x00, 0x00, 0x00 });
+
+  Session session;
+  session.send(startAppl, false);
+  session.send(slowInit, false);
+
+  // Polling of ECU RAM, with a keep-alive every few reads
+  for (int pass = 0; pass < WARMUP_PASSES + MEASURED_PASSES; pass++)
+  {
+    for (size_t i = 0; i < ramReads.size(); i++)
+    {
+      session.send(ramReads[i], pass >= WARMUP_PASSES);
+      if (i % 4 == 3)
+      {
+        session.send(keepAlive, pass >= WARMUP_PASSES);
+      }
+    }
+  }
+
+  session.send(openForWriting, false);
+  for (int i = 0; i < WARMUP_WRITES + MEASURED_WRITES; i++)
+  {
+    session.send(writeToFile, i >= WARMUP_WRITES);
+  }
+  session.send(closeFile, false);
+
+  session.send(openForReading, false);
+  for (int i = 0; i < WARMUP_READS + MEASURED_READS; i++)
+  {
+    session.send(readFromFile, i >= WARMUP_READS);
+  }
+  session.send(closeFile, false);
+
+  bool passed = session.ok;
+  if (!session.ok)
+  {
+    out << "Error: the simulator rejected a request frame\n";
+  }
+  for (const auto& cmd : session.stats)
+  {
+    const CommandStats& stats = cmd.second;
+    out << QString("cmd 0x%1: %2 allocations in %3 frames during warm-up").
+      arg(cmd.first, 2, 16, QChar('0')).arg(stats.warmupAllocs).arg(stats.warmupFrames);
+    if (stats.frames > 0)
+    {
+      out << QString(", %1 in %2 frames after (%3)").arg(stats.allocs).arg(stats.frames).
+        arg((stats.allocs == 0) ? "pass" : "FAIL");
+      passed = passed && (stats.allocs == 0);
+    }
+    out << "\n";
+  }
+  return passed;
+}
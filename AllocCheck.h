@@ -0,0 +1,26 @@
+#pragma once
+#include <cstdint>
+#include <QTextStream>
+
+/**
+ * Checks that the polling commands (ECU RAM reads, keep-alives, and reads
+ * and writes of files) are handled without allocating once they have warmed
+ * up. A scripted session is fed to a simulator over a socket pair, through
+ * the same receive, scheduling and output path as a connection to WSDC32,
+ * and the heap allocations made while handling each frame are counted and
+ * reported per command.
+ *
+ * Counting replaces the C library's malloc() family (which operator new also
+ * goes through), so it is only compiled in when the simulator is built with
+ * CONFIG+=alloc_stats. Only allocations made by the calling thread count.
+ */
+class AllocCheck
+{
+public:
+  static bool enabled();
+  static uint64_t count();
+  static bool run(QTextStream& out);
+
+private:
+  class Session;
+};
@@ -0,0 +1,285 @@
+#include "Checkpoint.h"
+#include <QDataStream>
+#include <QFile>
+#include <QSaveFile>
+
+namespace
+{
+const quint32 CHECKPOINT_MAGIC = 0x53443243; // "SD2C"
+const quint16 CHECKPOINT_VERSION = 2;
+
+// Checkpoints from before periodic frames and scenario actions were kept,
+// which also have a flag per pipe that is now skipped
+const quint16 CHECKPOINT_VERSION_NO_SCHEDULE = 1;
+}
+
+/**
+ * Writes the checkpoint to the given file. File contents are written as raw
+ * bytes rather than element by element, which is what makes restoring quick.
+ * The file is replaced only once it has been written in full.
+ */
+bool Checkpoint::save(const QString& filename) const
+{
+  QSaveFile outfile(filename);
+  if (!outfile.open(QIODevice::WriteOnly))
+  {
+    return false;
+  }
+
+  QDataStream out(&outfile);
+  out.setVersion(QDataStream::Qt_5_0);
+  out << CHECKPOINT_MAGIC << CHECKPOINT_VERSION;
+
+  out << static_cast<quint32>(upper.size());
+  for (auto dir = upper.constBegin(); dir != upper.constEnd(); ++dir)
+  {
+    out << dir.key() << static_cast<quint32>(dir.value().size());
+    for (auto file = dir.value().constBegin(); file != dir.value().constEnd(); ++file)
+    {
+      out << file.key() << static_cast<quint32>(file.value().size());
+      out.writeRawData(reinterpret_cast<const char*>(file.value().constData()), file.value().size());
+    }
+  }
+  out << layerNames << activeMask;
+
+  out << curDir << curFile << static_cast<quint8>(fileMode) << static_cast<qint32>(fileReadPos);
+  out << static_cast<quint32>(checksumBuf.size());
+  out.writeRawData(reinterpret_cast<const char*>(checksumBuf.data()), checksumBuf.size());
+  out << static_cast<quint32>(dirListing.size());
+  for (const VirtualFilesystem::DirEntry& entry : dirListing)
+  {
+    out << entry.name << entry.size;
+  }
+  out << static_cast<qint32>(dirListingPos);
+
+  out << static_cast<quint32>(pipes.size());
+  for (const Pipe& pipe : pipes)
+  {
+    out << pipe.running << static_cast<quint16>(pipe.ecuId) << pipe.protocolKnown
+        << static_cast<quint8>(pipe.protocol);
+  }
+  out << static_cast<qint32>(lastApplPipe) << lastCmdWasWriteToFile;
+
+  out << static_cast<quint32>(ramData.size());
+  for (const auto& ram : ramData)
+  {
+    out << ram.first << ram.second;
+  }
+  out << static_cast<quint32>(valueData.size());
+  for (const auto& value : valueData)
+  {
+    out << value.first << value.second;
+  }
+  out << static_cast<quint32>(snapshotData.size());
+  for (const auto& snapshot : snapshotData)
+  {
+    out << static_cast<qint32>(snapshot.first) << static_cast<quint32>(snapshot.second.size());
+    out.writeRawData(reinterpret_cast<const char*>(snapshot.second.data()), snapshot.second.size());
+  }
+  out << static_cast<quint32>(errorMemory.size());
+  out.writeRawData(reinterpret_cast<const char*>(errorMemory.data()), errorMemory.size());
+  out << static_cast<quint32>(scenarioStates.size());
+  for (const auto& state : scenarioStates)
+  {
+    out << static_cast<qint32>(state.first) << state.second;
+  }
+
+  out << static_cast<quint32>(periodicFrames.size());
+  for (const PeriodicFrame& periodic : periodicFrames)
+  {
+    out << periodic.pipe << periodic.key << periodic.delayMs << periodic.periodMs
+        << static_cast<quint32>(periodic.frame.size());
+    out.writeRawData(reinterpret_cast<const char*>(periodic.frame.data()), periodic.frame.size());
+  }
+  out << static_cast<quint32>(pendingActions.size());
+  for (const PendingAction& pending : pendingActions)
+  {
+    const Scenario::Action& action = pending.action;
+    out << pending.delayMs << static_cast<qint32>(pending.ecuId) << action.delayMs
+        << static_cast<quint8>(action.type) << action.target << action.value << action.periodMs;
+  }
+
+  return (out.status() == QDataStream::Ok) && outfile.commit();
+}
+
+/**
+ * Reads a checkpoint written by save(). Returns false if the file can't be
+ * read or isn't a checkpoint, in which case the contents are unspecified.
+ */
+bool Checkpoint::load(const QString& filename)
+{
+  QFile infile(filename);
+  if (!infile.open(QIODevice::ReadOnly))
+  {
+    return false;
+  }
+
+  // Any byte count larger than the file itself means the file is corrupt,
+  // and must not be used to size a buffer
+  const qint64 fileSize = infile.size();
+  QDataStream in(&infile);
+  in.setVersion(QDataStream::Qt_5_0);
+
+  auto readBytes = [&in, fileSize](std::vector<uint8_t>& bytes)
+  {
+    quint32 len = 0;
+    in >> len;
+    if (len > fileSize)
+    {
+      in.setStatus(QDataStream::ReadCorruptData);
+      return;
+    }
+    bytes.resize(len);
+    if (in.readRawData(reinterpret_cast<char*>(bytes.data()), len) != static_cast<int>(len))
+    {
+      in.setStatus(QDataStream::ReadPastEnd);
+    }
+  };
+
+  quint32 magic = 0;
+  quint16 version = 0;
+  in >> magic >> version;
+  if ((magic != CHECKPOINT_MAGIC) ||
+      ((version != CHECKPOINT_VERSION) && (version != CHECKPOINT_VERSION_NO_SCHEDULE)))
+  {
+    return false;
+  }
+
+  quint32 dirCount = 0;
+  in >> dirCount;
+  upper.clear();
+  for (quint32 i = 0; (i < dirCount) && (in.status() == QDataStream::Ok); i++)
+  {
+    QString dirname;
+    quint32 fileCount = 0;
+    in >> dirname >> fileCount;
+    QMap<QString,QVector<quint8>>& dir = upper[dirname];
+    for (quint32 j = 0; (j < fileCount) && (in.status() == QDataStream::Ok); j++)
+    {
+      QString name;
+      quint32 len = 0;
+      in >> name >> len;
+      if (len > fileSize)
+      {
+        return false;
+      }
+      QVector<quint8> contents(len);
+      if (in.readRawData(reinterpret_cast<char*>(contents.data()), len) != static_cast<int>(len))
+      {
+        return false;
+      }
+      dir.insert(name, contents);
+    }
+  }
+  in >> layerNames >> activeMask;
+
+  quint8 mode = 0;
+  qint32 readPos = 0;
+  in >> curDir >> curFile >> mode >> readPos;
+  fileMode = static_cast<FileMode>(mode);
+  fileReadPos = readPos;
+  readBytes(checksumBuf);
+  quint32 entryCount = 0;
+  in >> entryCount;
+  dirListing.clear();
+  for (quint32 i = 0; (i < entryCount) && (in.status() == QDataStream::Ok); i++)
+  {
+    VirtualFilesystem::DirEntry entry;
+    in >> entry.name >> entry.size;
+    dirListing.append(entry);
+  }
+  qint32 listingPos = 0;
+  in >> listingPos;
+  dirListingPos = listingPos;
+
+  quint32 pipeCount = 0;
+  in >> pipeCount;
+  pipes.clear();
+  for (quint32 i = 0; (i < pipeCount) && (in.status() == QDataStream::Ok); i++)
+  {
+    Pipe pipe;
+    quint16 ecuId = 0;
+    quint8 protocol = 0;
+    in >> pipe.running >> ecuId >> pipe.protocolKnown >> protocol;
+    if (version == CHECKPOINT_VERSION_NO_SCHEDULE)
+    {
+      // Whether the ECU had been initialized, which is no longer kept
+      bool initDone = false;
+      in >> initDone;
+    }
+    pipe.ecuId = ecuId;
+    pipe.protocol = static_cast<ProtocolType>(protocol);
+    pipes.push_back(pipe);
+  }
+  qint32 applPipe = 0;
+  in >> applPipe >> lastCmdWasWriteToFile;
+  lastApplPipe = applPipe;
+
+  quint32 count = 0;
+  in >> count;
+  ramData.clear();
+  for (quint32 i = 0; (i < count) && (in.status() == QDataStream::Ok); i++)
+  {
+    quint16 addr = 0;
+    quint8 val = 0;
+    in >> addr >> val;
+    ramData[addr] = val;
+  }
+  in >> count;
+  valueData.clear();
+  for (quint32 i = 0; (i < count) && (in.status() == QDataStream::Ok); i++)
+  {
+    quint8 id = 0;
+    quint32 val = 0;
+    in >> id >> val;
+    valueData[id] = val;
+  }
+  in >> count;
+  snapshotData.clear();
+  for (quint32 i = 0; (i < count) && (in.status() == QDataStream::Ok); i++)
+  {
+    qint32 index = 0;
+    in >> index;
+    readBytes(snapshotData[index]);
+  }
+  readBytes(errorMemory);
+  in >> count;
+  scenarioStates.clear();
+  for (quint32 i = 0; (i < count) && (in.status() == QDataStream::Ok); i++)
+  {
+    qint32 ecuId = 0;
+    quint8 state = 0;
+    in >> ecuId >> state;
+    scenarioStates[ecuId] = state;
+  }
+
+  periodicFrames.clear();
+  pendingActions.clear();
+  if (version == CHECKPOINT_VERSION_NO_SCHEDULE)
+  {
+    return (in.status() == QDataStream::Ok);
+  }
+
+  in >> count;
+  for (quint32 i = 0; (i < count) && (in.status() == QDataStream::Ok); i++)
+  {
+    PeriodicFrame periodic;
+    in >> periodic.pipe >> periodic.key >> periodic.delayMs >> periodic.periodMs;
+    readBytes(periodic.frame);
+    periodicFrames.push_back(periodic);
+  }
+  in >> count;
+  for (quint32 i = 0; (i < count) && (in.status() == QDataStream::Ok); i++)
+  {
+    PendingAction pending;
+    qint32 ecuId = 0;
+    quint8 type = 0;
+    Scenario::Action& action = pending.action;
+    in >> pending.delayMs >> ecuId >> action.delayMs >> type >> action.target >> action.value >> action.periodMs;
+    pending.ecuId = ecuId;
+    action.type = static_cast<Scenario::ActionType>(type);
+    pendingActions.push_back(pending);
+  }
+
+  return (in.status() == QDataStream::Ok);
+}
@@ -0,0 +1,89 @@
+#pragma once
+#include <cstdint>
+#include <map>
+#include <unordered_map>
+#include <vector>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include "EcuDatabase.h"
+#include "Scenario.h"
+#include "VirtualFilesystem.h"
+
+/**
+ * Everything that the simulator knows about a session in progress: the
+ * writable layer of the filesystem, which mounted images are showing, the
+ * open file and directory listing, the applications running on each pipe,
+ * and the ECU data. Restoring it puts WSDC32 back where it was mid-diagnosis.
+ *
+ * A checkpoint is captured by the protocol thread between frames. Capturing
+ * copies only the containers, not the file contents (which are implicitly
+ * shared), so it costs little more than the number of files; the copy is
+ * then written out on another thread while the protocol thread carries on.
+ *
+ * Mounted images and a mirrored host directory are referred to by name and
+ * are not embedded; they must be mounted again before restoring. Periodic
+ * frames and delayed scenario actions are kept with the time left until
+ * they're due. Frames that are sent only once, such as replies still
+ * waiting out the response time, belong to the connection and are not kept.
+ */
+struct Checkpoint
+{
+  enum class FileMode : quint8
+  {
+    Closed,
+    Reading,
+    Writing
+  };
+
+  struct Pipe
+  {
+    bool running = false;
+    int ecuId = 0;
+    bool protocolKnown = false;
+    ProtocolType protocol = ProtocolType::KWP71;
+  };
+
+  struct PeriodicFrame
+  {
+    uint8_t pipe = 0;
+    uint32_t key = 0;
+    uint32_t delayMs = 0;
+    uint32_t periodMs = 0;
+    std::vector<uint8_t> frame;
+  };
+
+  struct PendingAction
+  {
+    uint32_t delayMs = 0;
+    int ecuId = 0;
+    Scenario::Action action = {};
+  };
+
+  FileContentsMap upper;
+  QStringList layerNames;
+  uint32_t activeMask = 0;
+
+  QString curDir;
+  QString curFile;
+  FileMode fileMode = FileMode::Closed;
+  int fileReadPos = 0;
+  std::vector<uint8_t> checksumBuf;
+  QVector<VirtualFilesystem::DirEntry> dirListing;
+  int dirListingPos = 0;
+
+  std::vector<Pipe> pipes;
+  int lastApplPipe = 0;
+  bool lastCmdWasWriteToFile = false;
+
+  std::unordered_map<uint16_t,uint8_t> ramData;
+  std::unordered_map<uint8_t,uint32_t> valueData;
+  std::map<int,std::vector<uint8_t>> snapshotData;
+  std::vector<uint8_t> errorMemory;
+  std::unordered_map<int,uint8_t> scenarioStates;
+  std::vector<PeriodicFrame> periodicFrames;
+  std::vector<PendingAction> pendingActions;
+
+  bool save(const QString& filename) const;
+  bool load(const QString& filename);
+};
@@ -0,0 +1,759 @@
+#include "ControlServer.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <algorithm>
+#include <memory>
+#include <QJsonArray>
+#include <QJsonDocument>
+
+namespace
+{
+// Binary encoding: request ops, record kinds and reply statuses
+enum : uint8_t
+{
+  OP_UPDATE = 0x01,
+  OP_QUERY = 0x02,
+  OP_SUBSCRIBE = 0x03,
+  OP_LOAD_IMAGE = 0x04,
+  OP_SAVE_IMAGE = 0x05
+};
+
+enum : uint8_t
+{
+  KIND_RAM = 0x01,
+  KIND_VALUE = 0x02,
+  KIND_SNAPSHOT = 0x03,
+  KIND_ERROR_MEMORY = 0x04
+};
+
+enum : uint8_t
+{
+  STATUS_OK = 0x00,
+  STATUS_BAD_REQUEST = 0x01,
+  STATUS_FAILED = 0x02,
+  STATUS_EVENTS = 0x80
+};
+
+/**
+ * Reads big-endian fields from a binary request, noting (rather than
+ * overrunning) a request that ends early.
+ */
+class Reader
+{
+public:
+  Reader(const uint8_t* data, int len) : m_data(data), m_left(len) {}
+
+  bool ok() const { return m_ok; }
+  bool atEnd() const { return m_left == 0; }
+
+  const uint8_t* take(int count)
+  {
+    if (!m_ok || (count > m_left))
+    {
+      m_ok = false;
+      return nullptr;
+    }
+    const uint8_t* field = m_data;
+    m_data += count;
+    m_left -= count;
+    return field;
+  }
+
+  uint32_t number(int size)
+  {
+    const uint8_t* field = take(size);
+    uint32_t val = 0;
+    for (int i = 0; field && (i < size); i++)
+    {
+      val = (val << 8) | field[i];
+    }
+    return val;
+  }
+
+private:
+  const uint8_t* m_data;
+  int m_left;
+  bool m_ok = true;
+};
+
+void appendNumber(QByteArray& out, uint32_t val, int size)
+{
+  for (int i = size - 1; i >= 0; i--)
+  {
+    out.append(static_cast<char>(val >> (i * 8)));
+  }
+}
+
+QByteArray binaryReply(uint8_t status, const QByteArray& payload = QByteArray())
+{
+  QByteArray reply;
+  appendNumber(reply, payload.size() + 1, 4);
+  reply.append(static_cast<char>(status));
+  reply.append(payload);
+  return reply;
+}
+
+QJsonObject jsonError(const QString& error)
+{
+  QJsonObject reply;
+  reply["ok"] = false;
+  reply["error"] = error;
+  return reply;
+}
+
+std::vector<uint8_t> fromHex(const QJsonValue& val)
+{
+  const QByteArray bytes = QByteArray::fromHex(val.toString().toLatin1());
+  return std::vector<uint8_t>(bytes.constData(), bytes.constData() + bytes.size());
+}
+
+QString toHex(const std::vector<uint8_t>& bytes)
+{
+  return QString::fromLatin1(QByteArray(reinterpret_cast<const char*>(bytes.data()), bytes.size()).toHex());
+}
+}
+
+ControlServer::ControlServer(TesterSim& sim) :
+  m_sim(sim)
+{
+}
+
+ControlServer::~ControlServer()
+{
+  stop();
+}
+
+/**
+ * Starts serving on a socket at the given path (replacing anything that is
+ * already there). Returns false if the socket couldn't be set up.
+ */
+bool ControlServer::start(const QString& path)
+{
+  stop();
+
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(struct sockaddr_un));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, path.toLocal8Bit().constData(), sizeof(addr.sun_path) - 1);
+  unlink(addr.sun_path);
+
+  m_listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if ((m_listenFd < 0) ||
+      (bind(m_listenFd, (const struct sockaddr*)&addr, sizeof(struct sockaddr_un)) != 0) ||
+      (::listen(m_listenFd, 4) != 0) ||
+      (pipe(m_wakeFds) != 0))
+  {
+    stop();
+    return false;
+  }
+
+  fcntl(m_listenFd, F_SETFL, fcntl(m_listenFd, F_GETFL) | O_NONBLOCK);
+  m_path = path;
+  m_thread = std::thread(&ControlServer::run, this);
+  return true;
+}
+
+/**
+ * Stops serving and disconnects all clients.
+ */
+void ControlServer::stop()
+{
+  // Closing the write end of the wake pipe is seen by the server's thread as
+  // a hangup on the read end, which (unlike a write) can't fail
+  if (m_wakeFds[1] >= 0)
+  {
+    close(m_wakeFds[1]);
+    m_wakeFds[1] = -1;
+  }
+  if (m_thread.joinable())
+  {
+    m_thread.join();
+  }
+
+  for (Client& client : m_clients)
+  {
+    close(client.fd);
+  }
+  m_clients.clear();
+  m_sim.accessEvents().setEnabled(false);
+
+  for (int& fd : m_wakeFds)
+  {
+    if (fd >= 0)
+    {
+      close(fd);
+      fd = -1;
+    }
+  }
+  if (m_listenFd >= 0)
+  {
+    close(m_listenFd);
+    m_listenFd = -1;
+    unlink(m_path.toLocal8Bit().constData());
+  }
+}
+
+void ControlServer::run()
+{
+  std::vector<struct pollfd> fds;
+  bool running = true;
+  while (running)
+  {
+    fds.clear();
+    fds.push_back({ m_wakeFds[0], POLLIN, 0 });
+    fds.push_back({ m_listenFd, POLLIN, 0 });
+    bool anySubscribed = false;
+    for (const Client& client : m_clients)
+    {
+      fds.push_back({ client.fd, static_cast<short>(POLLIN | (client.tx.isEmpty() ? 0 : POLLOUT)), 0 });
+      anySubscribed = anySubscribed || client.subscribed;
+    }
+
+    if ((poll(fds.data(), fds.size(), anySubscribed ? EVENT_INTERVAL_MS : -1) < 0) && (errno != EINTR))
+    {
+      break;
+    }
+    if (fds[0].revents & (POLLIN | POLLHUP))
+    {
+      running = false;
+      continue;
+    }
+    if (fds[1].revents & POLLIN)
+    {
+      acceptClient();
+    }
+
+    // Clients accepted just now aren't in fds, and are polled next time
+    for (size_t i = 2; i < fds.size(); i++)
+    {
+      Client& client = m_clients[i - 2];
+      bool ok = true;
+      if (fds[i].revents & (POLLIN | POLLHUP | POLLERR))
+      {
+        ok = receive(client) && ((client.mode == Mode::Json) ? processJson(client) : processBinary(client));
+      }
+      if (ok && (fds[i].revents & POLLOUT))
+      {
+        ok = flush(client);
+      }
+      if (!ok)
+      {
+        setSubscribed(client, false);
+        close(client.fd);
+        client.fd = -1;
+      }
+    }
+    m_clients.erase(std::remove_if(m_clients.begin(), m_clients.end(), [](const Client& client)
+    {
+      return client.fd < 0;
+    }), m_clients.end());
+
+    dispatchEvents();
+    for (Client& client : m_clients)
+    {
+      flush(client);
+    }
+  }
+}
+
+void ControlServer::acceptClient()
+{
+  int fd = -1;
+  while ((fd = accept(m_listenFd, nullptr, nullptr)) >= 0)
+  {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    Client client;
+    client.fd = fd;
+    m_clients.push_back(client);
+  }
+}
+
+/**
+ * Reads whatever the client has sent. Returns false if the connection was
+ * closed, or if the client has sent more than a request can hold.
+ */
+bool ControlServer::receive(Client& client)
+{
+  char buf[4096];
+  const ssize_t len = read(client.fd, buf, sizeof(buf));
+  if ((len < 0) && ((errno == EAGAIN) || (errno == EINTR)))
+  {
+    return true;
+  }
+  if (len <= 0)
+  {
+    return false;
+  }
+
+  if (client.mode == Mode::Unknown)
+  {
+    client.mode = (buf[0] == '{') ? Mode::Json : Mode::Binary;
+  }
+  client.rx.append(buf, len);
+  return client.rx.size() <= MAX_MESSAGE_SIZE + 4;
+}
+
+/**
+ * Writes as much of the client's pending output as the socket will take.
+ */
+bool ControlServer::flush(Client& client)
+{
+  while (!client.tx.isEmpty())
+  {
+    const ssize_t len = write(client.fd, client.tx.constData(), client.tx.size());
+    if (len < 0)
+    {
+      return (errno == EAGAIN) || (errno == EINTR);
+    }
+    client.tx.remove(0, len);
+  }
+  return true;
+}
+
+/**
+ * Handles each complete binary request that has been received. Returns false
+ * if the client has stopped reading its replies.
+ */
+bool ControlServer::processBinary(Client& client)
+{
+  while (client.rx.size() >= 4)
+  {
+    const uint8_t* rx = reinterpret_cast<const uint8_t*>(client.rx.constData());
+    const uint32_t len = (rx[0] << 24) | (rx[1] << 16) | (rx[2] << 8) | rx[3];
+    if ((len == 0) || (len > MAX_MESSAGE_SIZE))
+    {
+      return false;
+    }
+    if (client.rx.size() < static_cast<int>(len + 4))
+    {
+      break;
+    }
+    client.tx.append(handleBinary(rx + 4, len, client));
+    client.rx.remove(0, len + 4);
+    if (client.tx.size() > MAX_PENDING_OUTPUT)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Handles each complete line of JSON that has been received.
+ */
+bool ControlServer::processJson(Client& client)
+{
+  int end = -1;
+  while ((end = client.rx.indexOf('\n')) >= 0)
+  {
+    const QByteArray line = client.rx.left(end).trimmed();
+    client.rx.remove(0, end + 1);
+    if (line.isEmpty())
+    {
+      continue;
+    }
+
+    QJsonParseError error;
+    const QJsonDocument request = QJsonDocument::fromJson(line, &error);
+    QJsonObject reply = request.isObject() ? handleJson(request.object(), client) :
+                                             jsonError(QString("Invalid JSON: %1").arg(error.errorString()));
+    if (request.isObject() && request.object().contains("id"))
+    {
+      reply["id"] = request.object().value("id");
+    }
+    client.tx.append(QJsonDocument(reply).toJson(QJsonDocument::Compact));
+    client.tx.append('\n');
+    if (client.tx.size() > MAX_PENDING_OUTPUT)
+    {
+      return false;
+    }
+  }
+  return client.rx.size() <= MAX_MESSAGE_SIZE;
+}
+
+QByteArray ControlServer::handleBinary(const uint8_t* msg, int len, Client& client)
+{
+  Reader in(msg + 1, len - 1);
+  const uint8_t op = msg[0];
+
+  if (op == OP_UPDATE)
+  {
+    std::shared_ptr<TesterSim::StateChange> change = std::make_shared<TesterSim::StateChange>();
+    while (in.ok() && !in.atEnd())
+    {
+      const uint8_t kind = in.number(1);
+      if (kind == KIND_RAM)
+      {
+        const uint16_t addr = in.number(2);
+        const int count = in.number(2);
+        const uint8_t* bytes = in.take(count);
+        if (bytes && (addr + count <= MemoryImage::SIZE))
+        {
+          change->ram.push_back({ addr, std::vector<uint8_t>(bytes, bytes + count) });
+        }
+        else
+        {
+          return binaryReply(STATUS_BAD_REQUEST);
+        }
+      }
+      else if (kind == KIND_VALUE)
+      {
+        const uint8_t id = in.number(1);
+        change->values.push_back({ id, in.number(4) });
+      }
+      else if ((kind == KIND_SNAPSHOT) || (kind == KIND_ERROR_MEMORY))
+      {
+        const int index = (kind == KIND_SNAPSHOT) ? in.number(1) : 0;
+        const int count = in.number(2);
+        const uint8_t* bytes = in.take(count);
+        if (!bytes)
+        {
+          return binaryReply(STATUS_BAD_REQUEST);
+        }
+        if (kind == KIND_SNAPSHOT)
+        {
+          change->snapshots.push_back({ index, std::vector<uint8_t>(bytes, bytes + count) });
+        }
+        else
+        {
+          change->replaceErrorMemory = true;
+          change->errorMemory.assign(bytes, bytes + count);
+        }
+      }
+      else
+      {
+        return binaryReply(STATUS_BAD_REQUEST);
+      }
+    }
+    if (!in.ok())
+    {
+      return binaryReply(STATUS_BAD_REQUEST);
+    }
+    m_sim.applyChange(change);
+    return binaryReply(STATUS_OK);
+  }
+  else if (op == OP_QUERY)
+  {
+    // The results go back in the order they were asked for
+    TesterSim::StateQuery query;
+    std::vector<std::pair<uint8_t,size_t>> order;
+    while (in.ok() && !in.atEnd())
+    {
+      const uint8_t kind = in.number(1);
+      if (kind == KIND_RAM)
+      {
+        const uint16_t addr = in.number(2);
+        const int count = in.number(2);
+        if (addr + count > MemoryImage::SIZE)
+        {
+          return binaryReply(STATUS_BAD_REQUEST);
+        }
+        order.push_back({ kind, query.ram.size() });
+        query.ram.push_back({ addr, std::vector<uint8_t>(count) });
+      }
+      else if (kind == KIND_VALUE)
+      {
+        order.push_back({ kind, query.values.size() });
+        query.values.push_back({ static_cast<uint8_t>(in.number(1)), 0 });
+      }
+      else if (kind == KIND_SNAPSHOT)
+      {
+        order.push_back({ kind, query.snapshots.size() });
+        query.snapshots.push_back({ static_cast<int>(in.number(1)), std::vector<uint8_t>() });
+      }
+      else if (kind == KIND_ERROR_MEMORY)
+      {
+        order.push_back({ kind, 0 });
+        query.errorMemory = true;
+      }
+      else
+      {
+        return binaryReply(STATUS_BAD_REQUEST);
+      }
+    }
+    if (!in.ok())
+    {
+      return binaryReply(STATUS_BAD_REQUEST);
+    }
+
+    m_sim.queryState(query);
+    QByteArray payload;
+    for (const auto& item : order)
+    {
+      if (item.first == KIND_RAM)
+      {
+        const std::vector<uint8_t>& bytes = query.ram[item.second].bytes;
+        payload.append(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+      }
+      else if (item.first == KIND_VALUE)
+      {
+        appendNumber(payload, query.values[item.second].second, 4);
+      }
+      else
+      {
+        const std::vector<uint8_t>& bytes = (item.first == KIND_SNAPSHOT) ? query.snapshots[item.second].second :
+                                                                            query.errorMemoryBytes;
+        appendNumber(payload, bytes.size(), 2);
+        payload.append(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+      }
+    }
+    return binaryReply(STATUS_OK, payload);
+  }
+  else if (op == OP_SUBSCRIBE)
+  {
+    const bool subscribed = in.number(1);
+    if (!in.ok())
+    {
+      return binaryReply(STATUS_BAD_REQUEST);
+    }
+    setSubscribed(client, subscribed);
+    return binaryReply(STATUS_OK);
+  }
+  else if ((op == OP_LOAD_IMAGE) || (op == OP_SAVE_IMAGE))
+  {
+    const QString path = QString::fromUtf8(reinterpret_cast<const char*>(msg + 1), len - 1);
+    const bool ok = (op == OP_LOAD_IMAGE) ? m_sim.loadState(path) : m_sim.saveState(path);
+    return binaryReply(ok ? STATUS_OK : STATUS_FAILED);
+  }
+  return binaryReply(STATUS_BAD_REQUEST);
+}
+
+QJsonObject ControlServer::handleJson(const QJsonObject& request, Client& client)
+{
+  const QString op = request.value("op").toString();
+  QJsonObject reply;
+  reply["ok"] = true;
+
+  if (op == "update")
+  {
+    std::shared_ptr<TesterSim::StateChange> change = std::make_shared<TesterSim::StateChange>();
+    for (const QJsonValue& run : request.value("ram").toArray())
+    {
+      const int addr = run.toObject().value("addr").toInt(-1);
+      std::vector<uint8_t> bytes = fromHex(run.toObject().value("bytes"));
+      if ((addr < 0) || (addr + static_cast<int>(bytes.size()) > MemoryImage::SIZE))
+      {
+        return jsonError("RAM run out of range");
+      }
+      change->ram.push_back({ static_cast<uint16_t>(addr), std::move(bytes) });
+    }
+    for (const QJsonValue& value : request.value("values").toArray())
+    {
+      const int id = value.toObject().value("id").toInt(-1);
+      if ((id < 0) || (id > 0xff))
+      {
+        return jsonError("Value ID out of range");
+      }
+      change->values.push_back({ static_cast<uint8_t>(id), static_cast<uint32_t>(value.toObject().value("value").toDouble()) });
+    }
+    for (const QJsonValue& snapshot : request.value("snapshots").toArray())
+    {
+      const int index = snapshot.toObject().value("index").toInt(-1);
+      if ((index < 0) || (index > 0xff))
+      {
+        return jsonError("Snapshot index out of range");
+      }
+      change->snapshots.push_back({ index, fromHex(snapshot.toObject().value("bytes")) });
+    }
+    if (request.contains("errorMemory"))
+    {
+      change->replaceErrorMemory = true;
+      change->errorMemory = fromHex(request.value("errorMemory"));
+    }
+    m_sim.applyChange(change);
+  }
+  else if (op == "query")
+  {
+    TesterSim::StateQuery query;
+    for (const QJsonValue& run : request.value("ram").toArray())
+    {
+      const int addr = run.toObject().value("addr").toInt(-1);
+      const int count = run.toObject().value("count").toInt(1);
+      if ((addr < 0) || (count < 0) || (addr + count > MemoryImage::SIZE))
+      {
+        return jsonError("RAM range out of range");
+      }
+      query.ram.push_back({ static_cast<uint16_t>(addr), std::vector<uint8_t>(count) });
+    }
+    for (const QJsonValue& value : request.value("values").toArray())
+    {
+      const int id = value.toInt(-1);
+      if ((id < 0) || (id > 0xff))
+      {
+        return jsonError("Value ID out of range");
+      }
+      query.values.push_back({ static_cast<uint8_t>(id), 0 });
+    }
+    for (const QJsonValue& snapshot : request.value("snapshots").toArray())
+    {
+      const int index = snapshot.toInt(-1);
+      if ((index < 0) || (index > 0xff))
+      {
+        return jsonError("Snapshot index out of range");
+      }
+      query.snapshots.push_back({ index, std::vector<uint8_t>() });
+    }
+    query.errorMemory = request.value("errorMemory").toBool();
+
+    m_sim.queryState(query);
+    QJsonArray ram;
+    for (const TesterSim::RamRun& run : query.ram)
+    {
+      ram.append(QJsonObject { { "addr", run.addr }, { "bytes", toHex(run.bytes) } });
+    }
+    QJsonArray values;
+    for (const auto& value : query.values)
+    {
+      values.append(QJsonObject { { "id", value.first }, { "value", static_cast<double>(value.second) } });
+    }
+    QJsonArray snapshots;
+    for (const auto& snapshot : query.snapshots)
+    {
+      snapshots.append(QJsonObject { { "index", snapshot.first }, { "bytes", toHex(snapshot.second) } });
+    }
+    reply["ram"] = ram;
+    reply["values"] = values;
+    reply["snapshots"] = snapshots;
+    if (query.errorMemory)
+    {
+      reply["errorMemory"] = toHex(query.errorMemoryBytes);
+    }
+  }
+  else if (op == "subscribe")
+  {
+    setSubscribed(client, request.value("enabled").toBool(true));
+  }
+  else if ((op == "loadImage") || (op == "saveImage"))
+  {
+    const QString path = request.value("path").toString();
+    if (!((op == "loadImage") ? m_sim.loadState(path) : m_sim.saveState(path)))
+    {
+      return jsonError(QString("Unable to %1 image '%2'").arg((op == "loadImage") ? "load" : "save").arg(path));
+    }
+  }
+  else
+  {
+    return jsonError(QString("Unknown op '%1'").arg(op));
+  }
+  return reply;
+}
+
+/**
+ * Returns an event message telling a client how many access events it has
+ * missed.
+ */
+QByteArray ControlServer::droppedMessage(Mode mode, uint32_t dropped)
+{
+  if (mode == Mode::Json)
+  {
+    QByteArray line = QJsonDocument(QJsonObject { { "event", "dropped" }, { "count", static_cast<double>(dropped) } }).
+      toJson(QJsonDocument::Compact);
+    line.append('\n');
+    return line;
+  }
+
+  QByteArray payload;
+  appendNumber(payload, dropped, 4);
+  return binaryReply(STATUS_EVENTS, payload);
+}
+
+/**
+ * Subscribes or unsubscribes a client to access events. Events are only
+ * recorded while at least one client is subscribed.
+ */
+void ControlServer::setSubscribed(Client& client, bool subscribed)
+{
+  client.subscribed = subscribed;
+  const bool anySubscribed = std::any_of(m_clients.begin(), m_clients.end(), [](const Client& c)
+  {
+    return (c.fd >= 0) && c.subscribed;
+  });
+
+  // Don't send the first subscriber whatever was left over from the last one
+  AccessEventRing& events = m_sim.accessEvents();
+  if (anySubscribed && !events.enabled())
+  {
+    AccessEventRing::Event discarded[MAX_EVENTS_PER_MESSAGE];
+    while (events.pop(discarded, MAX_EVENTS_PER_MESSAGE) > 0)
+    {
+    }
+    events.takeDropped();
+  }
+  events.setEnabled(anySubscribed);
+}
+
+/**
+ * Sends the access events recorded since the last call to every subscribed
+ * client. A client that has fallen too far behind in reading them has them
+ * dropped instead, and is told how many once it catches up.
+ */
+void ControlServer::dispatchEvents()
+{
+  if (!m_sim.accessEvents().enabled())
+  {
+    return;
+  }
+
+  AccessEventRing::Event events[MAX_EVENTS_PER_MESSAGE];
+  size_t count = 0;
+  while ((count = m_sim.accessEvents().pop(events, MAX_EVENTS_PER_MESSAGE)) > 0)
+  {
+    const uint32_t dropped = m_sim.accessEvents().takeDropped();
+    QByteArray binary;
+    QByteArray json;
+    for (Client& client : m_clients)
+    {
+      if (!client.subscribed)
+      {
+        continue;
+      }
+      if (client.tx.size() > MAX_PENDING_OUTPUT)
+      {
+        client.droppedEvents += dropped + count;
+        continue;
+      }
+      if (client.droppedEvents > 0)
+      {
+        client.tx.append(droppedMessage(client.mode, client.droppedEvents));
+        client.droppedEvents = 0;
+      }
+
+      if ((client.mode == Mode::Binary) && binary.isEmpty())
+      {
+        QByteArray payload;
+        appendNumber(payload, dropped, 4);
+        for (size_t i = 0; i < count; i++)
+        {
+          appendNumber(payload, static_cast<uint8_t>(events[i].space), 1);
+          appendNumber(payload, events[i].write, 1);
+          appendNumber(payload, events[i].addr, 4);
+          appendNumber(payload, events[i].value, 4);
+        }
+        binary = binaryReply(STATUS_EVENTS, payload);
+      }
+      else if ((client.mode == Mode::Json) && json.isEmpty())
+      {
+        if (dropped > 0)
+        {
+          json.append(droppedMessage(Mode::Json, dropped));
+        }
+        for (size_t i = 0; i < count; i++)
+        {
+          json.append(QJsonDocument(QJsonObject {
+            { "event", "access" },
+            { "space", AccessTracer::spaceName(events[i].space) },
+            { "write", events[i].write },
+            { "addr", static_cast<double>(events[i].addr) },
+            { "value", static_cast<double>(events[i].value) } }).toJson(QJsonDocument::Compact));
+          json.append('\n');
+        }
+      }
+      client.tx.append((client.mode == Mode::Json) ? json : binary);
+    }
+  }
+}
@@ -0,0 +1,79 @@
+#pragma once
+#include <cstdint>
+#include <thread>
+#include <vector>
+#include <QByteArray>
+#include <QJsonObject>
+#include <QString>
+#include "TesterSim.h"
+
+/**
+ * Local control API, served on a UNIX domain socket, through which scripts
+ * can change and read the simulated ECU state without going through the GUI.
+ * A request can change any number of RAM locations, values, snapshot pages
+ * and the error memory at once; the changes are applied together between two
+ * frames (so WSDC32 never sees half of them), and the reply is sent once they
+ * have been. Clients can also query the state, load and save filesystem
+ * images, and subscribe to the reads and writes of ECU state as they happen.
+ *
+ * Two encodings are accepted, chosen by the first byte that a client sends:
+ * JSON, one object per line, if it's '{', and otherwise a compact binary
+ * encoding (see README.md for both). The server runs on its own thread, and
+ * only ever waits for the listening thread between frames.
+ */
+class ControlServer
+{
+public:
+  explicit ControlServer(TesterSim& sim);
+  ~ControlServer();
+  ControlServer(const ControlServer&) = delete;
+  ControlServer& operator=(const ControlServer&) = delete;
+
+  bool start(const QString& path);
+  void stop();
+
+private:
+  static constexpr int MAX_MESSAGE_SIZE = 1024 * 1024;
+  static constexpr int EVENT_INTERVAL_MS = 20;
+  static constexpr int MAX_EVENTS_PER_MESSAGE = 1024;
+  // Output held for a client that isn't reading it. Past this, access events
+  // are dropped for that client, and one that doesn't read its replies is
+  // disconnected.
+  static constexpr int MAX_PENDING_OUTPUT = 4 * MAX_MESSAGE_SIZE;
+
+  enum class Mode
+  {
+    Unknown,
+    Binary,
+    Json
+  };
+
+  struct Client
+  {
+    int fd = -1;
+    Mode mode = Mode::Unknown;
+    QByteArray rx;
+    QByteArray tx;
+    bool subscribed = false;
+    uint32_t droppedEvents = 0;
+  };
+
+  TesterSim& m_sim;
+  QString m_path;
+  int m_listenFd = -1;
+  int m_wakeFds[2] = { -1, -1 };
+  std::thread m_thread;
+  std::vector<Client> m_clients;
+
+  void run();
+  void acceptClient();
+  bool receive(Client& client);
+  bool flush(Client& client);
+  bool processBinary(Client& client);
+  bool processJson(Client& client);
+  QByteArray handleBinary(const uint8_t* msg, int len, Client& client);
+  QJsonObject handleJson(const QJsonObject& request, Client& client);
+  static QByteArray droppedMessage(Mode mode, uint32_t dropped);
+  void setSubscribed(Client& client, bool subscribed);
+  void dispatchEvents();
+};
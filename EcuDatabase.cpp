@@ -0,0 +1,574 @@
+#include <algorithm>
+#include <cstring>
+#include <QDataStream>
+#include <QFile>
+#include <QFileInfo>
+#include "EcuDatabase.h"
+
+namespace
+{
+constexpr quint32 ECUDB_MAGIC = 0x53443245; // "SD2E"
+constexpr quint16 ECUDB_VERSION = 1;
+constexpr quint8 PROTOCOL_UNKNOWN = 0xff;
+
+/**
+ * Module family prefixes whose protocol is the same across every module in
+ * the family that we've seen so far.
+ */
+const struct
+{
+  const char* prefix;
+  ProtocolType protocol;
+} s_familyProtocols[] =
+{
+  { "BANT", ProtocolType::BoschAlarm },
+  { "BSOS", ProtocolType::BilsteinSuspension },
+  { "MCAM", ProtocolType::Marelli1AF },
+  { "TAIR", ProtocolType::FIAT9141 }
+};
+
+uint32_t fnv1a(uint32_t hash, const void* data, size_t len)
+{
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  for (size_t i = 0; i < len; i++)
+  {
+    hash = (hash ^ bytes[i]) * 16777619u;
+  }
+  return hash;
+}
+
+uint32_t readBE32(const quint8* p)
+{
+  return (static_cast<uint32_t>(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+/**
+ * Returns the 4-digit ECU ID embedded in a module or file name such as
+ * "BMOT0090.ECU" or "BMOT0090.Install", or -1 if there isn't one.
+ */
+int ecuIdFromName(const QString& name)
+{
+  int digits = 0;
+  for (int i = 0; i < name.length(); i++)
+  {
+    digits = name.at(i).isDigit() ? (digits + 1) : 0;
+    if ((digits == 4) && ((i + 1 >= name.length()) || !name.at(i + 1).isDigit()))
+    {
+      return name.mid(i - 3, 4).toInt();
+    }
+  }
+  return -1;
+}
+
+/**
+ * Parses a list of hex bytes such as "55 CD 83 01 98 3E" or
+ * "0x55,0xCD,0x83". Returns false if anything else is found.
+ */
+bool parseHexBytes(const QString& text, std::vector<uint8_t>& bytes)
+{
+  QString normalized = text;
+  normalized.replace(',', ' ');
+  bytes.clear();
+  for (const QString& token : normalized.split(' '))
+  {
+    if (token.isEmpty())
+    {
+      continue;
+    }
+    bool ok = false;
+    const unsigned int val = token.toUInt(&ok, 16);
+    if (!ok || (val > 0xff))
+    {
+      return false;
+    }
+    bytes.push_back(val);
+  }
+  return !bytes.empty();
+}
+
+bool isTrue(const QString& value)
+{
+  return (value.compare("TRUE", Qt::CaseInsensitive) == 0) || (value == "1");
+}
+}
+
+void EcuDatabase::clear()
+{
+  m_records.clear();
+  m_index.clear();
+  m_sourceHash = 0;
+}
+
+/**
+ * Hashes the parts of a Tester filesystem that the database is compiled
+ * from, so that a cached database can be checked for staleness without
+ * parsing anything.
+ */
+uint32_t EcuDatabase::computeSourceHash(const FileContentsMap& files)
+{
+  uint32_t hash = 2166136261u;
+  for (auto dir = files.constBegin(); dir != files.constEnd(); ++dir)
+  {
+    for (auto file = dir.value().constBegin(); file != dir.value().constEnd(); ++file)
+    {
+      const QString& name = file.key();
+      if ((name.compare("SCARICO.INI", Qt::CaseInsensitive) == 0) ||
+          name.endsWith(".ECU", Qt::CaseInsensitive) ||
+          name.endsWith(".Install", Qt::CaseInsensitive))
+      {
+        const QByteArray nameBytes = (dir.key() + "/" + name).toUtf8();
+        hash = fnv1a(hash, nameBytes.constData(), nameBytes.size());
+        hash = fnv1a(hash, file.value().constData(), file.value().size());
+      }
+    }
+  }
+  return hash;
+}
+
+const char* EcuDatabase::protocolName(ProtocolType protocol)
+{
+  switch (protocol)
+  {
+  case ProtocolType::KWP71:
+    return "KWP71";
+  case ProtocolType::FIAT9141:
+    return "FIAT9141";
+  case ProtocolType::Marelli1AF:
+    return "Marelli1AF";
+  case ProtocolType::BoschAlarm:
+    return "BoschAlarm";
+  case ProtocolType::BilsteinSuspension:
+    return "BilsteinSuspension";
+  }
+  return "unknown";
+}
+
+EcuRecord& EcuDatabase::recordFor(int ecuId)
+{
+  for (EcuRecord& rec : m_records)
+  {
+    if (rec.ecuId == ecuId)
+    {
+      return rec;
+    }
+  }
+  m_records.emplace_back();
+  m_records.back().ecuId = ecuId;
+  return m_records.back();
+}
+
+/**
+ * Scans a Tester filesystem for SCARICO.INI files, ECU module object files
+ * and .Install files, and (re)builds the database from them. Returns the
+ * number of ECU records found.
+ */
+int EcuDatabase::compile(const FileContentsMap& files)
+{
+  clear();
+
+  for (auto dir = files.constBegin(); dir != files.constEnd(); ++dir)
+  {
+    for (auto file = dir.value().constBegin(); file != dir.value().constEnd(); ++file)
+    {
+      if (file.key().compare("SCARICO.INI", Qt::CaseInsensitive) == 0)
+      {
+        parseScaricoIni(file.value());
+      }
+    }
+  }
+
+  for (auto dir = files.constBegin(); dir != files.constEnd(); ++dir)
+  {
+    for (auto file = dir.value().constBegin(); file != dir.value().constEnd(); ++file)
+    {
+      const int ecuId = ecuIdFromName(file.key());
+      if ((ecuId >= 0) && (ecuId <= MAX_ECU_ID) && file.key().endsWith(".ECU", Qt::CaseInsensitive))
+      {
+        EcuRecord& rec = recordFor(ecuId);
+        if (rec.exe.empty())
+        {
+          rec.exe = file.key().toStdString();
+        }
+        scanModule(rec, file.value());
+      }
+      else if (file.key().endsWith(".Install", Qt::CaseInsensitive))
+      {
+        const QByteArray content(reinterpret_cast<const char*>(file.value().constData()), file.value().size());
+        addInstallFile(file.key(), content);
+      }
+    }
+  }
+
+  m_sourceHash = computeSourceHash(files);
+  rebuildIndex();
+  return size();
+}
+
+/**
+ * Reads the ECU list from the Tester's SCARICO.INI, which has a [CONFIG]
+ * section listing the installed ECU IDs, followed by one section per ECU:
+ *   [0090]
+ *   name=MOTRONIC BOSCH 550 MARANELLO
+ *   dir=BMOT0090
+ *   exe=BMOT0090.ECU
+ *   linea_iso1=TRUE
+ *   ...
+ */
+void EcuDatabase::parseScaricoIni(const QVector<quint8>& content)
+{
+  const QString text = QString::fromLatin1(reinterpret_cast<const char*>(content.constData()), content.size());
+  EcuRecord* rec = nullptr;
+
+  for (const QString& rawLine : text.split('\n'))
+  {
+    const QString line = rawLine.trimmed();
+    if (line.startsWith('['))
+    {
+      const QString section = line.mid(1, line.indexOf(']') - 1);
+      bool isId = false;
+      const int ecuId = section.toInt(&isId);
+      rec = (isId && (ecuId >= 0) && (ecuId <= MAX_ECU_ID)) ? &recordFor(ecuId) : nullptr;
+    }
+    else if (rec && line.contains('='))
+    {
+      const QString key = line.section('=', 0, 0).trimmed().toLower();
+      const QString value = line.section('=', 1).trimmed();
+      if (key == "name")
+      {
+        rec->name = value.toStdString();
+      }
+      else if (key == "dir")
+      {
+        rec->dir = value.toStdString();
+      }
+      else if (key == "exe")
+      {
+        rec->exe = value.toStdString();
+      }
+      else if ((key == "linea_iso1") && isTrue(value))
+      {
+        rec->flags |= EcuRecord::LineISO1;
+      }
+      else if ((key == "linea_iso2") && isTrue(value))
+      {
+        rec->flags |= EcuRecord::LineISO2;
+      }
+      else if ((key == "linea_can") && isTrue(value))
+      {
+        rec->flags |= EcuRecord::LineCAN;
+      }
+      else if ((key == "linea_rs232") && isTrue(value))
+      {
+        rec->flags |= EcuRecord::LineRS232;
+      }
+    }
+  }
+}
+
+/**
+ * Looks through the symbol table of an ECU module (a 68k a.out object file)
+ * for hints about the protocol it speaks. Modules that define the KWP71 block
+ * read/write routines, or the frame receive routine used by the Bosch ABS
+ * modules, talk KWP71. Modules that import the 5-baud init routine perform a
+ * slow init. Failing that, the module family prefix is used.
+ */
+void EcuDatabase::scanModule(EcuRecord& rec, const QVector<quint8>& module)
+{
+  const quint8* data = module.constData();
+  const uint32_t len = module.size();
+  if (len < 32)
+  {
+    return;
+  }
+
+  const uint32_t textSize = readBE32(data + 4);
+  const uint32_t dataSize = readBE32(data + 8);
+  const uint32_t symSize = readBE32(data + 16);
+  const uint32_t trSize = readBE32(data + 24);
+  const uint32_t drSize = readBE32(data + 28);
+  const uint64_t symOffset = 32ull + textSize + dataSize + trSize + drSize;
+  const uint64_t strOffset = symOffset + symSize;
+
+  bool hasKwpBlockRoutines = false;
+  bool hasReceiveFrame = false;
+  if (strOffset <= len)
+  {
+    for (uint64_t pos = symOffset; pos + 12 <= strOffset; pos += 12)
+    {
+      const uint64_t nameOffset = strOffset + readBE32(data + pos);
+      const uint8_t type = data[pos + 4];
+      if (nameOffset >= len)
+      {
+        continue;
+      }
+      // A name that runs off the end of the file has been cut short, and
+      // can't be compared
+      const char* name = reinterpret_cast<const char*>(data + nameOffset);
+      if (!memchr(name, 0, len - nameOffset))
+      {
+        continue;
+      }
+      const bool defined = ((type & 0x1e) != 0);
+
+      // The frame receive routine is named for the ECU (e.g. _receiveFrame0096)
+      if (defined && (strcmp(name, "_readBlockEcu") == 0))
+      {
+        hasKwpBlockRoutines = true;
+      }
+      else if (defined && (strncmp(name, "_receiveFrame", 13) == 0))
+      {
+        hasReceiveFrame = true;
+      }
+      else if (strcmp(name, "_txFis5BaudLineaIso") == 0)
+      {
+        rec.flags |= EcuRecord::SlowInit;
+      }
+    }
+  }
+
+  if (rec.protocolKnown)
+  {
+    return;
+  }
+
+  if (hasKwpBlockRoutines || hasReceiveFrame)
+  {
+    rec.protocolKnown = true;
+    rec.protocol = ProtocolType::KWP71;
+    return;
+  }
+
+  const std::string& moduleName = rec.dir.empty() ? rec.exe : rec.dir;
+  for (const auto& family : s_familyProtocols)
+  {
+    if (moduleName.compare(0, 4, family.prefix) == 0)
+    {
+      rec.protocolKnown = true;
+      rec.protocol = family.protocol;
+      return;
+    }
+  }
+}
+
+/**
+ * Adds the information from a WSDC32 .Install file. These are INI-style text
+ * files; the ISO keyword sequence ("iso" or "keyword") and extra init info
+ * ("extra") are taken if their value is a list of hex bytes that fits in the
+ * reply, and the "protocol" key names the protocol. The ECU ID is taken from
+ * an "id" or "ecu" key, or from the 4-digit number in the filename.
+ * Information from an .Install file takes precedence over anything inferred
+ * from the module.
+ */
+bool EcuDatabase::addInstallFile(const QString& filename, const QByteArray& content)
+{
+  const QString text = QString::fromLatin1(content);
+  int ecuId = ecuIdFromName(QFileInfo(filename).fileName());
+  bool haveIso = false;
+  std::vector<uint8_t> isoBytes;
+  bool haveExtra = false;
+  std::vector<uint8_t> extraInitInfo;
+  bool haveProtocol = false;
+  ProtocolType protocol = ProtocolType::KWP71;
+
+  for (const QString& rawLine : text.split('\n'))
+  {
+    const QString line = rawLine.trimmed();
+    if (!line.contains('=') || line.startsWith(';'))
+    {
+      continue;
+    }
+
+    const QString key = line.section('=', 0, 0).trimmed().toLower();
+    const QString value = line.section('=', 1).trimmed();
+    std::vector<uint8_t> bytes;
+
+    if ((key == "id") || (key == "ecu"))
+    {
+      bool ok = false;
+      const int id = value.toInt(&ok);
+      ecuId = ok ? id : ecuId;
+    }
+    else if ((key == "extra") && parseHexBytes(value, bytes) && (bytes.size() <= MAX_EXTRA_INIT_INFO_LEN))
+    {
+      haveExtra = true;
+      extraInitInfo = bytes;
+    }
+    else if (((key == "iso") || (key == "keyword")) && parseHexBytes(value, bytes) &&
+             (bytes.size() <= MAX_ISO_KEYWORD_LEN))
+    {
+      haveIso = true;
+      isoBytes = bytes;
+    }
+    else if (key == "protocol")
+    {
+      const QString name = value.toUpper();
+      haveProtocol = true;
+      if (name.contains("KWP"))
+      {
+        protocol = ProtocolType::KWP71;
+      }
+      else if (name.contains("9141"))
+      {
+        protocol = ProtocolType::FIAT9141;
+      }
+      else if (name.contains("1AF"))
+      {
+        protocol = ProtocolType::Marelli1AF;
+      }
+      else if (name.contains("BILSTEIN"))
+      {
+        protocol = ProtocolType::BilsteinSuspension;
+      }
+      else if (name.contains("ALARM") || name.contains("VIM"))
+      {
+        protocol = ProtocolType::BoschAlarm;
+      }
+      else
+      {
+        haveProtocol = false;
+      }
+    }
+  }
+
+  if ((ecuId < 0) || (ecuId > MAX_ECU_ID) || (!haveIso && !haveExtra && !haveProtocol))
+  {
+    return false;
+  }
+
+  EcuRecord& rec = recordFor(ecuId);
+  if (haveIso)
+  {
+    rec.isoBytes = isoBytes;
+  }
+  if (haveExtra)
+  {
+    rec.extraInitInfo = extraInitInfo;
+  }
+  if (haveProtocol)
+  {
+    rec.protocolKnown = true;
+    rec.protocol = protocol;
+  }
+  rebuildIndex();
+  return true;
+}
+
+void EcuDatabase::rebuildIndex()
+{
+  m_index.assign(MAX_ECU_ID + 1, -1);
+  for (size_t i = 0; i < m_records.size(); i++)
+  {
+    m_index[m_records[i].ecuId] = i;
+  }
+}
+
+const EcuRecord* EcuDatabase::find(int ecuId) const
+{
+  if ((ecuId < 0) || (ecuId >= static_cast<int>(m_index.size())) || (m_index[ecuId] < 0))
+  {
+    return nullptr;
+  }
+  return &m_records[m_index[ecuId]];
+}
+
+/**
+ * Loads a previously compiled database. Fails if the file is missing,
+ * malformed (including a record with an unknown protocol, or with a keyword
+ * sequence or extra init info too long for a reply), or was compiled from a
+ * filesystem with a different source hash.
+ */
+bool EcuDatabase::load(const QString& path, uint32_t expectedSourceHash)
+{
+  QFile infile(path);
+  if (!infile.open(QIODevice::ReadOnly))
+  {
+    return false;
+  }
+
+  QDataStream in(&infile);
+  quint32 magic = 0;
+  quint16 version = 0;
+  quint32 sourceHash = 0;
+  quint32 count = 0;
+  in >> magic >> version >> sourceHash >> count;
+  if ((magic != ECUDB_MAGIC) || (version != ECUDB_VERSION) ||
+      (sourceHash != expectedSourceHash) || (count > MAX_ECU_ID + 1))
+  {
+    return false;
+  }
+
+  std::vector<EcuRecord> records(count);
+  for (EcuRecord& rec : records)
+  {
+    quint16 ecuId = 0;
+    quint8 protocol = PROTOCOL_UNKNOWN;
+    quint8 flags = 0;
+    QByteArray isoBytes;
+    QByteArray extraInitInfo;
+    QByteArray name;
+    QByteArray dir;
+    QByteArray exe;
+    in >> ecuId >> protocol >> flags >> isoBytes >> extraInitInfo >> name >> dir >> exe;
+
+    if ((protocol != PROTOCOL_UNKNOWN) && (protocol > static_cast<quint8>(ProtocolType::BilsteinSuspension)))
+    {
+      return false;
+    }
+    if ((isoBytes.size() > MAX_ISO_KEYWORD_LEN) || (extraInitInfo.size() > MAX_EXTRA_INIT_INFO_LEN))
+    {
+      return false;
+    }
+
+    rec.ecuId = ecuId;
+    rec.protocolKnown = (protocol != PROTOCOL_UNKNOWN);
+    rec.protocol = rec.protocolKnown ? static_cast<ProtocolType>(protocol) : ProtocolType::KWP71;
+    rec.flags = flags;
+    rec.isoBytes.assign(isoBytes.constData(), isoBytes.constData() + isoBytes.size());
+    rec.extraInitInfo.assign(extraInitInfo.constData(), extraInitInfo.constData() + extraInitInfo.size());
+    rec.name = name.toStdString();
+    rec.dir = dir.toStdString();
+    rec.exe = exe.toStdString();
+  }
+
+  if ((in.status() != QDataStream::Ok) || (records.size() != count))
+  {
+    return false;
+  }
+  for (const EcuRecord& rec : records)
+  {
+    if (rec.ecuId > MAX_ECU_ID)
+    {
+      return false;
+    }
+  }
+
+  m_records = std::move(records);
+  m_sourceHash = sourceHash;
+  rebuildIndex();
+  return true;
+}
+
+bool EcuDatabase::save(const QString& path) const
+{
+  QFile outfile(path);
+  if (!outfile.open(QIODevice::WriteOnly))
+  {
+    return false;
+  }
+
+  QDataStream out(&outfile);
+  out << ECUDB_MAGIC << ECUDB_VERSION << m_sourceHash << static_cast<quint32>(m_records.size());
+  for (const EcuRecord& rec : m_records)
+  {
+    out << static_cast<quint16>(rec.ecuId)
+        << static_cast<quint8>(rec.protocolKnown ? static_cast<quint8>(rec.protocol) : PROTOCOL_UNKNOWN)
+        << static_cast<quint8>(rec.flags)
+        << QByteArray(reinterpret_cast<const char*>(rec.isoBytes.data()), rec.isoBytes.size())
+        << QByteArray(reinterpret_cast<const char*>(rec.extraInitInfo.data()), rec.extraInitInfo.size())
+        << QByteArray(rec.name.c_str())
+        << QByteArray(rec.dir.c_str())
+        << QByteArray(rec.exe.c_str());
+  }
+  return (out.status() == QDataStream::Ok);
+}
+
@@ -0,0 +1,92 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <QByteArray>
+#include <QMap>
+#include <QString>
+#include <QVector>
+
+// Longest ISO keyword sequence and extra init info that a cmd 11/12 reply
+// can carry
+constexpr int MAX_ISO_KEYWORD_LEN = 6;
+constexpr int MAX_EXTRA_INIT_INFO_LEN = 32;
+
+enum class ProtocolType
+{
+  KWP71,
+  FIAT9141,
+  Marelli1AF,
+
+  /**
+   * This one seems to be an ealier version of the protocol used by Bosch with
+   * the Smartra III immobilizer, the spec for which was made available as
+   * Appendix H in the user manual provided to the FCC (FCC ID: LXP-VIMA01).
+   */
+  BoschAlarm,
+  BilsteinSuspension
+};
+
+typedef QMap<QString,QMap<QString,QVector<quint8>>> FileContentsMap;
+
+/**
+ * Everything known about one ECU module, as gathered from the Tester's
+ * filesystem (SCARICO.INI and the module object file itself) and from any
+ * .Install files supplied by WSDC32.
+ */
+struct EcuRecord
+{
+  enum LineFlag
+  {
+    LineISO1 = 0x01,
+    LineISO2 = 0x02,
+    LineCAN = 0x04,
+    LineRS232 = 0x08,
+    SlowInit = 0x10  // module imports the 5-baud init routine
+  };
+
+  uint16_t ecuId = 0;
+  bool protocolKnown = false;
+  ProtocolType protocol = ProtocolType::KWP71;
+  uint8_t flags = 0;
+  std::vector<uint8_t> isoBytes;
+  std::vector<uint8_t> extraInitInfo;
+  std::string name;
+  std::string dir;
+  std::string exe;
+};
+
+/**
+ * Compiled index of ECU modules. It is built by scanning a loaded Tester
+ * filesystem and cached in a compact binary file next to the state image, so
+ * that subsequent loads don't need to re-parse anything. Lookups by ECU ID
+ * are a direct array index.
+ */
+class EcuDatabase
+{
+public:
+  static constexpr int MAX_ECU_ID = 9999;
+
+  void clear();
+  int compile(const FileContentsMap& files);
+  bool addInstallFile(const QString& filename, const QByteArray& content);
+  bool load(const QString& path, uint32_t expectedSourceHash);
+  bool save(const QString& path) const;
+  const EcuRecord* find(int ecuId) const;
+  int size() const { return static_cast<int>(m_records.size()); }
+  uint32_t sourceHash() const { return m_sourceHash; }
+
+  static uint32_t computeSourceHash(const FileContentsMap& files);
+  static const char* protocolName(ProtocolType protocol);
+
+private:
+  std::vector<EcuRecord> m_records;
+  std::vector<int16_t> m_index;
+  uint32_t m_sourceHash = 0;
+
+  EcuRecord& recordFor(int ecuId);
+  void parseScaricoIni(const QVector<quint8>& content);
+  void scanModule(EcuRecord& rec, const QVector<quint8>& module);
+  void rebuildIndex();
+};
+
@@ -0,0 +1,199 @@
+#include "EcuModule.h"
+#include "M68kCpu.h"
+#include <algorithm>
+#include <cstring>
+
+static uint32_t readBE32(const uint8_t* p)
+{
+  return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+/**
+ * Loads the module into the CPU's memory at the given address. Imports that
+ * the resolver doesn't know are left pointing at address 0 and listed by
+ * unresolved(); the load still succeeds, since a module usually imports far
+ * more than it calls on any given path. Returns false (with a message in
+ * error()) if the image is malformed or doesn't fit in memory.
+ */
+bool EcuModule::load(const uint8_t* image, uint32_t len, M68kCpu& cpu, uint32_t base, const ImportResolver& resolve)
+{
+  m_symbols.clear();
+  m_unresolved.clear();
+  m_error.clear();
+
+  if (len < 32)
+  {
+    m_error = "Module is too short for an a.out header";
+    return false;
+  }
+
+  const uint32_t textSize = readBE32(image + 4);
+  const uint32_t dataSize = readBE32(image + 8);
+  const uint32_t bssSize = readBE32(image + 12);
+  const uint32_t symSize = readBE32(image + 16);
+  const uint32_t trSize = readBE32(image + 24);
+  const uint32_t drSize = readBE32(image + 28);
+  const uint64_t symOffset = 32ull + textSize + dataSize + trSize + drSize;
+  const uint64_t strOffset = symOffset + symSize;
+  if (strOffset > len)
+  {
+    m_error = "Module is truncated";
+    return false;
+  }
+
+  const uint64_t loadSize = static_cast<uint64_t>(textSize) + dataSize + bssSize;
+  uint8_t* mem = (loadSize < 0x1000000) ? cpu.memory(base, loadSize) : nullptr;
+  if (!mem)
+  {
+    m_error = "Module does not fit in memory";
+    return false;
+  }
+  memcpy(mem, image + 32, textSize + dataSize);
+  memset(mem + textSize + dataSize, 0, bssSize);
+
+  m_base = base;
+  m_textSize = textSize;
+  uint32_t next = (base + loadSize + 3) & ~3u;
+
+  const int numSymbols = symSize / 12;
+  std::vector<uint32_t> symbolAddrs(numSymbols, 0);
+  std::vector<bool> symbolIsExternal(numSymbols, false);
+  for (int i = 0; i < numSymbols; i++)
+  {
+    const uint8_t* sym = image + symOffset + (i * 12);
+    const uint64_t nameOffset = strOffset + readBE32(sym);
+    const uint8_t type = sym[4];
+    const uint32_t value = readBE32(sym + 8);
+
+    std::string name;
+    if (nameOffset < len)
+    {
+      const char* start = reinterpret_cast<const char*>(image + nameOffset);
+      const void* nul = memchr(start, 0, len - nameOffset);
+      name.assign(start, nul ? (static_cast<const char*>(nul) - start) : (len - nameOffset));
+    }
+
+    uint32_t addr = 0;
+    switch (type & N_TYPE)
+    {
+    case N_TEXT:
+    case N_DATA:
+    case N_BSS:
+      addr = base + value;
+      break;
+    case N_ABS:
+      addr = value;
+      break;
+    case N_UNDF:
+      if ((type & N_EXT) && (value != 0))
+      {
+        // Common symbol, for which the value is the size
+        const uint32_t align = (value >= 4) ? 4 : (value >= 2) ? 2 : 1;
+        next = (next + align - 1) & ~(align - 1);
+        uint8_t* common = cpu.memory(next, value);
+        if (!common)
+        {
+          m_error = "Common symbols do not fit in memory";
+          return false;
+        }
+        memset(common, 0, value);
+        addr = next;
+        next += value;
+      }
+      else if (type & N_EXT)
+      {
+        addr = resolve(name);
+        if (addr == 0)
+        {
+          m_unresolved.push_back(name);
+        }
+      }
+      break;
+    default:
+      break;
+    }
+
+    symbolAddrs[i] = addr;
+    symbolIsExternal[i] = (type & N_EXT);
+    if ((type & N_EXT) && (addr != 0))
+    {
+      m_symbols[name] = addr;
+    }
+  }
+
+  const uint8_t* textRelocs = image + 32 + textSize + dataSize;
+  if (!relocate(textRelocs, trSize, base, textSize, symbolAddrs, symbolIsExternal, cpu) ||
+      !relocate(textRelocs + trSize, drSize, base + textSize, dataSize, symbolAddrs, symbolIsExternal, cpu))
+  {
+    return false;
+  }
+
+  m_end = (next + 3) & ~3u;
+  return true;
+}
+
+/**
+ * Applies the relocations for one segment. Each location already holds the
+ * offset that the assembler computed with the module linked at address 0, so
+ * the load address (and, for external symbols, the symbol's address) is
+ * added to it. PC-relative references within the module need no change.
+ */
+bool EcuModule::relocate(const uint8_t* relocs, uint32_t relocSize, uint32_t segmentAddr, uint32_t segmentSize,
+                         const std::vector<uint32_t>& symbolAddrs, const std::vector<bool>& symbolIsExternal, M68kCpu& cpu)
+{
+  for (uint32_t pos = 0; pos + 8 <= relocSize; pos += 8)
+  {
+    const uint32_t offset = readBE32(relocs + pos);
+    const uint32_t info = readBE32(relocs + pos + 4);
+    const uint32_t symbolNum = info >> 8;
+    const bool pcRelative = (info >> 7) & 1;
+    const int length = (info >> 5) & 3;
+    const bool external = (info >> 4) & 1;
+    const uint32_t location = segmentAddr + offset;
+
+    if ((offset >= segmentSize) || (segmentSize - offset < (1u << std::min(length, 2))))
+    {
+      m_error = "Relocation is outside of its segment";
+      return false;
+    }
+
+    uint32_t adjust = 0;
+    if (external)
+    {
+      if ((symbolNum >= symbolAddrs.size()) || !symbolIsExternal[symbolNum])
+      {
+        m_error = "Relocation refers to an invalid symbol";
+        return false;
+      }
+      adjust = symbolAddrs[symbolNum] - (pcRelative ? m_base : 0);
+    }
+    else if (((symbolNum & N_TYPE) == N_TEXT) || ((symbolNum & N_TYPE) == N_DATA) || ((symbolNum & N_TYPE) == N_BSS))
+    {
+      adjust = pcRelative ? 0 : m_base;
+    }
+
+    if (length == 0)
+    {
+      cpu.write8(location, cpu.read8(location) + adjust);
+    }
+    else if (length == 1)
+    {
+      cpu.write16(location, cpu.read16(location) + adjust);
+    }
+    else
+    {
+      cpu.write32(location, cpu.read32(location) + adjust);
+    }
+  }
+  return true;
+}
+
+/**
+ * Returns the address of a symbol defined by the module, or 0.
+ */
+uint32_t EcuModule::symbol(const std::string& name) const
+{
+  const auto it = m_symbols.find(name);
+  return (it != m_symbols.end()) ? it->second : 0;
+}
+
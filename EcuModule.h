@@ -0,0 +1,55 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+class M68kCpu;
+
+/**
+ * Loader for the Tester's ECU application modules (.ECU files), which are
+ * relocatable 68k a.out objects that VxWorks would link in when the module
+ * is started. The text, data and bss segments are copied into the memory of
+ * an M68kCpu at a given base address, common symbols are allocated after
+ * them, and the text and data relocations are applied. Symbols that the
+ * module imports are looked up with a resolver supplied by the caller.
+ */
+class EcuModule
+{
+public:
+  /** Returns the address to use for an imported symbol, or 0 if it's unknown. */
+  typedef std::function<uint32_t(const std::string&)> ImportResolver;
+
+  bool load(const uint8_t* image, uint32_t len, M68kCpu& cpu, uint32_t base, const ImportResolver& resolve);
+
+  uint32_t symbol(const std::string& name) const;
+  uint32_t textStart() const { return m_base; }
+  uint32_t textEnd() const { return m_base + m_textSize; }
+  uint32_t end() const { return m_end; }
+  const std::vector<std::string>& unresolved() const { return m_unresolved; }
+  const std::string& error() const { return m_error; }
+
+private:
+  enum SymbolType
+  {
+    N_UNDF = 0x00,
+    N_EXT = 0x01,
+    N_ABS = 0x02,
+    N_TEXT = 0x04,
+    N_DATA = 0x06,
+    N_BSS = 0x08,
+    N_TYPE = 0x1e
+  };
+
+  uint32_t m_base = 0;
+  uint32_t m_textSize = 0;
+  uint32_t m_end = 0;
+  std::map<std::string,uint32_t> m_symbols;
+  std::vector<std::string> m_unresolved;
+  std::string m_error;
+
+  bool relocate(const uint8_t* relocs, uint32_t relocSize, uint32_t segmentAddr, uint32_t segmentSize,
+                const std::vector<uint32_t>& symbolAddrs, const std::vector<bool>& symbolIsExternal, M68kCpu& cpu);
+};
+
@@ -0,0 +1,287 @@
+#include "FrameScheduler.h"
+#include <algorithm>
+
+FrameScheduler::FrameScheduler() :
+  m_start(Clock::now()),
+  m_slots(WHEEL_SLOTS)
+{
+}
+
+uint64_t FrameScheduler::tickAt(Clock::time_point t) const
+{
+  const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(t - m_start).count();
+  return (elapsed > 0) ? static_cast<uint64_t>(elapsed) / TICK_MS : 0;
+}
+
+/**
+ * Places a timer in the slot it will expire in. Delays longer than one turn
+ * of the wheel are handled by counting the number of full turns remaining.
+ */
+void FrameScheduler::insert(int id, uint64_t ticksFromNow)
+{
+  Timer& timer = m_timers[id];
+  ticksFromNow = std::max<uint64_t>(ticksFromNow, 1);
+  timer.slot = (m_currentTick + ticksFromNow) % WHEEL_SLOTS;
+  timer.rounds = (ticksFromNow - 1) / WHEEL_SLOTS;
+  m_slots[timer.slot].push_back(id);
+}
+
+void FrameScheduler::remove(int id)
+{
+  Timer& timer = m_timers[id];
+  if (timer.active)
+  {
+    std::vector<int>& slot = m_slots[timer.slot];
+    slot.erase(std::remove(slot.begin(), slot.end(), id), slot.end());
+    release(id);
+  }
+}
+
+/**
+ * Returns a timer that is no longer in any slot to the free list.
+ */
+void FrameScheduler::release(int id)
+{
+  Timer& timer = m_timers[id];
+  if (timer.key != 0)
+  {
+    m_keyedTimers.erase(keyOf(timer.pipe, timer.key));
+    timer.key = 0;
+  }
+  timer.active = false;
+  timer.frame.reset();
+  m_freeTimers.push_back(id);
+  m_activeCount--;
+}
+
+/**
+ * Returns a frame holding a copy of the given bytes, in a pooled buffer that
+ * nothing else refers to any more if there is one. The search starts where
+ * the last one left off, as buffers tend to be freed in the order they were
+ * handed out.
+ */
+OutputQueue::Frame FrameScheduler::makeFrame(const uint8_t* data, int len)
+{
+  for (size_t i = 0; i < m_framePool.size(); i++)
+  {
+    std::shared_ptr<std::vector<uint8_t>>& buf = m_framePool[m_poolNext];
+    m_poolNext = (m_poolNext + 1) % m_framePool.size();
+    if (buf.use_count() == 1)
+    {
+      buf->assign(data, data + len);
+      return buf;
+    }
+  }
+
+  std::shared_ptr<std::vector<uint8_t>> buf = std::make_shared<std::vector<uint8_t>>(data, data + len);
+  if (m_framePool.size() < MAX_POOLED_FRAMES)
+  {
+    m_framePool.push_back(buf);
+  }
+  return buf;
+}
+
+/**
+ * Schedules a complete frame (header included) to be sent on a pipe after
+ * the given delay, and then every periodMs milliseconds if that is nonzero.
+ * Times are rounded up to the next TICK_MS. A nonzero key replaces whatever
+ * was scheduled on the same pipe with that key, so that something scheduled
+ * again (e.g. a periodic frame) is re-armed rather than running twice.
+ * Returns an ID that can be passed to cancel().
+ */
+int FrameScheduler::schedule(uint32_t delayMs, uint32_t periodMs, uint8_t pipe, const uint8_t* frame, int len,
+                             uint32_t key)
+{
+  if (key != 0)
+  {
+    const auto keyed = m_keyedTimers.find(keyOf(pipe, key));
+    if (keyed != m_keyedTimers.end())
+    {
+      remove(keyed->second);
+    }
+  }
+
+  int id = 0;
+  if (m_freeTimers.empty())
+  {
+    id = m_timers.size();
+    m_timers.push_back(Timer());
+  }
+  else
+  {
+    id = m_freeTimers.back();
+    m_freeTimers.pop_back();
+  }
+
+  Timer& timer = m_timers[id];
+  timer.active = true;
+  timer.pipe = pipe;
+  timer.key = key;
+  timer.periodTicks = (periodMs + TICK_MS - 1) / TICK_MS;
+  timer.frame = makeFrame(frame, len);
+  m_activeCount++;
+  if (key != 0)
+  {
+    m_keyedTimers[keyOf(pipe, key)] = id;
+  }
+
+  // The wheel may lag the clock slightly if it hasn't been serviced since the
+  // last tick boundary; account for that so the delay isn't cut short
+  const uint64_t now = tickAt(Clock::now());
+  const uint64_t lag = (now > m_currentTick) ? (now - m_currentTick) : 0;
+  insert(id, lag + (delayMs + TICK_MS - 1) / TICK_MS);
+  return id;
+}
+
+void FrameScheduler::cancel(int id)
+{
+  if ((id >= 0) && (id < static_cast<int>(m_timers.size())))
+  {
+    remove(id);
+  }
+}
+
+/**
+ * Cancels everything scheduled on a pipe, e.g. when the application that
+ * was running on it is restarted.
+ */
+void FrameScheduler::cancelPipe(uint8_t pipe)
+{
+  for (size_t id = 0; id < m_timers.size(); id++)
+  {
+    if (m_timers[id].active && (m_timers[id].pipe == pipe))
+    {
+      remove(id);
+    }
+  }
+}
+
+/**
+ * Cancels everything scheduled, e.g. when the connection it was meant for
+ * has been closed.
+ */
+void FrameScheduler::clear()
+{
+  for (size_t id = 0; id < m_timers.size(); id++)
+  {
+    remove(id);
+  }
+}
+
+/**
+ * Advances the wheel to the given time and queues every frame that has come
+ * due for output. Periodic frames are rescheduled, and share one buffer
+ * between all the times they're queued. Returns the number of frames queued.
+ */
+int FrameScheduler::collectDue(Clock::time_point now, OutputQueue& out)
+{
+  int count = 0;
+  const uint64_t target = tickAt(now);
+
+  while ((m_activeCount > 0) && (m_currentTick < target))
+  {
+    m_currentTick++;
+    std::vector<int>& slot = m_slots[m_currentTick % WHEEL_SLOTS];
+    m_expired.clear();
+
+    // Timers that expire in the same tick go out in the order they were
+    // scheduled, so a reply always precedes the frames queued after it
+    size_t kept = 0;
+    for (int id : slot)
+    {
+      Timer& timer = m_timers[id];
+      if (timer.rounds > 0)
+      {
+        timer.rounds--;
+        slot[kept++] = id;
+      }
+      else
+      {
+        m_expired.push_back(id);
+      }
+    }
+    slot.resize(kept);
+
+    for (int id : m_expired)
+    {
+      Timer& timer = m_timers[id];
+      out.push(timer.frame);
+      count++;
+
+      if (timer.periodTicks > 0)
+      {
+        insert(id, timer.periodTicks);
+      }
+      else
+      {
+        release(id);
+      }
+    }
+  }
+
+  // Nothing is pending, so there's no need to step through the idle ticks
+  if (m_activeCount == 0)
+  {
+    m_currentTick = std::max(m_currentTick, target);
+  }
+
+  return count;
+}
+
+/**
+ * Returns the number of milliseconds until the next frame may come due, for
+ * use as a poll() timeout, or -1 if nothing is scheduled. This may be earlier
+ * than the actual deadline when the nearest timer is more than one turn of
+ * the wheel away; waking early is harmless.
+ */
+int FrameScheduler::msUntilNext(Clock::time_point now) const
+{
+  if (m_activeCount == 0)
+  {
+    return -1;
+  }
+
+  const uint64_t nowTick = tickAt(now);
+  const uint64_t lag = (nowTick > m_currentTick) ? (nowTick - m_currentTick) : 0;
+
+  for (uint64_t ahead = 1; ahead <= WHEEL_SLOTS; ahead++)
+  {
+    if (!m_slots[(m_currentTick + ahead) % WHEEL_SLOTS].empty())
+    {
+      if (ahead <= lag)
+      {
+        return 0;
+      }
+      const auto sinceTick = std::chrono::duration_cast<std::chrono::milliseconds>(
+        now - m_start).count() % TICK_MS;
+      return static_cast<int>(((ahead - lag) * TICK_MS) - sinceTick);
+    }
+  }
+  return WHEEL_SLOTS * TICK_MS;
+}
+
+/**
+ * Lists the periodic frames that are scheduled, e.g. so that they can be
+ * saved and scheduled again later. Delays are rounded up to whole ticks.
+ */
+void FrameScheduler::periodicFrames(Clock::time_point now, std::vector<Periodic>& frames) const
+{
+  const uint64_t nowTick = tickAt(now);
+  const uint64_t lag = (nowTick > m_currentTick) ? (nowTick - m_currentTick) : 0;
+
+  for (const Timer& timer : m_timers)
+  {
+    if (timer.active && (timer.periodTicks > 0))
+    {
+      uint64_t ahead = (timer.slot + WHEEL_SLOTS - (m_currentTick % WHEEL_SLOTS)) % WHEEL_SLOTS;
+      if (ahead == 0)
+      {
+        ahead = WHEEL_SLOTS;
+      }
+      ahead += static_cast<uint64_t>(timer.rounds) * WHEEL_SLOTS;
+      const uint64_t ticks = (ahead > lag) ? (ahead - lag) : 0;
+      frames.push_back({ timer.pipe, timer.key, static_cast<uint32_t>(ticks * TICK_MS),
+                         timer.periodTicks * TICK_MS, timer.frame });
+    }
+  }
+}
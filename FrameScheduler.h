@@ -0,0 +1,85 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include "OutputQueue.h"
+
+/**
+ * Schedules frames that the Tester sends without having been asked, either
+ * once after a delay or periodically, on a per-pipe basis. It is a hashed
+ * timer wheel, so scheduling and expiry are constant-time regardless of how
+ * many frames are pending.
+ *
+ * The scheduler doesn't do any I/O itself; the listening thread asks it for
+ * the frames that have come due, which are appended to the output queue in
+ * the order they were scheduled. Frame buffers come from a pool, and are
+ * reused once neither a timer nor the output queue refers to them, so
+ * scheduling a reply doesn't allocate once the pool has warmed up. It's not
+ * thread-safe, and is only used by the listening thread.
+ */
+class FrameScheduler
+{
+public:
+  typedef std::chrono::steady_clock Clock;
+
+  /** A periodic frame as scheduled, with the time left until it's next sent. */
+  struct Periodic
+  {
+    uint8_t pipe;
+    uint32_t key;
+    uint32_t delayMs;
+    uint32_t periodMs;
+    OutputQueue::Frame frame;
+  };
+
+  static constexpr int TICK_MS = 10;
+  static constexpr int WHEEL_SLOTS = 256;
+
+  FrameScheduler();
+
+  int schedule(uint32_t delayMs, uint32_t periodMs, uint8_t pipe, const uint8_t* frame, int len,
+               uint32_t key = 0);
+  void cancel(int id);
+  void cancelPipe(uint8_t pipe);
+  void clear();
+  int collectDue(Clock::time_point now, OutputQueue& out);
+  int msUntilNext(Clock::time_point now) const;
+  void periodicFrames(Clock::time_point now, std::vector<Periodic>& frames) const;
+  bool empty() const { return m_activeCount == 0; }
+
+private:
+  struct Timer
+  {
+    bool active = false;
+    uint8_t pipe = 0;
+    uint32_t key = 0;
+    uint32_t periodTicks = 0;
+    uint32_t rounds = 0;
+    int slot = -1;
+    OutputQueue::Frame frame;
+  };
+
+  // Most frames in flight at once whose buffers are kept for reuse
+  static constexpr size_t MAX_POOLED_FRAMES = 256;
+
+  Clock::time_point m_start;
+  uint64_t m_currentTick = 0;
+  int m_activeCount = 0;
+  std::vector<Timer> m_timers;
+  std::vector<int> m_freeTimers;
+  std::vector<std::vector<int>> m_slots;
+  std::unordered_map<uint64_t,int> m_keyedTimers;
+  std::vector<int> m_expired;
+  std::vector<std::shared_ptr<std::vector<uint8_t>>> m_framePool;
+  size_t m_poolNext = 0;
+
+  uint64_t tickAt(Clock::time_point t) const;
+  void insert(int id, uint64_t ticksFromNow);
+  void remove(int id);
+  void release(int id);
+  OutputQueue::Frame makeFrame(const uint8_t* data, int len);
+  static uint64_t keyOf(uint8_t pipe, uint32_t key) { return (static_cast<uint64_t>(key) << 8) | pipe; }
+};
+
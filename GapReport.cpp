@@ -0,0 +1,116 @@
+#include "GapReport.h"
+#include <algorithm>
+#include <chrono>
+#include <tuple>
+#include <QSaveFile>
+#include <QTextStream>
+#include "EcuDatabase.h"
+
+namespace
+{
+QString hexBytes(const uint8_t* bytes, int len)
+{
+  QString text;
+  for (int i = 0; i < len; i++)
+  {
+    text += QString((i > 0) ? " %1" : "%1").arg(bytes[i], 2, 16, QChar('0'));
+  }
+  return text;
+}
+
+QString timestamp(qint64 timeMs)
+{
+  return QString::number(timeMs / 1000.0, 'f', 3);
+}
+}
+
+bool GapReport::Key::operator<(const Key& other) const
+{
+  return std::tie(cmd, ecuId, protocol, title, prefixLen, prefix) <
+         std::tie(other.cmd, other.ecuId, other.protocol, other.title, other.prefixLen, other.prefix);
+}
+
+/**
+ * Counts a request that couldn't be answered. If the title position is
+ * given, the block title is taken from there and the prefix follows it;
+ * otherwise the prefix is the start of the frame's payload. Returns true if
+ * this is the first request of its kind.
+ */
+bool GapReport::record(const uint8_t* frame, int ecuId, int protocol, int titlePos, const char* what)
+{
+  const int len = ((frame[1] << 8) | frame[2]) + 1;
+  Key key { frame[6], ecuId, protocol, NONE, 0, {} };
+  int prefixPos = 7;
+  if ((titlePos >= 0) && (titlePos < len))
+  {
+    key.title = frame[titlePos];
+    prefixPos = titlePos + 1;
+  }
+  key.prefixLen = std::max(0, std::min(PREFIX_LEN, len - prefixPos));
+  std::copy(frame + prefixPos, frame + prefixPos + key.prefixLen, key.prefix.begin());
+
+  const qint64 timeMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+    std::chrono::system_clock::now().time_since_epoch()).count();
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto it = m_entries.find(key);
+  if (it != m_entries.end())
+  {
+    it->second.count++;
+    it->second.lastMs = timeMs;
+    return false;
+  }
+  m_entries.emplace(key, Entry { what, 1, timeMs, timeMs, std::vector<uint8_t>(frame, frame + len) });
+  return true;
+}
+
+void GapReport::clear()
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_entries.clear();
+}
+
+/**
+ * Writes the report as CSV, most frequent gaps first.
+ */
+bool GapReport::save(const QString& path) const
+{
+  QSaveFile file(path);
+  if (!file.open(QIODevice::WriteOnly | QIODevice::Text))
+  {
+    return false;
+  }
+
+  QTextStream out(&file);
+  out << "gap,command,ecu,protocol,title,prefix,count,first,last,sample\n";
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::vector<std::map<Key,Entry>::const_iterator> sorted;
+    for (auto it = m_entries.cbegin(); it != m_entries.cend(); ++it)
+    {
+      sorted.push_back(it);
+    }
+    std::stable_sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b)
+    {
+      return a->second.count > b->second.count;
+    });
+
+    for (const auto& it : sorted)
+    {
+      const Key& key = it->first;
+      const Entry& entry = it->second;
+      out << QString("%1,0x%2,%3,%4,%5,%6,%7,%8,%9,").arg(entry.what).
+        arg(key.cmd, 2, 16, QChar('0')).
+        arg((key.ecuId == NONE) ? QString() : QString("%1").arg(key.ecuId, 4, 10, QChar('0'))).
+        arg((key.protocol == NONE) ? QString() : EcuDatabase::protocolName(static_cast<ProtocolType>(key.protocol))).
+        arg((key.title == NONE) ? QString() : QString("0x%1").arg(key.title, 2, 16, QChar('0'))).
+        arg(hexBytes(key.prefix.data(), key.prefixLen)).
+        arg(entry.count).
+        arg(timestamp(entry.firstMs)).
+        arg(timestamp(entry.lastMs));
+      out << hexBytes(entry.sample.data(), entry.sample.size()) << "\n";
+    }
+  }
+  out.flush();
+  return file.commit();
+}
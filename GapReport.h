@@ -0,0 +1,55 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <vector>
+#include <QString>
+
+/**
+ * Aggregates the requests that the simulator doesn't know how to answer: SD2
+ * commands without a handler, ECU protocol blocks with a title that isn't
+ * handled, and blocks for ECUs whose protocol isn't known at all. Requests
+ * are grouped by command, ECU ID, protocol, block title and the first few
+ * bytes after the title. Each group keeps a count, the times that it was
+ * first and last seen, and its first frame as a sample.
+ *
+ * At polling rate, logging each of these would flood the log, so only the
+ * first of each group is logged, and the report is saved on demand as a list
+ * of the gaps that are left to fill. Recording a request that falls into an
+ * existing group doesn't allocate.
+ */
+class GapReport
+{
+public:
+  static constexpr int PREFIX_LEN = 4;
+  static constexpr int NONE = -1; // ECU ID, protocol or title that doesn't apply
+
+  bool record(const uint8_t* frame, int ecuId, int protocol, int titlePos, const char* what);
+  void clear();
+  bool save(const QString& path) const;
+
+private:
+  struct Key
+  {
+    uint8_t cmd;
+    int ecuId;
+    int protocol;
+    int title;
+    int prefixLen;
+    std::array<uint8_t,PREFIX_LEN> prefix;
+    bool operator<(const Key& other) const;
+  };
+
+  struct Entry
+  {
+    const char* what;
+    uint64_t count;
+    qint64 firstMs;
+    qint64 lastMs;
+    std::vector<uint8_t> sample;
+  };
+
+  mutable std::mutex m_mutex;
+  std::map<Key,Entry> m_entries;
+};
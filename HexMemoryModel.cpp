@@ -0,0 +1,169 @@
+#include "HexMemoryModel.h"
+#include <algorithm>
+#include <QColor>
+
+HexMemoryModel::HexMemoryModel(QObject* parent) :
+  QAbstractTableModel(parent),
+  m_heat(MemoryImage::SIZE, 0)
+{
+}
+
+int HexMemoryModel::rowCount(const QModelIndex& parent) const
+{
+  return parent.isValid() ? 0 : (MemoryImage::SIZE / BYTES_PER_ROW);
+}
+
+int HexMemoryModel::columnCount(const QModelIndex& parent) const
+{
+  return parent.isValid() ? 0 : (BYTES_PER_ROW + 1);
+}
+
+QVariant HexMemoryModel::data(const QModelIndex& index, int role) const
+{
+  if (!index.isValid())
+  {
+    return QVariant();
+  }
+
+  const int rowAddr = index.row() * BYTES_PER_ROW;
+  if (index.column() == ASCII_COLUMN)
+  {
+    if (role != Qt::DisplayRole)
+    {
+      return QVariant();
+    }
+    QString text;
+    for (int i = 0; i < BYTES_PER_ROW; i++)
+    {
+      const uint8_t val = m_contents.at(rowAddr + i);
+      text += ((val >= 0x20) && (val < 0x7f)) ? QChar(val) : QChar('.');
+    }
+    return text;
+  }
+
+  // Addresses that have never been set read as zero, but are shown as such
+  const int addr = rowAddr + index.column();
+  switch (role)
+  {
+  case Qt::DisplayRole:
+    return m_contents.isSet(addr) ? QString("%1").arg(m_contents.at(addr), 2, 16, QChar('0')).toUpper() : QString("--");
+  case Qt::EditRole:
+    return QString("%1").arg(m_contents.at(addr), 2, 16, QChar('0')).toUpper();
+  case Qt::BackgroundRole:
+    if (m_diff[addr])
+    {
+      return QColor(255, 190, 190);
+    }
+    if (m_heat[addr] > 0)
+    {
+      return QColor(255, 255, 255 - m_heat[addr]);
+    }
+    return QVariant();
+  case Qt::ToolTipRole:
+    return QString("0x%1").arg(addr, 4, 16, QChar('0'));
+  default:
+    return QVariant();
+  }
+}
+
+QVariant HexMemoryModel::headerData(int section, Qt::Orientation orientation, int role) const
+{
+  if (role != Qt::DisplayRole)
+  {
+    return QVariant();
+  }
+  if (orientation == Qt::Vertical)
+  {
+    return QString("%1").arg(section * BYTES_PER_ROW, 4, 16, QChar('0')).toUpper();
+  }
+  return (section == ASCII_COLUMN) ? QString("ASCII") : QString("%1").arg(section, 0, 16).toUpper();
+}
+
+Qt::ItemFlags HexMemoryModel::flags(const QModelIndex& index) const
+{
+  Qt::ItemFlags flags = QAbstractTableModel::flags(index);
+  if (index.isValid() && (index.column() != ASCII_COLUMN))
+  {
+    flags |= Qt::ItemIsEditable;
+  }
+  return flags;
+}
+
+bool HexMemoryModel::setData(const QModelIndex& index, const QVariant& value, int role)
+{
+  if ((role != Qt::EditRole) || !index.isValid() || (index.column() == ASCII_COLUMN))
+  {
+    return false;
+  }
+
+  bool ok = false;
+  const unsigned val = value.toString().toUInt(&ok, 16);
+  if (!ok || (val > 0xff))
+  {
+    return false;
+  }
+  emit byteEdited((index.row() * BYTES_PER_ROW) + index.column(), val);
+  return true;
+}
+
+/**
+ * Replaces the displayed memory contents, telling the view about only the
+ * rows that actually changed.
+ */
+void HexMemoryModel::setContents(const MemoryImage& contents)
+{
+  int first = -1;
+  int last = -1;
+  for (int addr = 0; addr < MemoryImage::SIZE; addr++)
+  {
+    if ((contents.isSet(addr) != m_contents.isSet(addr)) || (contents.at(addr) != m_contents.at(addr)))
+    {
+      const int row = addr / BYTES_PER_ROW;
+      first = (first < 0) ? row : first;
+      last = row;
+    }
+  }
+  m_contents = contents;
+  emitRowsChanged(first, last);
+}
+
+/**
+ * Highlights the addresses in the bitmap (one bit per address) and fades the
+ * highlight of those that were read earlier. Called once per refresh.
+ */
+void HexMemoryModel::markReads(const std::vector<uint32_t>& reads)
+{
+  int first = -1;
+  int last = -1;
+  for (int addr = 0; addr < MemoryImage::SIZE; addr++)
+  {
+    const bool read = (static_cast<size_t>(addr / 32) < reads.size()) && (reads[addr / 32] & (1u << (addr % 32)));
+    const uint8_t heat = read ? HEAT_MAX : ((m_heat[addr] > HEAT_STEP) ? (m_heat[addr] - HEAT_STEP) : 0);
+    if (heat != m_heat[addr])
+    {
+      m_heat[addr] = heat;
+      const int row = addr / BYTES_PER_ROW;
+      first = (first < 0) ? row : first;
+      last = row;
+    }
+  }
+  emitRowsChanged(first, last);
+}
+
+/**
+ * Marks the addresses that differ from a compared dump (or clears the marks,
+ * given an empty set).
+ */
+void HexMemoryModel::setDiff(const std::bitset<MemoryImage::SIZE>& diff)
+{
+  m_diff = diff;
+  emitRowsChanged(0, rowCount() - 1);
+}
+
+void HexMemoryModel::emitRowsChanged(int first, int last)
+{
+  if (first >= 0)
+  {
+    emit dataChanged(index(first, 0), index(last, columnCount() - 1));
+  }
+}
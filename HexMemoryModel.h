@@ -0,0 +1,53 @@
+#pragma once
+#include <bitset>
+#include <cstdint>
+#include <vector>
+#include <QAbstractTableModel>
+#include "MemoryImage.h"
+
+/**
+ * Table model for the memory editor: one row per 16 bytes of the 64 KiB RAM
+ * space, with a column per byte and one for the bytes as ASCII. The view
+ * only asks for the rows that are on screen, so refreshing the whole space
+ * costs no more than refreshing a page of it.
+ *
+ * Bytes that WSDC32 has just read are highlighted, fading out over the next
+ * few refreshes, and bytes that differ from a compared dump are marked.
+ * Edits aren't applied here but reported with byteEdited(); they show up
+ * once the simulator's RAM is next copied in.
+ */
+class HexMemoryModel : public QAbstractTableModel
+{
+  Q_OBJECT
+
+public:
+  static constexpr int BYTES_PER_ROW = 16;
+  static constexpr int ASCII_COLUMN = BYTES_PER_ROW;
+
+  explicit HexMemoryModel(QObject* parent = nullptr);
+
+  int rowCount(const QModelIndex& parent = QModelIndex()) const override;
+  int columnCount(const QModelIndex& parent = QModelIndex()) const override;
+  QVariant data(const QModelIndex& index, int role = Qt::DisplayRole) const override;
+  QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const override;
+  Qt::ItemFlags flags(const QModelIndex& index) const override;
+  bool setData(const QModelIndex& index, const QVariant& value, int role = Qt::EditRole) override;
+
+  const MemoryImage& contents() const { return m_contents; }
+  void setContents(const MemoryImage& contents);
+  void markReads(const std::vector<uint32_t>& reads);
+  void setDiff(const std::bitset<MemoryImage::SIZE>& diff);
+
+signals:
+  void byteEdited(uint16_t addr, uint8_t val);
+
+private:
+  static constexpr uint8_t HEAT_MAX = 200;
+  static constexpr uint8_t HEAT_STEP = 40;
+
+  MemoryImage m_contents;
+  std::vector<uint8_t> m_heat;
+  std::bitset<MemoryImage::SIZE> m_diff;
+
+  void emitRowsChanged(int first, int last);
+};
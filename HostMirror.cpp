@@ -0,0 +1,345 @@
+#include "HostMirror.h"
+#include <string.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+
+static QString childDir(const QString& dir, const QString& name)
+{
+  return (dir == "/") ? ("/" + name) : (dir + "/" + name);
+}
+
+HostMirror::HostMirror(const QString& root) :
+  m_root(QDir::cleanPath(root))
+{
+  if (QFileInfo(m_root).isDir())
+  {
+    m_inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    scanDir("/");
+    m_valid = true;
+  }
+}
+
+HostMirror::~HostMirror()
+{
+  if (m_inotifyFd >= 0)
+  {
+    ::close(m_inotifyFd);
+  }
+}
+
+QString HostMirror::hostPath(const QString& dir, const QString& file) const
+{
+  return QDir::cleanPath(m_root + "/" + dir + "/" + file);
+}
+
+/**
+ * Records the size of every file in the given directory and its children,
+ * and starts watching each directory for changes.
+ */
+void HostMirror::scanDir(const QString& dir)
+{
+  const QString path = hostPath(dir);
+  if (m_inotifyFd >= 0)
+  {
+    const int wd = inotify_add_watch(m_inotifyFd, path.toLocal8Bit().constData(),
+      IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO);
+    if (wd >= 0)
+    {
+      m_watches[wd] = dir;
+    }
+  }
+
+  const QDir hostDir(path);
+  QMap<QString,Entry>& files = m_index[dir];
+  foreach (QString name, hostDir.entryList(QDir::Files))
+  {
+    Entry& entry = files[name];
+    entry.exists = true;
+    entry.size = QFileInfo(hostDir.filePath(name)).size();
+  }
+
+  foreach (QString name, hostDir.entryList(QDir::Dirs | QDir::NoDotAndDotDot))
+  {
+    scanDir(childDir(dir, name));
+  }
+}
+
+/**
+ * Marks every file in the given directory and its children as gone, after
+ * the directory has been removed or moved away on the host.
+ */
+void HostMirror::removeDir(const QString& dir)
+{
+  for (auto files = m_index.begin(); files != m_index.end(); ++files)
+  {
+    if ((files.key() == dir) || files.key().startsWith(dir + "/"))
+    {
+      for (auto entry = files.value().begin(); entry != files.value().end(); ++entry)
+      {
+        if (!entry.value().dirty)
+        {
+          entry.value().exists = false;
+          entry.value().size = 0;
+        }
+      }
+    }
+  }
+}
+
+HostMirror::Entry* HostMirror::findEntry(const QString& dir, const QString& file)
+{
+  auto files = m_index.find(dir);
+  if (files != m_index.end())
+  {
+    auto entry = files.value().find(file);
+    if (entry != files.value().end())
+    {
+      return &entry.value();
+    }
+  }
+  return nullptr;
+}
+
+/**
+ * Refreshes the size of a file after it has been changed on the host. If the
+ * file is currently open, its contents are left alone until it is closed, so
+ * that a transfer in progress sees a consistent copy. A file that is being
+ * written by WSDC32 is not touched; the upload wins when it is closed.
+ */
+void HostMirror::updateEntry(const QString& dir, const QString& file)
+{
+  Entry& entry = m_index[dir][file];
+  if (!entry.dirty)
+  {
+    const QFileInfo info(hostPath(dir, file));
+    entry.exists = info.isFile();
+    entry.size = entry.exists ? info.size() : 0;
+  }
+}
+
+/**
+ * Reads the named file from the host, if it hasn't been already, and returns
+ * its contents. Returns null if there is no such file.
+ */
+const QVector<quint8>* HostMirror::open(const QString& dir, const QString& file)
+{
+  Entry* entry = findEntry(dir, file);
+  if (!entry || !entry->exists)
+  {
+    return nullptr;
+  }
+
+  if (!entry->loaded)
+  {
+    QFile hostFile(hostPath(dir, file));
+    if (!hostFile.open(QIODevice::ReadOnly))
+    {
+      return nullptr;
+    }
+    const QByteArray data = hostFile.readAll();
+    entry->contents.resize(data.size());
+    memcpy(entry->contents.data(), data.constData(), data.size());
+    entry->size = data.size();
+    entry->loaded = true;
+  }
+
+  return &entry->contents;
+}
+
+/**
+ * Creates (or truncates) the named file in memory and returns it for writing.
+ * Nothing is written to the host until the file is closed.
+ */
+QVector<quint8>* HostMirror::create(const QString& dir, const QString& file)
+{
+  Entry& entry = m_index[dir][file];
+  entry.exists = true;
+  entry.loaded = true;
+  entry.dirty = true;
+  entry.contents.clear();
+  return &entry.contents;
+}
+
+/**
+ * Closes the named file, writing it back to the host if it was written, and
+ * releases its contents from memory. Returns false if the write-back failed.
+ */
+bool HostMirror::close(const QString& dir, const QString& file)
+{
+  bool status = true;
+  Entry* entry = findEntry(dir, file);
+  if (!entry)
+  {
+    return status;
+  }
+
+  if (entry->dirty)
+  {
+    QDir().mkpath(hostPath(dir));
+    QFile hostFile(hostPath(dir, file));
+    status = hostFile.open(QIODevice::WriteOnly | QIODevice::Truncate) &&
+             (hostFile.write(reinterpret_cast<const char*>(entry->contents.constData()), entry->contents.size()) ==
+              entry->contents.size());
+    entry->size = entry->contents.size();
+    entry->dirty = false;
+  }
+
+  entry->contents = QVector<quint8>();
+  entry->loaded = false;
+  return status;
+}
+
+bool HostMirror::contains(const QString& dir, const QString& file) const
+{
+  auto files = m_index.constFind(dir);
+  if (files != m_index.constEnd())
+  {
+    auto entry = files.value().constFind(file);
+    return (entry != files.value().constEnd()) && entry.value().exists;
+  }
+  return false;
+}
+
+/**
+ * Adds the name and size of each file in the given directory to the map.
+ */
+void HostMirror::list(const QString& dir, QMap<QString,uint32_t>& entries) const
+{
+  auto files = m_index.constFind(dir);
+  if (files != m_index.constEnd())
+  {
+    for (auto entry = files.value().constBegin(); entry != files.value().constEnd(); ++entry)
+    {
+      if (entry.value().exists)
+      {
+        entries.insert(entry.key(), entry.value().loaded ? entry.value().contents.size() : entry.value().size);
+      }
+    }
+  }
+}
+
+/**
+ * Adds the contents of every file to the map, reading them from the host as
+ * needed. This is used when saving state, and may be slow for a large tree;
+ * so that it can be done on another thread, the files that would have to be
+ * read can instead be added to a list, to be passed to readPending().
+ */
+void HostMirror::exportTo(FileContentsMap& files, QVector<PendingFile>* pending) const
+{
+  QVector<PendingFile> unread;
+  for (auto dir = m_index.constBegin(); dir != m_index.constEnd(); ++dir)
+  {
+    for (auto entry = dir.value().constBegin(); entry != dir.value().constEnd(); ++entry)
+    {
+      if (entry.value().loaded)
+      {
+        files[dir.key()][entry.key()] = entry.value().contents;
+      }
+      else if (entry.value().exists)
+      {
+        unread.append({ dir.key(), entry.key(), hostPath(dir.key(), entry.key()) });
+      }
+    }
+  }
+
+  if (pending)
+  {
+    *pending += unread;
+  }
+  else
+  {
+    readPending(files, unread);
+  }
+}
+
+/**
+ * Reads the files that exportTo() left on the host into the map. This
+ * doesn't touch the mirror, so it can be called from any thread.
+ */
+void HostMirror::readPending(FileContentsMap& files, const QVector<PendingFile>& pending)
+{
+  for (const PendingFile& file : pending)
+  {
+    QFile hostFile(file.hostPath);
+    if (hostFile.open(QIODevice::ReadOnly))
+    {
+      const QByteArray data = hostFile.readAll();
+      QVector<quint8>& contents = files[file.dir][file.file];
+      contents.resize(data.size());
+      memcpy(contents.data(), data.constData(), data.size());
+    }
+  }
+}
+
+int HostMirror::fileCount() const
+{
+  int count = 0;
+  for (auto files = m_index.constBegin(); files != m_index.constEnd(); ++files)
+  {
+    for (auto entry = files.value().constBegin(); entry != files.value().constEnd(); ++entry)
+    {
+      count += entry.value().exists ? 1 : 0;
+    }
+  }
+  return count;
+}
+
+/**
+ * Applies any changes made on the host since the last call. This never
+ * blocks. Returns the number of files and directories that changed.
+ */
+int HostMirror::pollChanges()
+{
+  int changes = 0;
+  if (m_inotifyFd < 0)
+  {
+    return changes;
+  }
+
+  alignas(struct inotify_event) char buf[4096];
+  ssize_t len = 0;
+  while ((len = read(m_inotifyFd, buf, sizeof(buf))) > 0)
+  {
+    const struct inotify_event* event = nullptr;
+    for (char* ptr = buf; ptr < buf + len; ptr += sizeof(struct inotify_event) + event->len)
+    {
+      event = reinterpret_cast<const struct inotify_event*>(ptr);
+      if (event->mask & IN_IGNORED)
+      {
+        m_watches.remove(event->wd);
+        continue;
+      }
+
+      auto watch = m_watches.constFind(event->wd);
+      if ((watch == m_watches.constEnd()) || (event->len == 0))
+      {
+        continue;
+      }
+
+      const QString dir = watch.value();
+      const QString name = QString::fromLocal8Bit(event->name);
+      if (event->mask & IN_ISDIR)
+      {
+        if (event->mask & (IN_CREATE | IN_MOVED_TO))
+        {
+          scanDir(childDir(dir, name));
+        }
+        else if (event->mask & (IN_DELETE | IN_MOVED_FROM))
+        {
+          removeDir(childDir(dir, name));
+        }
+      }
+      else
+      {
+        updateEntry(dir, name);
+      }
+      changes++;
+    }
+  }
+
+  return changes;
+}
+
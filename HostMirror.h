@@ -0,0 +1,73 @@
+#pragma once
+#include <cstdint>
+#include <QMap>
+#include <QString>
+#include <QVector>
+#include "EcuDatabase.h"
+
+/**
+ * Maps a directory tree on the host to the Tester's filesystem, so that its
+ * contents can be inspected and edited with ordinary tools. A Tester path
+ * such as /FN0/ecu/BMOT0090.ECU corresponds to <root>/FN0/ecu/BMOT0090.ECU.
+ *
+ * Only the directory structure and file sizes are held in memory up front;
+ * file contents are read from the host when a file is opened, and released
+ * again when it is closed. Files written by WSDC32 are written back to the
+ * host when closed.
+ *
+ * Changes made on the host side are tracked with inotify. The inotify
+ * descriptor is non-blocking, and is only read when pollChanges() is called,
+ * so this class is not thread-safe and must be used from a single thread.
+ */
+class HostMirror
+{
+public:
+  // A file that exportTo() has left to be read from the host later
+  struct PendingFile
+  {
+    QString dir;
+    QString file;
+    QString hostPath;
+  };
+
+  explicit HostMirror(const QString& root);
+  ~HostMirror();
+  HostMirror(const HostMirror&) = delete;
+  HostMirror& operator=(const HostMirror&) = delete;
+
+  bool isValid() const { return m_valid; }
+  const QString& root() const { return m_root; }
+
+  const QVector<quint8>* open(const QString& dir, const QString& file);
+  QVector<quint8>* create(const QString& dir, const QString& file);
+  bool close(const QString& dir, const QString& file);
+  bool contains(const QString& dir, const QString& file) const;
+  void list(const QString& dir, QMap<QString,uint32_t>& entries) const;
+  void exportTo(FileContentsMap& files, QVector<PendingFile>* pending = nullptr) const;
+  static void readPending(FileContentsMap& files, const QVector<PendingFile>& pending);
+  int fileCount() const;
+  int pollChanges();
+
+private:
+  struct Entry
+  {
+    uint32_t size = 0;
+    bool exists = true;
+    bool loaded = false;
+    bool dirty = false;
+    QVector<quint8> contents;
+  };
+
+  QString m_root;
+  bool m_valid = false;
+  int m_inotifyFd = -1;
+  QMap<int,QString> m_watches;
+  QMap<QString,QMap<QString,Entry>> m_index;
+
+  QString hostPath(const QString& dir, const QString& file = QString()) const;
+  void scanDir(const QString& dir);
+  void updateEntry(const QString& dir, const QString& file);
+  void removeDir(const QString& dir);
+  Entry* findEntry(const QString& dir, const QString& file);
+};
+
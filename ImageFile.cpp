@@ -0,0 +1,463 @@
+#include "ImageFile.h"
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <thread>
+#include <QByteArray>
+#include <QDataStream>
+#include <QFile>
+#include <QSaveFile>
+#include <QtEndian>
+
+namespace
+{
+// Magic (4), version (2), reserved (2), index size (4), index digest (8)
+constexpr int HEADER_SIZE = 20;
+
+constexpr uint64_t PRIME1 = 11400714785074694791ULL;
+constexpr uint64_t PRIME2 = 14029467366897019727ULL;
+constexpr uint64_t PRIME3 = 1609587929392839161ULL;
+constexpr uint64_t PRIME4 = 9650029242287828579ULL;
+constexpr uint64_t PRIME5 = 2870177450012600261ULL;
+
+inline uint64_t rotl(uint64_t val, int bits)
+{
+  return (val << bits) | (val >> (64 - bits));
+}
+
+inline uint64_t hashRound(uint64_t acc, uint64_t input)
+{
+  return rotl(acc + input * PRIME2, 31) * PRIME1;
+}
+
+inline uint64_t mergeRound(uint64_t acc, uint64_t val)
+{
+  return (acc ^ hashRound(0, val)) * PRIME1 + PRIME4;
+}
+
+// The number of images that are open at once while reading a batch
+constexpr int MAX_OPEN_IMAGES = 64;
+
+/**
+ * An image's file, mapped into memory (or read into a buffer if it can't be
+ * mapped). It is released as soon as all of the image's files have been
+ * hashed, counted down by pendingJobs.
+ */
+struct Source
+{
+  QFile file;
+  QByteArray buffer;
+  const uchar* data = nullptr;
+  qint64 size = 0;
+  std::atomic<size_t> pendingJobs { 0 };
+};
+
+/**
+ * The contents of one file in a version 2 image, to be checked against its
+ * hash (and copied out, if the image is being loaded).
+ */
+struct FileJob
+{
+  size_t image;
+  Source* source;
+  QString dir;
+  QString name;
+  const uchar* data;
+  uint32_t size;
+  uint64_t hash;
+  bool ok;
+  QVector<quint8> content;
+};
+
+/**
+ * Calls fn for each index from 0 to count - 1, on as many threads as there
+ * are cores. Each thread claims the next unclaimed index as soon as it's done
+ * with the last one, so a thread that finishes early takes on work that the
+ * others haven't reached yet rather than sitting idle.
+ */
+void parallelFor(size_t count, const std::function<void(size_t)>& fn)
+{
+  const size_t threadCount = std::min<size_t>(count, std::max(1u, std::thread::hardware_concurrency()));
+  std::atomic<size_t> next { 0 };
+  auto worker = [&next, count, &fn]()
+  {
+    size_t i = 0;
+    while ((i = next.fetch_add(1, std::memory_order_relaxed)) < count)
+    {
+      fn(i);
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < threadCount; i++)
+  {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (std::thread& thread : threads)
+  {
+    thread.join();
+  }
+}
+
+/**
+ * Reads a version 1 image, which is nothing but a serialized map.
+ */
+void readVersion1(const Source& source, ImageFile::Result& result)
+{
+  const QByteArray raw = QByteArray::fromRawData(reinterpret_cast<const char*>(source.data), source.size);
+  QDataStream in(raw);
+  in >> result.contents;
+  result.version = 1;
+  if (in.status() != QDataStream::Ok)
+  {
+    result.error = "Truncated or malformed";
+  }
+  else if (!in.atEnd())
+  {
+    result.error = "Unexpected data after the end of the image";
+  }
+}
+
+/**
+ * Checks a version 2 image's header and index, and adds a job for each file
+ * whose contents are present. Files that are cut short by the end of the
+ * image are added as already corrupt.
+ */
+void readVersion2Index(const Source& source, size_t image, ImageFile::Result& result, std::vector<FileJob>& jobs)
+{
+  result.version = 2;
+  if (source.size < HEADER_SIZE)
+  {
+    result.error = "Truncated header";
+    return;
+  }
+
+  const uchar* data = source.data;
+  const uint16_t version = qFromBigEndian<quint16>(data + 4);
+  const uint32_t indexSize = qFromBigEndian<quint32>(data + 8);
+  if (version != ImageFile::VERSION)
+  {
+    result.error = QString("Unsupported version %1").arg(version);
+    return;
+  }
+  if (HEADER_SIZE + static_cast<qint64>(indexSize) > source.size)
+  {
+    result.error = "Truncated index";
+    return;
+  }
+  if (ImageFile::hash(data + HEADER_SIZE, indexSize) != qFromBigEndian<quint64>(data + 12))
+  {
+    result.error = "Index doesn't match its digest";
+    return;
+  }
+
+  const uchar* index = data + HEADER_SIZE;
+  uint32_t pos = 0;
+  bool ok = true;
+  auto number = [index, indexSize, &pos, &ok](int size)
+  {
+    uint64_t val = 0;
+    ok = ok && (pos + size <= indexSize);
+    for (int i = 0; ok && (i < size); i++)
+    {
+      val = (val << 8) | index[pos++];
+    }
+    return val;
+  };
+  auto name = [index, indexSize, &pos, &ok, &number]()
+  {
+    const uint32_t len = number(2);
+    ok = ok && (pos + len <= indexSize);
+    const QString str = ok ? QString::fromUtf8(reinterpret_cast<const char*>(index + pos), len) : QString();
+    pos += ok ? len : 0;
+    return str;
+  };
+
+  uint64_t offset = HEADER_SIZE + indexSize;
+  const uint32_t dirCount = number(4);
+  for (uint32_t i = 0; ok && (i < dirCount); i++)
+  {
+    const QString dir = name();
+    const uint32_t fileCount = number(4);
+    result.contents[dir];
+    for (uint32_t j = 0; ok && (j < fileCount); j++)
+    {
+      FileJob job;
+      job.image = image;
+      job.source = nullptr;
+      job.dir = dir;
+      job.name = name();
+      job.size = number(4);
+      job.hash = number(8);
+      job.ok = (offset + job.size <= static_cast<uint64_t>(source.size));
+      job.data = job.ok ? (data + offset) : nullptr;
+      offset += job.size;
+      if (ok)
+      {
+        jobs.push_back(job);
+      }
+    }
+  }
+
+  if (!ok || (pos != indexSize))
+  {
+    result.error = "Malformed index";
+  }
+  else if (offset > static_cast<uint64_t>(source.size))
+  {
+    result.error = QString("Truncated (%1 of %2 bytes)").arg(source.size).arg(offset);
+  }
+  else if (offset < static_cast<uint64_t>(source.size))
+  {
+    result.error = QString("%1 bytes of unexpected data after the end of the image").arg(source.size - offset);
+  }
+}
+}
+
+/**
+ * Returns the XXH64 hash (with a seed of zero) of the given bytes.
+ */
+uint64_t ImageFile::hash(const void* data, size_t len)
+{
+  const uchar* p = static_cast<const uchar*>(data);
+  const uchar* const end = p + len;
+  uint64_t h = 0;
+
+  if (len >= 32)
+  {
+    uint64_t v1 = PRIME1 + PRIME2;
+    uint64_t v2 = PRIME2;
+    uint64_t v3 = 0;
+    uint64_t v4 = -PRIME1;
+    for (; p + 32 <= end; p += 32)
+    {
+      v1 = hashRound(v1, qFromLittleEndian<quint64>(p));
+      v2 = hashRound(v2, qFromLittleEndian<quint64>(p + 8));
+      v3 = hashRound(v3, qFromLittleEndian<quint64>(p + 16));
+      v4 = hashRound(v4, qFromLittleEndian<quint64>(p + 24));
+    }
+    h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+    h = mergeRound(h, v1);
+    h = mergeRound(h, v2);
+    h = mergeRound(h, v3);
+    h = mergeRound(h, v4);
+  }
+  else
+  {
+    h = PRIME5;
+  }
+
+  h += len;
+  for (; p + 8 <= end; p += 8)
+  {
+    h = rotl(h ^ hashRound(0, qFromLittleEndian<quint64>(p)), 27) * PRIME1 + PRIME4;
+  }
+  if (p + 4 <= end)
+  {
+    h = rotl(h ^ (qFromLittleEndian<quint32>(p) * PRIME1), 23) * PRIME2 + PRIME3;
+    p += 4;
+  }
+  for (; p < end; p++)
+  {
+    h = rotl(h ^ (*p * PRIME5), 11) * PRIME1;
+  }
+
+  h ^= h >> 33;
+  h *= PRIME2;
+  h ^= h >> 29;
+  h *= PRIME3;
+  h ^= h >> 32;
+  return h;
+}
+
+/**
+ * Reads and checks a single image. See readAll().
+ */
+ImageFile::Result ImageFile::read(const QString& filename)
+{
+  return readAll(QStringList { filename }).front();
+}
+
+/**
+ * Reads and checks a number of images in parallel, returning a result for
+ * each, in the same order. An image is ok only if it was read in full and
+ * (for version 2) its index and every file's contents match their hashes.
+ * The contents are kept only for images that are ok, and only if asked for;
+ * verifying a library of images doesn't need them.
+ *
+ * The images are read MAX_OPEN_IMAGES at a time, and each one is closed as
+ * soon as it has been checked, so that a large library doesn't run out of
+ * file descriptors or address space.
+ */
+std::vector<ImageFile::Result> ImageFile::readAll(const QStringList& filenames, bool keepContents)
+{
+  std::vector<Result> results(filenames.size());
+  for (int first = 0; first < filenames.size(); first += MAX_OPEN_IMAGES)
+  {
+    const int count = std::min<int>(MAX_OPEN_IMAGES, filenames.size() - first);
+
+    // Open each image and check its header and index (or, for version 1,
+    // parse all of it)
+    std::vector<std::unique_ptr<Source>> sources(count);
+    std::vector<std::vector<FileJob>> imageJobs(count);
+    parallelFor(count, [&filenames, &results, &sources, &imageJobs, first](size_t i)
+    {
+      Result& result = results[first + i];
+      std::unique_ptr<Source>& source = sources[i];
+      source = std::make_unique<Source>();
+      result.filename = filenames[first + i];
+      source->file.setFileName(result.filename);
+      if (!source->file.open(QIODevice::ReadOnly))
+      {
+        result.error = "Unable to open";
+        source.reset();
+        return;
+      }
+
+      source->size = source->file.size();
+      source->data = source->file.map(0, source->size);
+      if (!source->data)
+      {
+        source->buffer = source->file.readAll();
+        source->data = reinterpret_cast<const uchar*>(source->buffer.constData());
+      }
+      result.size = source->size;
+
+      if ((source->size >= 4) && (qFromBigEndian<quint32>(source->data) == MAGIC))
+      {
+        readVersion2Index(*source, first + i, result, imageJobs[i]);
+      }
+      else
+      {
+        readVersion1(*source, result);
+      }
+
+      for (FileJob& job : imageJobs[i])
+      {
+        job.source = source.get();
+      }
+      source->pendingJobs = imageJobs[i].size();
+      if (imageJobs[i].empty())
+      {
+        source.reset();
+      }
+    });
+
+    // Hash (and copy out) every file of every image, largest first, so that
+    // no thread is left with a large file at the end while the others are
+    // idle. The last of an image's files to be done releases the image.
+    std::vector<FileJob> jobs;
+    for (std::vector<FileJob>& image : imageJobs)
+    {
+      std::move(image.begin(), image.end(), std::back_inserter(jobs));
+    }
+    std::sort(jobs.begin(), jobs.end(), [](const FileJob& a, const FileJob& b) { return a.size > b.size; });
+    parallelFor(jobs.size(), [&jobs, &sources, keepContents, first](size_t i)
+    {
+      FileJob& job = jobs[i];
+      job.ok = job.ok && (hash(job.data, job.size) == job.hash);
+      if (job.ok && keepContents)
+      {
+        job.content.resize(job.size);
+        memcpy(job.content.data(), job.data, job.size);
+      }
+      job.data = nullptr;
+      if (job.source->pendingJobs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+      {
+        sources[job.image - first].reset();
+      }
+    });
+
+    for (FileJob& job : jobs)
+    {
+      Result& result = results[job.image];
+      if (!job.ok)
+      {
+        result.corruptFiles.append(QString("%1/%2").arg(job.dir).arg(job.name));
+      }
+      else if (keepContents)
+      {
+        result.contents[job.dir][job.name] = job.content;
+      }
+    }
+  }
+
+  for (Result& result : results)
+  {
+    result.corruptFiles.sort();
+    if (result.error.isEmpty() && !result.corruptFiles.isEmpty())
+    {
+      result.error = QString("%1 corrupt files").arg(result.corruptFiles.size());
+    }
+    result.ok = result.error.isEmpty();
+    if (!result.ok || !keepContents)
+    {
+      result.contents.clear();
+    }
+  }
+  return results;
+}
+
+/**
+ * Writes an image in the current version. The file is replaced only once it
+ * has been written in full.
+ */
+bool ImageFile::write(const QString& filename, const FileContentsMap& contents)
+{
+  auto appendNumber = [](QByteArray& out, uint64_t val, int size)
+  {
+    for (int i = size - 1; i >= 0; i--)
+    {
+      out.append(static_cast<char>(val >> (i * 8)));
+    }
+  };
+  auto appendName = [&appendNumber](QByteArray& out, const QString& name)
+  {
+    const QByteArray utf8 = name.toUtf8();
+    appendNumber(out, utf8.size(), 2);
+    out.append(utf8);
+    return utf8.size() <= 0xffff;
+  };
+
+  QByteArray index;
+  bool ok = true;
+  appendNumber(index, contents.size(), 4);
+  for (auto dir = contents.constBegin(); dir != contents.constEnd(); ++dir)
+  {
+    ok = appendName(index, dir.key()) && ok;
+    appendNumber(index, dir.value().size(), 4);
+    for (auto file = dir.value().constBegin(); file != dir.value().constEnd(); ++file)
+    {
+      ok = appendName(index, file.key()) && ok;
+      appendNumber(index, file.value().size(), 4);
+      appendNumber(index, hash(file.value().constData(), file.value().size()), 8);
+    }
+  }
+
+  QByteArray header;
+  appendNumber(header, MAGIC, 4);
+  appendNumber(header, VERSION, 2);
+  appendNumber(header, 0, 2);
+  appendNumber(header, index.size(), 4);
+  appendNumber(header, hash(index.constData(), index.size()), 8);
+
+  QSaveFile outfile(filename);
+  if (!ok || !outfile.open(QIODevice::WriteOnly))
+  {
+    return false;
+  }
+  outfile.write(header);
+  outfile.write(index);
+  for (auto dir = contents.constBegin(); dir != contents.constEnd(); ++dir)
+  {
+    for (auto file = dir.value().constBegin(); file != dir.value().constEnd(); ++file)
+    {
+      outfile.write(reinterpret_cast<const char*>(file.value().constData()), file.value().size());
+    }
+  }
+  return outfile.commit();
+}
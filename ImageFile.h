@@ -0,0 +1,46 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <QString>
+#include <QStringList>
+#include "EcuDatabase.h"
+
+/**
+ * Reads and writes saved Tester filesystem images (.sd2).
+ *
+ * Version 1 images are a FileContentsMap written with QDataStream, and carry
+ * nothing to check them against. Version 2 images start with a header and an
+ * index of every directory and file, giving each file's size and a 64-bit
+ * hash (XXH64) of its contents, followed by the contents themselves. The
+ * header holds a digest of the index, so that it covers every name, size and
+ * content hash in the image; the hashes of individual files then show which
+ * of them are corrupt. Both versions are read, and images are always saved as
+ * version 2.
+ *
+ * Several images are read at once by spreading the work across all cores:
+ * each image's index is checked on one thread, and then the contents of all
+ * the images' files are hashed and copied in parallel.
+ */
+class ImageFile
+{
+public:
+  static constexpr uint32_t MAGIC = 0x53443249; // "SD2I"
+  static constexpr uint16_t VERSION = 2;
+
+  struct Result
+  {
+    QString filename;
+    int version = 0;
+    qint64 size = 0;
+    bool ok = false;
+    QString error;
+    QStringList corruptFiles; // as "<dir>/<file>"
+    FileContentsMap contents;
+  };
+
+  static Result read(const QString& filename);
+  static std::vector<Result> readAll(const QStringList& filenames, bool keepContents = true);
+  static bool write(const QString& filename, const FileContentsMap& contents);
+  static uint64_t hash(const void* data, size_t len);
+};
@@ -0,0 +1,540 @@
+#include "LearnedResponses.h"
+#include "ReplyFrame.h"
+#include <algorithm>
+#include <map>
+#include <QDataStream>
+#include <QFile>
+#include <QStringList>
+#include <QTextStream>
+
+constexpr quint32 LEARNED_MAGIC = 0x5344324C; // "SD2L"
+constexpr quint16 LEARNED_VERSION = 1;
+
+// A byte position is only taken to be a counter or checksum if the pattern
+// holds across at least this many frames
+constexpr int MIN_PATTERN_SAMPLES = 3;
+
+// Checksums are looked for starting at each of these positions (the first
+// byte after the command, status, or block length)
+constexpr int FIRST_CHECKSUM_START = 7;
+constexpr int LAST_CHECKSUM_START = 10;
+
+static int frameSize(const uint8_t* frame)
+{
+  return ((frame[1] << 8) | frame[2]) + 1;
+}
+
+static uint8_t byteAt(const QByteArray& bytes, int pos)
+{
+  return static_cast<uint8_t>(bytes[pos]);
+}
+
+static uint8_t sum8(const uint8_t* bytes, int start, int end)
+{
+  uint8_t sum = 0;
+  for (int i = start; i < end; i++)
+  {
+    sum += bytes[i];
+  }
+  return sum;
+}
+
+/**
+ * Parses one line of a capture into an SD2 frame. Returns an empty array if
+ * the line isn't a complete frame.
+ */
+static QByteArray parseFrame(const QString& line)
+{
+  QString text = line.trimmed();
+  if (text.startsWith('['))
+  {
+    text = text.mid(text.indexOf(']') + 1);
+  }
+
+  QByteArray frame;
+  for (const QString& token : text.simplified().split(' '))
+  {
+    bool ok = false;
+    const uint32_t val = token.toUInt(&ok, 16);
+    if (!ok || (token.size() != 2))
+    {
+      return QByteArray();
+    }
+    frame.append(static_cast<char>(val));
+  }
+
+  if ((frame.size() < 7) ||
+      ((byteAt(frame, 0) != 0x50) && (byteAt(frame, 0) != 0x54)) ||
+      (frameSize(reinterpret_cast<const uint8_t*>(frame.constData())) != frame.size()))
+  {
+    return QByteArray();
+  }
+  return frame;
+}
+
+/**
+ * Reads the request/reply pairs for ECU commands (slow init, ISO keyword,
+ * and protocol blocks) out of a capture.
+ */
+bool LearnedResponses::readCapture(const QString& path, std::vector<Exchange>& exchanges)
+{
+  QFile file(path);
+  if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+  {
+    return false;
+  }
+
+  std::map<uint8_t,uint16_t> pipeEcus;
+  std::map<uint8_t,QByteArray> pendingRequests;
+  QTextStream in(&file);
+  while (!in.atEnd())
+  {
+    const QByteArray frame = parseFrame(in.readLine());
+    if (frame.isEmpty())
+    {
+      continue;
+    }
+
+    const uint8_t pipe = byteAt(frame, 5);
+    const uint8_t cmd = byteAt(frame, 6);
+    if (byteAt(frame, 0) == 0x50)
+    {
+      if ((cmd == 0x0B) && (frame.size() >= 10))
+      {
+        pipeEcus[byteAt(frame, 9)] = (byteAt(frame, 7) * 0x100) + byteAt(frame, 8);
+      }
+      else if ((cmd >= 0x11) && (cmd <= 0x13) && pipeEcus.count(pipe))
+      {
+        pendingRequests[pipe] = frame;
+      }
+    }
+    else if (pendingRequests.count(pipe) && (byteAt(pendingRequests[pipe], 6) == cmd))
+    {
+      exchanges.push_back({ pipeEcus[pipe], pendingRequests[pipe], frame });
+      pendingRequests.erase(pipe);
+    }
+  }
+
+  return true;
+}
+
+bool LearnedResponses::Model::operator==(const Model& other) const
+{
+  return (requestCounterPos == other.requestCounterPos) &&
+         (replyCounterPos == other.replyCounterPos) &&
+         (replyCounterDelta == other.replyCounterDelta) &&
+         (requestChecksumStart == other.requestChecksumStart) &&
+         (replyChecksumStart == other.replyChecksumStart);
+}
+
+/**
+ * Finds the first position at which consecutive frames step by the same
+ * (nonzero) amount most of the time, returning that amount in step.
+ */
+static int findCounter(const std::vector<const QByteArray*>& frames, uint8_t& step)
+{
+  int maxSize = 0;
+  for (const QByteArray* frame : frames)
+  {
+    maxSize = std::max(maxSize, static_cast<int>(frame->size()));
+  }
+
+  for (int pos = 7; pos < maxSize; pos++)
+  {
+    int diffCounts[0x100] = {};
+    int pairs = 0;
+    for (size_t i = 1; i < frames.size(); i++)
+    {
+      if ((frames[i - 1]->size() > pos) && (frames[i]->size() > pos))
+      {
+        diffCounts[static_cast<uint8_t>(byteAt(*frames[i], pos) - byteAt(*frames[i - 1], pos))]++;
+        pairs++;
+      }
+    }
+
+    const int* best = std::max_element(diffCounts + 1, diffCounts + 0x100);
+    if ((pairs >= MIN_PATTERN_SAMPLES) && (*best * 4 >= pairs * 3))
+    {
+      step = best - diffCounts;
+      return pos;
+    }
+  }
+  return -1;
+}
+
+/**
+ * Finds the start of the range of bytes whose 8-bit sum is stored in the
+ * last byte of every frame (that is long enough to have one).
+ */
+static int findChecksum(const std::vector<const QByteArray*>& frames, int counterPos)
+{
+  for (int start = FIRST_CHECKSUM_START; start <= LAST_CHECKSUM_START; start++)
+  {
+    int samples = 0;
+    int matches = 0;
+    for (const QByteArray* frame : frames)
+    {
+      if (frame->size() - start >= 3)
+      {
+        const uint8_t* bytes = reinterpret_cast<const uint8_t*>(frame->constData());
+        samples++;
+        matches += (sum8(bytes, start, frame->size() - 1) == bytes[frame->size() - 1]) ? 1 : 0;
+      }
+    }
+
+    // A checksum that doesn't cover the counter would be constant, and
+    // matching on it is harmless, so only accept one that covers it
+    if ((samples >= MIN_PATTERN_SAMPLES) && (matches == samples) && ((counterPos < 0) || (counterPos >= start)))
+    {
+      return start;
+    }
+  }
+  return -1;
+}
+
+/**
+ * Works out where the counters and checksums are in one ECU's frames, from
+ * the exchanges (in the order in which they were captured). Anything that
+ * can't be determined from this capture is carried over from the previous
+ * model.
+ */
+LearnedResponses::Model LearnedResponses::inferModel(const std::vector<const Exchange*>& exchanges, const Model& previous)
+{
+  std::vector<const QByteArray*> requests;
+  std::vector<const QByteArray*> replies;
+  for (const Exchange* exchange : exchanges)
+  {
+    if (byteAt(exchange->request, 6) == 0x13)
+    {
+      requests.push_back(&exchange->request);
+      replies.push_back(&exchange->reply);
+    }
+  }
+
+  if (requests.size() <= MIN_PATTERN_SAMPLES)
+  {
+    return previous;
+  }
+
+  Model model;
+  uint8_t step = 0;
+  model.requestCounterPos = findCounter(requests, step);
+  if (model.requestCounterPos >= 0)
+  {
+    // Look for a reply byte that stays a fixed distance from the request counter
+    for (int pos = 7; (pos < 0x100) && (model.replyCounterPos < 0); pos++)
+    {
+      int diffCounts[0x100] = {};
+      int samples = 0;
+      for (size_t i = 0; i < requests.size(); i++)
+      {
+        if ((requests[i]->size() > model.requestCounterPos) && (replies[i]->size() > pos))
+        {
+          diffCounts[static_cast<uint8_t>(byteAt(*replies[i], pos) - byteAt(*requests[i], model.requestCounterPos))]++;
+          samples++;
+        }
+      }
+
+      const int* best = std::max_element(diffCounts, diffCounts + 0x100);
+      if ((samples >= MIN_PATTERN_SAMPLES) && (*best * 4 >= samples * 3))
+      {
+        model.replyCounterPos = pos;
+        model.replyCounterDelta = best - diffCounts;
+      }
+    }
+  }
+  else
+  {
+    model.replyCounterPos = findCounter(replies, model.replyCounterDelta);
+  }
+
+  model.requestChecksumStart = findChecksum(requests, model.requestCounterPos);
+  model.replyChecksumStart = findChecksum(replies, model.replyCounterPos);
+
+  const bool foundAnything = (model.requestCounterPos >= 0) || (model.replyCounterPos >= 0) ||
+                             (model.requestChecksumStart >= 0) || (model.replyChecksumStart >= 0);
+  return foundAnything ? model : previous;
+}
+
+/**
+ * Returns the bytes of a request (from position 06 on) that identify it, with
+ * its counter and checksum zeroed.
+ */
+QByteArray LearnedResponses::requestKey(const Model& model, const QByteArray& request)
+{
+  QByteArray key = request.mid(6);
+  if ((model.requestCounterPos >= 0) && (model.requestCounterPos < request.size()))
+  {
+    key[model.requestCounterPos - 6] = 0;
+  }
+  if ((model.requestChecksumStart >= 0) && (request.size() - model.requestChecksumStart >= 3))
+  {
+    key[key.size() - 1] = 0;
+  }
+  return key;
+}
+
+/**
+ * Returns a stored reply (from position 06 on) with its counter and checksum
+ * zeroed, for telling whether two replies actually differ.
+ */
+QByteArray LearnedResponses::maskedReply(const Model& model, const QByteArray& reply)
+{
+  QByteArray masked = reply;
+  if ((model.replyCounterPos >= 0) && (model.replyCounterPos - 6 < masked.size()))
+  {
+    masked[model.replyCounterPos - 6] = 0;
+  }
+  if ((model.replyChecksumStart >= 0) && (masked.size() + 6 - model.replyChecksumStart >= 3))
+  {
+    masked[masked.size() - 1] = 0;
+  }
+  return masked;
+}
+
+/**
+ * Returns the model that applies to frames with the given command byte. The
+ * counters and checksums are only inferred from (and so only apply to) cmd
+ * 0x13 frames; the keyword replies to cmd 0x11/0x12 are replayed as they
+ * were captured.
+ */
+const LearnedResponses::Model& LearnedResponses::modelFor(const EcuIndex& ecu, uint8_t cmd)
+{
+  static const Model none;
+  return (cmd == 0x13) ? ecu.model : none;
+}
+
+void LearnedResponses::addEntry(EcuIndex& ecu, const QByteArray& request, const QByteArray& reply)
+{
+  const Model& model = modelFor(ecu, byteAt(request, 6));
+  Entry& entry = ecu.entries[requestKey(model, request)];
+  if (entry.request.isEmpty())
+  {
+    entry.request = request;
+  }
+
+  const QByteArray masked = maskedReply(model, reply);
+  for (const QByteArray& existing : entry.replies)
+  {
+    if (maskedReply(model, existing) == masked)
+    {
+      return;
+    }
+  }
+  if (entry.replies.size() < MAX_REPLIES_PER_REQUEST)
+  {
+    entry.replies.append(reply);
+  }
+}
+
+/**
+ * Rebuilds an ECU's index after its model has changed, since the keys (and
+ * which replies count as duplicates) depend on it.
+ */
+void LearnedResponses::rehash(EcuIndex& ecu)
+{
+  const QHash<QByteArray,Entry> oldEntries = ecu.entries;
+  ecu.entries.clear();
+  for (const Entry& entry : oldEntries)
+  {
+    for (const QByteArray& reply : entry.replies)
+    {
+      addEntry(ecu, entry.request, reply);
+    }
+  }
+}
+
+/**
+ * Adds the exchanges from a capture to the index. Returns the number of
+ * requests that weren't known before.
+ */
+int LearnedResponses::learn(const std::vector<Exchange>& exchanges)
+{
+  std::map<uint16_t,std::vector<const Exchange*>> byEcu;
+  for (const Exchange& exchange : exchanges)
+  {
+    byEcu[exchange.ecuId].push_back(&exchange);
+  }
+
+  int added = 0;
+  for (const auto& ecuExchanges : byEcu)
+  {
+    EcuIndex& ecu = m_ecus[ecuExchanges.first];
+    const Model model = inferModel(ecuExchanges.second, ecu.model);
+    if (!(model == ecu.model))
+    {
+      ecu.model = model;
+      rehash(ecu);
+    }
+
+    const int before = ecu.entries.size();
+    for (const Exchange* exchange : ecuExchanges.second)
+    {
+      addEntry(ecu, exchange->request, exchange->reply.mid(6));
+    }
+    added += ecu.entries.size() - before;
+  }
+
+  return added;
+}
+
+/**
+ * Fills in the reply to a request for the given ECU, if a matching request
+ * was learned. The counter and checksum in the reply are regenerated to suit
+ * the request.
+ */
+bool LearnedResponses::respond(int ecuId, const uint8_t* request, ReplyFrame& outbuf)
+{
+  auto ecuIt = m_ecus.find(ecuId);
+  if (ecuIt == m_ecus.end())
+  {
+    return false;
+  }
+
+  EcuIndex& ecu = *ecuIt;
+  const Model& model = modelFor(ecu, request[6]);
+  const int requestSize = frameSize(request);
+  const QByteArray requestBytes(reinterpret_cast<const char*>(request), requestSize);
+  auto entryIt = ecu.entries.find(requestKey(model, requestBytes));
+  if ((entryIt == ecu.entries.end()) || entryIt->replies.isEmpty())
+  {
+    return false;
+  }
+
+  Entry& entry = *entryIt;
+  const QByteArray& reply = entry.replies[entry.next];
+  entry.next = (entry.next + 1) % entry.replies.size();
+
+  const int replySize = reply.size() + 6;
+  outbuf.setLength(replySize - 1);
+  outbuf.put(6, reply.constData(), reply.size());
+
+  if ((model.replyCounterPos >= 0) && (model.replyCounterPos < replySize))
+  {
+    uint8_t counter = outbuf[model.replyCounterPos];
+    if (model.requestCounterPos >= 0)
+    {
+      if (model.requestCounterPos < requestSize)
+      {
+        counter = request[model.requestCounterPos] + model.replyCounterDelta;
+      }
+    }
+    else if (ecu.lastReplyCounter >= 0)
+    {
+      counter = ecu.lastReplyCounter + model.replyCounterDelta;
+    }
+    outbuf[model.replyCounterPos] = counter;
+    ecu.lastReplyCounter = counter;
+  }
+
+  if ((model.replyChecksumStart >= 0) && (replySize - model.replyChecksumStart >= 3))
+  {
+    uint8_t checksum = 0;
+    for (int i = model.replyChecksumStart; i < replySize - 1; i++)
+    {
+      checksum += outbuf[i];
+    }
+    outbuf[replySize - 1] = checksum;
+  }
+
+  return true;
+}
+
+int LearnedResponses::size() const
+{
+  int count = 0;
+  for (const EcuIndex& ecu : m_ecus)
+  {
+    count += ecu.entries.size();
+  }
+  return count;
+}
+
+bool LearnedResponses::load(const QString& path)
+{
+  QFile infile(path);
+  if (!infile.open(QIODevice::ReadOnly))
+  {
+    return false;
+  }
+
+  QDataStream in(&infile);
+  quint32 magic = 0;
+  quint16 version = 0;
+  quint32 ecuCount = 0;
+  in >> magic >> version >> ecuCount;
+  if ((magic != LEARNED_MAGIC) || (version != LEARNED_VERSION))
+  {
+    return false;
+  }
+
+  QHash<uint16_t,EcuIndex> ecus;
+  for (quint32 i = 0; (i < ecuCount) && (in.status() == QDataStream::Ok); i++)
+  {
+    quint16 ecuId = 0;
+    qint16 requestCounterPos = 0;
+    qint16 replyCounterPos = 0;
+    quint8 replyCounterDelta = 0;
+    qint16 requestChecksumStart = 0;
+    qint16 replyChecksumStart = 0;
+    quint32 entryCount = 0;
+    in >> ecuId >> requestCounterPos >> replyCounterPos >> replyCounterDelta
+       >> requestChecksumStart >> replyChecksumStart >> entryCount;
+
+    EcuIndex& ecu = ecus[ecuId];
+    ecu.model.requestCounterPos = requestCounterPos;
+    ecu.model.replyCounterPos = replyCounterPos;
+    ecu.model.replyCounterDelta = replyCounterDelta;
+    ecu.model.requestChecksumStart = requestChecksumStart;
+    ecu.model.replyChecksumStart = replyChecksumStart;
+
+    for (quint32 j = 0; (j < entryCount) && (in.status() == QDataStream::Ok); j++)
+    {
+      QByteArray request;
+      QVector<QByteArray> replies;
+      in >> request >> replies;
+      if (request.size() >= 7)
+      {
+        for (const QByteArray& reply : replies)
+        {
+          addEntry(ecu, request, reply);
+        }
+      }
+    }
+  }
+
+  if (in.status() != QDataStream::Ok)
+  {
+    return false;
+  }
+  m_ecus = ecus;
+  return true;
+}
+
+bool LearnedResponses::save(const QString& path) const
+{
+  QFile outfile(path);
+  if (!outfile.open(QIODevice::WriteOnly))
+  {
+    return false;
+  }
+
+  QDataStream out(&outfile);
+  out << LEARNED_MAGIC << LEARNED_VERSION << static_cast<quint32>(m_ecus.size());
+  for (auto it = m_ecus.constBegin(); it != m_ecus.constEnd(); ++it)
+  {
+    const Model& model = it->model;
+    out << static_cast<quint16>(it.key())
+        << static_cast<qint16>(model.requestCounterPos) << static_cast<qint16>(model.replyCounterPos)
+        << static_cast<quint8>(model.replyCounterDelta)
+        << static_cast<qint16>(model.requestChecksumStart) << static_cast<qint16>(model.replyChecksumStart)
+        << static_cast<quint32>(it->entries.size());
+    for (const Entry& entry : it->entries)
+    {
+      out << entry.request << entry.replies;
+    }
+  }
+
+  return (out.status() == QDataStream::Ok);
+}
+
@@ -0,0 +1,101 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <QByteArray>
+#include <QHash>
+#include <QString>
+#include <QVector>
+
+class ReplyFrame;
+
+/**
+ * Request-to-response index for ECUs whose protocol the simulator doesn't
+ * know, learned from captures of sessions between WSDC32 and a real Tester.
+ *
+ * A capture is a text file of SD2 frames, one per line, as hex bytes
+ * (optionally preceded by a bracketed timestamp, as in the simulator's own
+ * log). Requests (0x50) are paired with the Tester's replies (0x54) on the
+ * same pipe, and the ECU on each pipe is tracked from the cmd 0x0B requests
+ * that start its application thread.
+ *
+ * For each ECU, the cmd 0x13 frames in the capture are also examined for a
+ * rolling block counter in the requests and replies and for an 8-bit
+ * additive checksum at the end of the frames. In cmd 0x13 frames, those
+ * bytes are treated as wildcards when matching requests, and are regenerated
+ * in the replies, so that a reply recorded once can be replayed in a session
+ * whose counters are in a different place. Keyword replies (cmd 0x11/0x12)
+ * are replayed exactly as captured. When the same request was seen with
+ * several different replies, they are replayed in turn.
+ *
+ * Lookups are a hash of the masked request, per ECU ID.
+ */
+class LearnedResponses
+{
+public:
+  /** A request frame and the Tester's reply to it, for one ECU. */
+  struct Exchange
+  {
+    uint16_t ecuId;
+    QByteArray request;
+    QByteArray reply;
+  };
+
+  static bool readCapture(const QString& path, std::vector<Exchange>& exchanges);
+
+  int learn(const std::vector<Exchange>& exchanges);
+  bool respond(int ecuId, const uint8_t* request, ReplyFrame& outbuf);
+  bool knows(int ecuId) const { return m_ecus.contains(ecuId); }
+  int ecuCount() const { return m_ecus.size(); }
+  int size() const;
+
+  bool load(const QString& path);
+  bool save(const QString& path) const;
+
+private:
+  static constexpr int MAX_REPLIES_PER_REQUEST = 64;
+
+  /**
+   * Where the volatile bytes are in this ECU's frames. Positions are indexes
+   * into the SD2 frame, and are -1 if not present.
+   */
+  struct Model
+  {
+    int requestCounterPos = -1;
+    int replyCounterPos = -1;
+
+    // The reply counter is the request counter plus this, if the request has
+    // a counter; otherwise it advances by this much on every reply
+    uint8_t replyCounterDelta = 0;
+
+    // Checksums are the sum of the bytes from this position up to (but not
+    // including) the final byte of the frame, which holds the checksum
+    int requestChecksumStart = -1;
+    int replyChecksumStart = -1;
+
+    bool operator==(const Model& other) const;
+  };
+
+  struct Entry
+  {
+    QByteArray request;
+    QVector<QByteArray> replies; // from position 06 onward
+    int next = 0;
+  };
+
+  struct EcuIndex
+  {
+    Model model;
+    int lastReplyCounter = -1;
+    QHash<QByteArray,Entry> entries;
+  };
+
+  QHash<uint16_t,EcuIndex> m_ecus;
+
+  static Model inferModel(const std::vector<const Exchange*>& exchanges, const Model& previous);
+  static const Model& modelFor(const EcuIndex& ecu, uint8_t cmd);
+  static QByteArray requestKey(const Model& model, const QByteArray& request);
+  static QByteArray maskedReply(const Model& model, const QByteArray& reply);
+  static void addEntry(EcuIndex& ecu, const QByteArray& request, const QByteArray& reply);
+  static void rehash(EcuIndex& ecu);
+};
+
@@ -0,0 +1,149 @@
+#include "LogBuffer.h"
+#include <algorithm>
+#include <chrono>
+
+LogBuffer::LogBuffer()
+{
+  m_frames.reserve(MAX_PENDING_FRAMES);
+  m_frameBytes.reserve(MAX_PENDING_FRAME_BYTES);
+  m_takenFrames.reserve(MAX_PENDING_FRAMES);
+  m_takenFrameBytes.reserve(MAX_PENDING_FRAME_BYTES);
+}
+
+qint64 LogBuffer::now()
+{
+  const auto sinceEpoch = std::chrono::system_clock::now().time_since_epoch();
+  return std::chrono::duration_cast<std::chrono::milliseconds>(sinceEpoch).count();
+}
+
+bool LogBuffer::isEmpty() const
+{
+  return m_pending.entries.isEmpty() && m_frames.empty() && (m_pending.leadingDots == 0) &&
+         (m_pending.repeats == 0) && (m_pending.dropped == 0);
+}
+
+/**
+ * Adds a line, stamped with the current time. Returns true if the buffer was
+ * empty, i.e. the GUI needs to be told that there is something to collect.
+ */
+bool LogBuffer::add(const QString& line)
+{
+  const qint64 timeMs = now();
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  const bool wasEmpty = isEmpty();
+  if (m_pending.entries.size() >= MAX_PENDING)
+  {
+    m_pending.entries.remove(0, MAX_PENDING / 2);
+    m_pending.dropped += MAX_PENDING / 2;
+    for (RawFrame& frame : m_frames)
+    {
+      frame.linePos = std::max(0, frame.linePos - (MAX_PENDING / 2));
+    }
+  }
+  m_pending.entries.append(Entry { timeMs, line, 0 });
+  return wasEmpty;
+}
+
+/**
+ * Adds a frame, which will be shown as a line of hex bytes. This doesn't
+ * allocate: if the space reserved for frames is full, the frame is dropped.
+ */
+bool LogBuffer::addFrame(const uint8_t* frame, int len)
+{
+  const qint64 timeMs = now();
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  const bool wasEmpty = isEmpty();
+  if ((m_frames.size() >= MAX_PENDING_FRAMES) ||
+      (m_frameBytes.size() + len > MAX_PENDING_FRAME_BYTES))
+  {
+    m_pending.dropped++;
+  }
+  else
+  {
+    m_frames.push_back(RawFrame { timeMs, static_cast<int>(m_pending.entries.size()), static_cast<int>(m_frameBytes.size()), len, 0 });
+    m_frameBytes.insert(m_frameBytes.end(), frame, frame + len);
+  }
+  return wasEmpty;
+}
+
+/**
+ * Appends a progress dot to the most recent line.
+ */
+bool LogBuffer::addDot()
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  const bool wasEmpty = isEmpty();
+  if (!m_frames.empty() && (m_frames.back().linePos == m_pending.entries.size()))
+  {
+    m_frames.back().dots++;
+  }
+  else if (m_pending.entries.isEmpty())
+  {
+    m_pending.leadingDots++;
+  }
+  else
+  {
+    m_pending.entries.last().dots++;
+  }
+  return wasEmpty;
+}
+
+/**
+ * Counts a repeat of the last packet.
+ */
+bool LogBuffer::addRepeat()
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  const bool wasEmpty = isEmpty();
+  m_pending.repeats++;
+  return wasEmpty;
+}
+
+/**
+ * Removes and returns everything that has been added since the last call,
+ * with the frames formatted and put in order among the lines. Must only be
+ * called by one thread.
+ */
+LogBuffer::Batch LogBuffer::take()
+{
+  Batch batch;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::swap(batch, m_pending);
+    m_frames.swap(m_takenFrames);
+    m_frameBytes.swap(m_takenFrameBytes);
+  }
+
+  if (!m_takenFrames.empty())
+  {
+    QVector<Entry> merged;
+    merged.reserve(batch.entries.size() + m_takenFrames.size());
+    int line = 0;
+    for (const RawFrame& frame : m_takenFrames)
+    {
+      while (line < frame.linePos)
+      {
+        merged.append(batch.entries[line++]);
+      }
+
+      QString text;
+      text.reserve(frame.len * 3);
+      for (int i = 0; i < frame.len; i++)
+      {
+        text += QString("%1 ").arg(m_takenFrameBytes[frame.offset + i], 2, 16, QChar('0'));
+      }
+      merged.append(Entry { frame.timeMs, text, frame.dots });
+    }
+    while (line < batch.entries.size())
+    {
+      merged.append(batch.entries[line++]);
+    }
+    batch.entries.swap(merged);
+
+    m_takenFrames.clear();
+    m_takenFrameBytes.clear();
+  }
+  return batch;
+}
@@ -0,0 +1,78 @@
+#pragma once
+#include <cstdint>
+#include <mutex>
+#include <vector>
+#include <QString>
+#include <QVector>
+
+/**
+ * Holds log output from the simulator until the GUI collects it. Any thread
+ * may add to the buffer; the GUI takes everything that has accumulated in
+ * one batch. Adding reports whether the buffer was empty beforehand, so that
+ * the producer only needs to notify the GUI once per batch rather than once
+ * per line.
+ *
+ * Besides whole lines, the buffer counts the things that used to be sent as
+ * their own signals: repeats of the last packet (which drive the heartbeat
+ * bar) and consecutive file writes (which append a dot to the last line).
+ * If the GUI falls behind, the oldest pending lines are dropped and counted.
+ *
+ * Frames are logged as raw bytes into space that is allocated up front, and
+ * only formatted as text when the GUI takes them, so that logging the frames
+ * of a polling session doesn't allocate on the protocol thread. If that space
+ * fills up before the GUI takes it, further frames are dropped and counted.
+ */
+class LogBuffer
+{
+public:
+  struct Entry
+  {
+    qint64 timeMs;
+    QString text;
+    int dots;
+  };
+
+  struct Batch
+  {
+    QVector<Entry> entries;
+    int leadingDots = 0; // dots for the last line of the previous batch
+    int repeats = 0;
+    int dropped = 0;
+  };
+
+  LogBuffer();
+
+  bool add(const QString& line);
+  bool addFrame(const uint8_t* frame, int len);
+  bool addDot();
+  bool addRepeat();
+  Batch take();
+
+private:
+  static constexpr int MAX_PENDING = 20000;
+  static constexpr int MAX_PENDING_FRAMES = 8192;
+  static constexpr int MAX_PENDING_FRAME_BYTES = 1024 * 1024;
+
+  struct RawFrame
+  {
+    qint64 timeMs;
+    int linePos; // number of lines that were pending before this frame
+    int offset;
+    int len;
+    int dots;
+  };
+
+  std::mutex m_mutex;
+  Batch m_pending;
+  std::vector<RawFrame> m_frames;
+  std::vector<uint8_t> m_frameBytes;
+
+  // Swapped with the above by take(), so that neither set has to be
+  // allocated again; only used by the thread that takes the log
+  std::vector<RawFrame> m_takenFrames;
+  std::vector<uint8_t> m_takenFrameBytes;
+
+  bool isEmpty() const;
+  static qint64 now();
+};
+
@@ -0,0 +1,84 @@
+#include "LogModel.h"
+#include <algorithm>
+
+LogModel::LogModel(int capacity, QObject* parent) :
+  QAbstractListModel(parent),
+  m_lines(capacity),
+  m_capacity(capacity)
+{
+}
+
+int LogModel::rowCount(const QModelIndex& parent) const
+{
+  return parent.isValid() ? 0 : m_count;
+}
+
+QVariant LogModel::data(const QModelIndex& index, int role) const
+{
+  if ((role != Qt::DisplayRole) || !index.isValid() || (index.row() >= m_count))
+  {
+    return QVariant();
+  }
+  return format(at(index.row()));
+}
+
+/**
+ * Formats a line as it's shown in the view (and echoed to stdout).
+ */
+QString LogModel::format(const LogBuffer::Entry& entry)
+{
+  QString line = QString("[%1] %2").arg(entry.timeMs / 1000.0, 0, 'f', 3).arg(entry.text);
+  if (entry.dots > 0)
+  {
+    line += QString(entry.dots, QChar('.'));
+  }
+  return line;
+}
+
+/**
+ * Adds a batch of lines to the end of the log, evicting the oldest lines as
+ * necessary to stay within capacity.
+ */
+void LogModel::append(const LogBuffer::Batch& batch)
+{
+  if ((batch.leadingDots > 0) && (m_count > 0))
+  {
+    at(m_count - 1).dots += batch.leadingDots;
+    const QModelIndex last = index(m_count - 1);
+    emit dataChanged(last, last);
+  }
+
+  QVector<LogBuffer::Entry> added;
+  if (batch.dropped > 0)
+  {
+    added.append(LogBuffer::Entry { batch.entries.isEmpty() ? 0 : batch.entries.first().timeMs,
+                                    QString("(%1 lines dropped)").arg(batch.dropped), 0 });
+  }
+  added += batch.entries;
+
+  // Only the newest lines of an oversized batch are kept
+  const int skip = std::max(0, added.size() - m_capacity);
+  const int numNew = added.size() - skip;
+  if (numNew == 0)
+  {
+    return;
+  }
+
+  const int numEvicted = std::max(0, m_count + numNew - m_capacity);
+  if (numEvicted > 0)
+  {
+    beginRemoveRows(QModelIndex(), 0, numEvicted - 1);
+    m_first = (m_first + numEvicted) % m_capacity;
+    m_count -= numEvicted;
+    endRemoveRows();
+  }
+
+  beginInsertRows(QModelIndex(), m_count, m_count + numNew - 1);
+  for (int i = 0; i < numNew; i++)
+  {
+    at(m_count + i) = added[skip + i];
+  }
+  m_count += numNew;
+  endInsertRows();
+}
+
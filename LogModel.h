@@ -0,0 +1,35 @@
+#pragma once
+#include <QAbstractListModel>
+#include <QVector>
+#include "LogBuffer.h"
+
+/**
+ * List model for the log view, holding the most recent lines in a ring
+ * buffer of fixed capacity. Once it's full, each new line evicts the oldest,
+ * so memory use stays flat however long the session runs. Lines are added in
+ * batches, with one insertion (and at most one removal) per batch, so that
+ * the view only has to lay out the rows that are actually visible.
+ */
+class LogModel : public QAbstractListModel
+{
+  Q_OBJECT
+
+public:
+  explicit LogModel(int capacity, QObject* parent = nullptr);
+
+  int rowCount(const QModelIndex& parent = QModelIndex()) const override;
+  QVariant data(const QModelIndex& index, int role = Qt::DisplayRole) const override;
+
+  void append(const LogBuffer::Batch& batch);
+  static QString format(const LogBuffer::Entry& entry);
+
+private:
+  QVector<LogBuffer::Entry> m_lines;
+  int m_capacity;
+  int m_first = 0;
+  int m_count = 0;
+
+  LogBuffer::Entry& at(int row) { return m_lines[(m_first + row) % m_capacity]; }
+  const LogBuffer::Entry& at(int row) const { return m_lines[(m_first + row) % m_capacity]; }
+};
+
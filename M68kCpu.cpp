@@ -0,0 +1,1614 @@
+#include "M68kCpu.h"
+#include <cstdio>
+#include <utility>
+
+M68kCpu::Handler M68kCpu::s_handlers[0x10000];
+
+static inline uint32_t sizeMask(int size)
+{
+  return (size == 1) ? 0xff : (size == 2) ? 0xffff : 0xffffffff;
+}
+
+static inline uint32_t sizeMsb(int size)
+{
+  return (size == 1) ? 0x80 : (size == 2) ? 0x8000 : 0x80000000;
+}
+
+static inline int32_t signExtend(uint32_t val, int size)
+{
+  return (size == 1) ? static_cast<int8_t>(val) : (size == 2) ? static_cast<int16_t>(val) : static_cast<int32_t>(val);
+}
+
+/**
+ * Returns the operand size (in bytes) from bits 6-7 of the opcode, as used by
+ * most instructions.
+ */
+static inline int standardSize(uint16_t op)
+{
+  return 1 << ((op >> 6) & 3);
+}
+
+M68kCpu::M68kCpu(uint32_t memorySize) :
+  m_mem(memorySize, 0)
+{
+  static const bool tablesBuilt = (buildTables(), true);
+  (void)tablesBuilt;
+  reset();
+}
+
+void M68kCpu::buildTables()
+{
+  for (uint32_t op = 0; op < 0x10000; op++)
+  {
+    s_handlers[op] = decode(op);
+  }
+}
+
+/**
+ * Clears the registers. Memory is left as it is.
+ */
+void M68kCpu::reset()
+{
+  for (int i = 0; i < 8; i++)
+  {
+    m_d[i] = 0;
+    m_a[i] = 0;
+  }
+  m_pc = 0;
+  m_x = m_n = m_z = m_v = m_c = false;
+  m_status = Status::Stopped;
+  m_faultMessage.clear();
+  m_instructionCount = 0;
+}
+
+void M68kCpu::fault(const std::string& message)
+{
+  if (m_status != Status::Fault)
+  {
+    char location[32];
+    snprintf(location, sizeof(location), " at PC %08X", m_insnStart);
+    m_faultMessage = message + location;
+    m_status = Status::Fault;
+  }
+}
+
+/**
+ * Executes instructions until the given number have been run, or until a
+ * host call blocks or stops, or a fault occurs. Execution can be resumed
+ * with another call unless it faulted.
+ */
+M68kCpu::Status M68kCpu::run(uint64_t maxInstructions)
+{
+  if (m_status == Status::Fault)
+  {
+    return m_status;
+  }
+
+  m_status = Status::Running;
+  uint64_t executed = 0;
+  while ((m_status == Status::Running) && (executed < maxInstructions))
+  {
+    if (m_pc >= HOST_CALL_BASE)
+    {
+      callHost();
+      continue;
+    }
+
+    m_insnStart = m_pc;
+    const uint16_t op = fetch16();
+    if (m_status != Status::Running)
+    {
+      break;
+    }
+    s_handlers[op](*this, op);
+    executed++;
+  }
+
+  m_instructionCount += executed;
+  return m_status;
+}
+
+bool M68kCpu::callHost()
+{
+  m_insnStart = m_pc;
+  if (!m_hostCall)
+  {
+    fault("Host call with no handler");
+    return false;
+  }
+
+  switch (m_hostCall(*this, (m_pc - HOST_CALL_BASE) / 2))
+  {
+  case HostResult::Return:
+    m_pc = pop32();
+    break;
+  case HostResult::Block:
+    if (m_status == Status::Running)
+    {
+      m_status = Status::Blocked;
+    }
+    break;
+  case HostResult::Stop:
+    if (m_status == Status::Running)
+    {
+      m_status = Status::Stopped;
+    }
+    break;
+  }
+  return (m_status == Status::Running);
+}
+
+uint8_t* M68kCpu::memory(uint32_t addr, uint32_t len)
+{
+  if (static_cast<uint64_t>(addr) + len > m_mem.size())
+  {
+    return nullptr;
+  }
+  return m_mem.data() + addr;
+}
+
+uint8_t M68kCpu::read8(uint32_t addr)
+{
+  if (addr >= m_mem.size())
+  {
+    fault("Read outside of memory");
+    return 0;
+  }
+  return m_mem[addr];
+}
+
+uint16_t M68kCpu::read16(uint32_t addr)
+{
+  if (static_cast<uint64_t>(addr) + 2 > m_mem.size())
+  {
+    fault("Read outside of memory");
+    return 0;
+  }
+  return static_cast<uint16_t>((m_mem[addr] << 8) | m_mem[addr + 1]);
+}
+
+uint32_t M68kCpu::read32(uint32_t addr)
+{
+  if (static_cast<uint64_t>(addr) + 4 > m_mem.size())
+  {
+    fault("Read outside of memory");
+    return 0;
+  }
+  return (static_cast<uint32_t>(m_mem[addr]) << 24) | (static_cast<uint32_t>(m_mem[addr + 1]) << 16) |
+         (static_cast<uint32_t>(m_mem[addr + 2]) << 8) | m_mem[addr + 3];
+}
+
+void M68kCpu::write8(uint32_t addr, uint8_t val)
+{
+  if (addr >= m_mem.size())
+  {
+    fault("Write outside of memory");
+    return;
+  }
+  m_mem[addr] = val;
+}
+
+void M68kCpu::write16(uint32_t addr, uint16_t val)
+{
+  if (static_cast<uint64_t>(addr) + 2 > m_mem.size())
+  {
+    fault("Write outside of memory");
+    return;
+  }
+  m_mem[addr] = val >> 8;
+  m_mem[addr + 1] = val;
+}
+
+void M68kCpu::write32(uint32_t addr, uint32_t val)
+{
+  if (static_cast<uint64_t>(addr) + 4 > m_mem.size())
+  {
+    fault("Write outside of memory");
+    return;
+  }
+  m_mem[addr] = val >> 24;
+  m_mem[addr + 1] = val >> 16;
+  m_mem[addr + 2] = val >> 8;
+  m_mem[addr + 3] = val;
+}
+
+void M68kCpu::push32(uint32_t val)
+{
+  m_a[7] -= 4;
+  write32(m_a[7], val);
+}
+
+uint32_t M68kCpu::pop32()
+{
+  const uint32_t val = read32(m_a[7]);
+  m_a[7] += 4;
+  return val;
+}
+
+uint16_t M68kCpu::pop16()
+{
+  const uint16_t val = read16(m_a[7]);
+  m_a[7] += 2;
+  return val;
+}
+
+/**
+ * Returns the given 32-bit argument of a host call, which is made with the
+ * return address on top of the stack.
+ */
+uint32_t M68kCpu::stackArg(int index)
+{
+  return read32(m_a[7] + 4 + (index * 4));
+}
+
+uint16_t M68kCpu::fetch16()
+{
+  const uint16_t val = read16(m_pc);
+  m_pc += 2;
+  return val;
+}
+
+uint32_t M68kCpu::fetch32()
+{
+  const uint32_t val = read32(m_pc);
+  m_pc += 4;
+  return val;
+}
+
+/**
+ * Computes the address for the indexed addressing modes, in either the brief
+ * or (68020) full extension word format. The base is the address register or
+ * the address of the extension word.
+ */
+uint32_t M68kCpu::indexedAddress(uint32_t base)
+{
+  const uint16_t ext = fetch16();
+  const int indexReg = (ext >> 12) & 7;
+  uint32_t index = (ext & 0x8000) ? m_a[indexReg] : m_d[indexReg];
+  if (!(ext & 0x0800))
+  {
+    index = static_cast<int16_t>(index);
+  }
+  index <<= (ext >> 9) & 3;
+
+  if (!(ext & 0x0100))
+  {
+    return base + static_cast<int8_t>(ext & 0xff) + index;
+  }
+
+  if (ext & 0x0080)
+  {
+    base = 0;
+  }
+  if (ext & 0x0040)
+  {
+    index = 0;
+  }
+
+  uint32_t baseDisp = 0;
+  switch ((ext >> 4) & 3)
+  {
+  case 2:
+    baseDisp = static_cast<int16_t>(fetch16());
+    break;
+  case 3:
+    baseDisp = fetch32();
+    break;
+  case 0:
+    fault("Invalid extension word");
+    return 0;
+  }
+
+  const int indirect = ext & 7;
+  if (indirect == 0)
+  {
+    return base + baseDisp + index;
+  }
+
+  uint32_t outerDisp = 0;
+  if ((indirect & 3) == 2)
+  {
+    outerDisp = static_cast<int16_t>(fetch16());
+  }
+  else if ((indirect & 3) == 3)
+  {
+    outerDisp = fetch32();
+  }
+
+  if (indirect & 4)
+  {
+    // Post-indexed
+    return read32(base + baseDisp) + index + outerDisp;
+  }
+  return read32(base + baseDisp + index) + outerDisp;
+}
+
+M68kCpu::Operand M68kCpu::resolveEA(int mode, int reg, int size)
+{
+  switch (mode)
+  {
+  case 0:
+    return { OperandKind::DataReg, static_cast<uint32_t>(reg) };
+  case 1:
+    return { OperandKind::AddrReg, static_cast<uint32_t>(reg) };
+  case 2:
+    return { OperandKind::Memory, m_a[reg] };
+  case 3:
+  {
+    const uint32_t addr = m_a[reg];
+    m_a[reg] += ((size == 1) && (reg == 7)) ? 2 : size;
+    return { OperandKind::Memory, addr };
+  }
+  case 4:
+    m_a[reg] -= ((size == 1) && (reg == 7)) ? 2 : size;
+    return { OperandKind::Memory, m_a[reg] };
+  case 5:
+  {
+    const int16_t disp = fetch16();
+    return { OperandKind::Memory, m_a[reg] + disp };
+  }
+  case 6:
+    return { OperandKind::Memory, indexedAddress(m_a[reg]) };
+  default:
+    break;
+  }
+
+  switch (reg)
+  {
+  case 0:
+    return { OperandKind::Memory, static_cast<uint32_t>(static_cast<int16_t>(fetch16())) };
+  case 1:
+    return { OperandKind::Memory, fetch32() };
+  case 2:
+  {
+    const uint32_t base = m_pc;
+    const int16_t disp = fetch16();
+    return { OperandKind::Memory, base + disp };
+  }
+  case 3:
+    return { OperandKind::Memory, indexedAddress(m_pc) };
+  case 4:
+    if (size == 4)
+    {
+      return { OperandKind::Immediate, fetch32() };
+    }
+    return { OperandKind::Immediate, static_cast<uint32_t>(fetch16() & sizeMask(size)) };
+  default:
+    fault("Invalid addressing mode");
+    return { OperandKind::Immediate, 0 };
+  }
+}
+
+uint32_t M68kCpu::readOperand(const Operand& op, int size)
+{
+  switch (op.kind)
+  {
+  case OperandKind::DataReg:
+    return m_d[op.value] & sizeMask(size);
+  case OperandKind::AddrReg:
+    return m_a[op.value] & sizeMask(size);
+  case OperandKind::Memory:
+    return (size == 1) ? read8(op.value) : (size == 2) ? read16(op.value) : read32(op.value);
+  case OperandKind::Immediate:
+    break;
+  }
+  return op.value;
+}
+
+void M68kCpu::writeOperand(const Operand& op, int size, uint32_t val)
+{
+  switch (op.kind)
+  {
+  case OperandKind::DataReg:
+    m_d[op.value] = (m_d[op.value] & ~sizeMask(size)) | (val & sizeMask(size));
+    break;
+  case OperandKind::AddrReg:
+    m_a[op.value] = val;
+    break;
+  case OperandKind::Memory:
+    if (size == 1)
+    {
+      write8(op.value, val);
+    }
+    else if (size == 2)
+    {
+      write16(op.value, val);
+    }
+    else
+    {
+      write32(op.value, val);
+    }
+    break;
+  case OperandKind::Immediate:
+    fault("Write to immediate operand");
+    break;
+  }
+}
+
+uint32_t M68kCpu::readEA(int mode, int reg, int size)
+{
+  return readOperand(resolveEA(mode, reg, size), size);
+}
+
+uint16_t M68kCpu::ccr() const
+{
+  return (m_x ? 0x10 : 0) | (m_n ? 0x08 : 0) | (m_z ? 0x04 : 0) | (m_v ? 0x02 : 0) | (m_c ? 0x01 : 0);
+}
+
+void M68kCpu::setCCR(uint16_t val)
+{
+  m_x = val & 0x10;
+  m_n = val & 0x08;
+  m_z = val & 0x04;
+  m_v = val & 0x02;
+  m_c = val & 0x01;
+}
+
+bool M68kCpu::condition(int cc) const
+{
+  switch (cc)
+  {
+  case 0x0: return true;
+  case 0x1: return false;
+  case 0x2: return !m_c && !m_z;
+  case 0x3: return m_c || m_z;
+  case 0x4: return !m_c;
+  case 0x5: return m_c;
+  case 0x6: return !m_z;
+  case 0x7: return m_z;
+  case 0x8: return !m_v;
+  case 0x9: return m_v;
+  case 0xA: return !m_n;
+  case 0xB: return m_n;
+  case 0xC: return m_n == m_v;
+  case 0xD: return m_n != m_v;
+  case 0xE: return !m_z && (m_n == m_v);
+  default:  return m_z || (m_n != m_v);
+  }
+}
+
+void M68kCpu::setNZ(uint32_t result, int size)
+{
+  m_n = result & sizeMsb(size);
+  m_z = (result & sizeMask(size)) == 0;
+}
+
+void M68kCpu::setLogicFlags(uint32_t result, int size)
+{
+  setNZ(result, size);
+  m_v = false;
+  m_c = false;
+}
+
+uint32_t M68kCpu::add(uint32_t dst, uint32_t src, int size, bool withX)
+{
+  const uint32_t mask = sizeMask(size);
+  const uint64_t sum = static_cast<uint64_t>(dst & mask) + (src & mask) + ((withX && m_x) ? 1 : 0);
+  const uint32_t result = sum & mask;
+
+  m_c = m_x = (sum > mask);
+  m_v = (~(dst ^ src) & (dst ^ result) & sizeMsb(size)) != 0;
+  m_n = result & sizeMsb(size);
+  if (!withX || result)
+  {
+    m_z = (result == 0);
+  }
+  return result;
+}
+
+uint32_t M68kCpu::sub(uint32_t dst, uint32_t src, int size, bool withX, bool setX)
+{
+  const uint32_t mask = sizeMask(size);
+  const uint32_t borrowIn = (withX && m_x) ? 1 : 0;
+  const uint32_t result = ((dst & mask) - (src & mask) - borrowIn) & mask;
+
+  m_c = (static_cast<uint64_t>(src & mask) + borrowIn) > (dst & mask);
+  if (setX)
+  {
+    m_x = m_c;
+  }
+  m_v = ((dst ^ src) & (dst ^ result) & sizeMsb(size)) != 0;
+  m_n = result & sizeMsb(size);
+  if (!withX || result)
+  {
+    m_z = (result == 0);
+  }
+  return result;
+}
+
+/**
+ * Shifts or rotates a value by the given count, setting the flags. The type
+ * is as encoded in the opcode: 0 for arithmetic, 1 for logical, 2 for rotate
+ * through X, and 3 for rotate.
+ */
+uint32_t M68kCpu::shift(int type, bool left, uint32_t val, int count, int size)
+{
+  const uint32_t mask = sizeMask(size);
+  const uint32_t msb = sizeMsb(size);
+  val &= mask;
+  m_v = false;
+
+  if (count == 0)
+  {
+    m_c = (type == 2) ? m_x : false;
+    setNZ(val, size);
+    return val;
+  }
+
+  for (int i = 0; i < count; i++)
+  {
+    const bool out = left ? (val & msb) : (val & 1);
+    switch (type)
+    {
+    case 0:
+      if (left)
+      {
+        const uint32_t next = (val << 1) & mask;
+        m_v = m_v || ((next ^ val) & msb);
+        val = next;
+      }
+      else
+      {
+        val = (val >> 1) | (val & msb);
+      }
+      m_x = out;
+      break;
+    case 1:
+      val = left ? ((val << 1) & mask) : (val >> 1);
+      m_x = out;
+      break;
+    case 2:
+      val = left ? (((val << 1) & mask) | (m_x ? 1 : 0)) : ((val >> 1) | (m_x ? msb : 0));
+      m_x = out;
+      break;
+    default:
+      val = left ? (((val << 1) & mask) | (out ? 1 : 0)) : ((val >> 1) | (out ? msb : 0));
+      break;
+    }
+    m_c = out;
+  }
+
+  setNZ(val, size);
+  return val;
+}
+
+M68kCpu::Handler M68kCpu::decode(uint16_t op)
+{
+  const int mode = (op >> 3) & 7;
+  const int reg = op & 7;
+  const int size = (op >> 6) & 3;
+
+  switch (op >> 12)
+  {
+  case 0x0:
+    if ((op == 0x003C) || (op == 0x023C) || (op == 0x0A3C) || (op == 0x007C) || (op == 0x027C) || (op == 0x0A7C))
+    {
+      return opOriAndiEoriCCR;
+    }
+    if (op & 0x0100)
+    {
+      // MOVEP isn't supported
+      return (mode == 1) ? opUnimplemented : opBitDynamic;
+    }
+    if ((op & 0x0F00) == 0x0800)
+    {
+      return opBitStatic;
+    }
+    if (size == 3)
+    {
+      // CMP2, CHK2, CAS aren't supported
+      break;
+    }
+    switch (op & 0x0F00)
+    {
+    case 0x0000:
+    case 0x0200:
+    case 0x0400:
+    case 0x0600:
+    case 0x0A00:
+    case 0x0C00:
+      return opImmediate;
+    }
+    break;
+
+  case 0x1:
+  case 0x2:
+  case 0x3:
+    return (((op >> 6) & 7) == 1) ? opMovea : opMove;
+
+  case 0x4:
+    if ((op & 0xFFF8) == 0x49C0)
+    {
+      return opExt;
+    }
+    if ((op & 0x01C0) == 0x01C0)
+    {
+      return opLea;
+    }
+    if (((op & 0x01C0) == 0x0100) || ((op & 0x01C0) == 0x0180))
+    {
+      return opChk;
+    }
+    switch (op & 0x0F00)
+    {
+    case 0x0000:
+      return (size == 3) ? opMoveFromCCR : opNegx;
+    case 0x0200:
+      return (size == 3) ? opMoveFromCCR : opClr;
+    case 0x0400:
+      return (size == 3) ? opMoveToCCR : opNeg;
+    case 0x0600:
+      return (size == 3) ? opMoveToCCR : opNot;
+    case 0x0800:
+      if (size == 0)
+      {
+        // NBCD isn't supported
+        return (mode == 1) ? opLinkL : opUnimplemented;
+      }
+      if (size == 1)
+      {
+        // BKPT isn't supported
+        return (mode == 0) ? opSwap : (mode == 1) ? opUnimplemented : opPea;
+      }
+      return (mode == 0) ? opExt : opMovem;
+    case 0x0A00:
+      if (op == 0x4AFC)
+      {
+        break;
+      }
+      return (size == 3) ? opTas : opTst;
+    case 0x0C00:
+      return (size == 0) ? opMulL : (size == 1) ? opDivL : opMovem;
+    case 0x0E00:
+      if ((op & 0xFFF8) == 0x4E50)
+      {
+        return opLink;
+      }
+      if ((op & 0xFFF8) == 0x4E58)
+      {
+        return opUnlk;
+      }
+      if (op == 0x4E71)
+      {
+        return opNop;
+      }
+      if (op == 0x4E74)
+      {
+        return opRtd;
+      }
+      if (op == 0x4E75)
+      {
+        return opRts;
+      }
+      if (op == 0x4E77)
+      {
+        return opRtr;
+      }
+      if ((op & 0xFFC0) == 0x4E80)
+      {
+        return opJsr;
+      }
+      if ((op & 0xFFC0) == 0x4EC0)
+      {
+        return opJmp;
+      }
+      break;
+    }
+    break;
+
+  case 0x5:
+    if (size == 3)
+    {
+      if (mode == 1)
+      {
+        return opDbcc;
+      }
+      // TRAPcc isn't supported
+      return ((mode == 7) && (reg >= 2)) ? opUnimplemented : opScc;
+    }
+    return opAddqSubq;
+
+  case 0x6:
+    return opBcc;
+
+  case 0x7:
+    return (op & 0x0100) ? opUnimplemented : opMoveq;
+
+  case 0x8:
+    if (size == 3)
+    {
+      return opDivW;
+    }
+    // SBCD, PACK and UNPK aren't supported
+    if (((op & 0x01F0) == 0x0100) || ((op & 0x01F0) == 0x0140) || ((op & 0x01F0) == 0x0180))
+    {
+      break;
+    }
+    return opLogic;
+
+  case 0x9:
+  case 0xD:
+    if (size == 3)
+    {
+      return opAddaSuba;
+    }
+    return ((op & 0x0130) == 0x0100) ? opAddxSubx : opAddSub;
+
+  case 0xB:
+    if (size == 3)
+    {
+      return opCmpa;
+    }
+    if (op & 0x0100)
+    {
+      return (mode == 1) ? opCmpm : opEor;
+    }
+    return opCmp;
+
+  case 0xC:
+    if (size == 3)
+    {
+      return opMulW;
+    }
+    if (((op & 0x01F8) == 0x0140) || ((op & 0x01F8) == 0x0148) || ((op & 0x01F8) == 0x0188))
+    {
+      return opExg;
+    }
+    // ABCD isn't supported
+    if ((op & 0x01F0) == 0x0100)
+    {
+      break;
+    }
+    return opLogic;
+
+  case 0xE:
+    if (size == 3)
+    {
+      return (op & 0x0800) ? opBitfield : opShiftMem;
+    }
+    return opShiftReg;
+
+  default:
+    // A-line and F-line (coprocessor) instructions aren't supported
+    break;
+  }
+
+  return opUnimplemented;
+}
+
+void M68kCpu::opUnimplemented(M68kCpu& cpu, uint16_t op)
+{
+  char message[48];
+  snprintf(message, sizeof(message), "Unimplemented opcode %04X", op);
+  cpu.fault(message);
+}
+
+void M68kCpu::opOriAndiEoriCCR(M68kCpu& cpu, uint16_t op)
+{
+  // Only the condition codes are modelled, so the SR forms act on those too
+  const uint16_t imm = cpu.fetch16() & 0xff;
+  uint16_t ccr = cpu.ccr();
+  switch (op & 0x0F00)
+  {
+  case 0x0000:
+    ccr |= imm;
+    break;
+  case 0x0200:
+    ccr &= imm;
+    break;
+  default:
+    ccr ^= imm;
+    break;
+  }
+  cpu.setCCR(ccr);
+}
+
+void M68kCpu::opImmediate(M68kCpu& cpu, uint16_t op)
+{
+  const int size = standardSize(op);
+  const uint32_t imm = (size == 4) ? cpu.fetch32() : (cpu.fetch16() & sizeMask(size));
+  const Operand dst = cpu.resolveEA((op >> 3) & 7, op & 7, size);
+  const uint32_t val = cpu.readOperand(dst, size);
+  uint32_t result = 0;
+
+  switch (op & 0x0F00)
+  {
+  case 0x0000:
+    result = val | imm;
+    cpu.setLogicFlags(result, size);
+    break;
+  case 0x0200:
+    result = val & imm;
+    cpu.setLogicFlags(result, size);
+    break;
+  case 0x0400:
+    result = cpu.sub(val, imm, size, false, true);
+    break;
+  case 0x0600:
+    result = cpu.add(val, imm, size, false);
+    break;
+  case 0x0A00:
+    result = val ^ imm;
+    cpu.setLogicFlags(result, size);
+    break;
+  default:
+    cpu.sub(val, imm, size, false, false);
+    return;
+  }
+  cpu.writeOperand(dst, size, result);
+}
+
+/**
+ * Performs BTST, BCHG, BCLR, or BSET on the given bit of the destination,
+ * which is a long word in a data register or a byte in memory.
+ */
+void M68kCpu::bitOperation(uint16_t op, uint32_t bitNum)
+{
+  const int mode = (op >> 3) & 7;
+  const int size = (mode == 0) ? 4 : 1;
+  const Operand dst = resolveEA(mode, op & 7, size);
+  const uint32_t mask = 1u << (bitNum & ((size == 4) ? 31 : 7));
+  const uint32_t val = readOperand(dst, size);
+  m_z = !(val & mask);
+
+  switch ((op >> 6) & 3)
+  {
+  case 1:
+    writeOperand(dst, size, val ^ mask);
+    break;
+  case 2:
+    writeOperand(dst, size, val & ~mask);
+    break;
+  case 3:
+    writeOperand(dst, size, val | mask);
+    break;
+  default:
+    break;
+  }
+}
+
+void M68kCpu::opBitDynamic(M68kCpu& cpu, uint16_t op)
+{
+  cpu.bitOperation(op, cpu.m_d[(op >> 9) & 7]);
+}
+
+void M68kCpu::opBitStatic(M68kCpu& cpu, uint16_t op)
+{
+  cpu.bitOperation(op, cpu.fetch16() & 0xff);
+}
+
+static inline int moveSize(uint16_t op)
+{
+  const int code = (op >> 12) & 3;
+  return (code == 1) ? 1 : (code == 3) ? 2 : 4;
+}
+
+void M68kCpu::opMove(M68kCpu& cpu, uint16_t op)
+{
+  const int size = moveSize(op);
+  const uint32_t val = cpu.readEA((op >> 3) & 7, op & 7, size);
+  const Operand dst = cpu.resolveEA((op >> 6) & 7, (op >> 9) & 7, size);
+  cpu.writeOperand(dst, size, val);
+  cpu.setLogicFlags(val, size);
+}
+
+void M68kCpu::opMovea(M68kCpu& cpu, uint16_t op)
+{
+  const int size = moveSize(op);
+  const uint32_t val = cpu.readEA((op >> 3) & 7, op & 7, size);
+  cpu.m_a[(op >> 9) & 7] = signExtend(val, size);
+}
+
+void M68kCpu::opNegx(M68kCpu& cpu, uint16_t op)
+{
+  const int size = standardSize(op);
+  const Operand dst = cpu.resolveEA((op >> 3) & 7, op & 7, size);
+  cpu.writeOperand(dst, size, cpu.sub(0, cpu.readOperand(dst, size), size, true, true));
+}
+
+void M68kCpu::opClr(M68kCpu& cpu, uint16_t op)
+{
+  const int size = standardSize(op);
+  cpu.writeOperand(cpu.resolveEA((op >> 3) & 7, op & 7, size), size, 0);
+  cpu.setLogicFlags(0, size);
+}
+
+void M68kCpu::opNeg(M68kCpu& cpu, uint16_t op)
+{
+  const int size = standardSize(op);
+  const Operand dst = cpu.resolveEA((op >> 3) & 7, op & 7, size);
+  cpu.writeOperand(dst, size, cpu.sub(0, cpu.readOperand(dst, size), size, false, true));
+}
+
+void M68kCpu::opNot(M68kCpu& cpu, uint16_t op)
+{
+  const int size = standardSize(op);
+  const Operand dst = cpu.resolveEA((op >> 3) & 7, op & 7, size);
+  const uint32_t result = ~cpu.readOperand(dst, size) & sizeMask(size);
+  cpu.writeOperand(dst, size, result);
+  cpu.setLogicFlags(result, size);
+}
+
+void M68kCpu::opMoveFromCCR(M68kCpu& cpu, uint16_t op)
+{
+  cpu.writeOperand(cpu.resolveEA((op >> 3) & 7, op & 7, 2), 2, cpu.ccr());
+}
+
+void M68kCpu::opMoveToCCR(M68kCpu& cpu, uint16_t op)
+{
+  cpu.setCCR(cpu.readEA((op >> 3) & 7, op & 7, 2));
+}
+
+void M68kCpu::opSwap(M68kCpu& cpu, uint16_t op)
+{
+  uint32_t& reg = cpu.m_d[op & 7];
+  reg = (reg >> 16) | (reg << 16);
+  cpu.setLogicFlags(reg, 4);
+}
+
+void M68kCpu::opPea(M68kCpu& cpu, uint16_t op)
+{
+  const Operand src = cpu.resolveEA((op >> 3) & 7, op & 7, 4);
+  cpu.push32(src.value);
+}
+
+void M68kCpu::opExt(M68kCpu& cpu, uint16_t op)
+{
+  uint32_t& reg = cpu.m_d[op & 7];
+  switch ((op >> 6) & 7)
+  {
+  case 2: // EXT.W
+    reg = (reg & 0xffff0000) | (static_cast<int8_t>(reg) & 0xffff);
+    cpu.setLogicFlags(reg, 2);
+    break;
+  case 3: // EXT.L
+    reg = static_cast<int16_t>(reg);
+    cpu.setLogicFlags(reg, 4);
+    break;
+  default: // EXTB.L
+    reg = static_cast<int8_t>(reg);
+    cpu.setLogicFlags(reg, 4);
+    break;
+  }
+}
+
+void M68kCpu::opMovem(M68kCpu& cpu, uint16_t op)
+{
+  const bool toRegs = op & 0x0400;
+  const int size = (op & 0x0040) ? 4 : 2;
+  const uint16_t mask = cpu.fetch16();
+  const int mode = (op >> 3) & 7;
+  const int reg = op & 7;
+
+  if (!toRegs && (mode == 4))
+  {
+    // Predecrement: the mask runs from A7 (bit 0) down to D0 (bit 15)
+    uint32_t addr = cpu.m_a[reg];
+    for (int i = 0; i < 16; i++)
+    {
+      if (mask & (1 << i))
+      {
+        const int r = 15 - i;
+        const uint32_t val = (r < 8) ? cpu.m_d[r] : cpu.m_a[r - 8];
+        addr -= size;
+        if (size == 4)
+        {
+          cpu.write32(addr, val);
+        }
+        else
+        {
+          cpu.write16(addr, val);
+        }
+      }
+    }
+    cpu.m_a[reg] = addr;
+    return;
+  }
+
+  uint32_t addr = (mode == 3) ? cpu.m_a[reg] : cpu.resolveEA(mode, reg, size).value;
+  for (int r = 0; r < 16; r++)
+  {
+    if (mask & (1 << r))
+    {
+      if (toRegs)
+      {
+        const uint32_t val = (size == 4) ? cpu.read32(addr) : static_cast<uint32_t>(static_cast<int16_t>(cpu.read16(addr)));
+        if (r < 8)
+        {
+          cpu.m_d[r] = val;
+        }
+        else
+        {
+          cpu.m_a[r - 8] = val;
+        }
+      }
+      else
+      {
+        const uint32_t val = (r < 8) ? cpu.m_d[r] : cpu.m_a[r - 8];
+        if (size == 4)
+        {
+          cpu.write32(addr, val);
+        }
+        else
+        {
+          cpu.write16(addr, val);
+        }
+      }
+      addr += size;
+    }
+  }
+
+  if (mode == 3)
+  {
+    cpu.m_a[reg] = addr;
+  }
+}
+
+void M68kCpu::opTst(M68kCpu& cpu, uint16_t op)
+{
+  const int size = standardSize(op);
+  cpu.setLogicFlags(cpu.readEA((op >> 3) & 7, op & 7, size), size);
+}
+
+void M68kCpu::opTas(M68kCpu& cpu, uint16_t op)
+{
+  const Operand dst = cpu.resolveEA((op >> 3) & 7, op & 7, 1);
+  const uint32_t val = cpu.readOperand(dst, 1);
+  cpu.setLogicFlags(val, 1);
+  cpu.writeOperand(dst, 1, val | 0x80);
+}
+
+void M68kCpu::opMulL(M68kCpu& cpu, uint16_t op)
+{
+  const uint16_t ext = cpu.fetch16();
+  const uint32_t src = cpu.readEA((op >> 3) & 7, op & 7, 4);
+  const int low = (ext >> 12) & 7;
+  const int high = ext & 7;
+  const bool isSigned = ext & 0x0800;
+  const bool quad = ext & 0x0400;
+
+  uint64_t result = 0;
+  bool overflow = false;
+  if (isSigned)
+  {
+    const int64_t product = static_cast<int64_t>(static_cast<int32_t>(cpu.m_d[low])) * static_cast<int32_t>(src);
+    result = product;
+    overflow = (product != static_cast<int32_t>(product));
+  }
+  else
+  {
+    result = static_cast<uint64_t>(cpu.m_d[low]) * src;
+    overflow = (result >> 32) != 0;
+  }
+
+  if (quad)
+  {
+    cpu.m_d[high] = result >> 32;
+    cpu.m_d[low] = result;
+    cpu.m_n = result >> 63;
+    cpu.m_z = (result == 0);
+    cpu.m_v = false;
+  }
+  else
+  {
+    cpu.m_d[low] = result;
+    cpu.setNZ(result, 4);
+    cpu.m_v = overflow;
+  }
+  cpu.m_c = false;
+}
+
+void M68kCpu::opDivL(M68kCpu& cpu, uint16_t op)
+{
+  const uint16_t ext = cpu.fetch16();
+  const uint32_t divisor = cpu.readEA((op >> 3) & 7, op & 7, 4);
+  const int quotReg = (ext >> 12) & 7;
+  const int remReg = ext & 7;
+  const bool isSigned = ext & 0x0800;
+  const bool quad = ext & 0x0400;
+
+  if (divisor == 0)
+  {
+    cpu.fault("Division by zero");
+    return;
+  }
+
+  const uint64_t dividend = quad ? ((static_cast<uint64_t>(cpu.m_d[remReg]) << 32) | cpu.m_d[quotReg]) : cpu.m_d[quotReg];
+  uint32_t quotient = 0;
+  uint32_t remainder = 0;
+  cpu.m_c = false;
+
+  if (isSigned)
+  {
+    const int64_t sDividend = quad ? static_cast<int64_t>(dividend) : static_cast<int32_t>(dividend);
+    const int64_t sDivisor = static_cast<int32_t>(divisor);
+    if ((sDividend == INT64_MIN) && (sDivisor == -1))
+    {
+      cpu.m_v = true;
+      return;
+    }
+    const int64_t q = sDividend / sDivisor;
+    if ((q < INT32_MIN) || (q > INT32_MAX))
+    {
+      cpu.m_v = true;
+      return;
+    }
+    quotient = q;
+    remainder = sDividend % sDivisor;
+  }
+  else
+  {
+    const uint64_t q = dividend / divisor;
+    if (q > 0xffffffff)
+    {
+      cpu.m_v = true;
+      return;
+    }
+    quotient = q;
+    remainder = dividend % divisor;
+  }
+
+  if (remReg != quotReg)
+  {
+    cpu.m_d[remReg] = remainder;
+  }
+  cpu.m_d[quotReg] = quotient;
+  cpu.setNZ(quotient, 4);
+  cpu.m_v = false;
+}
+
+void M68kCpu::opLea(M68kCpu& cpu, uint16_t op)
+{
+  cpu.m_a[(op >> 9) & 7] = cpu.resolveEA((op >> 3) & 7, op & 7, 4).value;
+}
+
+void M68kCpu::opChk(M68kCpu& cpu, uint16_t op)
+{
+  const int size = ((op & 0x01C0) == 0x0180) ? 2 : 4;
+  const int32_t bound = signExtend(cpu.readEA((op >> 3) & 7, op & 7, size), size);
+  const int32_t val = signExtend(cpu.m_d[(op >> 9) & 7], size);
+  if ((val < 0) || (val > bound))
+  {
+    cpu.m_n = (val < 0);
+    cpu.fault("CHK exception");
+  }
+}
+
+void M68kCpu::opLink(M68kCpu& cpu, uint16_t op)
+{
+  const int reg = op & 7;
+  const int16_t disp = cpu.fetch16();
+  cpu.push32(cpu.m_a[reg]);
+  cpu.m_a[reg] = cpu.m_a[7];
+  cpu.m_a[7] += disp;
+}
+
+void M68kCpu::opLinkL(M68kCpu& cpu, uint16_t op)
+{
+  const int reg = op & 7;
+  const uint32_t disp = cpu.fetch32();
+  cpu.push32(cpu.m_a[reg]);
+  cpu.m_a[reg] = cpu.m_a[7];
+  cpu.m_a[7] += disp;
+}
+
+void M68kCpu::opUnlk(M68kCpu& cpu, uint16_t op)
+{
+  const int reg = op & 7;
+  cpu.m_a[7] = cpu.m_a[reg];
+  cpu.m_a[reg] = cpu.pop32();
+}
+
+void M68kCpu::opNop(M68kCpu&, uint16_t)
+{
+}
+
+void M68kCpu::opRts(M68kCpu& cpu, uint16_t)
+{
+  cpu.m_pc = cpu.pop32();
+}
+
+void M68kCpu::opRtd(M68kCpu& cpu, uint16_t)
+{
+  const int16_t disp = cpu.fetch16();
+  cpu.m_pc = cpu.pop32();
+  cpu.m_a[7] += disp;
+}
+
+void M68kCpu::opRtr(M68kCpu& cpu, uint16_t)
+{
+  cpu.setCCR(cpu.pop16());
+  cpu.m_pc = cpu.pop32();
+}
+
+void M68kCpu::opJsr(M68kCpu& cpu, uint16_t op)
+{
+  const uint32_t target = cpu.resolveEA((op >> 3) & 7, op & 7, 4).value;
+  cpu.push32(cpu.m_pc);
+  cpu.m_pc = target;
+}
+
+void M68kCpu::opJmp(M68kCpu& cpu, uint16_t op)
+{
+  cpu.m_pc = cpu.resolveEA((op >> 3) & 7, op & 7, 4).value;
+}
+
+void M68kCpu::opAddqSubq(M68kCpu& cpu, uint16_t op)
+{
+  const uint32_t data = ((op >> 9) & 7) ? ((op >> 9) & 7) : 8;
+  const bool isSub = op & 0x0100;
+  const int mode = (op >> 3) & 7;
+  const int reg = op & 7;
+
+  if (mode == 1)
+  {
+    // Address registers are always changed in full, and flags are untouched
+    cpu.m_a[reg] = isSub ? (cpu.m_a[reg] - data) : (cpu.m_a[reg] + data);
+    return;
+  }
+
+  const int size = standardSize(op);
+  const Operand dst = cpu.resolveEA(mode, reg, size);
+  const uint32_t val = cpu.readOperand(dst, size);
+  cpu.writeOperand(dst, size, isSub ? cpu.sub(val, data, size, false, true) : cpu.add(val, data, size, false));
+}
+
+void M68kCpu::opScc(M68kCpu& cpu, uint16_t op)
+{
+  const Operand dst = cpu.resolveEA((op >> 3) & 7, op & 7, 1);
+  cpu.writeOperand(dst, 1, cpu.condition((op >> 8) & 0xf) ? 0xff : 0x00);
+}
+
+void M68kCpu::opDbcc(M68kCpu& cpu, uint16_t op)
+{
+  const uint32_t base = cpu.m_pc;
+  const int16_t disp = cpu.fetch16();
+  if (!cpu.condition((op >> 8) & 0xf))
+  {
+    uint32_t& reg = cpu.m_d[op & 7];
+    const uint16_t count = (reg & 0xffff) - 1;
+    reg = (reg & 0xffff0000) | count;
+    if (count != 0xffff)
+    {
+      cpu.m_pc = base + disp;
+    }
+  }
+}
+
+void M68kCpu::opBcc(M68kCpu& cpu, uint16_t op)
+{
+  const uint32_t base = cpu.m_pc;
+  const int cc = (op >> 8) & 0xf;
+  int32_t disp = static_cast<int8_t>(op & 0xff);
+  if ((op & 0xff) == 0x00)
+  {
+    disp = static_cast<int16_t>(cpu.fetch16());
+  }
+  else if ((op & 0xff) == 0xff)
+  {
+    disp = cpu.fetch32();
+  }
+
+  if (cc == 1)
+  {
+    // BSR
+    cpu.push32(cpu.m_pc);
+    cpu.m_pc = base + disp;
+  }
+  else if (cpu.condition(cc))
+  {
+    cpu.m_pc = base + disp;
+  }
+}
+
+void M68kCpu::opMoveq(M68kCpu& cpu, uint16_t op)
+{
+  const uint32_t val = static_cast<int8_t>(op & 0xff);
+  cpu.m_d[(op >> 9) & 7] = val;
+  cpu.setLogicFlags(val, 4);
+}
+
+void M68kCpu::opDivW(M68kCpu& cpu, uint16_t op)
+{
+  const uint32_t divisor = cpu.readEA((op >> 3) & 7, op & 7, 2);
+  uint32_t& reg = cpu.m_d[(op >> 9) & 7];
+  if (divisor == 0)
+  {
+    cpu.fault("Division by zero");
+    return;
+  }
+
+  cpu.m_c = false;
+  if (op & 0x0100)
+  {
+    const int32_t dividend = reg;
+    const int32_t sDivisor = static_cast<int16_t>(divisor);
+    if ((dividend == INT32_MIN) && (sDivisor == -1))
+    {
+      cpu.m_v = true;
+      return;
+    }
+    const int32_t quotient = dividend / sDivisor;
+    if ((quotient < -32768) || (quotient > 32767))
+    {
+      cpu.m_v = true;
+      return;
+    }
+    reg = ((static_cast<uint32_t>(dividend % sDivisor) & 0xffff) << 16) | (quotient & 0xffff);
+  }
+  else
+  {
+    const uint32_t quotient = reg / divisor;
+    if (quotient > 0xffff)
+    {
+      cpu.m_v = true;
+      return;
+    }
+    reg = ((reg % divisor) << 16) | quotient;
+  }
+  cpu.setNZ(reg, 2);
+  cpu.m_v = false;
+}
+
+void M68kCpu::opMulW(M68kCpu& cpu, uint16_t op)
+{
+  const uint32_t src = cpu.readEA((op >> 3) & 7, op & 7, 2);
+  uint32_t& reg = cpu.m_d[(op >> 9) & 7];
+  if (op & 0x0100)
+  {
+    reg = static_cast<int32_t>(static_cast<int16_t>(reg)) * static_cast<int16_t>(src);
+  }
+  else
+  {
+    reg = (reg & 0xffff) * src;
+  }
+  cpu.setLogicFlags(reg, 4);
+}
+
+/**
+ * Handles OR (line 8) and AND (line C), in both directions.
+ */
+void M68kCpu::opLogic(M68kCpu& cpu, uint16_t op)
+{
+  const int size = standardSize(op);
+  const bool isAnd = (op & 0xF000) == 0xC000;
+  const Operand ea = cpu.resolveEA((op >> 3) & 7, op & 7, size);
+  const Operand reg = { OperandKind::DataReg, static_cast<uint32_t>((op >> 9) & 7) };
+  const Operand& dst = (op & 0x0100) ? ea : reg;
+
+  const uint32_t a = cpu.readOperand(ea, size);
+  const uint32_t b = cpu.m_d[reg.value] & sizeMask(size);
+  const uint32_t result = isAnd ? (a & b) : (a | b);
+  cpu.writeOperand(dst, size, result);
+  cpu.setLogicFlags(result, size);
+}
+
+/**
+ * Handles ADD (line D) and SUB (line 9), in both directions.
+ */
+void M68kCpu::opAddSub(M68kCpu& cpu, uint16_t op)
+{
+  const int size = standardSize(op);
+  const bool isAdd = (op & 0xF000) == 0xD000;
+  const Operand ea = cpu.resolveEA((op >> 3) & 7, op & 7, size);
+  const Operand reg = { OperandKind::DataReg, static_cast<uint32_t>((op >> 9) & 7) };
+
+  uint32_t dstVal = 0;
+  uint32_t srcVal = 0;
+  if (op & 0x0100)
+  {
+    dstVal = cpu.readOperand(ea, size);
+    srcVal = cpu.m_d[reg.value] & sizeMask(size);
+  }
+  else
+  {
+    dstVal = cpu.m_d[reg.value] & sizeMask(size);
+    srcVal = cpu.readOperand(ea, size);
+  }
+
+  const uint32_t result = isAdd ? cpu.add(dstVal, srcVal, size, false) : cpu.sub(dstVal, srcVal, size, false, true);
+  cpu.writeOperand((op & 0x0100) ? ea : reg, size, result);
+}
+
+void M68kCpu::opAddaSuba(M68kCpu& cpu, uint16_t op)
+{
+  const int size = (op & 0x0100) ? 4 : 2;
+  const uint32_t src = signExtend(cpu.readEA((op >> 3) & 7, op & 7, size), size);
+  uint32_t& reg = cpu.m_a[(op >> 9) & 7];
+  reg = ((op & 0xF000) == 0xD000) ? (reg + src) : (reg - src);
+}
+
+void M68kCpu::opAddxSubx(M68kCpu& cpu, uint16_t op)
+{
+  const int size = standardSize(op);
+  const bool isAdd = (op & 0xF000) == 0xD000;
+  const int dstReg = (op >> 9) & 7;
+  const int srcReg = op & 7;
+
+  if (op & 0x0008)
+  {
+    const uint32_t src = cpu.readEA(4, srcReg, size);
+    const Operand dst = cpu.resolveEA(4, dstReg, size);
+    const uint32_t val = cpu.readOperand(dst, size);
+    cpu.writeOperand(dst, size, isAdd ? cpu.add(val, src, size, true) : cpu.sub(val, src, size, true, true));
+  }
+  else
+  {
+    const Operand dst = { OperandKind::DataReg, static_cast<uint32_t>(dstReg) };
+    const uint32_t val = cpu.m_d[dstReg] & sizeMask(size);
+    const uint32_t src = cpu.m_d[srcReg] & sizeMask(size);
+    cpu.writeOperand(dst, size, isAdd ? cpu.add(val, src, size, true) : cpu.sub(val, src, size, true, true));
+  }
+}
+
+void M68kCpu::opCmp(M68kCpu& cpu, uint16_t op)
+{
+  const int size = standardSize(op);
+  const uint32_t src = cpu.readEA((op >> 3) & 7, op & 7, size);
+  cpu.sub(cpu.m_d[(op >> 9) & 7], src, size, false, false);
+}
+
+void M68kCpu::opCmpa(M68kCpu& cpu, uint16_t op)
+{
+  const int size = (op & 0x0100) ? 4 : 2;
+  const uint32_t src = signExtend(cpu.readEA((op >> 3) & 7, op & 7, size), size);
+  cpu.sub(cpu.m_a[(op >> 9) & 7], src, 4, false, false);
+}
+
+void M68kCpu::opCmpm(M68kCpu& cpu, uint16_t op)
+{
+  const int size = standardSize(op);
+  const uint32_t src = cpu.readEA(3, op & 7, size);
+  const uint32_t dst = cpu.readEA(3, (op >> 9) & 7, size);
+  cpu.sub(dst, src, size, false, false);
+}
+
+void M68kCpu::opEor(M68kCpu& cpu, uint16_t op)
+{
+  const int size = standardSize(op);
+  const Operand dst = cpu.resolveEA((op >> 3) & 7, op & 7, size);
+  const uint32_t result = cpu.readOperand(dst, size) ^ (cpu.m_d[(op >> 9) & 7] & sizeMask(size));
+  cpu.writeOperand(dst, size, result);
+  cpu.setLogicFlags(result, size);
+}
+
+void M68kCpu::opExg(M68kCpu& cpu, uint16_t op)
+{
+  const int rx = (op >> 9) & 7;
+  const int ry = op & 7;
+  switch (op & 0x01F8)
+  {
+  case 0x0140:
+    std::swap(cpu.m_d[rx], cpu.m_d[ry]);
+    break;
+  case 0x0148:
+    std::swap(cpu.m_a[rx], cpu.m_a[ry]);
+    break;
+  default:
+    std::swap(cpu.m_d[rx], cpu.m_a[ry]);
+    break;
+  }
+}
+
+void M68kCpu::opShiftReg(M68kCpu& cpu, uint16_t op)
+{
+  const int size = standardSize(op);
+  const int countField = (op >> 9) & 7;
+  const int count = (op & 0x0020) ? (cpu.m_d[countField] & 63) : (countField ? countField : 8);
+  const Operand dst = { OperandKind::DataReg, static_cast<uint32_t>(op & 7) };
+  const uint32_t result = cpu.shift((op >> 3) & 3, op & 0x0100, cpu.m_d[op & 7], count, size);
+  cpu.writeOperand(dst, size, result);
+}
+
+void M68kCpu::opShiftMem(M68kCpu& cpu, uint16_t op)
+{
+  const Operand dst = cpu.resolveEA((op >> 3) & 7, op & 7, 2);
+  const uint32_t result = cpu.shift((op >> 9) & 3, op & 0x0100, cpu.readOperand(dst, 2), 1, 2);
+  cpu.writeOperand(dst, 2, result);
+}
+
+/**
+ * Handles the 68020 bit field instructions. The field is counted from the
+ * most significant bit, either of a data register (wrapping around) or of
+ * the byte at the effective address (in which case the offset is signed and
+ * can reach outside of that byte).
+ */
+void M68kCpu::opBitfield(M68kCpu& cpu, uint16_t op)
+{
+  const uint16_t ext = cpu.fetch16();
+  const int mode = (op >> 3) & 7;
+  const int dataReg = (ext >> 12) & 7;
+  const int32_t offset = (ext & 0x0800) ? static_cast<int32_t>(cpu.m_d[(ext >> 6) & 7]) : ((ext >> 6) & 0x1f);
+  int width = ((ext & 0x0020) ? cpu.m_d[ext & 7] : ext) & 0x1f;
+  if (width == 0)
+  {
+    width = 32;
+  }
+  const uint32_t fieldMask = (width == 32) ? 0xffffffff : ((1u << width) - 1);
+  const int type = (op >> 8) & 7;
+
+  // The field is extracted from a 40-bit window, so that it's always aligned
+  // to bit (40 - width) after shifting
+  uint64_t window = 0;
+  int bitOffset = 0;
+  uint32_t addr = 0;
+  int byteCount = 0;
+  if (mode == 0)
+  {
+    // Rotate the register so that the field starts at its most significant bit
+    const uint32_t reg = cpu.m_d[op & 7];
+    const int rotate = offset & 31;
+    const uint32_t rotated = (rotate == 0) ? reg : ((reg << rotate) | (reg >> (32 - rotate)));
+    window = static_cast<uint64_t>(rotated) << 8;
+  }
+  else
+  {
+    addr = cpu.resolveEA(mode, op & 7, 1).value + (offset >> 3);
+    bitOffset = offset & 7;
+    byteCount = (bitOffset + width + 7) / 8;
+    for (int i = 0; i < 5; i++)
+    {
+      window = (window << 8) | ((i < byteCount) ? cpu.read8(addr + i) : 0);
+    }
+  }
+
+  const int fieldShift = 40 - bitOffset - width;
+  const uint32_t field = (window >> fieldShift) & fieldMask;
+  cpu.m_n = (field >> (width - 1)) & 1;
+  cpu.m_z = (field == 0);
+  cpu.m_v = false;
+  cpu.m_c = false;
+
+  uint32_t newField = field;
+  switch (type)
+  {
+  case 0: // BFTST
+    return;
+  case 1: // BFEXTU
+    cpu.m_d[dataReg] = field;
+    return;
+  case 3: // BFEXTS
+    cpu.m_d[dataReg] = (width == 32) ? field : static_cast<uint32_t>(static_cast<int32_t>(field << (32 - width)) >> (32 - width));
+    return;
+  case 5: // BFFFO
+  {
+    int i = 0;
+    while ((i < width) && !(field & (1u << (width - 1 - i))))
+    {
+      i++;
+    }
+    cpu.m_d[dataReg] = offset + i;
+    return;
+  }
+  case 2: // BFCHG
+    newField = ~field & fieldMask;
+    break;
+  case 4: // BFCLR
+    newField = 0;
+    break;
+  case 6: // BFSET
+    newField = fieldMask;
+    break;
+  default: // BFINS
+    newField = cpu.m_d[dataReg] & fieldMask;
+    cpu.m_n = (newField >> (width - 1)) & 1;
+    cpu.m_z = (newField == 0);
+    break;
+  }
+
+  window = (window & ~(static_cast<uint64_t>(fieldMask) << fieldShift)) | (static_cast<uint64_t>(newField) << fieldShift);
+  if (mode == 0)
+  {
+    const int rotate = offset & 31;
+    const uint32_t rotated = window >> 8;
+    cpu.m_d[op & 7] = (rotate == 0) ? rotated : ((rotated >> rotate) | (rotated << (32 - rotate)));
+  }
+  else
+  {
+    for (int i = 0; i < byteCount; i++)
+    {
+      cpu.write8(addr + i, window >> (32 - (i * 8)));
+    }
+  }
+}
+
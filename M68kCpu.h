@@ -0,0 +1,185 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+/**
+ * Interpreter for the user-mode integer instruction set of the 68020/CPU32,
+ * which is what the Tester's application modules are compiled for. There are
+ * no exception vectors or interrupts: anything that would raise an exception
+ * (TRAP, division by zero, an unimplemented opcode, an access outside of
+ * memory) stops execution with a fault instead.
+ *
+ * Opcodes are dispatched through a 64K-entry handler table that is built
+ * once.
+ *
+ * Calls to host functions are made by jumping to an address in the host
+ * call range (see hostCallAddress()). The host function finds its arguments
+ * on the stack as C code would pass them, returns its result in D0, and can
+ * choose to block, in which case execution stops at the call and resumes it
+ * on the next call to run().
+ */
+class M68kCpu
+{
+public:
+  enum class Status
+  {
+    Running,
+    Blocked,
+    Stopped,
+    Fault
+  };
+
+  enum class HostResult
+  {
+    Return,
+    Block,
+    Stop
+  };
+
+  typedef std::function<HostResult(M68kCpu&,int)> HostCallHandler;
+
+  static constexpr uint32_t HOST_CALL_BASE = 0xffff0000;
+
+  explicit M68kCpu(uint32_t memorySize);
+
+  void reset();
+  Status run(uint64_t maxInstructions);
+  Status status() const { return m_status; }
+  const std::string& faultMessage() const { return m_faultMessage; }
+  uint64_t instructionCount() const { return m_instructionCount; }
+
+  void setHostCallHandler(HostCallHandler handler) { m_hostCall = handler; }
+  static uint32_t hostCallAddress(int index) { return HOST_CALL_BASE + (index * 2); }
+
+  uint32_t d(int reg) const { return m_d[reg]; }
+  uint32_t a(int reg) const { return m_a[reg]; }
+  uint32_t pc() const { return m_pc; }
+  void setD(int reg, uint32_t val) { m_d[reg] = val; }
+  void setA(int reg, uint32_t val) { m_a[reg] = val; }
+  void setPC(uint32_t pc) { m_pc = pc; }
+  void push32(uint32_t val);
+  uint32_t pop32();
+  uint32_t stackArg(int index);
+
+  uint32_t memorySize() const { return m_mem.size(); }
+  uint8_t* memory(uint32_t addr, uint32_t len);
+  uint8_t read8(uint32_t addr);
+  uint16_t read16(uint32_t addr);
+  uint32_t read32(uint32_t addr);
+  void write8(uint32_t addr, uint8_t val);
+  void write16(uint32_t addr, uint16_t val);
+  void write32(uint32_t addr, uint32_t val);
+
+  void fault(const std::string& message);
+
+private:
+  typedef void (*Handler)(M68kCpu&, uint16_t);
+
+  enum class OperandKind : uint8_t
+  {
+    DataReg,
+    AddrReg,
+    Memory,
+    Immediate
+  };
+
+  struct Operand
+  {
+    OperandKind kind;
+    uint32_t value; // register number, address, or immediate value
+  };
+
+  std::vector<uint8_t> m_mem;
+  uint32_t m_d[8];
+  uint32_t m_a[8];
+  uint32_t m_pc = 0;
+  uint32_t m_insnStart = 0;
+  bool m_x = false;
+  bool m_n = false;
+  bool m_z = false;
+  bool m_v = false;
+  bool m_c = false;
+  Status m_status = Status::Stopped;
+  std::string m_faultMessage;
+  uint64_t m_instructionCount = 0;
+  HostCallHandler m_hostCall;
+
+  static Handler s_handlers[0x10000];
+  static void buildTables();
+  static Handler decode(uint16_t op);
+
+  bool callHost();
+
+  uint16_t fetch16();
+  uint32_t fetch32();
+  uint32_t indexedAddress(uint32_t base);
+  Operand resolveEA(int mode, int reg, int size);
+  uint32_t readOperand(const Operand& op, int size);
+  void writeOperand(const Operand& op, int size, uint32_t val);
+  uint32_t readEA(int mode, int reg, int size);
+  uint16_t ccr() const;
+  void setCCR(uint16_t val);
+  bool condition(int cc) const;
+  void setNZ(uint32_t result, int size);
+  void setLogicFlags(uint32_t result, int size);
+  uint16_t pop16();
+  uint32_t add(uint32_t dst, uint32_t src, int size, bool withX);
+  uint32_t sub(uint32_t dst, uint32_t src, int size, bool withX, bool setX);
+  uint32_t shift(int type, bool left, uint32_t val, int count, int size);
+  void bitOperation(uint16_t op, uint32_t bitNum);
+
+  static void opOriAndiEoriCCR(M68kCpu& cpu, uint16_t op);
+  static void opImmediate(M68kCpu& cpu, uint16_t op);
+  static void opBitDynamic(M68kCpu& cpu, uint16_t op);
+  static void opBitStatic(M68kCpu& cpu, uint16_t op);
+  static void opMove(M68kCpu& cpu, uint16_t op);
+  static void opMovea(M68kCpu& cpu, uint16_t op);
+  static void opNegx(M68kCpu& cpu, uint16_t op);
+  static void opClr(M68kCpu& cpu, uint16_t op);
+  static void opNeg(M68kCpu& cpu, uint16_t op);
+  static void opNot(M68kCpu& cpu, uint16_t op);
+  static void opMoveFromCCR(M68kCpu& cpu, uint16_t op);
+  static void opMoveToCCR(M68kCpu& cpu, uint16_t op);
+  static void opSwap(M68kCpu& cpu, uint16_t op);
+  static void opPea(M68kCpu& cpu, uint16_t op);
+  static void opExt(M68kCpu& cpu, uint16_t op);
+  static void opMovem(M68kCpu& cpu, uint16_t op);
+  static void opTst(M68kCpu& cpu, uint16_t op);
+  static void opTas(M68kCpu& cpu, uint16_t op);
+  static void opMulL(M68kCpu& cpu, uint16_t op);
+  static void opDivL(M68kCpu& cpu, uint16_t op);
+  static void opLea(M68kCpu& cpu, uint16_t op);
+  static void opChk(M68kCpu& cpu, uint16_t op);
+  static void opLink(M68kCpu& cpu, uint16_t op);
+  static void opLinkL(M68kCpu& cpu, uint16_t op);
+  static void opUnlk(M68kCpu& cpu, uint16_t op);
+  static void opNop(M68kCpu& cpu, uint16_t op);
+  static void opRts(M68kCpu& cpu, uint16_t op);
+  static void opRtd(M68kCpu& cpu, uint16_t op);
+  static void opRtr(M68kCpu& cpu, uint16_t op);
+  static void opJsr(M68kCpu& cpu, uint16_t op);
+  static void opJmp(M68kCpu& cpu, uint16_t op);
+  static void opAddqSubq(M68kCpu& cpu, uint16_t op);
+  static void opScc(M68kCpu& cpu, uint16_t op);
+  static void opDbcc(M68kCpu& cpu, uint16_t op);
+  static void opBcc(M68kCpu& cpu, uint16_t op);
+  static void opMoveq(M68kCpu& cpu, uint16_t op);
+  static void opDivW(M68kCpu& cpu, uint16_t op);
+  static void opMulW(M68kCpu& cpu, uint16_t op);
+  static void opLogic(M68kCpu& cpu, uint16_t op);
+  static void opAddSub(M68kCpu& cpu, uint16_t op);
+  static void opAddaSuba(M68kCpu& cpu, uint16_t op);
+  static void opAddxSubx(M68kCpu& cpu, uint16_t op);
+  static void opCmp(M68kCpu& cpu, uint16_t op);
+  static void opCmpa(M68kCpu& cpu, uint16_t op);
+  static void opCmpm(M68kCpu& cpu, uint16_t op);
+  static void opEor(M68kCpu& cpu, uint16_t op);
+  static void opExg(M68kCpu& cpu, uint16_t op);
+  static void opShiftReg(M68kCpu& cpu, uint16_t op);
+  static void opShiftMem(M68kCpu& cpu, uint16_t op);
+  static void opBitfield(M68kCpu& cpu, uint16_t op);
+  static void opUnimplemented(M68kCpu& cpu, uint16_t op);
+};
+
@@ -0,0 +1,314 @@
+#include "MemoryEditor.h"
+#include <algorithm>
+#include <QFileDialog>
+#include <QFontDatabase>
+#include <QHBoxLayout>
+#include <QHeaderView>
+#include <QLabel>
+#include <QVBoxLayout>
+
+MemoryEditor::MemoryEditor(TesterSim& sim, QWidget* parent) :
+  QDialog(parent),
+  m_sim(sim),
+  m_applyDiffButton("Apply diff")
+{
+  setWindowTitle("ECU memory");
+
+  // Fixed row heights let the view work out which rows are visible without
+  // measuring any of them
+  m_view.setModel(&m_model);
+  m_view.setFont(QFontDatabase::systemFont(QFontDatabase::FixedFont));
+  m_view.verticalHeader()->setSectionResizeMode(QHeaderView::Fixed);
+  m_view.verticalHeader()->setDefaultSectionSize(m_view.fontMetrics().height() + 4);
+  m_view.horizontalHeader()->setSectionResizeMode(QHeaderView::Fixed);
+  m_view.horizontalHeader()->setDefaultSectionSize(m_view.fontMetrics().horizontalAdvance("000"));
+  m_view.horizontalHeader()->resizeSection(HexMemoryModel::ASCII_COLUMN,
+    m_view.fontMetrics().horizontalAdvance(QString(HexMemoryModel::BYTES_PER_ROW + 2, QChar('0'))));
+
+  m_startBox.setPlaceholderText("0x0000");
+  m_endBox.setPlaceholderText("0xffff");
+  m_fillValueBox.setPlaceholderText("0x00");
+  m_copyDestBox.setPlaceholderText("0x0000");
+  m_applyDiffButton.setEnabled(false);
+
+  QPushButton* importButton = new QPushButton("Import...", this);
+  QPushButton* fillButton = new QPushButton("Fill", this);
+  QPushButton* copyButton = new QPushButton("Copy", this);
+  QPushButton* diffButton = new QPushButton("Diff...", this);
+
+  QHBoxLayout* rangeLayout = new QHBoxLayout;
+  rangeLayout->addWidget(new QLabel("Range", this));
+  rangeLayout->addWidget(&m_startBox);
+  rangeLayout->addWidget(new QLabel("to", this));
+  rangeLayout->addWidget(&m_endBox);
+  rangeLayout->addWidget(importButton);
+  rangeLayout->addWidget(diffButton);
+  rangeLayout->addWidget(&m_applyDiffButton);
+
+  QHBoxLayout* editLayout = new QHBoxLayout;
+  editLayout->addWidget(new QLabel("Value", this));
+  editLayout->addWidget(&m_fillValueBox);
+  editLayout->addWidget(fillButton);
+  editLayout->addWidget(new QLabel("Destination", this));
+  editLayout->addWidget(&m_copyDestBox);
+  editLayout->addWidget(copyButton);
+
+  QVBoxLayout* layout = new QVBoxLayout(this);
+  layout->addWidget(&m_view);
+  layout->addLayout(rangeLayout);
+  layout->addLayout(editLayout);
+  resize(720, 560);
+
+  connect(&m_model, &HexMemoryModel::byteEdited, this, &MemoryEditor::onByteEdited);
+  connect(m_view.selectionModel(), &QItemSelectionModel::selectionChanged, this, &MemoryEditor::onSelectionChanged);
+  connect(importButton, &QPushButton::clicked, this, &MemoryEditor::importDump);
+  connect(fillButton, &QPushButton::clicked, this, &MemoryEditor::fill);
+  connect(copyButton, &QPushButton::clicked, this, &MemoryEditor::copy);
+  connect(diffButton, &QPushButton::clicked, this, &MemoryEditor::diff);
+  connect(&m_applyDiffButton, &QPushButton::clicked, this, &MemoryEditor::applyDiff);
+  connect(&m_refreshTimer, &QTimer::timeout, this, &MemoryEditor::refresh);
+}
+
+void MemoryEditor::showEvent(QShowEvent* event)
+{
+  QDialog::showEvent(event);
+  refresh();
+  m_refreshTimer.start(REFRESH_MS);
+}
+
+void MemoryEditor::hideEvent(QHideEvent* event)
+{
+  m_refreshTimer.stop();
+  QDialog::hideEvent(event);
+}
+
+/**
+ * Copies the simulator's RAM into the model. If the listening thread is busy
+ * with a frame, the contents are left until the next refresh, but the reads
+ * are still highlighted.
+ */
+void MemoryEditor::refresh()
+{
+  MemoryImage contents;
+  std::vector<uint32_t> reads;
+  if (m_sim.copyRAM(contents, reads))
+  {
+    m_model.setContents(contents);
+  }
+  m_model.markReads(reads);
+}
+
+void MemoryEditor::onByteEdited(uint16_t addr, uint8_t val)
+{
+  m_sim.setRAMLoc(addr, val);
+  emit message(QString("Set RAM location %1 to %2.").arg(addr, 4, 16, QChar('0')).arg(val, 2, 16, QChar('0')));
+  refresh();
+}
+
+/**
+ * Puts the span of the selected bytes in the range boxes, so that an
+ * operation can be applied to a selection.
+ */
+void MemoryEditor::onSelectionChanged()
+{
+  const QModelIndexList selected = m_view.selectionModel()->selectedIndexes();
+  int first = MemoryImage::SIZE;
+  int last = -1;
+  for (const QModelIndex& index : selected)
+  {
+    if (index.column() != HexMemoryModel::ASCII_COLUMN)
+    {
+      const int addr = (index.row() * HexMemoryModel::BYTES_PER_ROW) + index.column();
+      first = std::min(first, addr);
+      last = std::max(last, addr);
+    }
+  }
+  if (last >= 0)
+  {
+    m_startBox.setText(QString("0x%1").arg(first, 4, 16, QChar('0')));
+    m_endBox.setText(QString("0x%1").arg(last, 4, 16, QChar('0')));
+  }
+}
+
+bool MemoryEditor::parseAddress(const QLineEdit& box, uint16_t& addr)
+{
+  const QString text = box.text().isEmpty() ? box.placeholderText() : box.text();
+  bool ok = false;
+  const unsigned val = text.toUInt(&ok, 0);
+  if (ok && (val < MemoryImage::SIZE))
+  {
+    addr = val;
+    return true;
+  }
+  return false;
+}
+
+/**
+ * Reads the address range (inclusive) from the range boxes, which default to
+ * the whole space when left empty.
+ */
+bool MemoryEditor::range(uint16_t& start, uint16_t& end)
+{
+  if (!parseAddress(m_startBox, start) || !parseAddress(m_endBox, end) || (start > end))
+  {
+    emit message("Error parsing memory address range.");
+    return false;
+  }
+  return true;
+}
+
+void MemoryEditor::importDump()
+{
+  uint16_t start = 0;
+  uint16_t end = 0;
+  if (!range(start, end))
+  {
+    return;
+  }
+
+  const QString filename = QFileDialog::getOpenFileName(this, "Import memory dump", "",
+    "Memory dumps (*.bin *.hex *.ihx *.s19 *.s28 *.s37 *.srec *.mot);;All files (*)");
+  if (filename.isEmpty())
+  {
+    return;
+  }
+
+  std::shared_ptr<MemoryImage> image = std::make_shared<MemoryImage>();
+  MemoryImage::ImportStats stats;
+  QString error;
+  if (!image->import(filename, start, end, stats, error))
+  {
+    emit message(QString("Failed to import memory dump '%1': %2").arg(filename).arg(error));
+    return;
+  }
+
+  m_sim.writeRAM(image);
+  emit message(QString("Imported %1 bytes (%2) from '%3' into 0x%4-0x%5%6").
+    arg(stats.bytes).arg(MemoryImage::formatName(stats.format)).arg(filename).
+    arg(start, 4, 16, QChar('0')).arg(end, 4, 16, QChar('0')).
+    arg((stats.skipped > 0) ? QString(" (%1 bytes outside the range skipped)").arg(stats.skipped) : QString()));
+  refresh();
+}
+
+void MemoryEditor::fill()
+{
+  uint16_t start = 0;
+  uint16_t end = 0;
+  bool ok = false;
+  const QString valText = m_fillValueBox.text().isEmpty() ? m_fillValueBox.placeholderText() : m_fillValueBox.text();
+  const unsigned val = valText.toUInt(&ok, 0);
+  if (!range(start, end))
+  {
+    return;
+  }
+  if (!ok || (val > 0xff))
+  {
+    emit message("Error parsing fill value.");
+    return;
+  }
+
+  std::shared_ptr<MemoryImage> image = std::make_shared<MemoryImage>();
+  for (int addr = start; addr <= end; addr++)
+  {
+    image->set(addr, val);
+  }
+  m_sim.writeRAM(image);
+  emit message(QString("Filled 0x%1-0x%2 with %3").
+    arg(start, 4, 16, QChar('0')).arg(end, 4, 16, QChar('0')).arg(val, 2, 16, QChar('0')));
+  refresh();
+}
+
+void MemoryEditor::copy()
+{
+  uint16_t start = 0;
+  uint16_t end = 0;
+  uint16_t dest = 0;
+  if (!range(start, end))
+  {
+    return;
+  }
+  if (!parseAddress(m_copyDestBox, dest) || (dest + (end - start) >= MemoryImage::SIZE))
+  {
+    emit message("Error parsing copy destination, or the copy would run past 0xffff.");
+    return;
+  }
+
+  // The source is the copy of RAM shown in the editor, so overlapping ranges
+  // are copied as they were before the copy
+  const MemoryImage& contents = m_model.contents();
+  std::shared_ptr<MemoryImage> image = std::make_shared<MemoryImage>();
+  for (int i = 0; i <= end - start; i++)
+  {
+    image->set(dest + i, contents.at(start + i));
+  }
+  m_sim.writeRAM(image);
+  emit message(QString("Copied 0x%1-0x%2 to 0x%3").
+    arg(start, 4, 16, QChar('0')).arg(end, 4, 16, QChar('0')).arg(dest, 4, 16, QChar('0')));
+  refresh();
+}
+
+/**
+ * Compares a dump with the current RAM contents over the address range,
+ * marking the bytes that differ. The differing bytes can then be written in
+ * one go with applyDiff().
+ */
+void MemoryEditor::diff()
+{
+  uint16_t start = 0;
+  uint16_t end = 0;
+  if (!range(start, end))
+  {
+    return;
+  }
+
+  const QString filename = QFileDialog::getOpenFileName(this, "Compare with memory dump", "",
+    "Memory dumps (*.bin *.hex *.ihx *.s19 *.s28 *.s37 *.srec *.mot);;All files (*)");
+  if (filename.isEmpty())
+  {
+    return;
+  }
+
+  MemoryImage dump;
+  MemoryImage::ImportStats stats;
+  QString error;
+  if (!dump.import(filename, start, end, stats, error))
+  {
+    emit message(QString("Failed to read memory dump '%1': %2").arg(filename).arg(error));
+    return;
+  }
+
+  const MemoryImage& contents = m_model.contents();
+  std::bitset<MemoryImage::SIZE> differs;
+  m_diffImage = std::make_shared<MemoryImage>();
+  int firstDiff = -1;
+  for (int addr = start; addr <= end; addr++)
+  {
+    if (dump.isSet(addr) && (dump.at(addr) != contents.at(addr)))
+    {
+      differs[addr] = true;
+      m_diffImage->set(addr, dump.at(addr));
+      firstDiff = (firstDiff < 0) ? addr : firstDiff;
+    }
+  }
+
+  m_model.setDiff(differs);
+  m_applyDiffButton.setEnabled(differs.any());
+  emit message(QString("%1 of %2 bytes in '%3' differ from RAM").arg(differs.count()).arg(stats.bytes).arg(filename));
+  if (firstDiff >= 0)
+  {
+    m_view.scrollTo(m_model.index(firstDiff / HexMemoryModel::BYTES_PER_ROW, firstDiff % HexMemoryModel::BYTES_PER_ROW));
+  }
+}
+
+void MemoryEditor::applyDiff()
+{
+  if (m_diffImage)
+  {
+    m_sim.writeRAM(m_diffImage);
+    emit message(QString("Wrote %1 differing bytes to RAM").arg(m_diffImage->count()));
+    m_diffImage.reset();
+  }
+  m_model.setDiff(std::bitset<MemoryImage::SIZE>());
+  m_applyDiffButton.setEnabled(false);
+  refresh();
+}
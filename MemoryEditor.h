@@ -0,0 +1,65 @@
+#pragma once
+#include <bitset>
+#include <memory>
+#include <QDialog>
+#include <QLineEdit>
+#include <QPushButton>
+#include <QTableView>
+#include <QTimer>
+#include "HexMemoryModel.h"
+#include "MemoryImage.h"
+#include "TesterSim.h"
+
+/**
+ * Window for viewing and editing the whole RAM space of the simulated ECUs
+ * as a hex dump. Besides editing single bytes, a range of addresses can be
+ * filled with a value, copied elsewhere, loaded from a dump file (raw binary,
+ * Intel HEX or S-records), or compared with a dump. Each of those operations
+ * is sent to the simulator as a single update.
+ *
+ * The display is refreshed from the simulator a few times a second while the
+ * window is open, highlighting the bytes that WSDC32 has just read.
+ */
+class MemoryEditor : public QDialog
+{
+  Q_OBJECT
+
+public:
+  explicit MemoryEditor(TesterSim& sim, QWidget* parent = nullptr);
+
+signals:
+  void message(const QString& line);
+
+protected:
+  void showEvent(QShowEvent* event) override;
+  void hideEvent(QHideEvent* event) override;
+
+private slots:
+  void refresh();
+  void onByteEdited(uint16_t addr, uint8_t val);
+  void onSelectionChanged();
+  void importDump();
+  void fill();
+  void copy();
+  void diff();
+  void applyDiff();
+
+private:
+  static constexpr int REFRESH_MS = 200;
+
+  TesterSim& m_sim;
+  HexMemoryModel m_model;
+  QTableView m_view;
+  QLineEdit m_startBox;
+  QLineEdit m_endBox;
+  QLineEdit m_fillValueBox;
+  QLineEdit m_copyDestBox;
+  QPushButton m_applyDiffButton;
+  QTimer m_refreshTimer;
+
+  // Bytes of the last compared dump that differ from RAM, ready to apply
+  std::shared_ptr<MemoryImage> m_diffImage;
+
+  bool range(uint16_t& start, uint16_t& end);
+  bool parseAddress(const QLineEdit& box, uint16_t& addr);
+};
@@ -0,0 +1,260 @@
+#include "MemoryImage.h"
+#include <algorithm>
+#include <QFile>
+
+namespace
+{
+int hexDigit(char c)
+{
+  if ((c >= '0') && (c <= '9'))
+  {
+    return c - '0';
+  }
+  if ((c >= 'A') && (c <= 'F'))
+  {
+    return c - 'A' + 10;
+  }
+  if ((c >= 'a') && (c <= 'f'))
+  {
+    return c - 'a' + 10;
+  }
+  return -1;
+}
+
+/**
+ * Decodes the hex digit pairs of a record (everything after its leading
+ * ':' or 'Sn') into bytes. Returns false if there are any stray characters.
+ */
+bool decodeRecord(const char* text, int len, uint8_t* bytes, int& count)
+{
+  if ((len % 2) != 0)
+  {
+    return false;
+  }
+  count = len / 2;
+  for (int i = 0; i < count; i++)
+  {
+    const int hi = hexDigit(text[i * 2]);
+    const int lo = hexDigit(text[(i * 2) + 1]);
+    if ((hi < 0) || (lo < 0))
+    {
+      return false;
+    }
+    bytes[i] = (hi << 4) | lo;
+  }
+  return true;
+}
+
+/**
+ * Calls the handler with each line of the text (without its line ending),
+ * stopping early if it returns false.
+ */
+template <typename Handler>
+bool forEachLine(const char* text, qint64 size, Handler handler)
+{
+  int lineNum = 0;
+  qint64 pos = 0;
+  while (pos < size)
+  {
+    qint64 end = pos;
+    while ((end < size) && (text[end] != '\n') && (text[end] != '\r'))
+    {
+      end++;
+    }
+    lineNum++;
+    if ((end > pos) && !handler(text + pos, static_cast<int>(end - pos), lineNum))
+    {
+      return false;
+    }
+    pos = end + 1;
+  }
+  return true;
+}
+}
+
+QString MemoryImage::formatName(Format format)
+{
+  switch (format)
+  {
+  case Format::IntelHex:
+    return "Intel HEX";
+  case Format::SRecord:
+    return "S-record";
+  default:
+    return "binary";
+  }
+}
+
+void MemoryImage::place(uint32_t addr, uint8_t val, uint16_t start, uint16_t end, ImportStats& stats)
+{
+  if ((addr >= start) && (addr <= end))
+  {
+    set(addr, val);
+    stats.bytes++;
+  }
+  else
+  {
+    stats.skipped++;
+  }
+}
+
+/**
+ * Reads a memory dump into the given address range (inclusive) of the image,
+ * leaving the rest of the image as it was. The file is mapped rather than
+ * read, so that large dumps of which only a small range is wanted don't have
+ * to be copied into memory.
+ */
+bool MemoryImage::import(const QString& path, uint16_t start, uint16_t end, ImportStats& stats, QString& error)
+{
+  QFile infile(path);
+  if (!infile.open(QIODevice::ReadOnly))
+  {
+    error = infile.errorString();
+    return false;
+  }
+
+  const qint64 size = infile.size();
+  const uchar* map = (size > 0) ? infile.map(0, size) : nullptr;
+  if (!map)
+  {
+    error = "File is empty or can't be mapped";
+    return false;
+  }
+
+  // Text formats may start with blank lines, but never with anything else
+  qint64 first = 0;
+  while ((first < size) && ((map[first] == '\r') || (map[first] == '\n')))
+  {
+    first++;
+  }
+
+  bool status = true;
+  const char* text = reinterpret_cast<const char*>(map);
+  if ((first < size) && (map[first] == ':'))
+  {
+    stats.format = Format::IntelHex;
+    status = importIntelHex(text, size, start, end, stats, error);
+  }
+  else if ((first + 1 < size) && (map[first] == 'S') && (map[first + 1] >= '0') && (map[first + 1] <= '9'))
+  {
+    stats.format = Format::SRecord;
+    status = importSRecord(text, size, start, end, stats, error);
+  }
+  else
+  {
+    stats.format = Format::Binary;
+    const qint64 len = std::min<qint64>(size, static_cast<qint64>(end) - start + 1);
+    for (qint64 i = 0; i < len; i++)
+    {
+      set(start + i, map[i]);
+    }
+    stats.bytes = len;
+    stats.skipped = size - len;
+  }
+
+  infile.unmap(const_cast<uchar*>(map));
+  return status;
+}
+
+bool MemoryImage::importIntelHex(const char* text, qint64 size, uint16_t start, uint16_t end, ImportStats& stats, QString& error)
+{
+  uint32_t baseAddr = 0;
+  bool done = false;
+  return forEachLine(text, size, [&](const char* line, int len, int lineNum)
+  {
+    uint8_t rec[0x110];
+    int count = 0;
+    if (done)
+    {
+      return true;
+    }
+    if ((line[0] != ':') || (len > 1 + 2 * static_cast<int>(sizeof(rec))) ||
+        !decodeRecord(line + 1, len - 1, rec, count) || (count < 5) || (count != rec[0] + 5))
+    {
+      error = QString("Malformed record on line %1").arg(lineNum);
+      return false;
+    }
+
+    uint8_t sum = 0;
+    for (int i = 0; i < count; i++)
+    {
+      sum += rec[i];
+    }
+    if (sum != 0)
+    {
+      error = QString("Bad checksum on line %1").arg(lineNum);
+      return false;
+    }
+
+    const uint16_t offset = (rec[1] << 8) | rec[2];
+    switch (rec[3])
+    {
+    case 0x00: // data
+      for (int i = 0; i < rec[0]; i++)
+      {
+        place(baseAddr + offset + i, rec[4 + i], start, end, stats);
+      }
+      break;
+    case 0x01: // end of file
+      done = true;
+      break;
+    case 0x02: // extended segment address
+      baseAddr = ((rec[4] << 8) | rec[5]) << 4;
+      break;
+    case 0x04: // extended linear address
+      baseAddr = static_cast<uint32_t>((rec[4] << 8) | rec[5]) << 16;
+      break;
+    default: // start addresses don't matter here
+      break;
+    }
+    return true;
+  });
+}
+
+bool MemoryImage::importSRecord(const char* text, qint64 size, uint16_t start, uint16_t end, ImportStats& stats, QString& error)
+{
+  return forEachLine(text, size, [&](const char* line, int len, int lineNum)
+  {
+    uint8_t rec[0x100];
+    int count = 0;
+    if ((len < 4) || (line[0] != 'S') || (len > 2 + 2 * static_cast<int>(sizeof(rec))) ||
+        !decodeRecord(line + 2, len - 2, rec, count) || (count != rec[0] + 1))
+    {
+      error = QString("Malformed record on line %1").arg(lineNum);
+      return false;
+    }
+
+    uint8_t sum = 0;
+    for (int i = 0; i < count; i++)
+    {
+      sum += rec[i];
+    }
+    if (sum != 0xff)
+    {
+      error = QString("Bad checksum on line %1").arg(lineNum);
+      return false;
+    }
+
+    // Only S1-S3 carry data; the address field is 2, 3 or 4 bytes long
+    const int type = line[1] - '0';
+    if ((type >= 1) && (type <= 3))
+    {
+      const int addrLen = type + 1;
+      if (count < 1 + addrLen + 1)
+      {
+        error = QString("Malformed record on line %1").arg(lineNum);
+        return false;
+      }
+      uint32_t addr = 0;
+      for (int i = 0; i < addrLen; i++)
+      {
+        addr = (addr << 8) | rec[1 + i];
+      }
+      for (int i = 1 + addrLen; i < count - 1; i++)
+      {
+        place(addr++, rec[i], start, end, stats);
+      }
+    }
+    return true;
+  });
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include <array>
+#include <bitset>
+#include <cstdint>
+#include <QString>
+
+/**
+ * Contents of (some of) an ECU's 64 KiB memory space, as imported from a
+ * dump or edited in the GUI. Only the bytes that have been set are written
+ * to the simulator, so an image can describe a single region as well as the
+ * whole space.
+ *
+ * Dumps may be raw binary, Intel HEX or Motorola S-records; the format is
+ * recognised from the content. A raw binary dump is placed at the start of
+ * the chosen address range, while the records of the text formats carry their
+ * own addresses. Either way, bytes that fall outside the range are skipped.
+ */
+class MemoryImage
+{
+public:
+  static constexpr int SIZE = 0x10000;
+
+  enum class Format
+  {
+    Binary,
+    IntelHex,
+    SRecord
+  };
+
+  struct ImportStats
+  {
+    Format format = Format::Binary;
+    int bytes = 0;
+    int skipped = 0;
+  };
+
+  uint8_t at(uint16_t addr) const { return m_bytes[addr]; }
+  bool isSet(uint16_t addr) const { return m_set[addr]; }
+  void set(uint16_t addr, uint8_t val) { m_bytes[addr] = val; m_set[addr] = true; }
+  void clear() { m_bytes.fill(0); m_set.reset(); }
+  int count() const { return m_set.count(); }
+
+  bool import(const QString& path, uint16_t start, uint16_t end, ImportStats& stats, QString& error);
+  static QString formatName(Format format);
+
+private:
+  std::array<uint8_t,SIZE> m_bytes {};
+  std::bitset<SIZE> m_set;
+
+  void place(uint32_t addr, uint8_t val, uint16_t start, uint16_t end, ImportStats& stats);
+  bool importIntelHex(const char* text, qint64 size, uint16_t start, uint16_t end, ImportStats& stats, QString& error);
+  bool importSRecord(const char* text, qint64 size, uint16_t start, uint16_t end, ImportStats& stats, QString& error);
+};
@@ -0,0 +1,664 @@
+#include "ModuleRunner.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <map>
+
+namespace
+{
+constexpr uint32_t MEMORY_SIZE = 0x200000;
+constexpr uint32_t MODULE_BASE = 0x1000;
+constexpr uint32_t STACK_SIZE = 0x10000;
+constexpr uint32_t IMPORT_CELL_SIZE = 0x40; // room for one entry per pipe
+constexpr uint32_t IMPORT_BASE = MEMORY_SIZE - STACK_SIZE - 0x1000;
+constexpr uint32_t TICKS_PER_SEC = 100;
+
+// How far virtual time may run ahead, and how many instructions may be
+// executed, while handling a single request before giving up on a reply
+constexpr uint64_t REQUEST_TIME_LIMIT_US = 10000000;
+constexpr uint64_t REQUEST_INSN_LIMIT = 50000000;
+constexpr uint64_t RUN_SLICE = 1000000;
+
+constexpr uint32_t ERROR = 0xffffffff;
+constexpr uint32_t FIONREAD = 1;
+
+struct DataImport
+{
+  const char* name;
+  int firstFd; // value of the first entry, or -1 for flags
+  bool perPipe;
+};
+}
+
+ModuleRunner::ModuleRunner(LogFunc log) :
+  m_log(log),
+  m_cpu(MEMORY_SIZE)
+{
+  m_cpu.setHostCallHandler([this](M68kCpu&, int index) { return callHost(index); });
+}
+
+/**
+ * Loads the module image and starts its _applModGestNNNN routine for the
+ * given pipe, running it until it first waits for a request. Returns false
+ * if the module can't be loaded or ends before it's ready.
+ */
+bool ModuleRunner::start(const QVector<quint8>& image, uint16_t ecuId, uint8_t pipe)
+{
+  static const std::map<std::string,HostFunction> s_functions = {
+    { "_read", HostFunction::Read },
+    { "_write", HostFunction::Write },
+    { "_ioctl", HostFunction::Ioctl },
+    { "_select", HostFunction::Select },
+    { "_taskDelay", HostFunction::TaskDelay },
+    { "_sysClkRateGet", HostFunction::SysClkRateGet },
+    { "_printf", HostFunction::Printf },
+    { "_sprintf", HostFunction::Sprintf },
+    { "_bzero", HostFunction::Bzero },
+    { "_bcopy", HostFunction::Bcopy },
+    { "_strlen", HostFunction::Strlen },
+    { "_abs", HostFunction::Abs },
+    { "_malloc", HostFunction::Malloc },
+    { "_free", HostFunction::Free }
+  };
+
+  static const DataImport s_dataImports[] = {
+    { "_applRun", -1, true },
+    { "_diagStRun", -1, true },
+    { "_fdLineaIso1", FD_LINE_ISO1, false },
+    { "_fdLineaIso2", FD_LINE_ISO2, false },
+    { "_fdPipeRxAppl", FD_PIPE_RX_APPL, true },
+    { "_fdPipeTxAppl", FD_PIPE_TX_APPL, true },
+    { "_fdPipeRxDiagSt", FD_PIPE_RX_DIAG_ST, true },
+    { "_fdPipeTxDiagSt", FD_PIPE_TX_DIAG_ST, true }
+  };
+
+  m_running = false;
+  m_ecuId = ecuId;
+  m_pipe = pipe;
+  m_rxMessages.clear();
+  m_txMessages.clear();
+  m_clockUs = 0;
+  m_cpu.reset();
+  memset(m_cpu.memory(0, MEMORY_SIZE), 0, MEMORY_SIZE);
+
+  // Host call 0 is where the module's entry routine returns to
+  m_hostFunctions.assign(1, HostFunction::TaskExit);
+  m_hostNames.assign(1, "exit");
+  m_loggedIgnored.clear();
+
+  std::map<std::string,uint32_t> dataAddrs;
+  const EcuModule::ImportResolver resolve = [&](const std::string& name) -> uint32_t
+  {
+    for (const DataImport& data : s_dataImports)
+    {
+      if (name == data.name)
+      {
+        dataAddrs[name] = IMPORT_BASE + (dataAddrs.size() * IMPORT_CELL_SIZE);
+        return dataAddrs[name];
+      }
+    }
+
+    const auto func = s_functions.find(name);
+    m_hostFunctions.push_back((func != s_functions.end()) ? func->second : HostFunction::Ignored);
+    m_hostNames.push_back(name);
+    return M68kCpu::hostCallAddress(m_hostFunctions.size() - 1);
+  };
+
+  if (!m_module.load(image.constData(), image.size(), m_cpu, MODULE_BASE, resolve))
+  {
+    m_log(QString("Unable to load module for ECU ID %1: %2").arg(ecuId, 4, 10, QChar('0')).arg(QString::fromStdString(m_module.error())));
+    return false;
+  }
+
+  for (const DataImport& data : s_dataImports)
+  {
+    const auto addr = dataAddrs.find(data.name);
+    if ((addr != dataAddrs.end()) && (data.firstFd >= 0))
+    {
+      const int count = data.perPipe ? (IMPORT_CELL_SIZE / 4) : 1;
+      for (int i = 0; i < count; i++)
+      {
+        m_cpu.write32(addr->second + (i * 4), data.firstFd + (data.perPipe ? i : 0));
+      }
+    }
+  }
+
+  char entryName[32];
+  snprintf(entryName, sizeof(entryName), "_applModGest%04d", ecuId);
+  const uint32_t entry = m_module.symbol(entryName);
+  if (entry == 0)
+  {
+    m_log(QString("Module for ECU ID %1 has no %2 routine").arg(ecuId, 4, 10, QChar('0')).arg(entryName));
+    return false;
+  }
+
+  m_heapNext = (m_module.end() + 15) & ~15u;
+  m_heapEnd = IMPORT_BASE;
+  m_cpu.setA(7, MEMORY_SIZE - 16);
+  m_cpu.push32(pipe);
+  m_cpu.push32(M68kCpu::hostCallAddress(0));
+  m_cpu.setPC(entry);
+  m_running = true;
+
+  // Let the module set up its line and get to the point of waiting for the
+  // first request
+  m_deadlineUs = m_clockUs + REQUEST_TIME_LIMIT_US;
+  const M68kCpu::Status status = m_cpu.run(REQUEST_INSN_LIMIT);
+  if (status == M68kCpu::Status::Fault)
+  {
+    stop(QString::fromStdString(m_cpu.faultMessage()));
+  }
+  else if (status == M68kCpu::Status::Stopped)
+  {
+    stop("its task ended during startup");
+  }
+  return m_running;
+}
+
+/**
+ * Passes a request frame to the module through its receive pipe and runs the
+ * module until it writes a reply frame to its transmit pipe. Every frame
+ * that the module wrote is returned in replies, in order, and the virtual
+ * time that it took in elapsedMs. Returns false if no reply was produced.
+ * timedOut() tells whether the module was still waiting when the time limit
+ * for the request was reached.
+ */
+bool ModuleRunner::request(const uint8_t* frame, int len, std::vector<QByteArray>& replies, uint32_t& elapsedMs)
+{
+  if (!m_running)
+  {
+    return false;
+  }
+
+  m_request = QByteArray(reinterpret_cast<const char*>(frame), len);
+  m_rxMessages.push_back(m_request);
+  m_txMessages.clear();
+  m_lineQueried[0] = -1;
+  m_lineQueried[1] = -1;
+  m_timedOut = false;
+  const uint64_t startUs = m_clockUs;
+  m_deadlineUs = startUs + REQUEST_TIME_LIMIT_US;
+
+  uint64_t executed = 0;
+  M68kCpu::Status status = M68kCpu::Status::Running;
+  while ((status == M68kCpu::Status::Running) && (executed < REQUEST_INSN_LIMIT))
+  {
+    const uint64_t before = m_cpu.instructionCount();
+    status = m_cpu.run(RUN_SLICE);
+    executed += m_cpu.instructionCount() - before;
+  }
+
+  if (status == M68kCpu::Status::Fault)
+  {
+    stop(QString::fromStdString(m_cpu.faultMessage()));
+  }
+  else if (status == M68kCpu::Status::Stopped)
+  {
+    stop("its task ended");
+  }
+  else if (status == M68kCpu::Status::Running)
+  {
+    m_log(QString("Module for ECU ID %1 is still running after %2 instructions")
+          .arg(m_ecuId, 4, 10, QChar('0')).arg(executed));
+  }
+
+  if (!m_printfLine.isEmpty())
+  {
+    print("\n");
+  }
+
+  elapsedMs = (m_clockUs - startUs) / 1000;
+  replies.swap(m_txMessages);
+  m_txMessages.clear();
+  return !replies.empty();
+}
+
+/**
+ * Supplies bytes that the module will find waiting on an ISO line (1 or 2).
+ */
+void ModuleRunner::lineReceive(int line, const QByteArray& bytes)
+{
+  if ((line == 1) || (line == 2))
+  {
+    m_lineIn[line - 1].append(bytes);
+  }
+}
+
+/**
+ * Returns (and clears) whatever the module has sent on an ISO line (1 or 2).
+ */
+QByteArray ModuleRunner::takeLineOutput(int line)
+{
+  QByteArray out;
+  if ((line == 1) || (line == 2))
+  {
+    out.swap(m_lineOut[line - 1]);
+  }
+  return out;
+}
+
+void ModuleRunner::stop(const QString& reason)
+{
+  m_running = false;
+  m_log(QString("Module for ECU ID %1 stopped: %2").arg(m_ecuId, 4, 10, QChar('0')).arg(reason));
+}
+
+M68kCpu::HostResult ModuleRunner::callHost(int index)
+{
+  if ((index < 0) || (index >= static_cast<int>(m_hostFunctions.size())))
+  {
+    m_cpu.fault("Call to an unknown host address");
+    return M68kCpu::HostResult::Stop;
+  }
+
+  M68kCpu& cpu = m_cpu;
+  switch (m_hostFunctions[index])
+  {
+  case HostFunction::TaskExit:
+    return M68kCpu::HostResult::Stop;
+  case HostFunction::Read:
+    return hostRead();
+  case HostFunction::Write:
+    return hostWrite();
+  case HostFunction::Select:
+    return hostSelect();
+  case HostFunction::TaskDelay:
+    return hostTaskDelay();
+  case HostFunction::Ioctl:
+    cpu.setD(0, 0);
+    if (cpu.stackArg(1) == FIONREAD)
+    {
+      answerLine(cpu.stackArg(0));
+      cpu.write32(cpu.stackArg(2), bytesAvailable(cpu.stackArg(0)));
+    }
+    break;
+  case HostFunction::SysClkRateGet:
+    cpu.setD(0, TICKS_PER_SEC);
+    break;
+  case HostFunction::Printf:
+    print(format(cpu.stackArg(0), 1));
+    cpu.setD(0, 0);
+    break;
+  case HostFunction::Sprintf:
+  {
+    const std::string text = format(cpu.stackArg(1), 2);
+    uint8_t* dest = cpu.memory(cpu.stackArg(0), text.size() + 1);
+    if (dest)
+    {
+      memcpy(dest, text.c_str(), text.size() + 1);
+    }
+    cpu.setD(0, text.size());
+    break;
+  }
+  case HostFunction::Bzero:
+  {
+    uint8_t* dest = cpu.memory(cpu.stackArg(0), cpu.stackArg(1));
+    if (dest)
+    {
+      memset(dest, 0, cpu.stackArg(1));
+    }
+    break;
+  }
+  case HostFunction::Bcopy:
+  {
+    const uint8_t* src = cpu.memory(cpu.stackArg(0), cpu.stackArg(2));
+    uint8_t* dest = cpu.memory(cpu.stackArg(1), cpu.stackArg(2));
+    if (src && dest)
+    {
+      memmove(dest, src, cpu.stackArg(2));
+    }
+    break;
+  }
+  case HostFunction::Strlen:
+    cpu.setD(0, readString(cpu.stackArg(0), MEMORY_SIZE).size());
+    break;
+  case HostFunction::Abs:
+  {
+    const int32_t val = static_cast<int32_t>(cpu.stackArg(0));
+    cpu.setD(0, (val < 0) ? -val : val);
+    break;
+  }
+  case HostFunction::Malloc:
+  {
+    const uint32_t size = (cpu.stackArg(0) + 15) & ~15u;
+    if (size <= m_heapEnd - m_heapNext)
+    {
+      cpu.setD(0, m_heapNext);
+      m_heapNext += size;
+    }
+    else
+    {
+      cpu.setD(0, 0);
+    }
+    break;
+  }
+  case HostFunction::Free:
+    break;
+  case HostFunction::Ignored:
+    if (m_loggedIgnored.insert(m_hostNames[index]).second)
+    {
+      m_log(QString("Module called %1, which is not emulated").arg(QString::fromStdString(m_hostNames[index])));
+    }
+    cpu.setD(0, 0);
+    break;
+  }
+
+  return (cpu.status() == M68kCpu::Status::Fault) ? M68kCpu::HostResult::Stop : M68kCpu::HostResult::Return;
+}
+
+/**
+ * Returns the number of bytes that a read() of the descriptor would get.
+ */
+int ModuleRunner::bytesAvailable(int fd) const
+{
+  if (fd == FD_PIPE_RX_APPL + m_pipe)
+  {
+    return m_rxMessages.empty() ? 0 : m_rxMessages.front().size();
+  }
+  else if ((fd == FD_LINE_ISO1) || (fd == FD_LINE_ISO2))
+  {
+    return m_lineIn[fd - FD_LINE_ISO1].size();
+  }
+  return 0;
+}
+
+/**
+ * Asks the line model for the ECU's answer if the module is about to look for
+ * bytes on an ISO line that has none, and puts the answer on the line. The
+ * model is asked once per request even if nothing has been sent (so that it
+ * can supply a keyword after a line init), and again whenever more has been
+ * sent since.
+ */
+void ModuleRunner::answerLine(int fd)
+{
+  if (!m_lineModel || ((fd != FD_LINE_ISO1) && (fd != FD_LINE_ISO2)))
+  {
+    return;
+  }
+
+  const int index = fd - FD_LINE_ISO1;
+  QByteArray& unanswered = m_lineUnanswered[index];
+  if (!m_lineIn[index].isEmpty() || (m_lineQueried[index] == unanswered.size()))
+  {
+    return;
+  }
+
+  m_lineQueried[index] = unanswered.size();
+  const QByteArray answer = m_lineModel(m_request, index + 1, unanswered);
+  if (!answer.isEmpty())
+  {
+    unanswered.clear();
+    m_lineQueried[index] = 0;
+    m_lineIn[index].append(answer);
+  }
+}
+
+/**
+ * Advances the clock for a wait of the given length, unless that would go
+ * past the deadline for the current request (in which case the module is
+ * left blocked in the wait, to be resumed by the next request).
+ */
+bool ModuleRunner::waitFor(uint64_t durationUs)
+{
+  if (!m_txMessages.empty())
+  {
+    return false;
+  }
+  if (m_clockUs + durationUs > m_deadlineUs)
+  {
+    m_timedOut = true;
+    return false;
+  }
+  m_clockUs += durationUs;
+  return true;
+}
+
+M68kCpu::HostResult ModuleRunner::hostRead()
+{
+  const int fd = m_cpu.stackArg(0);
+  const uint32_t bufAddr = m_cpu.stackArg(1);
+  const uint32_t maxLen = m_cpu.stackArg(2);
+
+  QByteArray data;
+  if (fd == FD_PIPE_RX_APPL + m_pipe)
+  {
+    // Each read takes one whole message off a pipe
+    if (m_rxMessages.empty())
+    {
+      return M68kCpu::HostResult::Block;
+    }
+    data = m_rxMessages.front().left(maxLen);
+    m_rxMessages.erase(m_rxMessages.begin());
+  }
+  else if ((fd == FD_LINE_ISO1) || (fd == FD_LINE_ISO2))
+  {
+    answerLine(fd);
+    QByteArray& lineIn = m_lineIn[fd - FD_LINE_ISO1];
+    if (lineIn.isEmpty())
+    {
+      return M68kCpu::HostResult::Block;
+    }
+    data = lineIn.left(maxLen);
+    lineIn.remove(0, data.size());
+  }
+  else
+  {
+    m_cpu.setD(0, ERROR);
+    return M68kCpu::HostResult::Return;
+  }
+
+  uint8_t* dest = m_cpu.memory(bufAddr, data.size());
+  if (dest)
+  {
+    memcpy(dest, data.constData(), data.size());
+  }
+  m_cpu.setD(0, data.size());
+  return M68kCpu::HostResult::Return;
+}
+
+M68kCpu::HostResult ModuleRunner::hostWrite()
+{
+  const int fd = m_cpu.stackArg(0);
+  const uint32_t len = m_cpu.stackArg(2);
+  const uint8_t* src = m_cpu.memory(m_cpu.stackArg(1), len);
+  if (!src)
+  {
+    m_cpu.setD(0, ERROR);
+    return M68kCpu::HostResult::Return;
+  }
+
+  // Modules don't all index the transmit pipe array by pipe number (some
+  // use the line number), so any of its entries is taken as the reply pipe
+  const QByteArray data(reinterpret_cast<const char*>(src), len);
+  if ((fd >= FD_PIPE_TX_APPL) && (fd < FD_PIPE_TX_APPL + 0x10))
+  {
+    m_txMessages.push_back(data);
+  }
+  else if ((fd == FD_LINE_ISO1) || (fd == FD_LINE_ISO2))
+  {
+    m_lineOut[fd - FD_LINE_ISO1].append(data);
+    m_lineUnanswered[fd - FD_LINE_ISO1].append(data);
+  }
+  m_cpu.setD(0, len);
+  return M68kCpu::HostResult::Return;
+}
+
+/**
+ * select() on the pipes and lines. Descriptor sets are arrays of 32-bit
+ * words, as VxWorks lays them out. Writes never block, so any descriptor in
+ * the write set is always ready.
+ */
+M68kCpu::HostResult ModuleRunner::hostSelect()
+{
+  const int numFds = std::min<uint32_t>(m_cpu.stackArg(0), 0x100);
+  const uint32_t readFds = m_cpu.stackArg(1);
+  const uint32_t writeFds = m_cpu.stackArg(2);
+  const uint32_t exceptFds = m_cpu.stackArg(3);
+  const uint32_t timeout = m_cpu.stackArg(4);
+  const int numWords = (numFds + 31) / 32;
+
+  int ready = 0;
+  std::vector<uint32_t> readyRead(numWords, 0);
+  std::vector<uint32_t> readyWrite(numWords, 0);
+  for (int fd = 0; fd < numFds; fd++)
+  {
+    const uint32_t bit = 1u << (fd % 32);
+    if (readFds && (m_cpu.read32(readFds + ((fd / 32) * 4)) & bit))
+    {
+      answerLine(fd);
+      if (bytesAvailable(fd) > 0)
+      {
+        readyRead[fd / 32] |= bit;
+        ready++;
+      }
+    }
+    if (writeFds && (m_cpu.read32(writeFds + ((fd / 32) * 4)) & bit))
+    {
+      readyWrite[fd / 32] |= bit;
+      ready++;
+    }
+  }
+
+  if (ready == 0)
+  {
+    if (!timeout)
+    {
+      return M68kCpu::HostResult::Block;
+    }
+    const uint64_t durationUs = (static_cast<uint64_t>(m_cpu.read32(timeout)) * 1000000) + m_cpu.read32(timeout + 4);
+    if (!waitFor(durationUs))
+    {
+      return M68kCpu::HostResult::Block;
+    }
+  }
+
+  for (int i = 0; i < numWords; i++)
+  {
+    if (readFds)
+    {
+      m_cpu.write32(readFds + (i * 4), readyRead[i]);
+    }
+    if (writeFds)
+    {
+      m_cpu.write32(writeFds + (i * 4), readyWrite[i]);
+    }
+    if (exceptFds)
+    {
+      m_cpu.write32(exceptFds + (i * 4), 0);
+    }
+  }
+  m_cpu.setD(0, ready);
+  return M68kCpu::HostResult::Return;
+}
+
+M68kCpu::HostResult ModuleRunner::hostTaskDelay()
+{
+  const int32_t ticks = static_cast<int32_t>(m_cpu.stackArg(0));
+  if ((ticks > 0) && !waitFor((static_cast<uint64_t>(ticks) * 1000000) / TICKS_PER_SEC))
+  {
+    return M68kCpu::HostResult::Block;
+  }
+  m_cpu.setD(0, 0);
+  return M68kCpu::HostResult::Return;
+}
+
+std::string ModuleRunner::readString(uint32_t addr, uint32_t maxLen)
+{
+  std::string str;
+  while ((str.size() < maxLen) && (addr < MEMORY_SIZE))
+  {
+    const char c = static_cast<char>(m_cpu.read8(addr++));
+    if (c == 0)
+    {
+      break;
+    }
+    str += c;
+  }
+  return str;
+}
+
+/**
+ * Formats a printf-style string from the module, taking the arguments from
+ * the stack starting at the given argument index. Every argument is a 32-bit
+ * stack slot, so the 'l' and 'h' modifiers make no difference.
+ */
+std::string ModuleRunner::format(uint32_t fmtAddr, int firstArg)
+{
+  const std::string fmt = readString(fmtAddr, 1024);
+  std::string out;
+  int arg = firstArg;
+
+  for (size_t i = 0; i < fmt.size(); i++)
+  {
+    if ((fmt[i] != '%') || (i + 1 >= fmt.size()))
+    {
+      out += fmt[i];
+      continue;
+    }
+
+    std::string spec = "%";
+    i++;
+    while ((i < fmt.size()) && strchr("-+ #0123456789.", fmt[i]))
+    {
+      spec += fmt[i++];
+    }
+    while ((i < fmt.size()) && strchr("lh", fmt[i]))
+    {
+      i++;
+    }
+    if (i >= fmt.size())
+    {
+      break;
+    }
+
+    char buf[256];
+    const char conv = fmt[i];
+    if (conv == '%')
+    {
+      out += '%';
+      continue;
+    }
+    else if (conv == 's')
+    {
+      const std::string str = readString(m_cpu.stackArg(arg++), 512);
+      snprintf(buf, sizeof(buf), (spec + 's').c_str(), str.c_str());
+    }
+    else if ((conv == 'd') || (conv == 'i') || (conv == 'c'))
+    {
+      snprintf(buf, sizeof(buf), (spec + conv).c_str(), static_cast<int32_t>(m_cpu.stackArg(arg++)));
+    }
+    else if (strchr("uxXop", conv))
+    {
+      snprintf(buf, sizeof(buf), (spec + ((conv == 'p') ? 'x' : conv)).c_str(), m_cpu.stackArg(arg++));
+    }
+    else
+    {
+      snprintf(buf, sizeof(buf), "%%%c", conv);
+    }
+    out += buf;
+  }
+  return out;
+}
+
+/**
+ * Sends the module's console output to the log a line at a time.
+ */
+void ModuleRunner::print(const std::string& text)
+{
+  for (char c : text)
+  {
+    if (c == '\n')
+    {
+      if (!m_printfLine.trimmed().isEmpty())
+      {
+        m_log(QString("Module: %1").arg(QString::fromLatin1(m_printfLine.trimmed())));
+      }
+      m_printfLine.clear();
+    }
+    else if (c != '\r')
+    {
+      m_printfLine.append(c);
+    }
+  }
+}
+
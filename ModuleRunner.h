@@ -0,0 +1,127 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <set>
+#include <string>
+#include <vector>
+#include <QByteArray>
+#include <QString>
+#include <QVector>
+#include "EcuModule.h"
+#include "M68kCpu.h"
+
+/**
+ * Runs one of the Tester's ECU application modules (_applModGestNNNN) in an
+ * emulated 68k, in place of a hand-written protocol handler. The module sees
+ * a small VxWorks environment: the pipes between the Tester's main program
+ * and the module, the two ISO lines, the clock, and the handful of C library
+ * routines that modules link against. GUI routines (used only by the modules
+ * that run standalone on the tablet) are accepted and ignored.
+ *
+ * The pipes carry SD2 frames verbatim: the module reads each request frame
+ * from its receive pipe and writes the reply frame to its transmit pipe.
+ * Time is virtual. Whenever the module waits with a timeout and nothing is
+ * ready, the clock jumps ahead to the end of the wait, so a request that
+ * would take a few seconds of line timeouts on the real Tester is answered
+ * in microseconds (the virtual time taken is reported with the reply).
+ *
+ * The ECU at the other end of the ISO line is left to the line model set with
+ * setLineModel(). When the module waits for bytes on a line that has none,
+ * the model is given the request being handled and whatever the module has
+ * sent on that line since it was last answered, and what it returns is put
+ * on the line. Bytes sent on the lines are also collected for logging.
+ */
+class ModuleRunner
+{
+public:
+  typedef std::function<void(const QString&)> LogFunc;
+  typedef std::function<QByteArray(const QByteArray& request, int line, const QByteArray& sent)> LineFunc;
+
+  explicit ModuleRunner(LogFunc log);
+
+  bool start(const QVector<quint8>& image, uint16_t ecuId, uint8_t pipe);
+  bool running() const { return m_running; }
+  uint16_t ecuId() const { return m_ecuId; }
+
+  void setLineModel(LineFunc model) { m_lineModel = model; }
+  bool request(const uint8_t* frame, int len, std::vector<QByteArray>& replies, uint32_t& elapsedMs);
+  bool timedOut() const { return m_timedOut; }
+  void lineReceive(int line, const QByteArray& bytes);
+  QByteArray takeLineOutput(int line);
+
+private:
+  enum class HostFunction
+  {
+    TaskExit,
+    Read,
+    Write,
+    Ioctl,
+    Select,
+    TaskDelay,
+    SysClkRateGet,
+    Printf,
+    Sprintf,
+    Bzero,
+    Bcopy,
+    Strlen,
+    Abs,
+    Malloc,
+    Free,
+    Ignored
+  };
+
+  // File descriptors as the module sees them. Each pipe array has an entry
+  // per SD2 pipe number, of which only the module's own is ever used.
+  static constexpr int FD_LINE_ISO1 = 3;
+  static constexpr int FD_LINE_ISO2 = 4;
+  static constexpr int FD_PIPE_RX_APPL = 0x20;
+  static constexpr int FD_PIPE_TX_APPL = 0x30;
+  static constexpr int FD_PIPE_RX_DIAG_ST = 0x40;
+  static constexpr int FD_PIPE_TX_DIAG_ST = 0x50;
+
+  LogFunc m_log;
+  LineFunc m_lineModel;
+  M68kCpu m_cpu;
+  EcuModule m_module;
+  std::vector<HostFunction> m_hostFunctions;
+  std::vector<std::string> m_hostNames;
+  std::set<std::string> m_loggedIgnored;
+  uint32_t m_heapNext = 0;
+  uint32_t m_heapEnd = 0;
+
+  bool m_running = false;
+  uint16_t m_ecuId = 0;
+  uint8_t m_pipe = 0;
+  std::vector<QByteArray> m_rxMessages;
+  std::vector<QByteArray> m_txMessages;
+  QByteArray m_lineIn[2];
+  QByteArray m_lineOut[2];
+  QByteArray m_request;
+
+  // Bytes sent on each line that the line model hasn't answered yet, and
+  // how many of them it was last given (-1 if it hasn't been asked during
+  // the current request)
+  QByteArray m_lineUnanswered[2];
+  int m_lineQueried[2] = { -1, -1 };
+  QByteArray m_printfLine;
+
+  // Virtual time, and the limit on how far it may run ahead while one
+  // request is being handled
+  uint64_t m_clockUs = 0;
+  uint64_t m_deadlineUs = 0;
+  bool m_timedOut = false;
+
+  M68kCpu::HostResult callHost(int index);
+  M68kCpu::HostResult hostRead();
+  M68kCpu::HostResult hostWrite();
+  M68kCpu::HostResult hostSelect();
+  M68kCpu::HostResult hostTaskDelay();
+  int bytesAvailable(int fd) const;
+  void answerLine(int fd);
+  bool waitFor(uint64_t durationUs);
+  std::string readString(uint32_t addr, uint32_t maxLen);
+  std::string format(uint32_t fmtAddr, int firstArg);
+  void print(const std::string& text);
+  void stop(const QString& reason);
+};
+
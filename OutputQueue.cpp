@@ -0,0 +1,106 @@
+#include "OutputQueue.h"
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+namespace
+{
+  constexpr int MAX_IOVECS = 64;
+}
+
+void OutputQueue::push(const Frame& frame)
+{
+  if (frame && !frame->empty())
+  {
+    m_frames.push_back(frame);
+    m_pendingBytes += frame->size();
+  }
+}
+
+void OutputQueue::clear()
+{
+  m_frames.clear();
+  m_head = 0;
+  m_headOffset = 0;
+  m_pendingBytes = 0;
+}
+
+/**
+ * Retires the frame at the head of the queue. Once the queue is empty, the
+ * vector is reset (keeping its capacity); if it never quite empties, the
+ * retired entries are dropped once they make up half of it.
+ */
+void OutputQueue::popFront()
+{
+  m_frames[m_head++].reset();
+  m_headOffset = 0;
+  if (m_head == m_frames.size())
+  {
+    m_frames.clear();
+    m_head = 0;
+  }
+  else if (m_head >= m_frames.size() / 2)
+  {
+    m_frames.erase(m_frames.begin(), m_frames.begin() + m_head);
+    m_head = 0;
+  }
+}
+
+/**
+ * Writes as much of the queue as the socket will take, gathering up to
+ * MAX_IOVECS frames into each call. Returns Done if the queue was emptied,
+ * WouldBlock if the socket's buffer filled first (the caller should wait
+ * for it to become writable), or Error if the connection failed.
+ */
+OutputQueue::FlushResult OutputQueue::flush(int fd)
+{
+  while (!empty())
+  {
+    struct iovec iov[MAX_IOVECS];
+    int iovCount = 0;
+    for (auto frame = m_frames.begin() + m_head; (frame != m_frames.end()) && (iovCount < MAX_IOVECS); ++frame)
+    {
+      const size_t offset = (iovCount == 0) ? m_headOffset : 0;
+      iov[iovCount].iov_base = const_cast<uint8_t*>((*frame)->data() + offset);
+      iov[iovCount].iov_len = (*frame)->size() - offset;
+      iovCount++;
+    }
+
+    struct msghdr msg = {};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = iovCount;
+
+    // MSG_NOSIGNAL, so that a closed connection is reported as an error
+    // rather than by SIGPIPE
+    ssize_t written = sendmsg(fd, &msg, MSG_NOSIGNAL);
+    if (written < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      return ((errno == EAGAIN) || (errno == EWOULDBLOCK)) ? FlushResult::WouldBlock : FlushResult::Error;
+    }
+
+    // Retire the frames that were written completely, and note how far we
+    // got into the one that wasn't
+    m_pendingBytes -= written;
+    while (written > 0)
+    {
+      const size_t remaining = m_frames[m_head]->size() - m_headOffset;
+      if (static_cast<size_t>(written) >= remaining)
+      {
+        written -= remaining;
+        popFront();
+      }
+      else
+      {
+        m_headOffset += written;
+        written = 0;
+      }
+    }
+  }
+
+  return FlushResult::Done;
+}
+
@@ -0,0 +1,49 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/**
+ * Queue of complete frames waiting to be written to the (non-blocking)
+ * socket. Frames are shared rather than copied, so a periodic frame can be
+ * queued any number of times from the same buffer, and the queue is flushed
+ * with as few vectored writes as possible. A frame that is only partly
+ * written stays at the head of the queue until the rest can be sent. The
+ * queue is a vector that is consumed from the front and reset whenever it
+ * empties, so it stops allocating once it has grown to its working size.
+ *
+ * When the other side stops reading, the queue grows until it is congested,
+ * at which point the listening thread stops taking in new requests (and
+ * stops collecting scheduled frames) until it drains. Nothing is dropped.
+ */
+class OutputQueue
+{
+public:
+  typedef std::shared_ptr<const std::vector<uint8_t>> Frame;
+
+  enum class FlushResult
+  {
+    Done,
+    WouldBlock,
+    Error
+  };
+
+  static constexpr size_t CONGESTED_BYTES = 64 * 1024;
+
+  void push(const Frame& frame);
+  FlushResult flush(int fd);
+  void clear();
+  bool empty() const { return m_head == m_frames.size(); }
+  size_t pendingBytes() const { return m_pendingBytes; }
+  bool congested() const { return m_pendingBytes >= CONGESTED_BYTES; }
+
+private:
+  std::vector<Frame> m_frames;
+  size_t m_head = 0;
+  size_t m_headOffset = 0;
+  size_t m_pendingBytes = 0;
+
+  void popFront();
+};
+
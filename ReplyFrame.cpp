@@ -0,0 +1,73 @@
+#include "ReplyFrame.h"
+#include <string.h>
+
+ReplyFrame::ReplyFrame() :
+  m_buf(CAPACITY, 0)
+{
+}
+
+/**
+ * Starts a new reply from a copy of the request, as the Tester does. The
+ * request is assumed to be no larger than the frame's capacity.
+ */
+void ReplyFrame::start(const uint8_t* request, int len)
+{
+  m_overflowed = false;
+  put(0, request, len);
+}
+
+/**
+ * Sets the frame's length field (the number of bytes after the prefix).
+ */
+void ReplyFrame::setLength(int len)
+{
+  if ((len < 0) || (len >= CAPACITY))
+  {
+    m_overflowed = true;
+    len = (len < 0) ? 0 : (CAPACITY - 1);
+  }
+  m_buf[1] = (len >> 8) & 0xff;
+  m_buf[2] = len & 0xff;
+}
+
+bool ReplyFrame::fits(int pos, int count)
+{
+  if ((pos < 0) || (count < 0) || (pos + count > CAPACITY))
+  {
+    m_overflowed = true;
+    return false;
+  }
+  return true;
+}
+
+void ReplyFrame::put(int pos, const void* src, int count)
+{
+  if (fits(pos, count))
+  {
+    memcpy(m_buf.data() + pos, src, count);
+  }
+}
+
+void ReplyFrame::fill(int pos, uint8_t val, int count)
+{
+  if (fits(pos, count))
+  {
+    memset(m_buf.data() + pos, val, count);
+  }
+}
+
+uint8_t& ReplyFrame::operator[](int pos)
+{
+  if (fits(pos, 1))
+  {
+    return m_buf[pos];
+  }
+  m_discard = 0;
+  return m_discard;
+}
+
+uint8_t ReplyFrame::operator[](int pos) const
+{
+  return ((pos >= 0) && (pos < CAPACITY)) ? m_buf[pos] : 0;
+}
+
@@ -0,0 +1,41 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+/**
+ * Output buffer in which the command handlers build their reply frames. It
+ * is large enough for any frame that the SD2 header's 16-bit length can
+ * describe, and every access is checked against that capacity: a write past
+ * the end is discarded (and noted) rather than corrupting memory.
+ *
+ * Handlers index the frame as they would a byte array, and set its length
+ * with setLength() so that both bytes of the length field are filled in.
+ */
+class ReplyFrame
+{
+public:
+  static constexpr int CAPACITY = 0x10000;
+
+  ReplyFrame();
+
+  void start(const uint8_t* request, int len);
+  void setLength(int len);
+  int length() const { return (m_buf[1] << 8) | m_buf[2]; }
+  int size() const { return length() + 1; }
+  const uint8_t* data() const { return m_buf.data(); }
+  bool overflowed() const { return m_overflowed; }
+
+  void put(int pos, const void* src, int count);
+  void fill(int pos, uint8_t val, int count);
+
+  uint8_t& operator[](int pos);
+  uint8_t operator[](int pos) const;
+
+private:
+  std::vector<uint8_t> m_buf;
+  uint8_t m_discard = 0;
+  bool m_overflowed = false;
+
+  bool fits(int pos, int count);
+};
+
@@ -0,0 +1,277 @@
+#include "SampleStream.h"
+#include <algorithm>
+#include <cmath>
+#include <string.h>
+#include <QByteArray>
+#include <QList>
+#include <QtEndian>
+
+namespace
+{
+  const char* const BINARY_MAGIC = "SD2L";
+  constexpr uint16_t BINARY_VERSION = 1;
+  constexpr int BINARY_HEADER_SIZE = 12;
+  constexpr int BINARY_CHANNEL_SIZE = 12;
+  constexpr int KIND_RAM = 0;
+  constexpr int KIND_VALUE = 1;
+}
+
+/**
+ * Opens a recorded log. Binary logs are mapped into memory and read in place;
+ * CSV logs are mapped, parsed into per-channel sample arrays, and unmapped.
+ */
+bool SampleStream::open(const QString& path)
+{
+  m_file.setFileName(path);
+  if (!m_file.open(QIODevice::ReadOnly))
+  {
+    return false;
+  }
+
+  const qint64 size = m_file.size();
+  m_map = (size > 0) ? m_file.map(0, size) : nullptr;
+  if (!m_map)
+  {
+    return false;
+  }
+
+  m_ramChannels.assign(0x10000, -1);
+  m_valueChannels.assign(0x100, -1);
+
+  bool status = false;
+  if ((size >= BINARY_HEADER_SIZE) && (memcmp(m_map, BINARY_MAGIC, 4) == 0))
+  {
+    status = openBinary(size);
+  }
+  else
+  {
+    status = openCSV(size);
+    m_file.unmap(const_cast<uchar*>(m_map));
+    m_map = nullptr;
+    m_file.close();
+  }
+
+  for (const Channel& channel : m_channels)
+  {
+    if ((channel.count > 0) && (channel.samples[channel.count - 1].timeMs > m_durationMs))
+    {
+      m_durationMs = channel.samples[channel.count - 1].timeMs;
+    }
+  }
+
+  return status && !m_channels.empty();
+}
+
+int32_t SampleStream::addChannel(int kind, uint16_t id)
+{
+  std::vector<int32_t>& index = (kind == KIND_RAM) ? m_ramChannels : m_valueChannels;
+  if (index[id] < 0)
+  {
+    index[id] = m_channels.size();
+    m_channels.push_back(Channel());
+  }
+  return index[id];
+}
+
+bool SampleStream::openBinary(qint64 size)
+{
+#if Q_BYTE_ORDER != Q_LITTLE_ENDIAN
+  // Samples are read in place, so they must already be in host byte order
+  return false;
+#endif
+
+  const uint16_t version = qFromLittleEndian<quint16>(m_map + 4);
+  const uint32_t channelCount = qFromLittleEndian<quint32>(m_map + 8);
+  if ((version != BINARY_VERSION) ||
+      (BINARY_HEADER_SIZE + (static_cast<qint64>(channelCount) * BINARY_CHANNEL_SIZE) > size))
+  {
+    return false;
+  }
+
+  for (uint32_t i = 0; i < channelCount; i++)
+  {
+    const uchar* chan = m_map + BINARY_HEADER_SIZE + (i * BINARY_CHANNEL_SIZE);
+    const int kind = chan[0];
+    const uint16_t id = qFromLittleEndian<quint16>(chan + 2);
+    const uint32_t count = qFromLittleEndian<quint32>(chan + 4);
+    const uint32_t offset = qFromLittleEndian<quint32>(chan + 8);
+
+    if (((kind != KIND_RAM) && (kind != KIND_VALUE)) ||
+        ((kind == KIND_VALUE) && (id > 0xff)) ||
+        ((offset % alignof(Sample)) != 0) ||
+        (offset + (static_cast<qint64>(count) * static_cast<qint64>(sizeof(Sample))) > size))
+    {
+      return false;
+    }
+
+    // Samples are looked up by time with a binary search, so a channel that
+    // isn't sorted by time can't be used
+    const Sample* samples = reinterpret_cast<const Sample*>(m_map + offset);
+    for (uint32_t j = 1; j < count; j++)
+    {
+      if (samples[j].timeMs < samples[j - 1].timeMs)
+      {
+        return false;
+      }
+    }
+
+    Channel& channel = m_channels[addChannel(kind, id)];
+    channel.samples = samples;
+    channel.count = count;
+    channel.cursor = 0;
+  }
+
+  return true;
+}
+
+bool SampleStream::openCSV(qint64 size)
+{
+  const QByteArray text = QByteArray::fromRawData(reinterpret_cast<const char*>(m_map), size);
+  int lineStart = 0;
+
+  while (lineStart < text.size())
+  {
+    int lineEnd = text.indexOf('\n', lineStart);
+    lineEnd = (lineEnd < 0) ? text.size() : lineEnd;
+    const QList<QByteArray> fields = text.mid(lineStart, lineEnd - lineStart).trimmed().split(',');
+    lineStart = lineEnd + 1;
+
+    if (fields.size() != 3)
+    {
+      continue;
+    }
+
+    bool timeOK = false;
+    bool idOK = false;
+    bool valueOK = false;
+    const double timeSec = fields[0].trimmed().toDouble(&timeOK);
+    const QByteArray channelName = fields[1].trimmed().toLower();
+    const double value = fields[2].trimmed().toDouble(&valueOK);
+
+    int kind = -1;
+    uint32_t id = 0;
+    if (channelName.startsWith("ram:"))
+    {
+      kind = KIND_RAM;
+      id = channelName.mid(4).toUInt(&idOK, 0);
+      idOK = idOK && (id <= 0xffff);
+    }
+    else if (channelName.startsWith("value:"))
+    {
+      kind = KIND_VALUE;
+      id = channelName.mid(6).toUInt(&idOK, 0);
+      idOK = idOK && (id <= 0xff);
+    }
+
+    if ((kind < 0) || !timeOK || !idOK || !valueOK || (timeSec < 0))
+    {
+      continue;
+    }
+
+    const size_t channelIndex = addChannel(kind, id);
+    if (m_parsedSamples.size() <= channelIndex)
+    {
+      m_parsedSamples.resize(channelIndex + 1);
+    }
+    const double clamped = std::min(std::max(std::round(value), 0.0), 4294967295.0);
+    m_parsedSamples[channelIndex].push_back({ static_cast<uint32_t>(std::llround(timeSec * 1000.0)),
+                                              static_cast<uint32_t>(clamped) });
+  }
+
+  for (size_t i = 0; i < m_parsedSamples.size(); i++)
+  {
+    std::vector<Sample>& samples = m_parsedSamples[i];
+    std::stable_sort(samples.begin(), samples.end(),
+      [](const Sample& a, const Sample& b) { return a.timeMs < b.timeMs; });
+    m_channels[i].samples = samples.data();
+    m_channels[i].count = samples.size();
+    m_channels[i].cursor = 0;
+  }
+
+  return true;
+}
+
+/**
+ * Returns the value of a channel at the given playback time. The cursor
+ * remembers where the last read landed, so that polling a channel as time
+ * moves forward only needs to look at the next sample or two; if it has to
+ * move further (or backward, when playback loops), it does a binary search.
+ */
+uint32_t SampleStream::evaluate(Channel& channel, uint32_t timeMs)
+{
+  if (channel.count == 0)
+  {
+    return 0;
+  }
+
+  const Sample* samples = channel.samples;
+  if ((m_durationMs > 0) && m_loop)
+  {
+    timeMs %= m_durationMs;
+  }
+
+  if (timeMs <= samples[0].timeMs)
+  {
+    return samples[0].value;
+  }
+  if (timeMs >= samples[channel.count - 1].timeMs)
+  {
+    return samples[channel.count - 1].value;
+  }
+
+  uint32_t cursor = channel.cursor;
+  if ((cursor + 1 < channel.count) && (samples[cursor].timeMs <= timeMs) && (samples[cursor + 1].timeMs > timeMs))
+  {
+    // still between the same two samples as last time
+  }
+  else if ((cursor + 2 < channel.count) && (samples[cursor + 1].timeMs <= timeMs) && (samples[cursor + 2].timeMs > timeMs))
+  {
+    cursor++;
+  }
+  else
+  {
+    const Sample* next = std::upper_bound(samples, samples + channel.count, timeMs,
+      [](uint32_t t, const Sample& s) { return t < s.timeMs; });
+    cursor = (next - samples) - 1;
+  }
+  channel.cursor = cursor;
+
+  const Sample& a = samples[cursor];
+  const Sample& b = samples[cursor + 1];
+  if ((m_interp == Interpolation::Step) || (b.timeMs == a.timeMs))
+  {
+    return a.value;
+  }
+
+  const int64_t delta = static_cast<int64_t>(b.value) - static_cast<int64_t>(a.value);
+  return static_cast<uint32_t>(a.value + (delta * (timeMs - a.timeMs)) / (b.timeMs - a.timeMs));
+}
+
+/**
+ * Reads a RAM location at the given playback time. Returns false if the log
+ * has no channel for this address.
+ */
+bool SampleStream::readRAM(uint16_t addr, uint32_t timeMs, uint8_t& val)
+{
+  const int32_t index = m_ramChannels.empty() ? -1 : m_ramChannels[addr];
+  if (index >= 0)
+  {
+    val = static_cast<uint8_t>(std::min<uint32_t>(evaluate(m_channels[index], timeMs), 0xff));
+  }
+  return (index >= 0);
+}
+
+/**
+ * Reads a sampled value at the given playback time. Returns false if the log
+ * has no channel for this value ID.
+ */
+bool SampleStream::readValue(uint8_t id, uint32_t timeMs, uint32_t& val)
+{
+  const int32_t index = m_valueChannels.empty() ? -1 : m_valueChannels[id];
+  if (index >= 0)
+  {
+    val = evaluate(m_channels[index], timeMs);
+  }
+  return (index >= 0);
+}
+
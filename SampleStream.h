@@ -0,0 +1,78 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <QFile>
+#include <QString>
+
+/**
+ * Source of live data for RAM locations and sampled values, played back from
+ * a recorded log. Each channel (a RAM address or a value ID) is a series of
+ * (time, value) samples, and is evaluated only when it's read, by finding
+ * the samples on either side of the current playback time and interpolating
+ * between them. Channels that are never read cost nothing at run time.
+ *
+ * Two log formats are accepted:
+ *
+ *  - CSV, one sample per line: <time in seconds>,<channel>,<value>
+ *    where <channel> is "ram:<addr>" or "value:<id>" (numbers may be decimal
+ *    or 0x-prefixed hex). Lines that don't parse, such as a header, are
+ *    skipped, and samples may appear in any order.
+ *
+ *  - Binary (little-endian), which is memory-mapped and read in place:
+ *      header:   "SD2L" magic, u16 version (1), u16 reserved, u32 channel count
+ *      channels: u8 kind (0 = RAM, 1 = value), u8 reserved, u16 address/ID,
+ *                u32 sample count, u32 file offset of first sample
+ *      samples:  u32 time in milliseconds, u32 value; sorted by time, or
+ *                the log is rejected
+ *
+ * Not thread-safe; the read cursors are updated as channels are evaluated.
+ */
+class SampleStream
+{
+public:
+  enum class Interpolation
+  {
+    Linear,
+    Step
+  };
+
+  bool open(const QString& path);
+  int channelCount() const { return static_cast<int>(m_channels.size()); }
+  uint32_t durationMs() const { return m_durationMs; }
+
+  void setLooping(bool loop) { m_loop = loop; }
+  void setInterpolation(Interpolation interp) { m_interp = interp; }
+
+  bool readRAM(uint16_t addr, uint32_t timeMs, uint8_t& val);
+  bool readValue(uint8_t id, uint32_t timeMs, uint32_t& val);
+
+private:
+  struct Sample
+  {
+    uint32_t timeMs;
+    uint32_t value;
+  };
+
+  struct Channel
+  {
+    const Sample* samples = nullptr;
+    uint32_t count = 0;
+    uint32_t cursor = 0;
+  };
+
+  QFile m_file;
+  const uchar* m_map = nullptr;
+  std::vector<std::vector<Sample>> m_parsedSamples;
+  std::vector<Channel> m_channels;
+  std::vector<int32_t> m_ramChannels;
+  std::vector<int32_t> m_valueChannels;
+  uint32_t m_durationMs = 0;
+  bool m_loop = true;
+  Interpolation m_interp = Interpolation::Linear;
+
+  bool openBinary(qint64 size);
+  bool openCSV(qint64 size);
+  int32_t addChannel(int kind, uint16_t id);
+  uint32_t evaluate(Channel& channel, uint32_t timeMs);
+};
+
@@ -0,0 +1,299 @@
+#include "Scenario.h"
+#include <map>
+
+uint64_t Scenario::triggerKey(int ecuId, uint32_t state, uint8_t title, uint32_t arg0, uint32_t arg1)
+{
+  return (static_cast<uint64_t>(ecuId) << 35) |
+         (static_cast<uint64_t>(state) << 26) |
+         (static_cast<uint64_t>(title) << 18) |
+         (static_cast<uint64_t>(arg0) << 9) |
+         arg1;
+}
+
+static QStringList tokenize(const QString& text)
+{
+  QStringList tokens;
+  foreach (QString token, QString(text).replace('=', " = ").split(' '))
+  {
+    if (!token.trimmed().isEmpty())
+    {
+      tokens.append(token.trimmed());
+    }
+  }
+  return tokens;
+}
+
+static bool parseHexByte(const QString& token, uint32_t& val)
+{
+  bool ok = false;
+  val = token.toUInt(&ok, 16);
+  return ok && (val <= 0xff);
+}
+
+/**
+ * Compiles the scenario text, replacing any rules already held. On failure,
+ * the error string describes the first problem found (with its line number).
+ */
+bool Scenario::compile(const QString& text, QString& error)
+{
+  std::map<uint64_t,std::vector<Action>> rules;
+  m_actions.clear();
+  m_sendBytes.clear();
+  m_triggers.clear();
+  m_stateNames.clear();
+  m_ruleCount = 0;
+
+  int ecuId = -1;
+  const QStringList lines = text.split('\n');
+
+  // Returns the index of the named state for the current ECU, declaring it
+  // if this is the first time it has been seen
+  auto stateIndex = [this, &ecuId](const QString& name) -> int
+  {
+    QStringList& names = m_stateNames[ecuId];
+    if (!names.contains(name) && (names.size() < 0xff))
+    {
+      names.append(name);
+    }
+    return names.indexOf(name);
+  };
+
+  for (int lineNum = 0; lineNum < lines.size(); lineNum++)
+  {
+    const QString line = lines[lineNum].section('#', 0, 0).trimmed();
+    const QString where = QString("line %1: ").arg(lineNum + 1);
+    if (line.isEmpty())
+    {
+      continue;
+    }
+
+    const QStringList tokens = tokenize(line.section("->", 0, 0));
+    if (tokens.isEmpty())
+    {
+      error = where + "missing trigger";
+      return false;
+    }
+    else if (tokens[0] == "ecu")
+    {
+      bool ok = false;
+      ecuId = (tokens.size() == 2) ? tokens[1].toInt(&ok, 10) : -1;
+      if (!ok || (ecuId < 0) || (ecuId > 9999))
+      {
+        error = where + "expected 'ecu <id>'";
+        return false;
+      }
+    }
+    else if (ecuId < 0)
+    {
+      error = where + "rule or state given before 'ecu'";
+      return false;
+    }
+    else if (tokens[0] == "state")
+    {
+      if (tokens.size() != 2)
+      {
+        error = where + "expected 'state <name>'";
+        return false;
+      }
+      if (stateIndex(tokens[1]) < 0)
+      {
+        error = where + QString("too many states for ECU %1").arg(ecuId, 4, 10, QChar('0'));
+        return false;
+      }
+    }
+    else if ((tokens[0] == "on") && line.contains("->"))
+    {
+      // Trigger: on <title> [<arg0> [<arg1>]] [in <state>]
+      uint32_t trigger[3] = { ANY, ANY, ANY };
+      uint32_t state = ANY;
+      int pos = 1;
+      for (int i = 0; (i < 3) && (pos < tokens.size()) && (tokens[pos] != "in"); i++, pos++)
+      {
+        if (!parseHexByte(tokens[pos], trigger[i]))
+        {
+          error = where + QString("bad trigger byte '%1'").arg(tokens[pos]);
+          return false;
+        }
+      }
+      if ((pos + 1 < tokens.size()) && (tokens[pos] == "in"))
+      {
+        const int index = stateIndex(tokens[pos + 1]);
+        if (index < 0)
+        {
+          error = where + QString("too many states for ECU %1").arg(ecuId, 4, 10, QChar('0'));
+          return false;
+        }
+        state = index;
+        pos += 2;
+      }
+      if ((trigger[0] == ANY) || (pos != tokens.size()))
+      {
+        error = where + "expected 'on <title> [<byte> [<byte>]] [in <state>] -> ...'";
+        return false;
+      }
+
+      std::vector<Action>& actions = rules[triggerKey(ecuId, state, trigger[0], trigger[1], trigger[2])];
+      foreach (QString actionText, line.section("->", 1).split(';'))
+      {
+        QStringList words = tokenize(actionText);
+        if (words.isEmpty())
+        {
+          continue;
+        }
+
+        Action action = { 0, ActionType::SetRAM, 0, 0, 0 };
+        bool ok = true;
+
+        if ((words.size() >= 2) && (words[0] == "after"))
+        {
+          action.delayMs = words[1].toUInt(&ok, 0);
+          words = words.mid(2);
+        }
+
+        if (ok && (words.size() == 2) && (words[0] == "state"))
+        {
+          const int index = stateIndex(words[1]);
+          if (index < 0)
+          {
+            error = where + QString("too many states for ECU %1").arg(ecuId, 4, 10, QChar('0'));
+            return false;
+          }
+          action.type = ActionType::SetState;
+          action.value = index;
+        }
+        else if (ok && (words.size() >= 2) && (words[0] == "send"))
+        {
+          // The frame payload is stored separately; the action refers to it
+          // by its offset (value) and length (target)
+          action.type = ActionType::SendFrame;
+          int pos = 1;
+          if ((words.size() >= 4) && (words[1] == "every"))
+          {
+            action.periodMs = words[2].toUInt(&ok, 0);
+            ok = ok && (action.periodMs > 0);
+            pos = 3;
+          }
+          action.value = m_sendBytes.size();
+          action.target = words.size() - pos;
+          ok = ok && (action.target <= MAX_SEND_LEN);
+          for (; ok && (pos < words.size()); pos++)
+          {
+            uint32_t byte = 0;
+            ok = parseHexByte(words[pos], byte);
+            m_sendBytes.push_back(byte);
+          }
+        }
+        else if (ok && (words.size() == 4) && (words[2] == "="))
+        {
+          bool targetOK = false;
+          bool valueOK = false;
+          const uint32_t target = words[1].toUInt(&targetOK, 0);
+          action.value = words[3].toUInt(&valueOK, 0);
+          action.target = target;
+
+          if (words[0] == "ram")
+          {
+            action.type = ActionType::SetRAM;
+            ok = targetOK && valueOK && (target <= 0xffff) && (action.value <= 0xff);
+          }
+          else if (words[0] == "value")
+          {
+            action.type = ActionType::SetValue;
+            ok = targetOK && valueOK && (target <= 0xff);
+          }
+          else if (words[0] == "error")
+          {
+            action.type = ActionType::SetErrorMemory;
+            ok = targetOK && valueOK && (target < 0x100) && (action.value <= 0xff);
+          }
+          else
+          {
+            ok = false;
+          }
+        }
+        else
+        {
+          ok = false;
+        }
+
+        if (!ok)
+        {
+          error = where + QString("bad action '%1'").arg(actionText.trimmed());
+          return false;
+        }
+        actions.push_back(action);
+      }
+      m_ruleCount++;
+    }
+    else
+    {
+      error = where + QString("unrecognized line '%1'").arg(line);
+      return false;
+    }
+  }
+
+  // Lay out the actions so that those for each trigger are contiguous
+  for (auto rule = rules.begin(); rule != rules.end(); ++rule)
+  {
+    m_triggers[rule->first] = { static_cast<uint32_t>(m_actions.size()), static_cast<uint32_t>(rule->second.size()) };
+    m_actions.insert(m_actions.end(), rule->second.begin(), rule->second.end());
+  }
+
+  return true;
+}
+
+QString Scenario::stateName(int ecuId, uint8_t state) const
+{
+  auto names = m_stateNames.find(ecuId);
+  if ((names != m_stateNames.end()) && (state < names->second.size()))
+  {
+    return names->second[state];
+  }
+  return QString::number(state);
+}
+
+/**
+ * Finds the actions that should be run in response to a protocol block sent
+ * to an ECU in the given state. The block starts with its title byte, and
+ * len is the number of valid bytes from there. The ranges of matching
+ * actions (from most to least specific trigger) are written to the supplied
+ * array, which must have room for MAX_MATCHES entries, and the number of
+ * ranges is returned.
+ */
+int Scenario::match(int ecuId, uint8_t state, const uint8_t* block, int len, ActionRange* ranges) const
+{
+  int count = 0;
+  if (m_triggers.empty() || (len < 1))
+  {
+    return count;
+  }
+
+  const uint32_t states[2] = { state, ANY };
+  for (uint32_t st : states)
+  {
+    uint64_t keys[3];
+    int keyCount = 0;
+    if (len >= 3)
+    {
+      keys[keyCount++] = triggerKey(ecuId, st, block[0], block[1], block[2]);
+    }
+    if (len >= 2)
+    {
+      keys[keyCount++] = triggerKey(ecuId, st, block[0], block[1], ANY);
+    }
+    keys[keyCount++] = triggerKey(ecuId, st, block[0], ANY, ANY);
+
+    for (int i = 0; i < keyCount; i++)
+    {
+      auto trigger = m_triggers.find(keys[i]);
+      if (trigger != m_triggers.end())
+      {
+        const Action* first = m_actions.data() + trigger->second.first;
+        ranges[count++] = { first, first + trigger->second.count };
+      }
+    }
+  }
+
+  return count;
+}
+
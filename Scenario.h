@@ -0,0 +1,98 @@
+#pragma once
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include <QString>
+#include <QStringList>
+
+/**
+ * A set of rules that make the simulated ECUs react to what WSDC32 asks of
+ * them, e.g. so that engaging a gear with an actuator test changes the gear
+ * position that is subsequently read back.
+ *
+ * Scenarios are written as text, one rule per line, and compiled once when
+ * loaded. Each rule is triggered by a protocol block sent to a given ECU,
+ * identified by its block title and optionally the first one or two bytes
+ * that follow it (such as an actuator ID and parameter):
+ *
+ *   ecu 0151
+ *   on 20 0A DC -> ram 0x0040 = 1; after 800 ram 0x0041 = 0x10
+ *   on 21 -> ram 0x0040 = 0
+ *
+ *   ecu 0086
+ *   state disarmed
+ *   on 44 96 in disarmed -> after 2000 ram 0x96 = 2; after 2000 state armed
+ *
+ * Trigger bytes are always hex. Action operands may be decimal or 0x-hex.
+ * The actions are "ram <addr> = <val>", "value <id> = <val>", "error <index>
+ * = <val>" (a byte of error memory), "state <name>" and "send [every <ms>]
+ * <bytes>", each optionally preceded by "after <ms>". Each ECU starts in the
+ * first state named for it, and a rule with "in <state>" only fires in that
+ * state. Lines starting with '#' are comments.
+ *
+ * A send action makes the Tester pass an unsolicited cmd 0x13 frame to
+ * WSDC32 on the same pipe, carrying the given (hex) bytes as if the ECU had
+ * sent them. It goes out after the reply to the triggering request, and is
+ * repeated if a period is given (firing the rule again restarts the period
+ * rather than adding a second repeating frame):
+ *
+ *   on 00 -> after 200 send 0D 01 F6 30 31 03
+ *
+ * Once compiled, finding the actions for a block is a handful of hash table
+ * lookups; no text is looked at after loading.
+ */
+class Scenario
+{
+public:
+  enum class ActionType : uint8_t
+  {
+    SetRAM,
+    SetValue,
+    SetErrorMemory,
+    SetState,
+    SendFrame
+  };
+
+  struct Action
+  {
+    uint32_t delayMs;
+    ActionType type;
+    uint16_t target;
+    uint32_t value;
+    uint32_t periodMs;
+  };
+
+  struct ActionRange
+  {
+    const Action* begin;
+    const Action* end;
+  };
+
+  bool compile(const QString& text, QString& error);
+  int ruleCount() const { return m_ruleCount; }
+  QString stateName(int ecuId, uint8_t state) const;
+  const uint8_t* sendBytes(const Action& action) const { return m_sendBytes.data() + action.value; }
+  int actionIndex(const Action& action) const { return &action - m_actions.data(); }
+  int match(int ecuId, uint8_t state, const uint8_t* block, int len, ActionRange* ranges) const;
+
+  static constexpr int MAX_MATCHES = 6;
+  static constexpr int MAX_SEND_LEN = 120;
+
+private:
+  static constexpr uint32_t ANY = 0x1ff;
+
+  struct Range
+  {
+    uint32_t first;
+    uint32_t count;
+  };
+
+  std::vector<Action> m_actions;
+  std::vector<uint8_t> m_sendBytes;
+  std::unordered_map<uint64_t,Range> m_triggers;
+  std::unordered_map<int,QStringList> m_stateNames;
+  int m_ruleCount = 0;
+
+  static uint64_t triggerKey(int ecuId, uint32_t state, uint8_t title, uint32_t arg0, uint32_t arg1);
+};
+
@@ -0,0 +1,197 @@
+#include "SpanTracer.h"
+#include <unistd.h>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <QSaveFile>
+#include <QTextStream>
+
+namespace
+{
+struct Event
+{
+  const char* name;
+  int arg;
+  int64_t startNs;
+  int64_t endNs;
+};
+
+/**
+ * The spans recorded by one thread, as a ring of the most recent ones. The
+ * lock is only ever contended while the buffers are being saved or cleared.
+ */
+struct ThreadBuffer
+{
+  std::mutex mutex;
+  int tid = 0;
+  const char* name = nullptr;
+  std::vector<Event> events;
+  size_t next = 0;
+};
+
+/**
+ * Hands the calling thread's buffer back when the thread exits. Its spans
+ * stay in it, and are saved along with everyone else's, until another thread
+ * takes the buffer over; so a process that keeps starting short-lived
+ * threads (such as the image reading workers) only ever has as many buffers
+ * as it has threads at once.
+ */
+struct BufferHandle
+{
+  ThreadBuffer* buffer = nullptr;
+  ~BufferHandle();
+};
+
+std::mutex s_buffersMutex;
+std::vector<std::unique_ptr<ThreadBuffer>> s_buffers;
+std::vector<ThreadBuffer*> s_freeBuffers;
+int s_lastTid = 0;
+thread_local BufferHandle t_buffer;
+thread_local const char* t_threadName = nullptr;
+
+BufferHandle::~BufferHandle()
+{
+  if (buffer)
+  {
+    std::lock_guard<std::mutex> lock(s_buffersMutex);
+    s_freeBuffers.push_back(buffer);
+  }
+}
+
+/**
+ * Returns the calling thread's buffer, taking over one left by a thread that
+ * has exited or, failing that, creating one. This is the only allocation
+ * made for a thread's spans.
+ */
+ThreadBuffer* threadBuffer()
+{
+  if (!t_buffer.buffer)
+  {
+    std::lock_guard<std::mutex> lock(s_buffersMutex);
+    if (s_freeBuffers.empty())
+    {
+      std::unique_ptr<ThreadBuffer> buffer = std::make_unique<ThreadBuffer>();
+      buffer->events.reserve(SpanTracer::EVENTS_PER_THREAD);
+      t_buffer.buffer = buffer.get();
+      s_buffers.push_back(std::move(buffer));
+    }
+    else
+    {
+      t_buffer.buffer = s_freeBuffers.back();
+      s_freeBuffers.pop_back();
+    }
+
+    ThreadBuffer* buffer = t_buffer.buffer;
+    std::lock_guard<std::mutex> bufferLock(buffer->mutex);
+    buffer->tid = ++s_lastTid;
+    buffer->name = t_threadName;
+    buffer->events.clear();
+    buffer->next = 0;
+  }
+  return t_buffer.buffer;
+}
+
+QString jsonString(const char* text)
+{
+  QString escaped = QString::fromUtf8(text);
+  escaped.replace("\\", "\\\\");
+  escaped.replace("\"", "\\\"");
+  return QString("\"%1\"").arg(escaped);
+}
+}
+
+/**
+ * Names the calling thread in saved traces (e.g. "protocol" or "GUI").
+ */
+void SpanTracer::setThreadName(const char* name)
+{
+  t_threadName = name;
+  if (t_buffer.buffer)
+  {
+    std::lock_guard<std::mutex> lock(t_buffer.buffer->mutex);
+    t_buffer.buffer->name = name;
+  }
+}
+
+void SpanTracer::record(const char* name, int arg, int64_t startNs, int64_t endNs)
+{
+  ThreadBuffer* buffer = threadBuffer();
+  std::lock_guard<std::mutex> lock(buffer->mutex);
+  const Event event { name, arg, startNs, endNs };
+  if (buffer->events.size() < EVENTS_PER_THREAD)
+  {
+    buffer->events.push_back(event);
+  }
+  else
+  {
+    buffer->events[buffer->next] = event;
+  }
+  buffer->next = (buffer->next + 1) % EVENTS_PER_THREAD;
+}
+
+/**
+ * Discards the spans recorded so far by all threads.
+ */
+void SpanTracer::clear()
+{
+  std::lock_guard<std::mutex> lock(s_buffersMutex);
+  for (const std::unique_ptr<ThreadBuffer>& buffer : s_buffers)
+  {
+    std::lock_guard<std::mutex> bufferLock(buffer->mutex);
+    buffer->events.clear();
+    buffer->next = 0;
+  }
+}
+
+/**
+ * Writes the spans recorded by all threads as a Chrome trace-event JSON file
+ * ("complete" events, with timestamps in microseconds). A span that has an
+ * argument (such as the command byte of a handler) has it appended to its
+ * name in hex, so that each command gets its own row of statistics.
+ */
+bool SpanTracer::save(const QString& path)
+{
+  QSaveFile file(path);
+  if (!file.open(QIODevice::WriteOnly | QIODevice::Text))
+  {
+    return false;
+  }
+
+  const qint64 pid = getpid();
+  QTextStream out(&file);
+  out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+  bool first = true;
+
+  std::lock_guard<std::mutex> lock(s_buffersMutex);
+  for (const std::unique_ptr<ThreadBuffer>& buffer : s_buffers)
+  {
+    std::vector<Event> events;
+    const char* threadName = nullptr;
+    {
+      std::lock_guard<std::mutex> bufferLock(buffer->mutex);
+      events = buffer->events;
+      threadName = buffer->name;
+    }
+
+    out << (first ? "" : ",\n") << QString("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%1,\"tid\":%2,\"args\":{\"name\":%3}}").
+      arg(pid).arg(buffer->tid).arg(jsonString(threadName ? threadName : "thread"));
+    first = false;
+
+    for (const Event& event : events)
+    {
+      QString name = jsonString(event.name);
+      if (event.arg != NO_ARG)
+      {
+        name = jsonString(QString("%1 0x%2").arg(event.name).arg(event.arg, 2, 16, QChar('0')).toUtf8().constData());
+      }
+      out << QString(",\n{\"name\":%1,\"ph\":\"X\",\"pid\":%2,\"tid\":%3,\"ts\":%4,\"dur\":%5}").
+        arg(name).arg(pid).arg(buffer->tid).
+        arg(QString::number(event.startNs / 1000.0, 'f', 3)).
+        arg(QString::number((event.endNs - event.startNs) / 1000.0, 'f', 3));
+    }
+  }
+
+  out << "\n]}\n";
+  out.flush();
+  return file.commit();
+}
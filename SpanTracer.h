@@ -0,0 +1,78 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <QString>
+
+/**
+ * Records timed spans of work (receiving bytes, handling a frame, running a
+ * command's handler, writing to the socket, notifying the GUI, updating the
+ * log view, ...) so that a slow session can be broken down afterwards. Spans
+ * are marked with TRACE_SPAN() at the top of a scope, and each thread records
+ * into its own buffer, which holds the most recent spans. The buffers are
+ * saved as Chrome trace-event JSON, which Perfetto (ui.perfetto.dev) and
+ * chrome://tracing can open.
+ *
+ * Recording is turned on and off at runtime. While it is off, a span costs a
+ * relaxed atomic load and a branch. Building with CONFIG+=no_spans removes
+ * the spans altogether.
+ */
+class SpanTracer
+{
+public:
+  static constexpr int EVENTS_PER_THREAD = 1 << 16;
+  static constexpr int NO_ARG = -1;
+
+  class Scope
+  {
+  public:
+    explicit Scope(const char* name, int arg = NO_ARG) :
+      m_name(name),
+      m_arg(arg),
+      m_startNs(s_enabled.load(std::memory_order_relaxed) ? now() : -1)
+    {
+    }
+
+    ~Scope()
+    {
+      if (m_startNs >= 0)
+      {
+        record(m_name, m_arg, m_startNs, now());
+      }
+    }
+
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+
+  private:
+    const char* m_name;
+    int m_arg;
+    int64_t m_startNs;
+  };
+
+  static void setEnabled(bool enabled) { s_enabled.store(enabled, std::memory_order_relaxed); }
+  static bool enabled() { return s_enabled.load(std::memory_order_relaxed); }
+  static void setThreadName(const char* name);
+  static void clear();
+  static bool save(const QString& path);
+
+private:
+  static inline std::atomic<bool> s_enabled { false };
+
+  static int64_t now()
+  {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+  static void record(const char* name, int arg, int64_t startNs, int64_t endNs);
+};
+
+#ifdef SD2SIM_NO_SPANS
+#define TRACE_SPAN(name)
+#define TRACE_SPAN_ARG(name, arg)
+#else
+#define TRACE_SPAN_CONCAT2(a, b) a##b
+#define TRACE_SPAN_CONCAT(a, b) TRACE_SPAN_CONCAT2(a, b)
+#define TRACE_SPAN(name) SpanTracer::Scope TRACE_SPAN_CONCAT(traceSpan, __LINE__)(name)
+#define TRACE_SPAN_ARG(name, arg) SpanTracer::Scope TRACE_SPAN_CONCAT(traceSpan, __LINE__)(name, arg)
+#endif
@@ -0,0 +1,94 @@
+#include "StateUpdateQueue.h"
+
+StateUpdateQueue::StateUpdateQueue() :
+  m_head(&m_stub),
+  m_tail(&m_stub)
+{
+}
+
+StateUpdateQueue::~StateUpdateQueue()
+{
+  Node* node = nullptr;
+  while ((node = popNode()) != nullptr)
+  {
+    delete node;
+  }
+}
+
+/**
+ * Enqueues an update. Safe to call from any number of threads concurrently.
+ */
+void StateUpdateQueue::push(Update update)
+{
+  Node* node = new Node;
+  node->update = std::move(update);
+  pushNode(node);
+}
+
+void StateUpdateQueue::pushNode(Node* node)
+{
+  node->next.store(nullptr, std::memory_order_relaxed);
+  Node* prev = m_head.exchange(node, std::memory_order_acq_rel);
+  prev->next.store(node, std::memory_order_release);
+}
+
+/**
+ * Removes the oldest node from the queue, or returns null if the queue is
+ * empty (or if a producer is midway through a push, in which case the node
+ * will be picked up by the next drain).
+ * Must only be called from the consumer thread.
+ */
+StateUpdateQueue::Node* StateUpdateQueue::popNode()
+{
+  Node* tail = m_tail;
+  Node* next = tail->next.load(std::memory_order_acquire);
+
+  if (tail == &m_stub)
+  {
+    if (next == nullptr)
+    {
+      return nullptr;
+    }
+    m_tail = next;
+    tail = next;
+    next = next->next.load(std::memory_order_acquire);
+  }
+
+  if (next != nullptr)
+  {
+    m_tail = next;
+    return tail;
+  }
+
+  if (tail != m_head.load(std::memory_order_acquire))
+  {
+    return nullptr;
+  }
+
+  pushNode(&m_stub);
+  next = tail->next.load(std::memory_order_acquire);
+  if (next != nullptr)
+  {
+    m_tail = next;
+    return tail;
+  }
+  return nullptr;
+}
+
+/**
+ * Applies all pending updates in the order they were pushed, and returns the
+ * number applied. Must only be called from the consumer thread.
+ */
+int StateUpdateQueue::drain()
+{
+  int count = 0;
+  Node* node = nullptr;
+  while ((node = popNode()) != nullptr)
+  {
+    node->update();
+    delete node;
+    count++;
+  }
+  return count;
+}
+
@@ -0,0 +1,41 @@
+#pragma once
+#include <atomic>
+#include <functional>
+
+/**
+ * Lock-free multi-producer/single-consumer queue of deferred state updates.
+ * Any thread (e.g. the GUI) may push an update without blocking; the protocol
+ * thread drains the queue between frames, so that the containers holding ECU
+ * state are only ever touched by a single thread.
+ *
+ * This is an intrusive linked-list queue in the style of Dmitry Vyukov's
+ * MPSC node-based queue. Pushing is a single atomic exchange.
+ */
+class StateUpdateQueue
+{
+public:
+  typedef std::function<void()> Update;
+
+  StateUpdateQueue();
+  ~StateUpdateQueue();
+  StateUpdateQueue(const StateUpdateQueue&) = delete;
+  StateUpdateQueue& operator=(const StateUpdateQueue&) = delete;
+
+  void push(Update update);
+  int drain();
+
+private:
+  struct Node
+  {
+    std::atomic<Node*> next { nullptr };
+    Update update;
+  };
+
+  std::atomic<Node*> m_head;
+  Node* m_tail;
+  Node m_stub;
+
+  void pushNode(Node* node);
+  Node* popNode();
+};
+
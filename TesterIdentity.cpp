@@ -0,0 +1,141 @@
+#include "TesterIdentity.h"
+#include <ctime>
+#include "utilities.h"
+#include <QDir>
+#include <QFileInfo>
+#include <QSettings>
+#include <QStringList>
+
+static bool parseDate(const QString& text, TesterIdentity::Date& date)
+{
+  const QStringList fields = text.trimmed().split('-');
+  bool ok[3] = { false, false, false };
+  TesterIdentity::Date parsed = date;
+  if (fields.size() == 3)
+  {
+    parsed.year = fields[0].toInt(&ok[0]);
+    parsed.month = fields[1].toInt(&ok[1]);
+    parsed.day = fields[2].toInt(&ok[2]);
+  }
+  if (ok[0] && ok[1] && ok[2])
+  {
+    date = parsed;
+  }
+  return ok[0] && ok[1] && ok[2];
+}
+
+static bool parseVersion(const QString& text, uint8_t* version)
+{
+  const QStringList fields = text.trimmed().split('.');
+  bool ok[2] = { false, false };
+  if (fields.size() == 2)
+  {
+    const uint32_t maj = fields[0].toUInt(&ok[0]);
+    const uint32_t min = fields[1].toUInt(&ok[1]);
+    if (ok[0] && ok[1] && (maj <= 0xff) && (min <= 0xff))
+    {
+      version[0] = maj;
+      version[1] = min;
+      return true;
+    }
+  }
+  return false;
+}
+
+QString TesterIdentity::defaultPath()
+{
+  return QDir::homePath() + "/.config/sd2-tester-sim/identity.ini";
+}
+
+/**
+ * Reads the identity profile from an INI file. Returns false if the file
+ * doesn't exist, in which case the defaults are left in place.
+ */
+bool TesterIdentity::load(const QString& path)
+{
+  if (!QFileInfo(path).exists())
+  {
+    return false;
+  }
+
+  QSettings settings(path, QSettings::IniFormat);
+  settings.beginGroup("Tester");
+
+  bool ok = false;
+  const uint32_t serial = settings.value("serialNumber").toString().toUInt(&ok, 0);
+  if (ok && (serial <= 0xffff))
+  {
+    serialNumber = serial;
+  }
+  const uint32_t freeFlash = settings.value("freeFlashBytes").toString().toUInt(&ok, 0);
+  if (ok)
+  {
+    freeFlashBytes = freeFlash;
+  }
+
+  parseVersion(settings.value("loaderVersion").toString(), loaderVersion);
+  parseVersion(settings.value("osVersion").toString(), osVersion);
+  parseDate(settings.value("loaderDate").toString(), loaderDate);
+  parseDate(settings.value("osDate").toString(), osDate);
+
+  if (settings.contains("workshopLine1"))
+  {
+    workshopLine1 = fieldText(settings.value("workshopLine1").toString(), WORKSHOP_LINE1_LEN);
+  }
+  if (settings.contains("workshopLine2"))
+  {
+    workshopLine2 = fieldText(settings.value("workshopLine2").toString(), WORKSHOP_LINE2_LEN);
+  }
+
+  // dateTime is "YYYY-MM-DD hh:mm:ss"
+  const QStringList dateTime = settings.value("dateTime").toString().trimmed().split(' ');
+  const QStringList time = (dateTime.size() == 2) ? dateTime[1].split(':') : QStringList();
+  if ((time.size() == 3) && parseDate(dateTime[0], fixedDate))
+  {
+    fixedClock = true;
+    for (int i = 0; i < 3; i++)
+    {
+      bool timeOK = false;
+      fixedTime[i] = time[i].toInt(&timeOK);
+      fixedClock = fixedClock && timeOK;
+    }
+  }
+
+  settings.endGroup();
+  return true;
+}
+
+/**
+ * Writes the Tester's current date and time as seven BCD bytes, in the order
+ * that cmd 0x3A returns them: hour, minute, second, day, month, two-digit
+ * year, and day of the week (0 = Sunday).
+ */
+void TesterIdentity::dateTimeBCD(uint8_t* out) const
+{
+  struct tm t = {};
+  if (fixedClock)
+  {
+    t.tm_year = fixedDate.year - 1900;
+    t.tm_mon = fixedDate.month - 1;
+    t.tm_mday = fixedDate.day;
+    t.tm_hour = fixedTime[0];
+    t.tm_min = fixedTime[1];
+    t.tm_sec = fixedTime[2];
+    t.tm_isdst = -1;
+    mktime(&t); // fills in the day of the week
+  }
+  else
+  {
+    const time_t now = time(nullptr);
+    localtime_r(&now, &t);
+  }
+
+  out[0] = toBCD(t.tm_hour);
+  out[1] = toBCD(t.tm_min);
+  out[2] = toBCD(t.tm_sec);
+  out[3] = toBCD(t.tm_mday);
+  out[4] = toBCD(t.tm_mon + 1);
+  out[5] = toBCD(t.tm_year % 100);
+  out[6] = toBCD(t.tm_wday);
+}
+
@@ -0,0 +1,55 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <QString>
+
+/**
+ * The details that the simulated Tester reports about itself: its serial
+ * number, the versions and dates of its system loader and OS, the free space
+ * on its flash storage, the workshop data strings, and its clock. They are
+ * loaded once at startup from an INI file, e.g.:
+ *
+ *   [Tester]
+ *   serialNumber=212
+ *   loaderVersion=3.01
+ *   loaderDate=1998-09-25
+ *   osVersion=5.05
+ *   osDate=1999-03-04
+ *   freeFlashBytes=0x233333
+ *   workshopLine1=abcdefghij
+ *   workshopLine2=klmnopqrs
+ *   dateTime=2023-12-02 06:31:50
+ *
+ * Any key that is missing keeps the default shown above, except dateTime:
+ * unless it's given, the Tester reports the host's local time.
+ */
+struct TesterIdentity
+{
+  struct Date
+  {
+    int year;
+    int month;
+    int day;
+  };
+
+  static constexpr int WORKSHOP_LINE1_LEN = 10;
+  static constexpr int WORKSHOP_LINE2_LEN = 9;
+
+  uint16_t serialNumber = 212;
+  uint8_t loaderVersion[2] = { 3, 1 };
+  Date loaderDate = { 1998, 9, 25 };
+  uint8_t osVersion[2] = { 5, 5 };
+  Date osDate = { 1999, 3, 4 };
+  uint32_t freeFlashBytes = 0x233333;
+  std::string workshopLine1 = "abcdefghij";
+  std::string workshopLine2 = "klmnopqrs";
+  bool fixedClock = false;
+  Date fixedDate = { 2023, 12, 2 };
+  int fixedTime[3] = { 6, 31, 50 };
+
+  bool load(const QString& path);
+  void dateTimeBCD(uint8_t* out) const;
+
+  static QString defaultPath();
+};
+
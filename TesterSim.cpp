@@ -1,3 +1,6 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdbool.h>
@@ -5,412 +8,1457 @@
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <unistd.h>
+#include <algorithm>
 #include <chrono>
-#include <thread>
+#include <future>
+#include <set>
 #include "TesterSim.h"
+#include "ImageFile.h"
+#include "SpanTracer.h"
 #include "utilities.h"
 #include <QFile>
-#include <QDataStream>
 #include <QFileInfo>
 
-std::map<uint8_t,std::function<void(const uint8_t*,uint8_t*,TesterSim*)>> TesterSim::s_commandProcs =
-{
-  { 0x01, TesterSim::process01TabletInfo },
-  { 0x02, TesterSim::process02SerialNo },
-  { 0x09, TesterSim::process09 },
-  { 0x0A, TesterSim::process0AWorkshopData },
-  { 0x0B, TesterSim::process0BStartApplModGest },
-  { 0x11, TesterSim::process11DoSlowInit },
-  { 0x12, TesterSim::process12GetISOKeyword },
-  { 0x13, TesterSim::process13CommandToECU },
-  { 0x15, TesterSim::process15DisplayString },
-  { 0x1C, TesterSim::process1C },
-  { 0x1E, TesterSim::process1ECloseFile },
-  { 0x20, TesterSim::process20OpenFileForWriting },
-  { 0x21, TesterSim::process21WriteToFile },
-  { 0x23, TesterSim::process23OpenFileForReading },
-  { 0x24, TesterSim::process24ReadFromFile },
-  { 0x25, TesterSim::process25ChecksumFile },
-  { 0x2A, TesterSim::process2AChdir },
-  { 0x2B, TesterSim::process2BGetNextDirEntry },
-  { 0x3A, TesterSim::process3AGetDateTime },
-  { 0x3D, TesterSim::process3DEraseFlash }
-};
+const std::array<TesterSim::CommandProc,0x100> TesterSim::s_commandProcs = []()
+{
+  std::array<CommandProc,0x100> procs {};
+  procs[0x01] = TesterSim::process01TabletInfo;
+  procs[0x02] = TesterSim::process02SerialNo;
+  procs[0x09] = TesterSim::process09;
+  procs[0x0A] = TesterSim::process0AWorkshopData;
+  procs[0x0B] = TesterSim::process0BStartApplModGest;
+  procs[0x11] = TesterSim::process11DoSlowInit;
+  procs[0x12] = TesterSim::process12GetISOKeyword;
+  procs[0x13] = TesterSim::process13CommandToECU;
+  procs[0x15] = TesterSim::process15DisplayString;
+  procs[0x1C] = TesterSim::process1C;
+  procs[0x1E] = TesterSim::process1ECloseFile;
+  procs[0x20] = TesterSim::process20OpenFileForWriting;
+  procs[0x21] = TesterSim::process21WriteToFile;
+  procs[0x23] = TesterSim::process23OpenFileForReading;
+  procs[0x24] = TesterSim::process24ReadFromFile;
+  procs[0x25] = TesterSim::process25ChecksumFile;
+  procs[0x2A] = TesterSim::process2AChdir;
+  procs[0x2B] = TesterSim::process2BGetNextDirEntry;
+  procs[0x3A] = TesterSim::process3AGetDateTime;
+  procs[0x3D] = TesterSim::process3DEraseFlash;
+  return procs;
+}();
 
 
 TesterSim::TesterSim(QObject* parent) : QObject(parent)
 {
-  memset(m_inbuf, 0, 128);
-  memset(m_outbuf, 0, 128);
+  memset(m_inbuf, 0, MAX_REQUEST_SIZE);
   memset(m_checksumBuf, 0, CHKSUM_BUF_SIZE);
-  memset(m_lastInbuf, 0, 128);
-  for (int i = 0; i < 16; i++)
+  memset(m_lastInbuf, 0, MAX_REQUEST_SIZE);
+  for (std::atomic<uint32_t>& reads : m_ramReads)
+  {
+    reads = 0;
+  }
+  buildReplyTemplates();
+
+  if (pipe(m_wakeFds) == 0)
   {
-    m_applRun[i] = false;
+    fcntl(m_wakeFds[0], F_SETFL, fcntl(m_wakeFds[0], F_GETFL) | O_NONBLOCK);
+    fcntl(m_wakeFds[1], F_SETFL, fcntl(m_wakeFds[1], F_GETFL) | O_NONBLOCK);
   }
+
+  connect(this, &TesterSim::snapshotWritten, this, [this](int snapshotIndex, QByteArray content)
+  {
+    m_guiSnapshotData[snapshotIndex].assign(content.constBegin(), content.constEnd());
+    emit snapshotChanged(snapshotIndex);
+  }, Qt::QueuedConnection);
 }
 
-void TesterSim::setRAMLoc(uint16_t addr, uint8_t val)
+TesterSim::~TesterSim()
 {
-  m_ramData[addr] = val;
+  // A checkpoint that hasn't been captured yet is captured now, so that the
+  // thread writing it can finish
+  {
+    std::lock_guard<std::mutex> lock(m_stateMutex);
+    m_updates.drain();
+  }
+  if (m_checkpointThread.joinable())
+  {
+    m_checkpointThread.join();
+  }
+  for (int fd : m_wakeFds)
+  {
+    if (fd >= 0)
+    {
+      close(fd);
+    }
+  }
 }
 
-void TesterSim::setValue(uint16_t id, uint32_t val)
+/**
+ * Loads the Tester identity profile (see TesterIdentity.h) and rebuilds the
+ * replies that depend on it. This must be done before listening. Returns
+ * false if the file doesn't exist, leaving the default identity in place.
+ */
+bool TesterSim::loadIdentity(const QString& path)
 {
-  m_valueData[id] = val;
+  const bool status = m_identity.load(path);
+  if (status)
+  {
+    log(QString("Loaded Tester identity from %1 (serial no. %2)").arg(path).arg(m_identity.serialNumber));
+  }
+  buildReplyTemplates();
+  return status;
 }
 
-int TesterSim::readBytes(uint8_t* buf, int count)
+/**
+ * Builds the replies to the commands that WSDC32 polls for the Tester's own
+ * details. These never change while running, apart from the fields that
+ * their handlers patch in (an echoed sequence number, or the time), so they
+ * are built once and copied into each reply.
+ */
+void TesterSim::buildReplyTemplates()
 {
-  int bufPos = 0;
-  int readResult = 0;
-
-  while ((bufPos < count) && !m_shutdown)
+  const TesterIdentity& id = m_identity;
+  for (std::vector<uint8_t>& tmpl : m_replyTemplates)
   {
-    readResult = read(m_sockFd, buf + bufPos, count - bufPos);
-    if (readResult > 0)
-    {
-      bufPos += readResult;
-    }
+    tmpl.clear();
   }
-  return bufPos;
+
+  m_replyTemplates[0x01] =
+  {
+    id.loaderVersion[0], // sys loader maj version
+    id.loaderVersion[1], // sys loader min version
+    toBCD(id.loaderDate.day), // sys loader date (day)
+    toBCD(id.loaderDate.month), // sys loader date (month)
+    toBCD(id.loaderDate.year / 100), // sys loader date (decade)
+    toBCD(id.loaderDate.year % 100), // sys loader date (year)
+    id.osVersion[0], // OS maj version
+    id.osVersion[1], // OS min version
+    toBCD(id.osDate.day), // OS date (day)
+    toBCD(id.osDate.month), // OS date (month)
+    toBCD(id.osDate.year / 100), // OS date (decade)
+    toBCD(id.osDate.year % 100), // OS date (year)
+    static_cast<uint8_t>(id.freeFlashBytes >> 24), // free space on flash storage (32 bit val)
+    static_cast<uint8_t>(id.freeFlashBytes >> 16),
+    static_cast<uint8_t>(id.freeFlashBytes >> 8),
+    static_cast<uint8_t>(id.freeFlashBytes),
+    static_cast<uint8_t>(id.serialNumber >> 8), // serial num hi
+    static_cast<uint8_t>(id.serialNumber) // serial num lo
+  };
+
+  m_replyTemplates[0x02] =
+  {
+    static_cast<uint8_t>(id.serialNumber >> 8),
+    static_cast<uint8_t>(id.serialNumber)
+  };
+
+  m_replyTemplates[0x09] = { 0x10 };
+
+  // Workshop data: success, the echoed sequence number (patched in), and
+  // two NUL-terminated strings in fixed-size fields, padded out to 0x76
+  std::vector<uint8_t>& workshop = m_replyTemplates[0x0A];
+  workshop.assign(0x77 - 7, 0);
+  workshop[0] = 1;
+  std::copy(id.workshopLine1.begin(), id.workshopLine1.end(), workshop.begin() + 2);
+  std::copy(id.workshopLine2.begin(), id.workshopLine2.end(), workshop.begin() + 2 + TesterIdentity::WORKSHOP_LINE1_LEN + 1);
+
+  // Date/time: the handler patches in the current time unless it's fixed
+  m_replyTemplates[0x3A].assign(7, 0);
+  id.dateTimeBCD(m_replyTemplates[0x3A].data());
 }
 
-bool TesterSim::sendReply(bool print)
+/**
+ * Copies a prebuilt reply payload into the output frame and sets its length.
+ */
+void TesterSim::applyReplyTemplate(uint8_t cmd, ReplyFrame& outbuf) const
 {
-  bool status = true;
-  if (m_outbuf[2] != 0)
+  const std::vector<uint8_t>& tmpl = m_replyTemplates[cmd];
+  outbuf.setLength(6 + tmpl.size());
+  outbuf.put(7, tmpl.data(), tmpl.size());
+}
+
+/**
+ * Sets the value of a location in ECU memory. The change is queued and takes
+ * effect before the next frame is processed by the listening thread.
+ */
+void TesterSim::setRAMLoc(uint16_t addr, uint8_t val)
+{
+  queueUpdate([this, addr, val]()
   {
-    std::this_thread::sleep_for(std::chrono::milliseconds(40));
+    m_ramData.set(addr, val);
+    noteWrite(AccessTracer::Space::RAM, addr, val);
+  });
+}
 
-    // Although m_outbuf[1] should contain the hi byte
-    // of a 16-bit byte count, it seems that neither the
-    // win32 size nor the Tester ever send packets with
-    // more than 128 bytes total (including the prefix).
-    const uint16_t len = m_outbuf[2] + 1;
-    if (print)
+/**
+ * Sets every byte that is set in the image (e.g. an imported dump, or a
+ * region filled or copied in the memory editor) in a single update. Since
+ * RAM is shared by all the ECUs, the writes aren't recorded against any of
+ * them in the access trace (whichever one WSDC32 last addressed may not be
+ * the one the image is meant for).
+ */
+void TesterSim::writeRAM(std::shared_ptr<const MemoryImage> image)
+{
+  queueUpdate([this, image]()
+  {
+    for (int addr = 0; addr < MemoryImage::SIZE; addr++)
     {
-      printPacket(m_outbuf);
+      if (image->isSet(addr))
+      {
+        m_ramData.set(addr, image->at(addr));
+        noteWrite(AccessTracer::Space::RAM, addr, image->at(addr));
+      }
     }
+  });
+}
 
-    const int wroteBytes = write(m_sockFd, m_outbuf, len);
-    status = (wroteBytes == len);
+/**
+ * Copies the current RAM contents into the image, along with a bitmap of the
+ * addresses that have been read since the last call. Since this is called
+ * periodically by the GUI, it doesn't wait for the listening thread: if a
+ * frame is being processed, it returns false and the image is left as it was
+ * (the bitmap is still collected).
+ */
+bool TesterSim::copyRAM(MemoryImage& image, std::vector<uint32_t>& reads)
+{
+  reads.resize(m_ramReads.size());
+  for (size_t i = 0; i < m_ramReads.size(); i++)
+  {
+    reads[i] = m_ramReads[i].exchange(0, std::memory_order_relaxed);
   }
-  return status;
+
+  if (!m_stateMutex.try_lock())
+  {
+    return false;
+  }
+  image = m_ramData;
+  m_stateMutex.unlock();
+  return true;
 }
 
-bool TesterSim::processBuf(bool print)
+/**
+ * Sets a sampled value. The change is queued and takes effect before the next
+ * frame is processed by the listening thread.
+ */
+void TesterSim::setValue(uint16_t id, uint32_t val)
 {
-  bool status = false;
-  const uint8_t size = m_inbuf[2] + 1;
-
-  if (size >= 7)
+  queueUpdate([this, id, val]()
   {
-    memcpy(m_outbuf, m_inbuf, size); // tablet SW usually starts by copying the message
-                                     // from the PC into the reply buffer
-    m_outbuf[0] = 0x54; // fixed value indicating a reply from the tester in
-                        // linked-to-PC mode
-    m_outbuf[1] = 0x00; // tester only seems to send messages with a length < 0x80,
-                        // so the hi byte is always 00
+    m_valueData[id & 0xff] = val;
+    m_valueSet[id & 0xff] = true;
+    noteWrite(AccessTracer::Space::Value, id, val);
+  });
+}
 
-    // To keep the log output cleaner, we keep track of whether we
-    // received multiple consecutive Write-to-File commands.
-    if (m_inbuf[6] != 0x21)
+/**
+ * Applies a batch of changes to the ECU state (see StateChange) in a single
+ * update, so that no frame sees only some of them, and waits until it has
+ * been applied.
+ */
+void TesterSim::applyChange(std::shared_ptr<const StateChange> change)
+{
+  runBetweenFrames([this, change]()
+  {
+    for (const RamRun& run : change->ram)
     {
-      m_lastCmdWasWriteToFile = false;
+      for (size_t i = 0; (i < run.bytes.size()) && (run.addr + i < MemoryImage::SIZE); i++)
+      {
+        m_ramData.set(run.addr + i, run.bytes[i]);
+        noteWrite(AccessTracer::Space::RAM, run.addr + i, run.bytes[i]);
+      }
     }
-
-    if (s_commandProcs.count(m_inbuf[6]))
+    for (const auto& value : change->values)
     {
-      s_commandProcs.at(m_inbuf[6])(m_inbuf, m_outbuf, this);
+      m_valueData[value.first] = value.second;
+      m_valueSet[value.first] = true;
+      noteWrite(AccessTracer::Space::Value, value.first, value.second);
     }
-    else
+    for (const auto& snapshot : change->snapshots)
     {
-      emit logMsg(QString("Sending generic 'success' response to command msg type 0x%1").arg(m_inbuf[6], 2, 16, QChar('0')));
-      m_outbuf[2] = 7;
-      m_outbuf[7] = 1;
+      m_snapshotData[snapshot.first] = snapshot.second;
+      for (size_t i = 0; i < snapshot.second.size(); i++)
+      {
+        noteWrite(AccessTracer::Space::Snapshot, (snapshot.first << 8) | i, snapshot.second[i]);
+      }
     }
-    status = sendReply(print);
+    if (change->replaceErrorMemory)
+    {
+      m_errorMemory = change->errorMemory;
+      for (size_t i = 0; i < m_errorMemory.size(); i++)
+      {
+        noteWrite(AccessTracer::Space::ErrorMemory, i, m_errorMemory[i]);
+      }
+    }
+  });
 
-    // TODO: Of the ECUs that send unsolicited info immediately after the ISO
-    // keyword sequence, we need to determine which of them have their ID info
-    // concatenated to the cmd 0x11 (or 0x12) response payload, and which have
-    // their info sent in separate messages after the 0x11/0x12 response.
-    // In the case of separate messages, the message type is probably supposed
-    // to be set to 0x13.
-  }
-  else
+  for (const auto& snapshot : change->snapshots)
   {
-    emit logMsg("Warning: received message of fewer than 7 bytes.\n");
+    emit snapshotWritten(snapshot.first,
+                         QByteArray(reinterpret_cast<const char*>(snapshot.second.data()), snapshot.second.size()));
   }
-  return status;
 }
 
-bool TesterSim::connectToSocket(const QString &sockPath)
+/**
+ * Fills in the query (see StateQuery) with the current ECU state, as it is
+ * between two frames. The values are those last set, not those that a data
+ * log being streamed would give, and reading them isn't recorded as an
+ * access.
+ */
+void TesterSim::queryState(StateQuery& query)
 {
-  bool status = false;
-  struct sockaddr_un addr;
-
-  m_sockFd = socket((AF_UNIX), SOCK_STREAM, 0);
-  if (m_sockFd > 0)
+  runBetweenFrames([this, &query]()
   {
-    memset(&addr, 0, sizeof(struct sockaddr_un));
-    addr.sun_family = AF_UNIX;
-    strncpy(addr.sun_path, sockPath.toStdString().c_str(), sizeof(addr.sun_path) - 1);
-
-    if (::connect(m_sockFd, (const struct sockaddr*)&addr, sizeof(struct sockaddr_un)) == 0)
+    for (RamRun& run : query.ram)
     {
-      status = true;
+      for (size_t i = 0; i < run.bytes.size(); i++)
+      {
+        run.bytes[i] = m_ramData.at((run.addr + i) & 0xffff);
+      }
     }
-    else
+    for (auto& value : query.values)
     {
-      m_sockFd = -1;
+      value.second = m_valueData[value.first];
     }
-  }
-
-  return status;
+    for (auto& snapshot : query.snapshots)
+    {
+      const auto it = m_snapshotData.find(snapshot.first);
+      snapshot.second = (it != m_snapshotData.end()) ? it->second : std::vector<uint8_t>();
+    }
+    if (query.errorMemory)
+    {
+      query.errorMemoryBytes = m_errorMemory;
+    }
+  });
 }
 
-void TesterSim::stopListening()
+/**
+ * Runs a function as a state update and waits until it has run. Only the
+ * calling thread waits: if the listening thread is busy with a frame, the
+ * update is applied as soon as that frame is done, rather than being left
+ * for the next one to arrive.
+ */
+void TesterSim::runBetweenFrames(std::function<void()> fn)
 {
-  m_shutdown = true;
-  if (m_sockFd >= 0)
+  std::shared_ptr<std::promise<void>> done = std::make_shared<std::promise<void>>();
+  std::future<void> finished = done->get_future();
+  queueUpdate([fn, done]()
   {
-    shutdown(m_sockFd, SHUT_RDWR);
+    fn();
+    done->set_value();
+  });
+
+  // Listening may have stopped just as the update was queued
+  while (finished.wait_for(std::chrono::milliseconds(UPDATE_RETRY_MS)) != std::future_status::ready)
+  {
+    drainIfNotListening();
   }
 }
 
 /**
- * Determines whether the packet containing the supplied buffer should be
- * printed in its entirety.
+ * Queues a change to the ECU state and returns without waiting. While
+ * listening, the listening thread is woken to apply it between frames (even
+ * if no frame is arriving). Otherwise, there is nothing for it to disturb,
+ * and it's applied right away.
  */
-bool TesterSim::shouldDisplayPacket(const uint8_t* buf)
+void TesterSim::queueUpdate(StateUpdateQueue::Update update)
 {
-  const uint8_t numBytes = buf[2];
-  bool status = true;
-  if (memcmp(buf, m_lastInbuf, numBytes) == 0)
+  m_updates.push(std::move(update));
+  if (m_listening)
   {
-    emit lastLogMsgRepeated();
-    status = false;
+    const char wake = 0;
+    if (write(m_wakeFds[1], &wake, 1) < 0)
+    {
+      // The pipe is already full of wake-ups, which is just as good
+    }
+  }
+  else
+  {
+    drainIfNotListening();
   }
-  memcpy(m_lastInbuf, buf, numBytes);
-  return status;
 }
 
-void TesterSim::printPacket(const uint8_t* buf)
+/**
+ * Applies the queued updates on the calling thread, but only if no listening
+ * thread is running to apply them.
+ */
+void TesterSim::drainIfNotListening()
 {
-  QString packetStr;
-  for (int i = 0; i <= buf[2]; i++)
+  if (!m_listening)
   {
-    packetStr += QString("%1 ").arg(buf[i], 2, 16, QChar('0'));
+    std::lock_guard<std::mutex> lock(m_stateMutex);
+    if (!m_listening)
+    {
+      m_updates.drain();
+    }
   }
-  log(packetStr);
 }
 
-void TesterSim::emitConsecutiveWriteToFileSignal()
+/**
+ * Returns the compiled database record for the given ECU ID, or null if
+ * there is no database loaded or it has no record for the ECU.
+ */
+const EcuRecord* TesterSim::ecuRecord(int ecuId) const
 {
-  emit consecutiveWriteToFileCmd();
+  const EcuRecord* rec = m_ecuDb ? m_ecuDb->find(ecuId) : nullptr;
+  for (auto db = m_layerEcuDbs.rbegin(); !rec && (db != m_layerEcuDbs.rend()); ++db)
+  {
+    rec = (*db)->find(ecuId);
+  }
+  return rec;
 }
 
-bool TesterSim::listen()
+/**
+ * Returns the contents of the .ECU module for the given ECU ID, as found in
+ * the Tester's filesystem, or null if it isn't there.
+ */
+const QVector<quint8>* TesterSim::findModule(int ecuId) const
 {
-  bool status = true;
-  int fullPacketSize = 0;
-
-  while (status && !m_shutdown)
+  const QString moduleDir("/FN0/ecu");
+  const EcuRecord* rec = ecuRecord(ecuId);
+  if (rec && !rec->exe.empty())
   {
-    // Read the first 3 bytes. The first byte (which we'll call the prefix)
-    // is fixed to be one of a couple possible values, depending on the mode
-    // of the Windows diagnostic software (Ferrari vs. Maserati).
-    // The second and third bytes, taken together, are a big-endian 16-bit
-    // count of the bytes in the payload for this message, including those
-    // two bytes themselves but not including the prefix byte.
-    if (readBytes(m_inbuf, 3) == 3)
+    const QVector<quint8>* contents = m_fs.find(moduleDir, QString::fromStdString(rec->exe));
+    if (contents)
     {
-      fullPacketSize = m_inbuf[2] + 1;
-
-      if ((fullPacketSize >= 7) &&
-          (readBytes(m_inbuf + 3, fullPacketSize - 3) ==
-            (fullPacketSize - 3)))
-      {
-        if (shouldDisplayPacket(m_inbuf))
-        {
-          printPacket(m_inbuf);
-          status = processBuf(true);
-        }
-        else
-        {
-          status = processBuf(false);
-        }
-      }
-      else
-      {
-        if (fullPacketSize < 7)
-        {
-          emit logMsg(QString("Error: reported packet size of %1 too small").arg(fullPacketSize));
-        }
-        else
-        {
-          emit logMsg("Error receiving packet body");
-        }
-        status = false;
-      }
+      return contents;
     }
-    else
+  }
+
+  // Modules that were uploaded after the ECU database was compiled
+  const QString suffix = QString("%1.ECU").arg(ecuId, 4, 10, QChar('0'));
+  for (const VirtualFilesystem::DirEntry& entry : m_fs.list(moduleDir))
+  {
+    if (entry.name.endsWith(suffix, Qt::CaseInsensitive))
     {
-      // failed to read the first three bytes of the packet
-      status = false;
+      return m_fs.find(moduleDir, entry.name);
     }
   }
-
-  return status;
+  return nullptr;
 }
 
-void TesterSim::process01TabletInfo(const uint8_t* /*inbuf*/, uint8_t* outbuf, TesterSim* sim)
+/**
+ * Loads the .ECU module of the application on the given pipe into a new
+ * emulated 68k and starts it.
+ */
+void TesterSim::startModule(ApplContext& ctx, int pipeNum)
 {
-  sim->log("Request for Tester info");
-  outbuf[1] = 0;
-  outbuf[2] = 0x18;
-  outbuf[7] = 0x03; // sys loader maj version
-  outbuf[8] = 0x01; // sys loader min version
-  outbuf[9] = 0x25; // sys loader date (day)
-  outbuf[10] = 0x09; // sys loader date (month)
-  outbuf[11] = 0x19; // sys loader date (decade)
-  outbuf[12] = 0x98; // sys loader date (year)
-  outbuf[13] = 0x05; // OS maj version
-  outbuf[14] = 0x05; // OS min version
-  outbuf[15] = 0x04; // OS date (day)
-  outbuf[16] = 0x03; // OS date (month)
-  outbuf[17] = 0x19; // OS date (decade)
-  outbuf[18] = 0x99; // OS date (year)
-  outbuf[19] = 0x00; // free space on flash storage (32 bit val)
-  outbuf[20] = 0x23;
-  outbuf[21] = 0x33;
-  outbuf[22] = 0x33;
-  outbuf[23] = 0;   // serial num hi
-  outbuf[24] = 212; // serial num lo
+  const QVector<quint8>* image = findModule(ctx.ecuId);
+  if (image)
+  {
+    ctx.module = std::make_shared<ModuleRunner>([this](const QString& line) { log(line); });
+    const uint16_t ecuId = ctx.ecuId;
+    ctx.module->setLineModel([this, ecuId](const QByteArray& request, int, const QByteArray& sent)
+    {
+      return answerModuleLine(ecuId, request, sent);
+    });
+    if (ctx.module->start(*image, ctx.ecuId, pipeNum))
+    {
+      log(QString("Running module for ECU ID %1 in the 68k emulator").arg(ctx.ecuId, 4, 10, QChar('0')));
+    }
+    else
+    {
+      ctx.module.reset();
+    }
+  }
+  else
+  {
+    log(QString("No module for ECU ID %1 in the filesystem to run").arg(ctx.ecuId, 4, 10, QChar('0')));
+  }
 }
 
-void TesterSim::process02SerialNo(const uint8_t* /*inbuf*/, uint8_t* outbuf, TesterSim* sim)
+/**
+ * Passes a request frame to the .ECU module running for its pipe, if there
+ * is one, and puts the module's reply frame in the output buffer. Any further
+ * frames that the module wrote follow the reply as unsolicited frames.
+ * Returns false if no module is running, or if it didn't reply, in which case
+ * the request is left to the protocol handlers.
+ */
+bool TesterSim::runModule(const uint8_t* inbuf, ReplyFrame& outbuf)
 {
-  sim->log("Request for Tester serial no.");
-  outbuf[2] = 8;
-  outbuf[7] = 0;   // hi byte
-  outbuf[8] = 212; // lo byte
-}
+  ApplContext& ctx = applContext(inbuf);
+  if (!ctx.module || !ctx.module->running())
+  {
+    return false;
+  }
 
-void TesterSim::process09(const uint8_t* /*inbuf*/, uint8_t* outbuf, TesterSim* /*sim*/)
-{
-  outbuf[1] = 0;
-  outbuf[2] = 7;
-  outbuf[7] = 0x10;
-}
+  std::vector<QByteArray> replies;
+  uint32_t elapsedMs = 0;
+  const int len = ((inbuf[1] << 8) | inbuf[2]) + 1;
+  ctx.module->request(inbuf, len, replies, elapsedMs);
 
-void TesterSim::process0AWorkshopData(const uint8_t* inbuf, uint8_t* outbuf, TesterSim* sim)
-{
-  sim->log("Request for workshop data");
-  outbuf[2] = 0x76;
-  outbuf[7] = 1;
-  outbuf[8] = inbuf[7];
-  char c = 'a';
-  int pos = 9;
-  while (pos < 19)
+  for (int line = 1; line <= 2; line++)
   {
-    outbuf[pos++] = c++;
+    const QByteArray sent = ctx.module->takeLineOutput(line);
+    if (!sent.isEmpty())
+    {
+      QString msg = QString("Module sent %1 bytes on ISO line %2:").arg(sent.size()).arg(line);
+      for (int i = 0; i < sent.size(); i++)
+      {
+        msg += QString(" %1").arg(static_cast<uint8_t>(sent.at(i)), 2, 16, QChar('0'));
+      }
+      log(msg);
+    }
   }
-  outbuf[pos++] = '\0';
-  while (pos < 29)
+
+  // Frames too short to have an SD2 header can't be sent
+  replies.erase(std::remove_if(replies.begin(), replies.end(), [](const QByteArray& frame)
+  {
+    return frame.size() < 7;
+  }), replies.end());
+  if (replies.empty())
   {
-    outbuf[pos++] = c++;
+    log(QString("Warning: module for ECU ID %1 did not reply").arg(ctx.ecuId, 4, 10, QChar('0')));
+    return false;
   }
-  outbuf[pos++] = '\0';
-  while (pos < 0x77)
+
+  outbuf.put(0, replies.front().constData(), replies.front().size());
+  outbuf[0] = 0x54;
+  outbuf.setLength(replies.front().size() - 1);
+
+  // The module's waits are simulated time, and may be long if the line model
+  // didn't answer, so only part of that is passed on as the reply delay
+  if (!ctx.module->timedOut())
   {
-    outbuf[pos++] = '\0';
+    m_replyDelayMs = std::min<uint32_t>(std::max<uint32_t>(REPLY_DELAY_MS, elapsedMs), MODULE_REPLY_DELAY_LIMIT_MS);
   }
-}
 
-void TesterSim::process0BStartApplModGest(const uint8_t* inbuf, uint8_t* outbuf, TesterSim* sim)
-{
-  const uint16_t ecuId = (inbuf[7] * 0x100) + inbuf[8];
-  const uint8_t pipeNum = inbuf[9];
-  sim->log(QString("Starting _applModGest%1 thread on pipe %2").arg(ecuId, 4, 10, QChar('0')).arg(pipeNum));
-  std::this_thread::sleep_for(std::chrono::milliseconds(500));
-  sim->m_applRun[pipeNum] = true;
-  sim->m_currentECUID = ecuId;
-  outbuf[2] = 7;
-  outbuf[7] = 1;
+  for (size_t i = 1; i < replies.size(); i++)
+  {
+    UnsolicitedFrame unsolicited = { 0, 0, std::vector<uint8_t>(replies[i].constBegin(), replies[i].constEnd()), 0 };
+    std::vector<uint8_t>& frame = unsolicited.frame;
+    frame[0] = 0x54;
+    frame[1] = (frame.size() - 1) >> 8;
+    frame[2] = (frame.size() - 1) & 0xff;
+    m_unsolicitedFrames.push_back(unsolicited);
+  }
+  return true;
 }
 
-void TesterSim::process11DoSlowInit(const uint8_t* inbuf, uint8_t* outbuf, TesterSim* sim)
+/**
+ * Line model for the modules: answers what a module has sent on its ISO line
+ * with the ECU's side of an exchange learned from captures. While the module
+ * handles a cmd 0x11/0x12 request, the ECU's answer to the line init (or its
+ * address byte) is the learned keyword. Otherwise the bytes sent are taken to
+ * be a protocol block, and looked up as a cmd 0x13 request carrying the
+ * complete block from position 08. Returns nothing if there's no match, in
+ * which case the ECU stays silent.
+ */
+QByteArray TesterSim::answerModuleLine(uint16_t ecuId, const QByteArray& request, const QByteArray& sent)
 {
-  std::this_thread::sleep_for(std::chrono::seconds(1));
+  if (request.size() < 7)
+  {
+    return QByteArray();
+  }
 
-  const uint8_t ecuAddr = inbuf[7];
-  if (inbuf[2] >= 8)
+  QByteArray frame;
+  const uint8_t cmd = request.at(6);
+  if ((cmd == 0x11) || (cmd == 0x12))
   {
-    sim->log(QString("Do 5-baud slow init for ECU address 0x%1 with %2 bytes expected in response sequence").arg(ecuAddr, 2, 16, QChar('0')).arg(inbuf[8]));
+    if (sent.size() > 1)
+    {
+      return QByteArray();
+    }
+    frame = request;
   }
   else
   {
-    sim->log(QString("Do 5-baud slow init for ECU address 0x%1").arg(ecuAddr, 2, 16, QChar('0')));
+    frame = request.left(6);
+    frame.append(static_cast<char>(0x13));
+    frame.append(static_cast<char>(0x00));
+    frame.append(sent);
+    frame[1] = static_cast<char>((frame.size() - 1) >> 8);
+    frame[2] = static_cast<char>((frame.size() - 1) & 0xff);
   }
 
-  process12GetISOKeyword(inbuf, outbuf, sim);
+  const uint8_t* frameData = reinterpret_cast<const uint8_t*>(frame.constData());
+  m_moduleLineReply.start(frameData, frame.size());
+  if (!m_learned->respond(ecuId, frameData, m_moduleLineReply) || (m_moduleLineReply.size() <= 8))
+  {
+    return QByteArray();
+  }
+  return QByteArray(reinterpret_cast<const char*>(m_moduleLineReply.data()) + 8, m_moduleLineReply.size() - 8);
 }
 
-void TesterSim::process12GetISOKeyword(const uint8_t* /*inbuf*/, uint8_t* outbuf, TesterSim* sim)
+/**
+ * Runs the scenario actions triggered by a protocol block sent to an ECU.
+ * Actions without a delay are applied immediately; the rest are queued.
+ * Frames to be sent are handed to the frame scheduler, delay and all.
+ */
+void TesterSim::runScenario(int ecuId, const uint8_t* block, int len)
 {
-  if (sim->s_isoBytes.count(sim->m_currentECUID))
+  if (!m_scenario)
   {
-    const std::vector<uint8_t>& isoBytes = sim->s_isoBytes.at(sim->m_currentECUID);
-    const int isoByteCount = isoBytes.size();
-    QString replyLogMsg = QString("Replying with keyword sequence of %1 bytes:").arg(isoByteCount);
-    outbuf[2] = 7 + isoByteCount;
-    outbuf[7] = 1;
+    return;
+  }
 
-    for (int i = 0; i < isoByteCount; i++)
-    {
-      outbuf[8 + i] = isoBytes[i];
-      replyLogMsg += QString(" %1").arg(isoBytes[i], 2, 16, QChar('0'));
-    }
+  Scenario::ActionRange ranges[Scenario::MAX_MATCHES];
+  const auto state = m_scenarioStates.find(ecuId);
+  const int matches = m_scenario->match(ecuId, (state != m_scenarioStates.end()) ? state->second : 0,
+                                        block, len, ranges);
+  const auto now = std::chrono::steady_clock::now();
 
-    // There are some modules whose cmd 11/12 reply message contains
-    // more than just the ISO keyword sequence -- it contains one or more
-    // frames of ID data from the ECU, which are concatenated into the same
-    // serial message payload from the Tester back to WSDC32.
-    if (sim->s_moduleExtraInitInfo.count(sim->m_currentECUID))
+  for (int i = 0; i < matches; i++)
+  {
+    for (const Scenario::Action* action = ranges[i].begin; action != ranges[i].end; ++action)
     {
-      const int extraDataLen = sim->s_moduleExtraInitInfo.at(sim->m_currentECUID).size();
-      outbuf[2] = 7 + isoByteCount + extraDataLen;
-      memcpy(&outbuf[8 + isoByteCount], sim->s_moduleExtraInitInfo.at(sim->m_currentECUID).data(), extraDataLen);
-
-      printf("slow init reply msg:");
-      for (int i = 0; i <= outbuf[2]; i++)
+      if (action->type == Scenario::ActionType::SendFrame)
+      {
+        // A periodic frame is keyed by its action, so that the rule firing
+        // again re-arms it instead of starting another one
+        const uint32_t key = (action->periodMs > 0) ? (m_scenario->actionIndex(*action) + 1) : 0;
+        queueUnsolicitedFrame(m_scenario->sendBytes(*action), action->target, action->delayMs, action->periodMs, key);
+      }
+      else if (action->delayMs == 0)
+      {
+        applyScenarioAction(ecuId, *action);
+      }
+      else
       {
-        printf(" %02X", outbuf[i]);
+        m_pendingActions.push_back({ now + std::chrono::milliseconds(action->delayMs), ecuId, *action });
+        std::push_heap(m_pendingActions.begin(), m_pendingActions.end());
       }
-      printf("\n");
     }
-
-    sim->log(replyLogMsg);
   }
-  else
+}
+
+/**
+ * Applies any delayed scenario actions that have come due.
+ */
+void TesterSim::runPendingScenarioActions()
+{
+  const auto now = std::chrono::steady_clock::now();
+  while (!m_pendingActions.empty() && (m_pendingActions.front().due <= now))
   {
-    sim->log(QString("Warning: no ISO byte record for ECU ID %1").arg(sim->m_currentECUID, 4, 10, QChar('0')));
+    std::pop_heap(m_pendingActions.begin(), m_pendingActions.end());
+    const PendingAction pending = m_pendingActions.back();
+    m_pendingActions.pop_back();
+    applyScenarioAction(pending.ecuId, pending.action);
   }
 }
 
-void TesterSim::process13CommandToECU(const uint8_t* inbuf, uint8_t* outbuf, TesterSim* sim)
+void TesterSim::applyScenarioAction(int ecuId, const Scenario::Action& action)
 {
-  const int currentECU = sim->m_currentECUID;
-  if (s_protocols.count(currentECU))
+  AccessTracer::EcuTrace* trace = m_tracing ? m_tracer.ecu(ecuId) : nullptr;
+  switch (action.type)
   {
-    const ProtocolType proto = s_protocols.at(currentECU);
+  case Scenario::ActionType::SetRAM:
+    m_ramData.set(action.target, action.value);
+    noteWrite(AccessTracer::Space::RAM, action.target, action.value & 0xff, trace);
+    break;
+  case Scenario::ActionType::SetValue:
+    m_valueData[action.target & 0xff] = action.value;
+    m_valueSet[action.target & 0xff] = true;
+    noteWrite(AccessTracer::Space::Value, action.target, action.value, trace);
+    break;
+  case Scenario::ActionType::SetErrorMemory:
+    if (m_errorMemory.size() <= action.target)
+    {
+      m_errorMemory.resize(action.target + 1, 0);
+    }
+    m_errorMemory[action.target] = action.value;
+    noteWrite(AccessTracer::Space::ErrorMemory, action.target, action.value & 0xff, trace);
+    break;
+  case Scenario::ActionType::SetState:
+    m_scenarioStates[ecuId] = action.value;
+    log(QString("Scenario: ECU %1 is now in state '%2'").arg(ecuId, 4, 10, QChar('0')).
+      arg(m_scenario->stateName(ecuId, action.value)));
+    break;
+  case Scenario::ActionType::SendFrame:
+    // scheduled directly by runScenario()
+    break;
+  }
+}
 
-    // Sometimes (maybe just for certain ECUs like BMOT0145?), WSDC32 sends requests with 0x13 in position 06,
-    // and the request payload starting immediately after (at position 07). In this format, the request payload
-    // does not contain the block's prefix/size byte, the block sequence number, or the terminator.
+/**
+ * Returns the contents of a location in ECU memory. If a data log is being
+ * streamed and it has a channel for this address, the value is taken from
+ * the log at the current playback time; otherwise it's the value last set
+ * through the GUI (or zero).
+ */
+uint8_t TesterSim::readRAM(uint16_t addr)
+{
+  std::atomic<uint32_t>& reads = m_ramReads[addr / 32];
+  const uint32_t bit = 1u << (addr % 32);
+  if (!(reads.load(std::memory_order_relaxed) & bit))
+  {
+    reads.fetch_or(bit, std::memory_order_relaxed);
+  }
+
+  uint8_t val = 0;
+  if (!m_dataLog || !m_dataLog->readRAM(addr, m_dataLogTimeMs, val))
+  {
+    val = m_ramData.at(addr);
+  }
+  noteRead(AccessTracer::Space::RAM, addr, val);
+  return val;
+}
+
+/**
+ * Returns a byte of error memory, which must exist.
+ */
+uint8_t TesterSim::readErrorMemory(int index)
+{
+  noteRead(AccessTracer::Space::ErrorMemory, index, m_errorMemory[index]);
+  return m_errorMemory[index];
+}
+
+/**
+ * Returns a sampled value, from the streamed data log if it has a channel
+ * for this value ID, or otherwise as last set through the GUI (or zero).
+ */
+uint32_t TesterSim::readValue(uint8_t id)
+{
+  uint32_t val = 0;
+  if (!m_dataLog || !m_dataLog->readValue(id, m_dataLogTimeMs, val))
+  {
+    val = m_valueData[id];
+  }
+  noteRead(AccessTracer::Space::Value, id, val);
+  return val;
+}
+
+/**
+ * Records a read of ECU state by WSDC32, in the access trace (if tracing)
+ * and for control API subscribers (if there are any).
+ */
+void TesterSim::noteRead(AccessTracer::Space space, uint32_t addr, uint32_t val)
+{
+  if (m_trace)
+  {
+    m_trace->recordRead(space, addr);
+  }
+  if (m_accessEvents.enabled())
+  {
+    m_accessEvents.push(space, false, addr, val);
+  }
+}
+
+/**
+ * Records a write of ECU state (by the GUI, a scenario or the control API)
+ * for control API subscribers. Only a write made on behalf of a particular
+ * ECU, i.e. by a scenario, is given that ECU's trace to be recorded in; the
+ * GUI and the control API don't write to any one ECU, and are left out of
+ * the access trace.
+ */
+void TesterSim::noteWrite(AccessTracer::Space space, uint32_t addr, uint32_t val, AccessTracer::EcuTrace* trace)
+{
+  if (trace)
+  {
+    trace->recordWrite(space, addr);
+  }
+  if (m_accessEvents.enabled())
+  {
+    m_accessEvents.push(space, true, addr, val);
+  }
+}
+
+/**
+ * Reads whatever bytes are available from the socket into the receive
+ * buffer. Returns false if the connection was closed.
+ */
+bool TesterSim::receiveBytes()
+{
+  TRACE_SPAN("receiveBytes");
+  const int readResult = read(m_sockFd, m_rxBuf + m_rxLen, sizeof(m_rxBuf) - m_rxLen);
+  if (readResult == 0)
+  {
+    return false;
+  }
+  else if (readResult < 0)
+  {
+    return (errno == EINTR) || (errno == EAGAIN) || (errno == EWOULDBLOCK);
+  }
+  m_rxLen += readResult;
+  return true;
+}
+
+/**
+ * Processes every complete frame received so far. Partial frames are kept
+ * until the rest arrives, so a slow sender never holds up the scheduled
+ * output. If the output queue becomes congested, the remaining frames are
+ * left in the buffer until it drains. Returns false if a malformed frame
+ * was received.
+ */
+bool TesterSim::processReceivedFrames()
+{
+  bool status = true;
+  int consumed = 0;
+
+  // The first byte of each frame (which we'll call the prefix) is fixed to be
+  // one of a couple possible values, depending on the mode of the Windows
+  // diagnostic software (Ferrari vs. Maserati). The second and third bytes,
+  // taken together, are a big-endian 16-bit count of the bytes in the payload
+  // for this message, including those two bytes themselves but not including
+  // the prefix byte.
+  while (status && !m_shutdown && !m_output.congested() && (m_rxLen - consumed >= 3))
+  {
+    const int fullPacketSize = ((m_rxBuf[consumed + 1] << 8) | m_rxBuf[consumed + 2]) + 1;
+    if (fullPacketSize < 7)
+    {
+      log(QString("Error: reported packet size of %1 too small").arg(fullPacketSize));
+      status = false;
+    }
+    else if (fullPacketSize > MAX_REQUEST_SIZE)
+    {
+      log(QString("Error: reported packet size of %1 too large").arg(fullPacketSize));
+      status = false;
+    }
+    else if (m_rxLen - consumed >= fullPacketSize)
+    {
+      memcpy(m_inbuf, m_rxBuf + consumed, fullPacketSize);
+      consumed += fullPacketSize;
+      status = handleFrame();
+    }
+    else
+    {
+      break;
+    }
+  }
+
+  m_rxLen -= consumed;
+  memmove(m_rxBuf, m_rxBuf + consumed, m_rxLen);
+  return status;
+}
+
+/**
+ * Processes the complete frame in m_inbuf.
+ */
+bool TesterSim::handleFrame()
+{
+  TRACE_SPAN("handleFrame");
+  std::lock_guard<std::mutex> lock(m_stateMutex);
+  beginFrame();
+
+  if (shouldDisplayPacket(m_inbuf))
+  {
+    printPacket(m_inbuf);
+    return processBuf(true);
+  }
+  return processBuf(false);
+}
+
+/**
+ * Brings the ECU state up to date before a frame is processed. Must be called
+ * with m_stateMutex held.
+ */
+void TesterSim::beginFrame()
+{
+  TRACE_SPAN("beginFrame");
+  // Apply any state changes made by the GUI since the last frame,
+  // and pick up any files that were changed in the host mirror
+  m_updates.drain();
+  const int hostChanges = m_fs.pollHostChanges();
+  if (hostChanges > 0)
+  {
+    log(QString("Picked up %1 change(s) from host directory").arg(hostChanges));
+  }
+
+  runPendingScenarioActions();
+
+  // All reads from the data log during this frame see the same instant
+  if (m_dataLog)
+  {
+    m_dataLogTimeMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - m_dataLogStart).count();
+  }
+}
+
+/**
+ * Processes a single request frame synchronously, without a socket, and
+ * returns the reply (empty if there is none) along with how long the Tester
+ * would take to send it and any unsolicited frames that would follow it.
+ * This is for embedding the simulator (see capi/), and must not be used
+ * while listening.
+ */
+bool TesterSim::transact(const uint8_t* request, int len, std::vector<uint8_t>& reply, uint32_t& delayMs,
+                         std::vector<UnsolicitedFrame>& unsolicited)
+{
+  if ((len < 7) || (len > MAX_REQUEST_SIZE) || (((request[1] << 8) | request[2]) + 1 != len))
+  {
+    log(QString("Error: request of %1 bytes is not a single well-formed frame").arg(len));
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(m_stateMutex);
+  memcpy(m_inbuf, request, len);
+  beginFrame();
+
+  const bool print = shouldDisplayPacket(m_inbuf);
+  if (print)
+  {
+    printPacket(m_inbuf);
+  }
+  if (!buildReply())
+  {
+    return false;
+  }
+
+  reply.clear();
+  if (m_outbuf.length() != 0)
+  {
+    if (print)
+    {
+      printPacket(m_outbuf.data());
+    }
+    reply.assign(m_outbuf.data(), m_outbuf.data() + m_outbuf.size());
+  }
+  delayMs = m_replyDelayMs;
+  unsolicited.clear();
+  unsolicited.swap(m_unsolicitedFrames);
+  m_replyDelayMs = REPLY_DELAY_MS;
+  return true;
+}
+
+/**
+ * Queues every scheduled frame that has come due (unless the output is
+ * already backed up) and writes as much of the output queue as the socket
+ * will take. Returns false if the connection failed.
+ */
+bool TesterSim::flushOutput()
+{
+  TRACE_SPAN("flushOutput");
+  if (!m_output.congested())
+  {
+    m_scheduler.collectDue(FrameScheduler::Clock::now(), m_output);
+  }
+  return (m_output.flush(m_sockFd) != OutputQueue::FlushResult::Error);
+}
+
+/**
+ * Schedules the reply in m_outbuf to be sent once the Tester's response time
+ * (m_replyDelayMs) has passed.
+ */
+bool TesterSim::sendReply(bool print)
+{
+  TRACE_SPAN("sendReply");
+  if (m_outbuf.length() != 0)
+  {
+    if (print)
+    {
+      printPacket(m_outbuf.data());
+    }
+
+    m_scheduler.schedule(m_replyDelayMs, 0, m_inbuf[5], m_outbuf.data(), m_outbuf.size());
+  }
+  return true;
+}
+
+/**
+ * Queues an unsolicited cmd 0x13 frame carrying the given payload, to be
+ * sent on the same pipe as the request being processed. The delay is
+ * measured from when the reply to that request is sent, and the frame is
+ * repeated every periodMs milliseconds if that is nonzero. The SD2 header is
+ * taken from the request, the same way that replies are built. A nonzero key
+ * replaces whatever was queued earlier on the pipe with the same key.
+ */
+void TesterSim::queueUnsolicitedFrame(const uint8_t* payload, int len, uint32_t delayMs, uint32_t periodMs,
+                                      uint32_t key)
+{
+  UnsolicitedFrame unsolicited = { delayMs, periodMs, std::vector<uint8_t>(m_inbuf, m_inbuf + 8), key };
+  std::vector<uint8_t>& frame = unsolicited.frame;
+  frame[0] = 0x54;
+  frame[1] = 0x00;
+  frame[2] = 7 + len;
+  frame[6] = 0x13;
+  frame[7] = 0x01;
+  frame.insert(frame.end(), payload, payload + len);
+  m_unsolicitedFrames.push_back(unsolicited);
+}
+
+/**
+ * Processes the frame in m_inbuf and schedules the reply, along with any
+ * unsolicited frames.
+ */
+bool TesterSim::processBuf(bool print)
+{
+  if (!buildReply())
+  {
+    return false;
+  }
+
+  const bool status = sendReply(print);
+
+  // Any unsolicited frames produced while handling the request follow the
+  // reply, with their delays measured from when it is sent
+  for (const UnsolicitedFrame& unsolicited : m_unsolicitedFrames)
+  {
+    m_scheduler.schedule(m_replyDelayMs + unsolicited.delayMs, unsolicited.periodMs, m_inbuf[5],
+                         unsolicited.frame.data(), unsolicited.frame.size(), unsolicited.key);
+  }
+  m_unsolicitedFrames.clear();
+  m_replyDelayMs = REPLY_DELAY_MS;
+  return status;
+}
+
+/**
+ * Runs the handler for the frame in m_inbuf, leaving the reply in m_outbuf,
+ * its delay in m_replyDelayMs and any unsolicited frames that should follow
+ * it in m_unsolicitedFrames.
+ */
+bool TesterSim::buildReply()
+{
+  bool status = false;
+  const int size = m_inbuf[2] + 1;
+
+  if (size >= 7)
+  {
+    m_outbuf.start(m_inbuf, size); // tablet SW usually starts by copying the message
+                                   // from the PC into the reply buffer
+    m_outbuf[0] = 0x54; // fixed value indicating a reply from the tester in
+                        // linked-to-PC mode
+
+    // To keep the log output cleaner, we keep track of whether we
+    // received multiple consecutive Write-to-File (or Read-from-File)
+    // commands.
+    if (m_inbuf[6] != 0x21)
+    {
+      m_lastCmdWasWriteToFile = false;
+    }
+
+    if (m_inbuf[6] != 0x24)
+    {
+      m_lastCmdWasReadFromFile = false;
+    }
+
+    TRACE_SPAN_ARG("cmd", m_inbuf[6]);
+    if (s_commandProcs[m_inbuf[6]])
+    {
+      s_commandProcs[m_inbuf[6]](m_inbuf, m_outbuf, this);
+    }
+    else
+    {
+      reportGap(m_inbuf, GapReport::NONE, GapReport::NONE, GapReport::NONE, "no handler; sent generic success");
+      m_outbuf.setLength(7);
+      m_outbuf[7] = 1;
+    }
+
+    if (m_outbuf.overflowed())
+    {
+      log(QString("Error: reply to command msg type 0x%1 did not fit in a frame and was truncated").
+        arg(m_inbuf[6], 2, 16, QChar('0')));
+    }
+    status = true;
+
+    // TODO: Of the ECUs that send unsolicited info immediately after the ISO
+    // keyword sequence, we need to determine which of them have their ID info
+    // concatenated to the cmd 0x11 (or 0x12) response payload, and which have
+    // their info sent in separate messages after the 0x11/0x12 response.
+    // In the case of separate messages, the message type is probably supposed
+    // to be set to 0x13, and they can be sent with queueUnsolicitedFrame().
+  }
+  else
+  {
+    log("Warning: received message of fewer than 7 bytes.\n");
+  }
+  return status;
+}
+
+bool TesterSim::connectToSocket(const QString &sockPath)
+{
+  bool status = false;
+  struct sockaddr_un addr;
+
+  m_shutdown = false;
+  m_sockFd = socket((AF_UNIX), SOCK_STREAM, 0);
+  if (m_sockFd > 0)
+  {
+    memset(&addr, 0, sizeof(struct sockaddr_un));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, sockPath.toStdString().c_str(), sizeof(addr.sun_path) - 1);
+
+    if (::connect(m_sockFd, (const struct sockaddr*)&addr, sizeof(struct sockaddr_un)) == 0)
+    {
+      // Reads and writes are driven by poll(), and must never block
+      fcntl(m_sockFd, F_SETFL, fcntl(m_sockFd, F_GETFL) | O_NONBLOCK);
+      status = true;
+    }
+    else
+    {
+      m_sockFd = -1;
+    }
+  }
+
+  return status;
+}
+
+void TesterSim::stopListening()
+{
+  m_shutdown = true;
+  if (m_sockFd >= 0)
+  {
+    shutdown(m_sockFd, SHUT_RDWR);
+  }
+}
+
+/**
+ * Determines whether the packet containing the supplied buffer should be
+ * printed in its entirety.
+ */
+bool TesterSim::shouldDisplayPacket(const uint8_t* buf)
+{
+  const uint8_t numBytes = buf[2];
+  bool status = true;
+  if (memcmp(buf, m_lastInbuf, numBytes) == 0)
+  {
+    if (m_logBuffer.addRepeat())
+    {
+      TRACE_SPAN("emit logReady");
+      emit logReady();
+    }
+    status = false;
+  }
+  memcpy(m_lastInbuf, buf, numBytes);
+  return status;
+}
+
+/**
+ * Logs a frame as hex bytes. The bytes are copied into the log buffer as
+ * they are, and only formatted when the GUI takes them.
+ */
+void TesterSim::printPacket(const uint8_t* buf)
+{
+  if (m_logBuffer.addFrame(buf, ((buf[1] << 8) | buf[2]) + 1))
+  {
+    TRACE_SPAN("emit logReady");
+    emit logReady();
+  }
+}
+
+void TesterSim::logConsecutiveWriteToFile()
+{
+  if (m_logBuffer.addDot())
+  {
+    TRACE_SPAN("emit logReady");
+    emit logReady();
+  }
+}
+
+/**
+ * Counts a request that the simulator can't answer properly in the gap
+ * report (see GapReport). Only the first request of each kind is logged.
+ */
+void TesterSim::reportGap(const uint8_t* inbuf, int ecuId, int protocol, int titlePos, const char* what)
+{
+  if (m_gaps.record(inbuf, ecuId, protocol, titlePos, what))
+  {
+    QString details = QString("cmd 0x%1").arg(inbuf[6], 2, 16, QChar('0'));
+    if (ecuId != GapReport::NONE)
+    {
+      details += QString(", ECU ID %1").arg(ecuId, 4, 10, QChar('0'));
+    }
+    if (titlePos != GapReport::NONE)
+    {
+      details += QString(", block title 0x%1").arg(inbuf[titlePos], 2, 16, QChar('0'));
+    }
+    log(QString("Warning: %1 (%2); repeats are only counted in the gap report").arg(what).arg(details));
+  }
+}
+
+void TesterSim::logConsecutiveReadFromFile()
+{
+  if (m_logBuffer.addDot())
+  {
+    TRACE_SPAN("emit logReady");
+    emit logReady();
+  }
+}
+
+/**
+ * Returns the application context for the pipe named in the header of the
+ * supplied frame (position 05). If that byte does not name a pipe with a
+ * running application, the context most recently started with cmd 0x0B is
+ * used instead, which preserves the single-ECU behavior for frames that
+ * don't carry a pipe number.
+ */
+ApplContext& TesterSim::applContext(const uint8_t* inbuf)
+{
+  const uint8_t pipeNum = inbuf[5];
+  if ((pipeNum < NUM_PIPES) && m_appl[pipeNum].running)
+  {
+    return m_appl[pipeNum];
+  }
+  return m_appl[m_lastApplPipe];
+}
+
+/**
+ * Services the connection to WSDC32 until it is closed or stopListening() is
+ * called. The thread waits for incoming data, the next scheduled frame, or
+ * room in the socket's send buffer, whichever comes first, so that
+ * unsolicited and periodic frames go out on time even while no requests are
+ * arriving. While the output queue is congested, no new requests are read.
+ */
+bool TesterSim::listen()
+{
+  bool status = true;
+  SpanTracer::setThreadName("protocol");
+  m_gaps.clear();
+
+  // Nothing that was scheduled or half-received on an earlier connection
+  // carries over to this one. From here on, only this thread applies state
+  // updates (which may also touch the scheduler).
+  {
+    std::lock_guard<std::mutex> lock(m_stateMutex);
+    m_output.clear();
+    m_scheduler.clear();
+    m_rxLen = 0;
+    m_listening = true;
+    m_updates.drain();
+  }
+
+  while (status && !m_shutdown)
+  {
+    struct pollfd pfds[2] = { { m_sockFd, 0, 0 }, { m_wakeFds[0], POLLIN, 0 } };
+    struct pollfd& pfd = pfds[0];
+    int timeout = -1;
+    if (!m_output.congested())
+    {
+      timeout = m_scheduler.msUntilNext(FrameScheduler::Clock::now());
+      if (m_rxLen < static_cast<int>(sizeof(m_rxBuf)))
+      {
+        pfd.events |= POLLIN;
+      }
+    }
+    if (!m_output.empty())
+    {
+      pfd.events |= POLLOUT;
+    }
+
+    int ready = 0;
+    {
+      TRACE_SPAN("poll");
+      ready = poll(pfds, 2, timeout);
+    }
+    if ((ready > 0) && (pfds[1].revents & POLLIN))
+    {
+      applyQueuedUpdates();
+    }
+    if ((ready > 0) && (pfd.revents & (POLLIN | POLLHUP | POLLERR)) && (pfd.events & POLLIN))
+    {
+      status = receiveBytes();
+    }
+    else if ((ready < 0) && (errno != EINTR))
+    {
+      status = false;
+    }
+
+    if (status)
+    {
+      status = processReceivedFrames() && flushOutput();
+    }
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(m_stateMutex);
+    m_listening = false;
+    m_updates.drain();
+  }
+  return status;
+}
+
+/**
+ * Applies the state updates queued since the last frame, when woken by
+ * queueUpdate() while no frame is arriving.
+ */
+void TesterSim::applyQueuedUpdates()
+{
+  char buf[64];
+  while (read(m_wakeFds[0], buf, sizeof(buf)) > 0)
+  {
+  }
+  std::lock_guard<std::mutex> lock(m_stateMutex);
+  m_updates.drain();
+}
+
+void TesterSim::process01TabletInfo(const uint8_t* /*inbuf*/, ReplyFrame& outbuf, TesterSim* sim)
+{
+  sim->log(QStringLiteral("Request for Tester info"));
+  sim->applyReplyTemplate(0x01, outbuf);
+}
+
+void TesterSim::process02SerialNo(const uint8_t* /*inbuf*/, ReplyFrame& outbuf, TesterSim* sim)
+{
+  sim->log(QStringLiteral("Request for Tester serial no."));
+  sim->applyReplyTemplate(0x02, outbuf);
+}
+
+void TesterSim::process09(const uint8_t* /*inbuf*/, ReplyFrame& outbuf, TesterSim* sim)
+{
+  sim->applyReplyTemplate(0x09, outbuf);
+}
+
+void TesterSim::process0AWorkshopData(const uint8_t* inbuf, ReplyFrame& outbuf, TesterSim* sim)
+{
+  sim->log(QStringLiteral("Request for workshop data"));
+  sim->applyReplyTemplate(0x0A, outbuf);
+  outbuf[8] = inbuf[7];
+}
+
+void TesterSim::process0BStartApplModGest(const uint8_t* inbuf, ReplyFrame& outbuf, TesterSim* sim)
+{
+  const uint16_t ecuId = (inbuf[7] * 0x100) + inbuf[8];
+  const uint8_t pipeNum = inbuf[9];
+  outbuf.setLength(7);
+
+  if (pipeNum >= NUM_PIPES)
+  {
+    sim->log(QString("Error: cannot start _applModGest%1 on invalid pipe %2").arg(ecuId, 4, 10, QChar('0')).arg(pipeNum));
+    outbuf[7] = 0xfe;
+    return;
+  }
+
+  sim->log(QString("Starting _applModGest%1 thread on pipe %2").arg(ecuId, 4, 10, QChar('0')).arg(pipeNum));
+  sim->m_replyDelayMs = 500;
+
+  // Frames scheduled by whatever was running on this pipe are dropped
+  sim->m_scheduler.cancelPipe(pipeNum);
+
+  // The hand-maintained table takes precedence over anything inferred by the
+  // ECU database compiler.
+  const EcuRecord* rec = sim->ecuRecord(ecuId);
+  if (rec && !rec->name.empty())
+  {
+    sim->log(QString("Module: %1").arg(QString::fromStdString(rec->name)));
+  }
+
+  const ModuleInfo* info = moduleInfo(ecuId);
+  ApplContext& ctx = sim->m_appl[pipeNum];
+  ctx.running = true;
+  ctx.ecuId = ecuId;
+  if (info && info->protocolKnown)
+  {
+    ctx.protocolKnown = true;
+    ctx.protocol = info->protocol;
+  }
+  else
+  {
+    ctx.protocolKnown = rec && rec->protocolKnown;
+    ctx.protocol = ctx.protocolKnown ? rec->protocol : ProtocolType::KWP71;
+  }
+  ctx.module.reset();
+  ctx.trace = sim->m_tracing ? sim->m_tracer.ecu(ecuId) : nullptr;
+  sim->m_lastApplPipe = pipeNum;
+  outbuf[7] = 1;
+
+  if (!ctx.protocolKnown && sim->m_runModules)
+  {
+    sim->startModule(ctx, pipeNum);
+  }
+}
+
+void TesterSim::process11DoSlowInit(const uint8_t* inbuf, ReplyFrame& outbuf, TesterSim* sim)
+{
+  if (sim->runModule(inbuf, outbuf))
+  {
+    return;
+  }
+
+  // A 5-baud init takes about a second on the real hardware
+  sim->m_replyDelayMs = 1000;
+
+  const uint8_t ecuAddr = inbuf[7];
+  if (inbuf[2] >= 8)
+  {
+    sim->log(QString("Do 5-baud slow init for ECU address 0x%1 with %2 bytes expected in response sequence").arg(ecuAddr, 2, 16, QChar('0')).arg(inbuf[8]));
+  }
+  else
+  {
+    sim->log(QString("Do 5-baud slow init for ECU address 0x%1").arg(ecuAddr, 2, 16, QChar('0')));
+  }
+
+  process12GetISOKeyword(inbuf, outbuf, sim);
+}
+
+void TesterSim::process12GetISOKeyword(const uint8_t* inbuf, ReplyFrame& outbuf, TesterSim* sim)
+{
+  if (sim->runModule(inbuf, outbuf))
+  {
+    return;
+  }
+
+  ApplContext& ctx = sim->applContext(inbuf);
+  const ModuleInfo* info = moduleInfo(ctx.ecuId);
+  const EcuRecord* rec = sim->ecuRecord(ctx.ecuId);
+
+  const uint8_t* isoBytes = nullptr;
+  int isoByteCount = 0;
+  if (info && !info->isoBytes.empty())
+  {
+    isoBytes = info->isoBytes.data();
+    isoByteCount = info->isoBytes.size();
+  }
+  else if (rec && !rec->isoBytes.empty())
+  {
+    isoBytes = rec->isoBytes.data();
+    isoByteCount = rec->isoBytes.size();
+  }
+
+  if (isoBytes)
+  {
+    QString replyLogMsg = QString("Replying with keyword sequence of %1 bytes:").arg(isoByteCount);
+    outbuf.setLength(7 + isoByteCount);
+    outbuf[7] = 1;
+
+    for (int i = 0; i < isoByteCount; i++)
+    {
+      outbuf[8 + i] = isoBytes[i];
+      replyLogMsg += QString(" %1").arg(isoBytes[i], 2, 16, QChar('0'));
+    }
+
+    // There are some modules whose cmd 11/12 reply message contains
+    // more than just the ISO keyword sequence -- it contains one or more
+    // frames of ID data from the ECU, which are concatenated into the same
+    // serial message payload from the Tester back to WSDC32.
+    const uint8_t* extraInfo = nullptr;
+    int extraDataLen = 0;
+    if (info && !info->extraInitInfo.empty())
+    {
+      extraInfo = info->extraInitInfo.data();
+      extraDataLen = info->extraInitInfo.size();
+    }
+    else if (rec && !rec->extraInitInfo.empty())
+    {
+      extraInfo = rec->extraInitInfo.data();
+      extraDataLen = rec->extraInitInfo.size();
+    }
+
+    if (extraInfo)
+    {
+      outbuf.setLength(7 + isoByteCount + extraDataLen);
+      outbuf.put(8 + isoByteCount, extraInfo, extraDataLen);
+
+      replyLogMsg += QString(", then %1 bytes of ID data:").arg(extraDataLen);
+      for (int i = 0; i < extraDataLen; i++)
+      {
+        replyLogMsg += QString(" %1").arg(extraInfo[i], 2, 16, QChar('0'));
+      }
+    }
+
+    sim->log(replyLogMsg);
+  }
+  else if (sim->m_learned->respond(ctx.ecuId, inbuf, outbuf))
+  {
+    sim->log(QString("Replying with learned keyword sequence for ECU ID %1").arg(ctx.ecuId, 4, 10, QChar('0')));
+  }
+  else
+  {
+    sim->log(QString("Warning: no ISO byte record for ECU ID %1").arg(ctx.ecuId, 4, 10, QChar('0')));
+  }
+}
+
+void TesterSim::process13CommandToECU(const uint8_t* inbuf, ReplyFrame& outbuf, TesterSim* sim)
+{
+  const ApplContext& ctx = sim->applContext(inbuf);
+  sim->m_trace = ctx.trace;
+
+  if (sim->runModule(inbuf, outbuf))
+  {
+    return;
+  }
+
+  if (ctx.protocolKnown)
+  {
+    const ProtocolType proto = ctx.protocol;
+
+    // Sometimes (maybe just for certain ECUs like BMOT0145?), WSDC32 sends requests with 0x13 in position 06,
+    // and the request payload starting immediately after (at position 07). In this format, the request payload
+    // does not contain the block's prefix/size byte, the block sequence number, or the terminator.
     // The other format that cmd 0x13 messages can take (e.g. for BABS0096) has 0x13 at position 06, an unused
     // byte at position 07 (as a placeholder for the 0x01 status in the response), and then a *complete* ECU
     // protocol block starting at 08, for example:
@@ -444,10 +1492,25 @@ void TesterSim::process13CommandToECU(const uint8_t* inbuf, uint8_t* outbuf, Tes
     {
       processBilsteinSuspensionCommandToECU(inbuf, outbuf, sim, hasVerbosePayload);
     }
+
+    // Let the scenario (if there is one) react to the block. Its changes take
+    // effect for subsequent requests, not the reply to this one.
+    int titlePos = 7;
+    if ((proto == ProtocolType::BoschAlarm) || (proto == ProtocolType::BilsteinSuspension))
+    {
+      titlePos = 8;
+    }
+    else if (hasVerbosePayload)
+    {
+      titlePos = (proto == ProtocolType::KWP71) ? 10 : 9;
+    }
+    sim->runScenario(ctx.ecuId, inbuf + titlePos, inbuf[2] + 1 - titlePos);
   }
-  else
+  else if (!sim->m_learned->respond(ctx.ecuId, inbuf, outbuf))
   {
-    sim->log(QString("Warning: protocol for ECU ID %1 is not known").arg(sim->m_currentECUID, 4, 10, QChar('0')));
+    sim->reportGap(inbuf, ctx.ecuId, GapReport::NONE, GapReport::NONE,
+                   sim->m_learned->knows(ctx.ecuId) ? "protocol not known and no learned response matches" :
+                                                      "protocol not known");
   }
 }
 
@@ -457,13 +1520,13 @@ void TesterSim::process13CommandToECU(const uint8_t* inbuf, uint8_t* outbuf, Tes
  * omitted from the input block due to SD2 framing; this is indicated by the
  * state of the hasVerbosePayload flag.
  */
-void TesterSim::processKWP71CommandToECU(const uint8_t* inbuf, uint8_t* outbuf, TesterSim* sim, bool hasVerbosePayload)
+void TesterSim::processKWP71CommandToECU(const uint8_t* inbuf, ReplyFrame& outbuf, TesterSim* sim, bool hasVerbosePayload)
 {
   const uint8_t blockTitle = hasVerbosePayload ? inbuf[10] : inbuf[7];
 
   if (blockTitle == 0x00) // Req ID code
   {
-    outbuf[2] = 16;    // overall message size (minus prefix byte)
+    outbuf.setLength(16);    // overall message size (minus prefix byte)
     outbuf[7] = 1;     // 'success' indicator
     outbuf[8] = 8;     // number of bytes following
     outbuf[9] = 0xF6;  // KWP71 response title with ASCII/ID data
@@ -477,19 +1540,18 @@ void TesterSim::processKWP71CommandToECU(const uint8_t* inbuf, uint8_t* outbuf,
   }
   else if (blockTitle == 0x01) // Read RAM
   {
-    const uint8_t count = hasVerbosePayload ? inbuf[11] : inbuf[8];
+    const int count = std::min<int>(hasVerbosePayload ? inbuf[11] : inbuf[8], MAX_KWP_DATA_LEN);
     const uint16_t addr = hasVerbosePayload ? (((uint16_t)inbuf[12] * 0x100) + inbuf[13]) : (((uint16_t)inbuf[9] * 0x100) + inbuf[10]);
-    if (sim->m_ramData.count(addr) == 0)
-    {
-      sim->m_ramData[addr] = 0;
-    }
 
-    outbuf[2] = count + 10;
+    outbuf.setLength(count + 10);
     outbuf[7] = 1;          // indicate success
     outbuf[8] = count + 2;  // number of bytes that follow (response from ECU)
     outbuf[9] = 0xFD;       // KWP71 response type to request 01
-    outbuf[10] = sim->m_ramData[addr];
-    outbuf[11] = 0x03;      // end-of-packet marker
+    for (int i = 0; i < count; i++)
+    {
+      outbuf[10 + i] = sim->readRAM(addr + i);
+    }
+    outbuf[10 + count] = 0x03; // end-of-packet marker
   }
   else if (blockTitle == 0x07) // read trouble codes
   {
@@ -500,20 +1562,22 @@ void TesterSim::processKWP71CommandToECU(const uint8_t* inbuf, uint8_t* outbuf,
     {
       sim->m_errorMemory.resize(5);
     }
-    const uint8_t numFaultCodeBytes = sim->m_errorMemory.size();
+    // The count is a single byte, but the SD2 frame can be longer than 0xff
+    const int numFaultCodeBytes = std::min<int>(sim->m_errorMemory.size(), 0xff);
 
-    outbuf[2] = 8 + numFaultCodeBytes;
+    outbuf.setLength(8 + numFaultCodeBytes);
     outbuf[7] = 1;
     outbuf[8] = numFaultCodeBytes;
-    for (uint8_t errorBytePos = 0; errorBytePos < numFaultCodeBytes; errorBytePos++)
+    for (int errorBytePos = 0; errorBytePos < numFaultCodeBytes; errorBytePos++)
     {
-      outbuf[9 + errorBytePos] = sim->m_errorMemory[errorBytePos];
+      outbuf[9 + errorBytePos] = sim->readErrorMemory(errorBytePos);
     }
   }
   else
   {
-    sim->log("Warning: unhandled KWP71 command");
-    outbuf[2] = 7;
+    sim->reportGap(inbuf, sim->applContext(inbuf).ecuId, static_cast<int>(ProtocolType::KWP71),
+                   hasVerbosePayload ? 10 : 7, "unhandled KWP71 command");
+    outbuf.setLength(7);
     outbuf[7] = 1;
   }
 }
@@ -524,13 +1588,13 @@ void TesterSim::processKWP71CommandToECU(const uint8_t* inbuf, uint8_t* outbuf,
  * omitted from the input block due to SD2 framing; this is indicated by the
  * state of the hasVerbosePayload flag.
  */
-void TesterSim::processFIAT9141CommandToECU(const uint8_t* inbuf, uint8_t* outbuf, TesterSim* sim, bool hasVerbosePayload)
+void TesterSim::processFIAT9141CommandToECU(const uint8_t* inbuf, ReplyFrame& outbuf, TesterSim* sim, bool hasVerbosePayload)
 {
   const uint8_t blockTitle = hasVerbosePayload ? inbuf[9] : inbuf[7];
 
   if (blockTitle == 0x00) // Req ID code
   {
-    outbuf[2] = 16;
+    outbuf.setLength(16);
     outbuf[7] = 1;
     outbuf[8] = 8;
     outbuf[9] = 0xF6;
@@ -544,24 +1608,24 @@ void TesterSim::processFIAT9141CommandToECU(const uint8_t* inbuf, uint8_t* outbu
   }
   else if (blockTitle == 0x01) // Read RAM
   {
-    const uint8_t count = hasVerbosePayload ? inbuf[10] : inbuf[8];
+    const int count = std::min<int>(hasVerbosePayload ? inbuf[10] : inbuf[8], MAX_KWP_DATA_LEN);
     const uint16_t addr = hasVerbosePayload ? (((uint16_t)inbuf[11] * 0x100) + inbuf[12]) : (((uint16_t)inbuf[9] * 0x100) + inbuf[10]);
-    if (sim->m_ramData.count(addr) == 0)
-    {
-      sim->m_ramData[addr] = 0;
-    }
 
-    outbuf[2] = count + 10;
+    outbuf.setLength(count + 10);
     outbuf[7] = 1;          // indicate success
     outbuf[8] = count + 2;  // number of bytes that follow (response from ECU)
     outbuf[9] = 0xFD;       // KWP71 response type to request 01
-    outbuf[10] = sim->m_ramData[addr];
-    outbuf[11] = 0x03;      // end-of-packet marker
+    for (int i = 0; i < count; i++)
+    {
+      outbuf[10 + i] = sim->readRAM(addr + i);
+    }
+    outbuf[10 + count] = 0x03; // end-of-packet marker
   }
   else
   {
-    sim->log("Warning: unhandled FIAT9141 command");
-    outbuf[2] = 7;
+    sim->reportGap(inbuf, sim->applContext(inbuf).ecuId, static_cast<int>(ProtocolType::FIAT9141),
+                   hasVerbosePayload ? 9 : 7, "unhandled FIAT9141 command");
+    outbuf.setLength(7);
     outbuf[7] = 1;
   }
 }
@@ -572,13 +1636,13 @@ void TesterSim::processFIAT9141CommandToECU(const uint8_t* inbuf, uint8_t* outbu
  * from the input block due to SD2 framing; this is indicated by the state of
  * the hasVerbosePayload flag.
  */
-void TesterSim::processMarelli1AFCommandToECU(const uint8_t* inbuf, uint8_t* outbuf, TesterSim* sim, bool hasVerbosePayload)
+void TesterSim::processMarelli1AFCommandToECU(const uint8_t* inbuf, ReplyFrame& outbuf, TesterSim* sim, bool hasVerbosePayload)
 {
   const uint8_t blockTitle = hasVerbosePayload ? inbuf[9] : inbuf[7];
 
   if (blockTitle == 0x51) // request for ID info
   {
-    outbuf[2] = 24;
+    outbuf.setLength(24);
     outbuf[7] = 1;
     outbuf[8] = 16;
     outbuf[9] = 0xAE; // ID of reply to request for info
@@ -609,7 +1673,7 @@ void TesterSim::processMarelli1AFCommandToECU(const uint8_t* inbuf, uint8_t* out
       sim->log(QString("ACTUATOR: ID 0x%1, parameter 0x%2").arg(actuatorID, 2, 16, QChar('0')).arg(actuatorParam, 2, 16, QChar('0')));
     }
 
-    outbuf[2] = 11;
+    outbuf.setLength(11);
     outbuf[7] = 1;
     outbuf[8] = 3;
     outbuf[9] = 0x09;
@@ -618,7 +1682,7 @@ void TesterSim::processMarelli1AFCommandToECU(const uint8_t* inbuf, uint8_t* out
   else if (blockTitle == 0x01) // set diagnostic mode
   {
     const uint8_t diagnosticMode = hasVerbosePayload ? inbuf[10] : inbuf[8];
-    outbuf[2] = 13;
+    outbuf.setLength(13);
     outbuf[7] = 1;
     outbuf[8] = 5;
     outbuf[9] = 0x0D;
@@ -631,15 +1695,15 @@ void TesterSim::processMarelli1AFCommandToECU(const uint8_t* inbuf, uint8_t* out
     const uint16_t startAddr = hasVerbosePayload ?
       (static_cast<uint16_t>(inbuf[10] << 8) | (inbuf[11] & 0xff)) :
       (static_cast<uint16_t>(inbuf[8] << 8) | (inbuf[9] & 0xff));
-    const uint8_t numBytes = hasVerbosePayload ? inbuf[12] : inbuf[10];
+    const int numBytes = std::min<int>(hasVerbosePayload ? inbuf[12] : inbuf[10], MAX_1AF_DATA_LEN);
 
-    outbuf[2] = 11 + numBytes;
+    outbuf.setLength(11 + numBytes);
     outbuf[7] = 1;
     outbuf[8] = 3 + numBytes;
     outbuf[9] = 0xCF;
-    for (uint16_t addr = startAddr; addr < (startAddr + numBytes); addr++)
+    for (int i = 0; i < numBytes; i++)
     {
-      outbuf[10 + addr] = sim->m_ramData[addr];
+      outbuf[10 + i] = sim->readRAM(startAddr + i);
     }
     add16BitChecksum(&outbuf[8]);
   }
@@ -647,14 +1711,15 @@ void TesterSim::processMarelli1AFCommandToECU(const uint8_t* inbuf, uint8_t* out
   {
     const uint8_t valueCode = hasVerbosePayload ? inbuf[10] : inbuf[8];
 
-    outbuf[2] = 15;
+    outbuf.setLength(15);
     outbuf[7] = 1;
     outbuf[8] = 7;    // bytecount
     outbuf[9] = 0xCE; // reply title
-    outbuf[10] = sim->m_valueData[valueCode] >> 24;
-    outbuf[11] = sim->m_valueData[valueCode] >> 16;
-    outbuf[12] = sim->m_valueData[valueCode] >> 8;
-    outbuf[13] = sim->m_valueData[valueCode] & 0xff;
+    const uint32_t value = sim->readValue(valueCode);
+    outbuf[10] = value >> 24;
+    outbuf[11] = value >> 16;
+    outbuf[12] = value >> 8;
+    outbuf[13] = value & 0xff;
     add16BitChecksum(&outbuf[8]);
   }
   else if (blockTitle == 0x32) // request for snapshot
@@ -670,16 +1735,22 @@ void TesterSim::processMarelli1AFCommandToECU(const uint8_t* inbuf, uint8_t* out
       sim->m_snapshotData[snapshotIndex].resize(DEFAULT_SNAPSHOT_SIZE, 0);
     }
 
-    const uint8_t numBytesInSnapshot = sim->m_snapshotData[snapshotIndex].size();
+    const int numBytesInSnapshot = std::min<int>(sim->m_snapshotData[snapshotIndex].size(), MAX_1AF_DATA_LEN);
+    if (numBytesInSnapshot < static_cast<int>(sim->m_snapshotData[snapshotIndex].size()))
+    {
+      sim->log(QString("Warning: snapshot page %1 is longer than a 1AF block; sending the first %2 bytes").
+        arg(snapshotIndex).arg(numBytesInSnapshot));
+    }
 
-    outbuf[2] = 11 + numBytesInSnapshot; // bytecount in the SD2 frame (including the ending checksum)
+    outbuf.setLength(11 + numBytesInSnapshot); // bytecount in the SD2 frame (including the ending checksum)
     outbuf[7] = 1;
     outbuf[8] = 3 + numBytesInSnapshot; // bytecount in the 1AF frame; pg. 28 of FIAT 3.00601 Marelli 1AF document seems to have an error here
     outbuf[9] = 0xCD; // reply title
 
-    for (unsigned int i = 0; i < numBytesInSnapshot; i++)
+    for (int i = 0; i < numBytesInSnapshot; i++)
     {
       outbuf[10 + i] = sim->m_snapshotData[snapshotIndex][i];
+      sim->noteRead(AccessTracer::Space::Snapshot, (snapshotIndex << 8) | i, outbuf[10 + i]);
     }
     add16BitChecksum(&outbuf[8]);
   }
@@ -689,23 +1760,29 @@ void TesterSim::processMarelli1AFCommandToECU(const uint8_t* inbuf, uint8_t* out
     {
       sim->m_errorMemory.resize(DEFAULT_ERROR_MEMORY_SIZE, 0);
     }
-    const uint8_t numBytesInErrorMem = sim->m_errorMemory.size();
+    const int numBytesInErrorMem = std::min<int>(sim->m_errorMemory.size(), MAX_1AF_DATA_LEN);
+    if (numBytesInErrorMem < static_cast<int>(sim->m_errorMemory.size()))
+    {
+      sim->log(QString("Warning: error memory is longer than a 1AF block; sending the first %1 bytes").
+        arg(numBytesInErrorMem));
+    }
 
-    outbuf[2] = 11 + numBytesInErrorMem; // bytecount in the SD2 frame (including the ending checksum)
+    outbuf.setLength(11 + numBytesInErrorMem); // bytecount in the SD2 frame (including the ending checksum)
     outbuf[7] = 1;
     outbuf[8] = 3 + numBytesInErrorMem; // bytecount in the 1AF frame
     outbuf[9] = 0xAF; // reply title
 
-    for (unsigned int i = 0; i < numBytesInErrorMem; i++)
+    for (int i = 0; i < numBytesInErrorMem; i++)
     {
-      outbuf[10 + i] = sim->m_errorMemory[i];
+      outbuf[10 + i] = sim->readErrorMemory(i);
     }
     add16BitChecksum(&outbuf[8]);
   }
   else
   {
-    sim->log("Warning: unhandled FIAT/Marelli 1AF command");
-    outbuf[2] = 7;
+    sim->reportGap(inbuf, sim->applContext(inbuf).ecuId, static_cast<int>(ProtocolType::Marelli1AF),
+                   hasVerbosePayload ? 9 : 7, "unhandled FIAT/Marelli 1AF command");
+    outbuf.setLength(7);
     outbuf[7] = 1;
   }
 }
@@ -717,7 +1794,7 @@ void TesterSim::processMarelli1AFCommandToECU(const uint8_t* inbuf, uint8_t* out
  * WSDC32's behavior (i.e. the commands it then sends for diagnostics) will
  * change depending on the VIM version.
  */
-void TesterSim::processBoschAlarmCommandToECU(const uint8_t* inbuf, uint8_t* outbuf, TesterSim* sim, bool /*hasVerbosePayload*/)
+void TesterSim::processBoschAlarmCommandToECU(const uint8_t* inbuf, ReplyFrame& outbuf, TesterSim* sim, bool /*hasVerbosePayload*/)
 {
   // A typical command looks like: (... 13 01) 52 FE 01
   if (inbuf[8] == 0x52)
@@ -726,39 +1803,31 @@ void TesterSim::processBoschAlarmCommandToECU(const uint8_t* inbuf, uint8_t* out
     const uint8_t commNumberLo = inbuf[10];
     const uint16_t commNumber = ((uint16_t)commNumberHi << 8) | commNumberLo;
 
-    if (sim->m_ramData.count(commNumber) == 0)
-    {
-      sim->m_ramData[commNumber] = 0;
-    }
-
     // This command apparently reads a single byte from the ECU, and that is the only
     // thing echoed back to WSDC32 in the payload (i.e. after byte index 07)
-    outbuf[2] = 8; // byte count
+    outbuf.setLength(8); // byte count
     outbuf[7] = 1; // indicate success
-    outbuf[8] = sim->m_ramData[commNumber];
+    outbuf[8] = sim->readRAM(commNumber);
   }
   else if (inbuf[8] == 0x44)
   {
     // This is another type of Read command -- possibly from a different address space or device?
     // Unlike cmd 52h, it is followed by only a single byte (which must be an 8-bit address.)
     const uint8_t commNumber = inbuf[9];
-    if (sim->m_ramData.count(commNumber) == 0)
-    {
-      sim->m_ramData[commNumber] = 0;
-    }
-    outbuf[2] = 8; // byte count
+    outbuf.setLength(8); // byte count
     outbuf[7] = 1; // indicate success
-    outbuf[8] = sim->m_ramData[commNumber];
+    outbuf[8] = sim->readRAM(commNumber);
   }
   else
   {
-    sim->log("Warning: unhandled Bosch Alarm command");
+    sim->reportGap(inbuf, sim->applContext(inbuf).ecuId, static_cast<int>(ProtocolType::BoschAlarm),
+                   8, "unhandled Bosch Alarm command");
   }
 }
 
 /**
  */
-void TesterSim::processBilsteinSuspensionCommandToECU(const uint8_t* inbuf, uint8_t* outbuf, TesterSim* sim, bool /*hasVerbosePayload*/)
+void TesterSim::processBilsteinSuspensionCommandToECU(const uint8_t* inbuf, ReplyFrame& outbuf, TesterSim* sim, bool /*hasVerbosePayload*/)
 {
   // A typical command looks like: (... 13 01) 01 00 23 00 22
 
@@ -769,18 +1838,13 @@ void TesterSim::processBilsteinSuspensionCommandToECU(const uint8_t* inbuf, uint
     const uint8_t addrLo = inbuf[10];
     const uint16_t addr = ((uint16_t)addrHi << 8) | addrLo;
 
-    if (sim->m_ramData.count(addr) == 0)
-    {
-      sim->m_ramData[addr] = 0;
-    }
-
-    outbuf[2] = 12; // Total byte count for the SD2 Tester msg (should match the index of the last byte)
+    outbuf.setLength(12); // Total byte count for the SD2 Tester msg (should match the index of the last byte)
     outbuf[7] = 1;  // Indication of success. Note that this byte overwrites a byte *count* that we
                     // received from WSDC32 (where it would have been 05 for the 5-byte message that follows)
     outbuf[8] = 0x01;
     outbuf[9] = addrHi;
     outbuf[10] = addrLo;
-    outbuf[11] = sim->m_ramData[addr];
+    outbuf[11] = sim->readRAM(addr);
     outbuf[12] = (outbuf[8] ^ outbuf[9] ^ outbuf[10] ^ outbuf[11]);
   }
   else if (inbuf[8] == 0x06) // unknown
@@ -788,7 +1852,7 @@ void TesterSim::processBilsteinSuspensionCommandToECU(const uint8_t* inbuf, uint
     const uint8_t addrHi = inbuf[9];
     const uint8_t addrLo = inbuf[10];
 
-    outbuf[2] = 12; // total byte count for the SD2 Tester msg (should match the index of the last byte)
+    outbuf.setLength(12); // total byte count for the SD2 Tester msg (should match the index of the last byte)
     outbuf[7] = 1;  // Indication of success. Note that this byte overwrites a byte *count* that we
                     // received from WSDC32 (where it would have been 05 for the 5-byte message that follows)
     outbuf[8] = 0x06;
@@ -799,7 +1863,8 @@ void TesterSim::processBilsteinSuspensionCommandToECU(const uint8_t* inbuf, uint
   }
   else if (inbuf[8] == 0x0B) // something to do with actuator activation
   {
-    sim->log("Warning: Bilstein suspension ECU command for actuators not yet implemented");
+    sim->reportGap(inbuf, sim->applContext(inbuf).ecuId, static_cast<int>(ProtocolType::BilsteinSuspension),
+                   8, "Bilstein suspension actuator command not implemented");
   }
   else if (inbuf[8] == 0x11)
   {
@@ -811,58 +1876,73 @@ void TesterSim::processBilsteinSuspensionCommandToECU(const uint8_t* inbuf, uint
     const uint8_t byteA = inbuf[9];
     const uint8_t byteB = inbuf[10];
 
-    outbuf[2] = 12; // total byte count for the SD2 Tester msg (should match the index of the last byte)
+    outbuf.setLength(12); // total byte count for the SD2 Tester msg (should match the index of the last byte)
     outbuf[7] = 1;  // Indication of success. Note that this byte overwrites a byte *count* that we
                     // received from WSDC32 (where it would have been 05 for the 5-byte message that follows)
     outbuf[8] = 0x11;
     outbuf[9] = byteA;
     outbuf[10] = byteB;
-    outbuf[11] = sim->m_ramData[0x55 + byteB]; // NOTE: this works for BSOS0088, others may vary
+    outbuf[11] = sim->readRAM(0x55 + byteB); // NOTE: this works for BSOS0088, others may vary
+    if (sim->m_trace)
+    {
+      // Record what was actually asked for, since the mapping above is a guess
+      sim->m_trace->recordRead(AccessTracer::Space::Raw, (byteA << 8) | byteB);
+    }
     outbuf[12] = (outbuf[8] ^ outbuf[9] ^ outbuf[10] ^ outbuf[11]);
   }
   else
   {
-    sim->log("Warning: unhandled Bilstein suspension ECU command");
+    sim->reportGap(inbuf, sim->applContext(inbuf).ecuId, static_cast<int>(ProtocolType::BilsteinSuspension),
+                   8, "unhandled Bilstein suspension ECU command");
   }
 }
 
-void TesterSim::process15DisplayString(const uint8_t* inbuf, uint8_t* outbuf, TesterSim* sim)
+void TesterSim::process15DisplayString(const uint8_t* inbuf, ReplyFrame& outbuf, TesterSim* sim)
 {
   std::string dstring((char*)(inbuf + 14), inbuf[2] - 13);
   sim->log(QString("Display string on Tester screen: '%1'").arg(QString::fromStdString(dstring)));
-  outbuf[2] = 7;
+  outbuf.setLength(7);
   outbuf[7] = 1;
 }
 
-void TesterSim::process1C(const uint8_t* inbuf, uint8_t* outbuf, TesterSim* sim)
+void TesterSim::process1C(const uint8_t* inbuf, ReplyFrame& outbuf, TesterSim* sim)
 {
   const uint8_t pipeNum = inbuf[5];
   sim->log(QString("Shut down ECU appl thread monitoring pipe %1").arg(pipeNum));
 
-  if (sim->m_applRun[pipeNum])
+  if ((pipeNum < NUM_PIPES) && sim->m_appl[pipeNum].running)
   {
-    sim->m_applRun[pipeNum] = false;
-    outbuf[2] = 7;
+    sim->m_appl[pipeNum].running = false;
+    outbuf.setLength(7);
     outbuf[7] = 1;
   }
   else
   {
     sim->log("Thread not yet running; replying with negative status from applModGen...");
-    outbuf[2] = 7;
+    outbuf.setLength(7);
     outbuf[5] = 0;
     outbuf[7] = 0xfe;
   }
 }
 
-void TesterSim::process1ECloseFile(const uint8_t* /*inbuf*/, uint8_t* outbuf, TesterSim* sim)
+void TesterSim::process1ECloseFile(const uint8_t* /*inbuf*/, ReplyFrame& outbuf, TesterSim* sim)
 {
+  if (sim->m_curFileContents)
+  {
+    sim->m_curFileContents->squeeze();
+  }
   sim->m_curFileContents = nullptr;
+  sim->m_readFileContents = nullptr;
   sim->log(QString("Close file (which is currently '%1')").arg(sim->m_curFile));
-  outbuf[2] = 7;
+  if (!sim->m_fs.close(sim->m_curDir, sim->m_curFile))
+  {
+    sim->log(QString("Warning: unable to write '%1' back to host directory").arg(sim->m_curFile));
+  }
+  outbuf.setLength(7);
   outbuf[7] = 1;
 }
 
-void TesterSim::process20OpenFileForWriting(const uint8_t* inbuf, uint8_t* outbuf, TesterSim* sim)
+void TesterSim::process20OpenFileForWriting(const uint8_t* inbuf, ReplyFrame& outbuf, TesterSim* sim)
 {
   const QString filenameWithPath = QString::fromStdString(std::string((char*)(inbuf + 7), inbuf[2] - 6));
   const QFileInfo fileinfo(filenameWithPath);
@@ -871,14 +1951,17 @@ void TesterSim::process20OpenFileForWriting(const uint8_t* inbuf, uint8_t* outbu
 
   sim->m_curDir = dirOnly;
   sim->m_curFile = filenameOnly;
-  sim->m_curFileContents = &(sim->m_fileContents[dirOnly][filenameOnly]);
-  sim->m_curFileContents->clear(); // only truncate is supported (no append)
+  sim->m_curFileContents = sim->m_fs.create(dirOnly, filenameOnly); // only truncate is supported (no append)
+  if (sim->m_curFileContents)
+  {
+    sim->m_curFileContents->reserve(WRITE_FILE_RESERVE);
+  }
   sim->log(QString("Open file for writing: %1 (in dir %2)").arg(sim->m_curFile).arg(sim->m_curDir));
-  outbuf[2] = 7;
+  outbuf.setLength(7);
   outbuf[7] = 1;
 }
 
-void TesterSim::process21WriteToFile(const uint8_t* inbuf, uint8_t* outbuf, TesterSim* sim)
+void TesterSim::process21WriteToFile(const uint8_t* inbuf, ReplyFrame& outbuf, TesterSim* sim)
 {
   const int byteCount = inbuf[2] - 0xb;
 
@@ -889,22 +1972,29 @@ void TesterSim::process21WriteToFile(const uint8_t* inbuf, uint8_t* outbuf, Test
   // consecutively.
   if (sim->m_lastCmdWasWriteToFile)
   {
-    sim->emitConsecutiveWriteToFileSignal();
+    sim->logConsecutiveWriteToFile();
   }
   else
   {
     sim->log(QString("Write bytes to file"));
     sim->m_lastCmdWasWriteToFile = true;
   }
+  if (!sim->m_curFileContents)
+  {
+    sim->log("Error: m_curFileContents is null. File write operation without an open file?");
+    outbuf.setLength(7);
+    outbuf[7] = 0;
+    return;
+  }
   for (int i = 0; i < byteCount; i++)
   {
     sim->m_curFileContents->append(inbuf[0xb + i]);
   }
-  outbuf[2] = 7;
+  outbuf.setLength(7);
   outbuf[7] = 1;
 }
 
-void TesterSim::process23OpenFileForReading(const uint8_t* inbuf, uint8_t* outbuf, TesterSim* sim)
+void TesterSim::process23OpenFileForReading(const uint8_t* inbuf, ReplyFrame& outbuf, TesterSim* sim)
 {
   const QString filenameWithPath = QString::fromStdString(std::string((char*)(inbuf + 7), inbuf[2] - 6));
   const QFileInfo fileinfo(filenameWithPath);
@@ -914,27 +2004,37 @@ void TesterSim::process23OpenFileForReading(const uint8_t* inbuf, uint8_t* outbu
   sim->m_curDir = dirOnly;
   sim->m_curFile = filenameOnly;
   sim->m_fileReadPos = 0;
-  sim->m_curFileContents = &(sim->m_fileContents[dirOnly][filenameOnly]);
+  sim->m_readFileContents = sim->m_fs.find(dirOnly, filenameOnly);
   memset(sim->m_checksumBuf, 0, CHKSUM_BUF_SIZE);
 
   sim->log(QString("Open file for reading: %1 (in dir %2)").arg(sim->m_curFile).arg(sim->m_curDir));
-  outbuf[2] = 7;
+  outbuf.setLength(7);
   outbuf[7] = 1;
 }
 
-void TesterSim::process24ReadFromFile(const uint8_t* inbuf, uint8_t* outbuf, TesterSim* sim)
+void TesterSim::process24ReadFromFile(const uint8_t* inbuf, ReplyFrame& outbuf, TesterSim* sim)
 {
-  if (!sim->m_curFileContents)
+  // Opening a file that doesn't exist is treated as opening an empty file
+  static const QVector<quint8> s_emptyFile;
+  const QVector<quint8>* contents = sim->m_readFileContents ? sim->m_readFileContents : &s_emptyFile;
+
+  const int bytesLeftInFile = (contents->size() - sim->m_fileReadPos);
+  const int numBytesToSend = (bytesLeftInFile >= CHKSUM_BUF_SIZE) ? CHKSUM_BUF_SIZE : bytesLeftInFile;
+
+  // As with writes, only the first of a run of consecutive reads is logged
+  // in full; the rest just add a dot
+  const bool logChunk = !sim->m_lastCmdWasReadFromFile;
+  if (logChunk)
+  {
+    sim->log(QString("Read from file (%1 bytes left, %2 bytes in this chunk, file pos 0x%3)").
+      arg(bytesLeftInFile).arg(numBytesToSend).arg(sim->m_fileReadPos, 8, 16, QChar('0')));
+    sim->m_lastCmdWasReadFromFile = true;
+  }
+  else
   {
-    sim->log("Error: m_curFileContents is null. File read/write operation without an open file?");
-    return;
+    sim->logConsecutiveReadFromFile();
   }
-
-  const int bytesLeftInFile = (sim->m_curFileContents->size() - sim->m_fileReadPos);
-  const int numBytesToSend = (bytesLeftInFile >= CHKSUM_BUF_SIZE) ? CHKSUM_BUF_SIZE : bytesLeftInFile;
-  sim->log(QString("Read from file (%1 bytes left, %2 bytes in this chunk, file pos 0x%3)").
-    arg(bytesLeftInFile).arg(numBytesToSend).arg(sim->m_fileReadPos, 8, 16, QChar('0')));
-  outbuf[2] = numBytesToSend + 0xc;
+  outbuf.setLength(numBytesToSend + 0xc);
   outbuf[7] = 1;
   outbuf[8] = inbuf[7];
   outbuf[9] = inbuf[8];
@@ -944,7 +2044,7 @@ void TesterSim::process24ReadFromFile(const uint8_t* inbuf, uint8_t* outbuf, Tes
   {
     for (int i = 0; i < numBytesToSend; i++)
     {
-      outbuf[12 + i] = sim->m_curFileContents->at(sim->m_fileReadPos + i);
+      outbuf[12 + i] = contents->at(sim->m_fileReadPos + i);
       sim->m_checksumBuf[i] += outbuf[12 + i];
     }
     const int checksumBufPos = 12 + numBytesToSend;
@@ -954,7 +2054,10 @@ void TesterSim::process24ReadFromFile(const uint8_t* inbuf, uint8_t* outbuf, Tes
       outbuf[checksumBufPos] += outbuf[i];
     }
     outbuf[checksumBufPos] = ~outbuf[checksumBufPos];
-    sim->log(QString("Computed checksum of %1 for this chunk").arg(outbuf[checksumBufPos], 2, 16));
+    if (logChunk)
+    {
+      sim->log(QString("Computed checksum of %1 for this chunk").arg(outbuf[checksumBufPos], 2, 16));
+    }
     sim->m_fileReadPos += numBytesToSend;
   }
   else
@@ -965,11 +2068,10 @@ void TesterSim::process24ReadFromFile(const uint8_t* inbuf, uint8_t* outbuf, Tes
   }
 }
 
-void TesterSim::process25ChecksumFile(const uint8_t* /*inbuf*/, uint8_t* outbuf, TesterSim* sim)
+void TesterSim::process25ChecksumFile(const uint8_t* /*inbuf*/, ReplyFrame& outbuf, TesterSim* sim)
 {
   sim->log("Request for checksum verification of file");
-  outbuf[1] = 0;
-  outbuf[2] = 0x75;
+  outbuf.setLength(0x75);
   outbuf[7] = 1;
 
   for (int i = 0; i < CHKSUM_BUF_SIZE; i++)
@@ -978,30 +2080,35 @@ void TesterSim::process25ChecksumFile(const uint8_t* /*inbuf*/, uint8_t* outbuf,
   }
 }
 
-void TesterSim::process2AChdir(const uint8_t* inbuf, uint8_t* outbuf, TesterSim* sim)
+void TesterSim::process2AChdir(const uint8_t* inbuf, ReplyFrame& outbuf, TesterSim* sim)
 {
   const QString curDir = QString::fromStdString(std::string((char*)(inbuf + 7), inbuf[2] - 6));
   sim->m_curDir = curDir;
-  sim->m_curDirIterator = sim->m_fileContents[curDir].begin();
+  sim->m_dirListing = sim->m_fs.list(curDir);
+  sim->m_dirListingPos = 0;
   sim->log(QString("Change directory: %1").arg(curDir));
-  outbuf[2] = 7;
+  outbuf.setLength(7);
   outbuf[7] = 1;
 }
 
-void TesterSim::process2BGetNextDirEntry(const uint8_t* inbuf, uint8_t* outbuf, TesterSim* sim)
+void TesterSim::process2BGetNextDirEntry(const uint8_t* inbuf, ReplyFrame& outbuf, TesterSim* sim)
 {
   sim->log("Request for next directory entry");
 
-  if (sim->m_curDirIterator !=
-      sim->m_fileContents[sim->m_curDir].end())
+  if (sim->m_dirListingPos < sim->m_dirListing.size())
   {
-    const QString filename = sim->m_curDirIterator.key();
-    const uint32_t filesize = sim->m_curDirIterator.value().size();
+    const QString filename = sim->m_dirListing[sim->m_dirListingPos].name;
+    const uint32_t filesize = sim->m_dirListing[sim->m_dirListingPos].size;
     sim->log(QString(" File: %1, size %2").arg(filename).arg(filesize));
-    const uint8_t truncLen = (filename.length() < 90) ? filename.length() : 90;
+
+    // The name is sent as up to DIR_ENTRY_NAME_LEN bytes of UTF-8. A name
+    // that had to be cut is padded with NULs to one byte more than that
+    const std::string truncName = fieldText(filename, DIR_ENTRY_NAME_LEN);
+    const int nameLen = truncName.size();
+    const int truncLen = (nameLen < filename.toUtf8().size()) ? (DIR_ENTRY_NAME_LEN + 1) : nameLen;
     sim->log(QString(" Truncated length of filename: %1").arg(truncLen));
 
-    outbuf[2] = 38 + truncLen - 1;
+    outbuf.setLength(38 + truncLen - 1);
     outbuf[7] = 1; // indicate success
     outbuf[8] = inbuf[7]; // 32-bit sequence num
     outbuf[9] = inbuf[8];
@@ -1012,102 +2119,699 @@ void TesterSim::process2BGetNextDirEntry(const uint8_t* inbuf, uint8_t* outbuf,
     outbuf[14] = (filesize >> 16) & 0xff;
     outbuf[15] = (filesize >> 8) & 0xff;
     outbuf[16] = filesize & 0xff;
-    memcpy(outbuf + 17, "AUG-06-1998  13:24:55", 21);
-    strncpy((char*)(outbuf + 38), filename.toStdString().c_str(), 89);
+    outbuf.put(17, "AUG-06-1998  13:24:55", 21);
+    outbuf.fill(38, 0, truncLen);
+    outbuf.put(38, truncName.data(), truncName.size());
 
-    sim->m_curDirIterator++;
+    sim->m_dirListingPos++;
   }
   else
   {
     // indicate end of directory
-    outbuf[2] = 7;
+    outbuf.setLength(7);
     outbuf[7] = 4;
   }
 }
 
-void TesterSim::process3AGetDateTime(const uint8_t* /*inbuf*/, uint8_t* outbuf, TesterSim* sim)
+void TesterSim::process3AGetDateTime(const uint8_t* /*inbuf*/, ReplyFrame& outbuf, TesterSim* sim)
 {
-  sim->log("Request for Tester date/time");
-  outbuf[2] = 0x0d;
-  outbuf[7] = 0x06;
-  outbuf[8] = 0x31;
-  outbuf[9] = 0x50;
-  outbuf[10] = 0x02;
-  outbuf[11] = 0x12;
-  outbuf[12] = 0x23;
-  outbuf[13] = 0x06;
+  sim->log(QStringLiteral("Request for Tester date/time"));
+  sim->applyReplyTemplate(0x3A, outbuf);
+  if (!sim->m_identity.fixedClock)
+  {
+    uint8_t now[7];
+    sim->m_identity.dateTimeBCD(now);
+    outbuf.put(7, now, sizeof(now));
+  }
 }
 
-void TesterSim::process3DEraseFlash(const uint8_t* inbuf, uint8_t* outbuf, TesterSim* sim)
+void TesterSim::process3DEraseFlash(const uint8_t* inbuf, ReplyFrame& outbuf, TesterSim* sim)
 {
   sim->log("Command to erase flash on Tester");
-  outbuf[2] = 8;
+  outbuf.setLength(8);
   outbuf[8] = inbuf[7];
   outbuf[7] = 1;
 }
 
+/**
+ * Reads a saved filesystem image (.sd2) into the supplied map, checking it
+ * (see ImageFile). If it can't be used, the reason is given in error.
+ */
+bool TesterSim::readImage(const QString& filename, FileContentsMap& contents, QString* error)
+{
+  ImageFile::Result result = ImageFile::read(filename);
+  if (!result.ok && error)
+  {
+    *error = result.corruptFiles.isEmpty() ? result.error :
+      QString("%1: %2").arg(result.error).arg(result.corruptFiles.join(", "));
+  }
+  contents = result.contents;
+  return result.ok;
+}
+
+/**
+ * Returns the compiled ECU database for a filesystem image. The database is
+ * cached next to the image (with an .ecudb suffix) and is only recompiled
+ * when the modules or SCARICO.INI in the image have changed.
+ */
+std::shared_ptr<const EcuDatabase> TesterSim::loadEcuDatabase(const QString& imageFilename, const FileContentsMap& contents)
+{
+  std::shared_ptr<EcuDatabase> db = std::make_shared<EcuDatabase>();
+  const QString dbFilename = imageFilename + ".ecudb";
+  if (db->load(dbFilename, EcuDatabase::computeSourceHash(contents)))
+  {
+    log(QString("Loaded ECU database with %1 modules from %2").arg(db->size()).arg(dbFilename));
+  }
+  else
+  {
+    db->compile(contents);
+    log(QString("Compiled ECU database with %1 modules").arg(db->size()));
+    if (!db->save(dbFilename))
+    {
+      log(QString("Warning: unable to write ECU database cache to %1").arg(dbFilename));
+    }
+  }
+  return db;
+}
+
+/**
+ * Loads a filesystem image into the writable upper layer of the Tester's
+ * filesystem, replacing whatever was there. Any mounted read-only images are
+ * left in place.
+ */
 bool TesterSim::loadState(const QString& filename)
 {
-  bool status = false;
-  QFile infile(filename);
+  FileContentsMap contents;
+  QString error;
+  if (!readImage(filename, contents, &error))
+  {
+    log(QString("Error: image %1 can't be used (%2)").arg(filename).arg(error));
+    return false;
+  }
 
-  if (infile.open(QIODevice::ReadOnly))
+  log("Loaded filesystem entries:");
+  foreach (QString dirname, contents.keys())
   {
-    QDataStream in(&infile);
-    in >> m_fileContents;
-    infile.close();
-    status = true;
+    log(QString(" dir: %1").arg(dirname));
+    foreach (QString filename, contents[dirname].keys())
+    {
+      log(QString("  file: %1 (%2 bytes)").arg(filename).arg(contents[dirname][filename].size()));
+    }
+  }
+  log("(End of filesystem entry list)");
+
+  std::shared_ptr<const EcuDatabase> db = loadEcuDatabase(filename, contents);
+
+  const QString learnedFilename = filename + ".learned";
+  std::shared_ptr<LearnedResponses> learned = std::make_shared<LearnedResponses>();
+  if (learned->load(learnedFilename))
+  {
+    log(QString("Loaded %1 learned responses for %2 ECUs from %3").
+      arg(learned->size()).arg(learned->ecuCount()).arg(learnedFilename));
+  }
+
+  queueUpdate([this, contents, db, learned, learnedFilename]()
+  {
+    m_fs.setUpper(contents);
+    m_curFileContents = nullptr;
+    m_readFileContents = nullptr;
+    m_dirListing = m_fs.list(m_curDir);
+    m_dirListingPos = 0;
+    m_ecuDb = db;
+    m_learned = learned;
+    m_learnedFilename = learnedFilename;
+  });
+
+  return true;
+}
+
+/**
+ * Mounts a filesystem image as a read-only layer beneath the upper layer, so
+ * that its files are visible to WSDC32 alongside those of any other mounted
+ * images. Returns the index of the new layer (for use with setImageActive()),
+ * or -1 on failure.
+ */
+int TesterSim::mountImage(const QString& filename)
+{
+  return mountImages(QStringList { filename }).front();
+}
 
-    emit logMsg("Loaded filesystem entries:");
-    foreach (QString dirname, m_fileContents.keys())
+/**
+ * Mounts a number of images, which are read and checked in parallel. Returns
+ * the index of each image's new layer, in the same order, or -1 for any that
+ * couldn't be mounted.
+ */
+std::vector<int> TesterSim::mountImages(const QStringList& filenames)
+{
+  std::vector<int> layers;
+  const std::vector<ImageFile::Result> results = ImageFile::readAll(filenames);
+  for (const ImageFile::Result& result : results)
+  {
+    if (!result.ok)
     {
-      emit logMsg(QString(" dir: %1").arg(dirname));
-      foreach (QString filename, m_fileContents[dirname].keys())
+      log(QString("Error: image %1 can't be used (%2)").arg(result.filename).arg(result.error));
+      for (const QString& file : result.corruptFiles)
       {
-        emit logMsg(QString("  file: %1 (%2 bytes)").arg(filename).arg(m_fileContents[dirname][filename].size()));
+        log(QString(" corrupt: %1").arg(file));
       }
     }
-    emit logMsg("(End of filesystem entry list)");
+    layers.push_back(result.ok ? mountContents(result.filename, result.contents) : -1);
   }
+  return layers;
+}
 
-  return status;
+int TesterSim::mountContents(const QString& filename, const FileContentsMap& contents)
+{
+  if (m_guiLayerCount >= VirtualFilesystem::MAX_LOWER_LAYERS)
+  {
+    return -1;
+  }
+
+  int fileCount = 0;
+  for (auto dir = contents.constBegin(); dir != contents.constEnd(); ++dir)
+  {
+    fileCount += dir.value().size();
+  }
+  log(QString("Mounting %1 (%2 files) as read-only layer %3").arg(filename).arg(fileCount).arg(m_guiLayerCount));
+
+  std::shared_ptr<const EcuDatabase> db = loadEcuDatabase(filename, contents);
+  const QString name = QFileInfo(filename).completeBaseName();
+  queueUpdate([this, name, contents, db]()
+  {
+    m_fs.mount(name, contents);
+    m_layerEcuDbs.push_back(db);
+  });
+
+  return m_guiLayerCount++;
+}
+
+/**
+ * Mirrors a directory on the host into the Tester's filesystem, on top of the
+ * loaded and mounted images. Files are read from the host as they are opened,
+ * files written by WSDC32 are written back to the host when closed, and
+ * changes made on the host are picked up between frames.
+ */
+bool TesterSim::mirrorHostDirectory(const QString& path)
+{
+  std::shared_ptr<HostMirror> mirror = std::make_shared<HostMirror>(path);
+  if (!mirror->isValid())
+  {
+    return false;
+  }
+
+  log(QString("Mirroring host directory %1 (%2 files)").arg(mirror->root()).arg(mirror->fileCount()));
+  queueUpdate([this, mirror]()
+  {
+    m_fs.setHostMirror(mirror);
+    m_curFileContents = nullptr;
+    m_readFileContents = nullptr;
+    m_dirListing = m_fs.list(m_curDir);
+    m_dirListingPos = 0;
+  });
+  return true;
+}
+
+/**
+ * Plays back a recorded log of RAM and value samples (see SampleStream for
+ * the formats), starting from the beginning and looping when it reaches the
+ * end. RAM locations and values that have a channel in the log are served
+ * from it; everything else still comes from the values set in the GUI.
+ */
+bool TesterSim::streamDataLog(const QString& path)
+{
+  std::shared_ptr<SampleStream> dataLog = std::make_shared<SampleStream>();
+  if (!dataLog->open(path))
+  {
+    return false;
+  }
+
+  log(QString("Streaming %1 channels (%2 s) from %3").
+    arg(dataLog->channelCount()).arg(dataLog->durationMs() / 1000.0).arg(path));
+  queueUpdate([this, dataLog]()
+  {
+    m_dataLog = dataLog;
+    m_dataLogStart = std::chrono::steady_clock::now();
+  });
+  return true;
+}
+
+/**
+ * Loads and compiles a scenario file (see Scenario for the syntax), replacing
+ * any scenario that was already loaded. All ECUs start over in their initial
+ * states, and any actions still waiting on a delay are dropped.
+ */
+bool TesterSim::loadScenario(const QString& path)
+{
+  QFile infile(path);
+  if (!infile.open(QIODevice::ReadOnly))
+  {
+    return false;
+  }
+
+  std::shared_ptr<Scenario> scenario = std::make_shared<Scenario>();
+  QString error;
+  if (!scenario->compile(QString::fromUtf8(infile.readAll()), error))
+  {
+    log(QString("Error in scenario %1: %2").arg(path).arg(error));
+    return false;
+  }
+
+  log(QString("Loaded scenario %1 (%2 rules)").arg(path).arg(scenario->ruleCount()));
+  queueUpdate([this, scenario]()
+  {
+    m_scenario = scenario;
+    m_scenarioStates.clear();
+    m_pendingActions.clear();
+  });
+  return true;
+}
+
+/**
+ * Adds the request/reply pairs in a capture of a real Tester session to the
+ * learned responses, which are used for ECUs whose protocol isn't known. If
+ * a filesystem image is loaded, the learned responses are saved next to it.
+ */
+bool TesterSim::learnFromCapture(const QString& filename)
+{
+  std::vector<LearnedResponses::Exchange> exchanges;
+  if (!LearnedResponses::readCapture(filename, exchanges))
+  {
+    return false;
+  }
+
+  queueUpdate([this, exchanges]()
+  {
+    const int added = m_learned->learn(exchanges);
+    log(QString("Learned %1 new requests from %2 exchanges (%3 requests for %4 ECUs in total)").
+      arg(added).arg(exchanges.size()).arg(m_learned->size()).arg(m_learned->ecuCount()));
+
+    if (m_learnedFilename.isEmpty())
+    {
+      log("No filesystem image is loaded, so the learned responses will not be saved");
+    }
+    else if (!m_learned->save(m_learnedFilename))
+    {
+      log(QString("Warning: unable to write learned responses to %1").arg(m_learnedFilename));
+    }
+  });
+
+  return true;
+}
+
+/**
+ * Starts or stops recording which ECU memory locations are accessed. Starting
+ * begins a new capture session, discarding anything recorded before.
+ */
+void TesterSim::setTracing(bool enabled)
+{
+  queueUpdate([this, enabled]()
+  {
+    m_tracing = enabled;
+    m_trace = nullptr;
+    if (enabled)
+    {
+      m_tracer.reset();
+    }
+    for (ApplContext& ctx : m_appl)
+    {
+      ctx.trace = (ctx.running && enabled) ? m_tracer.ecu(ctx.ecuId) : nullptr;
+    }
+    log(enabled ? "Tracing ECU memory accesses" : "Stopped tracing ECU memory accesses");
+  });
+}
+
+/**
+ * Enables or disables running the .ECU modules of ECUs whose protocol isn't
+ * known. This takes effect when an application is next started.
+ */
+void TesterSim::setRunModules(bool enabled)
+{
+  queueUpdate([this, enabled]()
+  {
+    m_runModules = enabled;
+    log(enabled ? "Running modules for ECUs with unknown protocols" : "Stopped running modules for ECUs with unknown protocols");
+  });
+}
+
+/**
+ * Writes a report of the traced memory accesses to the given file, and the
+ * raw counts (which can be compared with --diff-trace) to a CSV file next to
+ * it. This can be done while tracing is still running.
+ */
+bool TesterSim::saveTrace(const QString& filename)
+{
+  QString csvFilename = filename;
+  if (csvFilename.endsWith(".txt"))
+  {
+    csvFilename.chop(4);
+  }
+  csvFilename += ".csv";
+
+  QFile report(filename);
+  if (!report.open(QIODevice::WriteOnly | QIODevice::Text))
+  {
+    return false;
+  }
+  QTextStream out(&report);
+  m_tracer.writeReport(out);
+  out.flush();
+  return m_tracer.saveCSV(csvFilename);
+}
+
+/**
+ * Writes the requests that couldn't be answered in this session (see
+ * GapReport) to a CSV file.
+ */
+bool TesterSim::saveGapReport(const QString& filename)
+{
+  return m_gaps.save(filename);
+}
+
+/**
+ * Shows or hides a mounted image. Files that are in a hidden image won't
+ * appear in directory listings and can't be opened. This takes effect before
+ * the next frame, and doesn't interrupt an open file or directory listing.
+ */
+void TesterSim::setImageActive(int layer, bool active)
+{
+  queueUpdate([this, layer, active]() { m_fs.setLayerActive(layer, active); });
 }
 
+/**
+ * Saves the Tester's filesystem (all layers flattened into one) as an image,
+ * in the current version (see ImageFile).
+ */
 bool TesterSim::saveState(const QString& filename)
 {
-  bool status = false;
-  QFile outfile(filename);
+  // Only copying the layers holds up the listening thread; merging them,
+  // reading any files from the host and writing the image are done after
+  VirtualFilesystem::Contents contents;
+  {
+    std::lock_guard<std::mutex> lock(m_stateMutex);
+    contents = m_fs.contents();
+  }
+  return ImageFile::write(filename, contents.flatten());
+}
 
-  if (outfile.open(QIODevice::WriteOnly))
+/**
+ * Copies the whole session state into a checkpoint. Must be called by
+ * whichever thread holds m_stateMutex. File contents aren't copied, but the
+ * upper layer's maps are rebuilt rather than shared, because the file open
+ * for writing is appended to through a pointer into them.
+ */
+void TesterSim::captureCheckpoint(Checkpoint& cp) const
+{
+  const FileContentsMap& upper = m_fs.upper();
+  for (auto dir = upper.constBegin(); dir != upper.constEnd(); ++dir)
   {
-    QDataStream out(&outfile);
-    out << m_fileContents;
-    outfile.close();
-    status = true;
+    QMap<QString,QVector<quint8>>& cpDir = cp.upper[dir.key()];
+    for (auto file = dir.value().constBegin(); file != dir.value().constEnd(); ++file)
+    {
+      cpDir.insert(file.key(), file.value());
+    }
+  }
+  for (int i = 0; i < m_fs.layerCount(); i++)
+  {
+    cp.layerNames.append(m_fs.layerName(i));
   }
+  cp.activeMask = m_fs.activeMask();
+
+  cp.curDir = m_curDir;
+  cp.curFile = m_curFile;
+  cp.fileMode = m_curFileContents ? Checkpoint::FileMode::Writing :
+                m_readFileContents ? Checkpoint::FileMode::Reading : Checkpoint::FileMode::Closed;
+  cp.fileReadPos = m_fileReadPos;
+  cp.checksumBuf.assign(m_checksumBuf, m_checksumBuf + CHKSUM_BUF_SIZE);
+  cp.dirListing = m_dirListing;
+  cp.dirListingPos = m_dirListingPos;
+
+  for (const ApplContext& ctx : m_appl)
+  {
+    Checkpoint::Pipe pipe;
+    pipe.running = ctx.running;
+    pipe.ecuId = ctx.ecuId;
+    pipe.protocolKnown = ctx.protocolKnown;
+    pipe.protocol = ctx.protocol;
+    cp.pipes.push_back(pipe);
+  }
+  cp.lastApplPipe = m_lastApplPipe;
+  cp.lastCmdWasWriteToFile = m_lastCmdWasWriteToFile;
 
-  return status;
+  for (int addr = 0; addr < MemoryImage::SIZE; addr++)
+  {
+    if (m_ramData.isSet(addr))
+    {
+      cp.ramData[addr] = m_ramData.at(addr);
+    }
+  }
+  for (size_t id = 0; id < m_valueData.size(); id++)
+  {
+    if (m_valueSet[id])
+    {
+      cp.valueData[id] = m_valueData[id];
+    }
+  }
+  cp.snapshotData = m_snapshotData;
+  cp.errorMemory = m_errorMemory;
+  cp.scenarioStates = m_scenarioStates;
+
+  const auto now = std::chrono::steady_clock::now();
+  std::vector<FrameScheduler::Periodic> periodic;
+  m_scheduler.periodicFrames(now, periodic);
+  for (const FrameScheduler::Periodic& frame : periodic)
+  {
+    cp.periodicFrames.push_back({ frame.pipe, frame.key, frame.delayMs, frame.periodMs, *frame.frame });
+  }
+  for (const PendingAction& pending : m_pendingActions)
+  {
+    const auto delayMs = std::chrono::duration_cast<std::chrono::milliseconds>(pending.due - now).count();
+    cp.pendingActions.push_back({ static_cast<uint32_t>(std::max<int64_t>(delayMs, 0)), pending.ecuId, pending.action });
+  }
+}
+
+/**
+ * Replaces the session state with that of a checkpoint. Must be called by
+ * whichever thread holds m_stateMutex.
+ */
+void TesterSim::applyCheckpoint(const Checkpoint& cp)
+{
+  m_fs.setUpper(cp.upper);
+  bool sameLayers = (cp.layerNames.size() == m_fs.layerCount());
+  for (int i = 0; sameLayers && (i < m_fs.layerCount()); i++)
+  {
+    sameLayers = (cp.layerNames.at(i) == m_fs.layerName(i));
+  }
+  if (sameLayers)
+  {
+    for (int i = 0; i < m_fs.layerCount(); i++)
+    {
+      m_fs.setLayerActive(i, cp.activeMask & (1u << i));
+    }
+  }
+  else
+  {
+    log(QString("Warning: the checkpoint was saved with images mounted (%1) that differ from those mounted now").
+      arg(cp.layerNames.join(", ")));
+  }
+
+  m_curDir = cp.curDir;
+  m_curFile = cp.curFile;
+  m_fileReadPos = cp.fileReadPos;
+  memset(m_checksumBuf, 0, CHKSUM_BUF_SIZE);
+  memcpy(m_checksumBuf, cp.checksumBuf.data(), std::min<size_t>(cp.checksumBuf.size(), CHKSUM_BUF_SIZE));
+  m_curFileContents = nullptr;
+  m_readFileContents = nullptr;
+  if (cp.fileMode == Checkpoint::FileMode::Reading)
+  {
+    m_readFileContents = m_fs.find(m_curDir, m_curFile);
+  }
+  else if (cp.fileMode == Checkpoint::FileMode::Writing)
+  {
+    m_curFileContents = m_fs.reopen(m_curDir, m_curFile);
+    if (!m_curFileContents)
+    {
+      log(QString("Warning: '%1' was open for writing but can't be reopened").arg(m_curFile));
+    }
+  }
+  m_dirListing = cp.dirListing;
+  m_dirListingPos = cp.dirListingPos;
+
+  for (int i = 0; i < NUM_PIPES; i++)
+  {
+    m_scheduler.cancelPipe(i);
+    ApplContext& ctx = m_appl[i];
+    ctx = ApplContext();
+    if (i < static_cast<int>(cp.pipes.size()))
+    {
+      ctx.running = cp.pipes[i].running;
+      ctx.ecuId = cp.pipes[i].ecuId;
+      ctx.protocolKnown = cp.pipes[i].protocolKnown;
+      ctx.protocol = cp.pipes[i].protocol;
+    }
+    ctx.trace = (ctx.running && m_tracing) ? m_tracer.ecu(ctx.ecuId) : nullptr;
+
+    // An emulated module can't be resumed, only started over
+    if (ctx.running && !ctx.protocolKnown && m_runModules)
+    {
+      startModule(ctx, i);
+    }
+  }
+  m_lastApplPipe = cp.lastApplPipe;
+  m_lastCmdWasWriteToFile = cp.lastCmdWasWriteToFile;
+  m_lastCmdWasReadFromFile = false;
+
+  m_ramData.clear();
+  for (const auto& ram : cp.ramData)
+  {
+    m_ramData.set(ram.first, ram.second);
+  }
+  m_valueData.fill(0);
+  m_valueSet.reset();
+  for (const auto& value : cp.valueData)
+  {
+    m_valueData[value.first] = value.second;
+    m_valueSet[value.first] = true;
+  }
+  m_snapshotData = cp.snapshotData;
+  m_errorMemory = cp.errorMemory;
+  m_scenarioStates = cp.scenarioStates;
+
+  for (const Checkpoint::PeriodicFrame& periodic : cp.periodicFrames)
+  {
+    if ((periodic.pipe < NUM_PIPES) && !periodic.frame.empty())
+    {
+      m_scheduler.schedule(periodic.delayMs, periodic.periodMs, periodic.pipe, periodic.frame.data(),
+                           periodic.frame.size(), periodic.key);
+    }
+  }
+  const auto now = std::chrono::steady_clock::now();
+  m_pendingActions.clear();
+  for (const Checkpoint::PendingAction& pending : cp.pendingActions)
+  {
+    m_pendingActions.push_back({ now + std::chrono::milliseconds(pending.delayMs), pending.ecuId, pending.action });
+  }
+  std::make_heap(m_pendingActions.begin(), m_pendingActions.end());
+}
+
+/**
+ * Saves a checkpoint of the whole session (see Checkpoint) without holding
+ * up the protocol thread: the state is captured between frames, and written
+ * to the file on a separate thread. Only one checkpoint can be in progress
+ * at a time. The outcome is logged when the file has been written.
+ */
+bool TesterSim::saveCheckpoint(const QString& filename)
+{
+  if (m_checkpointBusy.exchange(true))
+  {
+    log("A checkpoint is still being saved");
+    return false;
+  }
+  if (m_checkpointThread.joinable())
+  {
+    m_checkpointThread.join();
+  }
+
+  std::shared_ptr<std::promise<std::shared_ptr<const Checkpoint>>> captured =
+    std::make_shared<std::promise<std::shared_ptr<const Checkpoint>>>();
+  std::future<std::shared_ptr<const Checkpoint>> checkpoint = captured->get_future();
+  queueUpdate([this, captured]()
+  {
+    std::shared_ptr<Checkpoint> cp = std::make_shared<Checkpoint>();
+    captureCheckpoint(*cp);
+    captured->set_value(cp);
+  });
+
+  m_checkpointThread = std::thread([this, filename, checkpoint = std::move(checkpoint)]() mutable
+  {
+    const std::shared_ptr<const Checkpoint> cp = checkpoint.get();
+    const auto start = std::chrono::steady_clock::now();
+    const bool saved = cp->save(filename);
+    const auto elapsedMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - start).count();
+    if (saved)
+    {
+      log(QString("Saved checkpoint to '%1' in %2 ms").arg(filename).arg(elapsedMs));
+    }
+    else
+    {
+      log(QString("Failed to save checkpoint to '%1'").arg(filename));
+    }
+    m_checkpointBusy = false;
+  });
+
+  return true;
+}
+
+/**
+ * Restores a checkpoint saved by saveCheckpoint(). The file is read by the
+ * calling (GUI) thread, and the state is replaced between frames; the time
+ * taken, from reading the file to the state being in place, is logged.
+ */
+bool TesterSim::restoreCheckpoint(const QString& filename)
+{
+  const auto start = std::chrono::steady_clock::now();
+  std::shared_ptr<Checkpoint> cp = std::make_shared<Checkpoint>();
+  if (!cp->load(filename))
+  {
+    return false;
+  }
+
+  // Every page that was set before or is set now may have changed
+  std::set<int> changed;
+  for (const auto& snapshot : m_guiSnapshotData)
+  {
+    changed.insert(snapshot.first);
+  }
+  for (const auto& snapshot : cp->snapshotData)
+  {
+    changed.insert(snapshot.first);
+  }
+  m_guiSnapshotData = cp->snapshotData;
+  for (int snapshotIndex : changed)
+  {
+    emit snapshotChanged(snapshotIndex);
+  }
+
+  queueUpdate([this, cp, start]()
+  {
+    applyCheckpoint(*cp);
+    const auto elapsedMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - start).count();
+    log(QString("Restored checkpoint in %1 ms").arg(elapsedMs));
+  });
+  return true;
 }
 
 void TesterSim::log(const QString& line)
 {
-  emit logMsg(line);
+  TRACE_SPAN("log");
+  if (m_logBuffer.add(line))
+  {
+    TRACE_SPAN("emit logReady");
+    emit logReady();
+  }
 }
 
+/**
+ * Returns the content of a snapshot page as last set through
+ * setSnapshotContent(). Must only be called from the same (GUI) thread that
+ * sets snapshot content.
+ */
 const std::vector<uint8_t>& TesterSim::getSnapshotContent(int snapshotIndex)
 {
-  return m_snapshotData[snapshotIndex];
+  return m_guiSnapshotData[snapshotIndex];
 }
 
 void TesterSim::setSnapshotContent(int snapshotIndex, const std::vector<uint8_t>& content)
 {
-  m_snapshotData[snapshotIndex] = content;
-  emit logMsg(QString("Set snapshot data with %1 bytes").arg(content.size()));
+  m_guiSnapshotData[snapshotIndex] = content;
+  queueUpdate([this, snapshotIndex, content]() { m_snapshotData[snapshotIndex] = content; });
+  log(QString("Set snapshot data with %1 bytes").arg(content.size()));
 }
 
 void TesterSim::setErrorMemoryContent(const std::vector<uint8_t>& content)
 {
-  m_errorMemory = content;
-  emit logMsg(QString("Set error memory with %1 bytes").arg(content.size()));
+  queueUpdate([this, content]() { m_errorMemory = content; });
+  log(QString("Set error memory with %1 bytes").arg(content.size()));
 }
 
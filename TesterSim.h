@@ -1,116 +1,395 @@
 #pragma once
+#include <array>
+#include <atomic>
+#include <bitset>
+#include <chrono>
 #include <cstdint>
 #include <functional>
+#include <initializer_list>
 #include <vector>
 #include <unordered_map>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include <QMap>
 #include <QObject>
 #include <QString>
+#include <QStringList>
+#include "AccessEventRing.h"
+#include "AccessTracer.h"
+#include "Checkpoint.h"
+#include "EcuDatabase.h"
+#include "LearnedResponses.h"
+#include "LogBuffer.h"
+#include "MemoryImage.h"
+#include "FrameScheduler.h"
+#include "GapReport.h"
+#include "ModuleRunner.h"
+#include "ReplyFrame.h"
+#include "SampleStream.h"
+#include "Scenario.h"
+#include "StateUpdateQueue.h"
+#include "TesterIdentity.h"
+#include "VirtualFilesystem.h"
 
 constexpr int CHKSUM_BUF_SIZE = 110;
 constexpr int DEFAULT_SNAPSHOT_SIZE = 16;
 constexpr int DEFAULT_ERROR_MEMORY_SIZE = 16;
+constexpr int NUM_PIPES = 16;
+constexpr int REPLY_DELAY_MS = 40;
+constexpr int MODULE_REPLY_DELAY_LIMIT_MS = 2000;
+constexpr int UPDATE_RETRY_MS = 5;
+constexpr int MAX_REQUEST_SIZE = 0x100;
+constexpr int DIR_ENTRY_NAME_LEN = 89;
 
-enum class ProtocolType
+// Space reserved for a file when it is opened for writing, so that the
+// writes that follow don't have to grow it (files larger than this still can)
+constexpr int WRITE_FILE_RESERVE = 256 * 1024;
+
+// Largest data payloads that fit in an ECU protocol block, whose byte count
+// is a single byte that also covers the title and the terminator/checksum
+constexpr int MAX_KWP_DATA_LEN = 0xff - 2;
+constexpr int MAX_1AF_DATA_LEN = 0xff - 3;
+
+/**
+ * Fixed-capacity byte sequence that can be built in a constant expression,
+ * for the static tables in TesterSimModuleInfo.cpp. If more than Capacity
+ * bytes are supplied, only the first Capacity are stored but len reflects
+ * the full count, so that the table checks can catch it.
+ */
+template <int Capacity>
+struct ByteSpan
+{
+  uint8_t len = 0;
+  uint8_t bytes[Capacity] = {};
+
+  constexpr ByteSpan() = default;
+  constexpr ByteSpan(std::initializer_list<uint8_t> list)
+  {
+    for (uint8_t b : list)
+    {
+      if (len < Capacity)
+      {
+        bytes[len] = b;
+      }
+      len++;
+    }
+  }
+
+  constexpr bool empty() const { return len == 0; }
+  constexpr int size() const { return len; }
+  constexpr const uint8_t* data() const { return bytes; }
+};
+
+/**
+ * Hand-maintained information about one ECU module, looked up by ECU ID.
+ */
+struct ModuleInfo
+{
+  bool protocolKnown = false;
+  ProtocolType protocol = ProtocolType::KWP71;
+  ByteSpan<MAX_ISO_KEYWORD_LEN> isoBytes;
+  ByteSpan<MAX_EXTRA_INIT_INFO_LEN> extraInitInfo;
+};
+
+/**
+ * State of the ECU application module (_applModGest) that WSDC32 has started
+ * on one of the Tester's pipes. Each pipe talks to its own ECU, so commands
+ * are routed to a context by the pipe number carried in the frame.
+ */
+struct ApplContext
 {
-  KWP71,
-  FIAT9141,
-  Marelli1AF,
-
-  /**
-   * This one seems to be an ealier version of the protocol used by Bosch with
-   * the Smartra III immobilizer, the spec for which was made available as
-   * Appendix H in the user manual provided to the FCC (FCC ID: LXP-VIMA01).
-   */
-  BoschAlarm,
-  BilsteinSuspension
+  bool running = false;
+  int ecuId = 0;
+  bool protocolKnown = false;
+  ProtocolType protocol = ProtocolType::KWP71;
+  std::shared_ptr<ModuleRunner> module;
+  AccessTracer::EcuTrace* trace = nullptr; // only while tracing
 };
 
 class TesterSim : public QObject
 {
   Q_OBJECT
 
+  // The allocation check drives the socket path directly (see AllocCheck.h)
+  friend class AllocCheck;
+
 public:
+  // A frame that the Tester sends without having been asked, delayMs after
+  // the reply to the request that produced it (and every periodMs, if that
+  // is nonzero). A nonzero key replaces anything scheduled with the same key
+  // on the same pipe (see FrameScheduler::schedule()).
+  struct UnsolicitedFrame
+  {
+    uint32_t delayMs;
+    uint32_t periodMs;
+    std::vector<uint8_t> frame;
+    uint32_t key;
+  };
+
+  // A run of consecutive RAM locations, starting at addr
+  struct RamRun
+  {
+    uint16_t addr;
+    std::vector<uint8_t> bytes;
+  };
+
+  // Changes to the ECU state that are applied together (see applyChange())
+  struct StateChange
+  {
+    std::vector<RamRun> ram;
+    std::vector<std::pair<uint8_t,uint32_t>> values;
+    std::vector<std::pair<int,std::vector<uint8_t>>> snapshots;
+    bool replaceErrorMemory = false;
+    std::vector<uint8_t> errorMemory;
+  };
+
+  // Parts of the ECU state to read (see queryState()). The RAM runs' sizes,
+  // the value IDs and the snapshot indexes say what to read, and the rest is
+  // filled in.
+  struct StateQuery
+  {
+    std::vector<RamRun> ram;
+    std::vector<std::pair<uint8_t,uint32_t>> values;
+    std::vector<std::pair<int,std::vector<uint8_t>>> snapshots;
+    bool errorMemory = false;
+    std::vector<uint8_t> errorMemoryBytes;
+  };
+
   explicit TesterSim(QObject* parent = nullptr);
+  ~TesterSim();
+  bool loadIdentity(const QString& path);
   bool connectToSocket(const QString& path);
   bool listen();
   void stopListening();
+  bool transact(const uint8_t* request, int len, std::vector<uint8_t>& reply, uint32_t& delayMs,
+                std::vector<UnsolicitedFrame>& unsolicited);
   void setRAMLoc(uint16_t addr, uint8_t val);
+  void writeRAM(std::shared_ptr<const MemoryImage> image);
+  bool copyRAM(MemoryImage& image, std::vector<uint32_t>& reads);
   void setValue(uint16_t addr, uint32_t val);
+  void applyChange(std::shared_ptr<const StateChange> change);
+  void queryState(StateQuery& query);
+  AccessEventRing& accessEvents() { return m_accessEvents; }
   bool loadState(const QString& filename);
+  int mountImage(const QString& filename);
+  std::vector<int> mountImages(const QStringList& filenames);
+  void setImageActive(int layer, bool active);
+  bool mirrorHostDirectory(const QString& path);
+  bool streamDataLog(const QString& path);
+  bool loadScenario(const QString& path);
+  bool learnFromCapture(const QString& filename);
+  void setTracing(bool enabled);
+  void setRunModules(bool enabled);
+  bool saveTrace(const QString& filename);
+  bool saveGapReport(const QString& filename);
   bool saveState(const QString& filename);
+  bool saveCheckpoint(const QString& filename);
+  bool restoreCheckpoint(const QString& filename);
   const std::vector<uint8_t>& getSnapshotContent(int snapshotIndex);
   void setSnapshotContent(int snapshotIndex, const std::vector<uint8_t>& content);
   void setErrorMemoryContent(const std::vector<uint8_t>& content);
 
+  static bool readImage(const QString& filename, FileContentsMap& contents, QString* error = nullptr);
+
+  LogBuffer::Batch takeLog() { return m_logBuffer.take(); }
+
 signals:
-  void logMsg(const QString& line);
-  void lastLogMsgRepeated();
-  void consecutiveWriteToFileCmd();
+  // Emitted when there is log output to collect with takeLog(), once per
+  // batch rather than once per line
+  void logReady();
+  // Emitted when a snapshot page has been changed other than by
+  // setSnapshotContent(), e.g. through the control API
+  void snapshotChanged(int snapshotIndex);
+  // Carries a snapshot page written on another thread back to this object's
+  // thread, where the copy returned by getSnapshotContent() is updated
+  void snapshotWritten(int snapshotIndex, QByteArray content);
 
 private:
-  bool m_shutdown = false;
+  std::atomic<bool> m_shutdown { false };
+  LogBuffer m_logBuffer;
   int m_sockFd = -1;
-  uint8_t m_inbuf[128];
-  uint8_t m_outbuf[128];
+  uint8_t m_inbuf[MAX_REQUEST_SIZE];
+  ReplyFrame m_outbuf;
   uint8_t m_checksumBuf[CHKSUM_BUF_SIZE];
-  uint8_t m_lastInbuf[128];
+  uint8_t m_lastInbuf[MAX_REQUEST_SIZE];
+  uint8_t m_rxBuf[1024];
+  int m_rxLen = 0;
+
+  // Everything the Tester sends (replies included) goes through the frame
+  // scheduler, so that the listening thread never sleeps while emulating the
+  // Tester's response time, and then through the output queue, which writes
+  // whatever has come due with as few syscalls as possible. Unsolicited
+  // frames produced while handling a request are held until its reply has
+  // been scheduled, so that they always follow it.
+  FrameScheduler m_scheduler;
+  uint32_t m_replyDelayMs = REPLY_DELAY_MS;
+  std::vector<UnsolicitedFrame> m_unsolicitedFrames;
+  OutputQueue m_output;
   QString m_curDir;
   QString m_curFile;
   int m_fileReadPos = 0;
-  bool m_applRun[16];
-  int m_currentECUID = 0;
+  TesterIdentity m_identity;
+
+  // Prebuilt payloads (from position 07 on) of the replies that depend only
+  // on the Tester identity, indexed by command; empty if not templated
+  std::array<std::vector<uint8_t>,0x100> m_replyTemplates;
+
+  ApplContext m_appl[NUM_PIPES];
+  int m_lastApplPipe = 0;
   bool m_lastCmdWasWriteToFile = false;
-  std::unordered_map<uint16_t,uint8_t> m_ramData;
-  std::unordered_map<uint8_t,uint32_t> m_valueData;
+  bool m_lastCmdWasReadFromFile = false;
+
+  // RAM and sampled values are held in flat arrays rather than maps, so that
+  // polling them doesn't allocate; a location that was never set reads as 0
+  MemoryImage m_ramData;
+
+  // One bit per RAM address, set when WSDC32 reads it and cleared when the
+  // GUI collects them with copyRAM() (to highlight live reads)
+  std::array<std::atomic<uint32_t>,MemoryImage::SIZE / 32> m_ramReads;
+  std::array<uint32_t,0x100> m_valueData {};
+  std::bitset<0x100> m_valueSet;
+  std::shared_ptr<SampleStream> m_dataLog;
+  std::chrono::steady_clock::time_point m_dataLogStart;
+  uint32_t m_dataLogTimeMs = 0;
+  std::shared_ptr<const Scenario> m_scenario;
+  std::unordered_map<int,uint8_t> m_scenarioStates;
+  struct PendingAction
+  {
+    std::chrono::steady_clock::time_point due;
+    int ecuId;
+    Scenario::Action action;
+    bool operator<(const PendingAction& other) const { return due > other.due; }
+  };
+  std::vector<PendingAction> m_pendingActions;
   std::map<int,std::vector<uint8_t>> m_snapshotData;
   std::vector<uint8_t> m_errorMemory;
 
-  QMap<QString,QMap<QString,QVector<quint8>>> m_fileContents;
-  QMap<QString,QVector<quint8>>::Iterator m_curDirIterator;
+  // Memory accesses are recorded against the ECU that the current frame is
+  // addressed to, when tracing is enabled (m_trace is null otherwise). Each
+  // pipe's trace is looked up once, when its application is started.
+  AccessTracer m_tracer;
+  AccessTracer::EcuTrace* m_trace = nullptr;
+  bool m_tracing = false;
+
+  // Requests that couldn't be answered properly, since listening started
+  GapReport m_gaps;
+
+  // Reads and writes of ECU state, for control API subscribers
+  AccessEventRing m_accessEvents;
+
+  // ECU state edits from the GUI are queued here and applied by the protocol
+  // thread between frames; the pushing thread writes to the wake pipe so that
+  // they're applied even while no frames are arriving. Only while nothing is
+  // listening does the pushing thread apply them itself. The GUI keeps its
+  // own copy of the snapshot pages so that it can display them without
+  // touching m_snapshotData. m_stateMutex is held by whichever thread is
+  // currently touching ECU state, and is only try-locked by the GUI.
+  StateUpdateQueue m_updates;
+  std::mutex m_stateMutex;
+  std::atomic<bool> m_listening { false };
+  int m_wakeFds[2] = { -1, -1 };
+  std::map<int,std::vector<uint8_t>> m_guiSnapshotData;
+
+  // Checkpoints are captured by the protocol thread (as a state update) and
+  // written out by this thread, one at a time
+  std::thread m_checkpointThread;
+  std::atomic<bool> m_checkpointBusy { false };
+
+  VirtualFilesystem m_fs;
+  std::shared_ptr<const EcuDatabase> m_ecuDb;
+  std::vector<std::shared_ptr<const EcuDatabase>> m_layerEcuDbs;
+
+  // Responses learned from captures, for ECUs whose protocol isn't known.
+  // Owned by the protocol thread once installed (replaying advances cursors)
+  std::shared_ptr<LearnedResponses> m_learned = std::make_shared<LearnedResponses>();
+  QString m_learnedFilename;
+
+  // When set, ECUs whose protocol isn't known are served by running their
+  // uploaded .ECU module in an emulated 68k (see ApplContext::module)
+  bool m_runModules = false;
+  ReplyFrame m_moduleLineReply;
+  int m_guiLayerCount = 0;
+  QVector<VirtualFilesystem::DirEntry> m_dirListing;
+  int m_dirListingPos = 0;
   QVector<quint8>* m_curFileContents = nullptr;
+  const QVector<quint8>* m_readFileContents = nullptr;
 
   void log(const QString& line);
   bool shouldDisplayPacket(const uint8_t* buf);
   void printPacket(const uint8_t* buf);
-  int readBytes(uint8_t* buf, int count);
+  bool receiveBytes();
+  bool processReceivedFrames();
+  bool handleFrame();
+  void beginFrame();
+  bool flushOutput();
   bool sendReply(bool print);
   bool processBuf(bool print);
+  bool buildReply();
+  void buildReplyTemplates();
+  void applyReplyTemplate(uint8_t cmd, ReplyFrame& outbuf) const;
+  void queueUnsolicitedFrame(const uint8_t* payload, int len, uint32_t delayMs, uint32_t periodMs,
+                             uint32_t key = 0);
   void chdir(const std::string& dir);
   void addToFile(const std::string& name, int numBytes);
-  void emitConsecutiveWriteToFileSignal();
-
-  static std::map<uint8_t,std::function<void(const uint8_t*,uint8_t*,TesterSim*)>> s_commandProcs;
-  static const std::unordered_map<int,ProtocolType> s_protocols;
-  static const std::unordered_map<int,std::vector<uint8_t>> s_isoBytes;
-  static const std::unordered_map<int,std::vector<uint8_t>> s_moduleExtraInitInfo;
-
-  static void process01TabletInfo(const uint8_t* inbuf, uint8_t* outbuf, TesterSim*);
-  static void process02SerialNo(const uint8_t* inbuf, uint8_t* outbuf, TesterSim*);
-  static void process09(const uint8_t* inbuf, uint8_t* outbuf, TesterSim*);
-  static void process0AWorkshopData(const uint8_t* inbuf, uint8_t* outbuf, TesterSim*);
-  static void process0BStartApplModGest(const uint8_t* inbuf, uint8_t* outbuf, TesterSim*);
-  static void process11DoSlowInit(const uint8_t* inbuf, uint8_t* outbuf, TesterSim*);
-  static void process12GetISOKeyword(const uint8_t* inbuf, uint8_t* outbuf, TesterSim*);
-  static void process13CommandToECU(const uint8_t* inbuf, uint8_t* outbuf, TesterSim*);
-  static void process15DisplayString(const uint8_t* inbuf, uint8_t* outbuf, TesterSim*);
-  static void process1C(const uint8_t* inbuf, uint8_t* outbuf, TesterSim*);
-  static void process1ECloseFile(const uint8_t* inbuf, uint8_t* outbuf, TesterSim*);
-  static void process20OpenFileForWriting(const uint8_t* inbuf, uint8_t* outbuf, TesterSim*);
-  static void process21WriteToFile(const uint8_t* inbuf, uint8_t* outbuf, TesterSim*);
-  static void process23OpenFileForReading(const uint8_t* inbuf, uint8_t* outbuf, TesterSim*);
-  static void process24ReadFromFile(const uint8_t* inbuf, uint8_t* outbuf, TesterSim*);
-  static void process25ChecksumFile(const uint8_t* inbuf, uint8_t* outbuf, TesterSim*);
-  static void process2AChdir(const uint8_t* inbuf, uint8_t* outbuf, TesterSim*);
-  static void process2BGetNextDirEntry(const uint8_t* inbuf, uint8_t* outbuf, TesterSim*);
-  static void process3AGetDateTime(const uint8_t* inbuf, uint8_t* outbuf, TesterSim*);
-  static void process3DEraseFlash(const uint8_t* inbuf, uint8_t* outbuf, TesterSim*);
-
-  static void processKWP71CommandToECU(const uint8_t* inbuf, uint8_t* outbuf, TesterSim* sim, bool hasVerbosePayload);
-  static void processFIAT9141CommandToECU(const uint8_t* inbuf, uint8_t* outbuf, TesterSim* sim, bool hasVerbosePayload);
-  static void processMarelli1AFCommandToECU(const uint8_t* inbuf, uint8_t* outbuf, TesterSim* sim, bool hasVerbosePayload);
-  static void processBoschAlarmCommandToECU(const uint8_t* inbuf, uint8_t* outbuf, TesterSim* sim, bool hasVerbosePayload);
-  static void processBilsteinSuspensionCommandToECU(const uint8_t* inbuf, uint8_t* outbuf, TesterSim* sim, bool hasVerbosePayload);
+  void logConsecutiveWriteToFile();
+  void logConsecutiveReadFromFile();
+  void reportGap(const uint8_t* inbuf, int ecuId, int protocol, int titlePos, const char* what);
+  ApplContext& applContext(const uint8_t* inbuf);
+  void queueUpdate(StateUpdateQueue::Update update);
+  void drainIfNotListening();
+  void applyQueuedUpdates();
+  void runScenario(int ecuId, const uint8_t* block, int len);
+  void applyScenarioAction(int ecuId, const Scenario::Action& action);
+  void runPendingScenarioActions();
+  uint8_t readRAM(uint16_t addr);
+  uint32_t readValue(uint8_t id);
+  uint8_t readErrorMemory(int index);
+  void noteRead(AccessTracer::Space space, uint32_t addr, uint32_t val);
+  void noteWrite(AccessTracer::Space space, uint32_t addr, uint32_t val, AccessTracer::EcuTrace* trace = nullptr);
+  void runBetweenFrames(std::function<void()> fn);
+  const EcuRecord* ecuRecord(int ecuId) const;
+  const QVector<quint8>* findModule(int ecuId) const;
+  void startModule(ApplContext& ctx, int pipeNum);
+  bool runModule(const uint8_t* inbuf, ReplyFrame& outbuf);
+  QByteArray answerModuleLine(uint16_t ecuId, const QByteArray& request, const QByteArray& sent);
+  void captureCheckpoint(Checkpoint& cp) const;
+  void applyCheckpoint(const Checkpoint& cp);
+  std::shared_ptr<const EcuDatabase> loadEcuDatabase(const QString& imageFilename, const FileContentsMap& contents);
+  int mountContents(const QString& filename, const FileContentsMap& contents);
+
+  // Handlers indexed by command byte (null if there isn't one), looked up
+  // directly for each frame
+  typedef void (*CommandProc)(const uint8_t*, ReplyFrame&, TesterSim*);
+  static const std::array<CommandProc,0x100> s_commandProcs;
+  static const ModuleInfo* moduleInfo(int ecuId);
+
+  static void process01TabletInfo(const uint8_t* inbuf, ReplyFrame& outbuf, TesterSim*);
+  static void process02SerialNo(const uint8_t* inbuf, ReplyFrame& outbuf, TesterSim*);
+  static void process09(const uint8_t* inbuf, ReplyFrame& outbuf, TesterSim*);
+  static void process0AWorkshopData(const uint8_t* inbuf, ReplyFrame& outbuf, TesterSim*);
+  static void process0BStartApplModGest(const uint8_t* inbuf, ReplyFrame& outbuf, TesterSim*);
+  static void process11DoSlowInit(const uint8_t* inbuf, ReplyFrame& outbuf, TesterSim*);
+  static void process12GetISOKeyword(const uint8_t* inbuf, ReplyFrame& outbuf, TesterSim*);
+  static void process13CommandToECU(const uint8_t* inbuf, ReplyFrame& outbuf, TesterSim*);
+  static void process15DisplayString(const uint8_t* inbuf, ReplyFrame& outbuf, TesterSim*);
+  static void process1C(const uint8_t* inbuf, ReplyFrame& outbuf, TesterSim*);
+  static void process1ECloseFile(const uint8_t* inbuf, ReplyFrame& outbuf, TesterSim*);
+  static void process20OpenFileForWriting(const uint8_t* inbuf, ReplyFrame& outbuf, TesterSim*);
+  static void process21WriteToFile(const uint8_t* inbuf, ReplyFrame& outbuf, TesterSim*);
+  static void process23OpenFileForReading(const uint8_t* inbuf, ReplyFrame& outbuf, TesterSim*);
+  static void process24ReadFromFile(const uint8_t* inbuf, ReplyFrame& outbuf, TesterSim*);
+  static void process25ChecksumFile(const uint8_t* inbuf, ReplyFrame& outbuf, TesterSim*);
+  static void process2AChdir(const uint8_t* inbuf, ReplyFrame& outbuf, TesterSim*);
+  static void process2BGetNextDirEntry(const uint8_t* inbuf, ReplyFrame& outbuf, TesterSim*);
+  static void process3AGetDateTime(const uint8_t* inbuf, ReplyFrame& outbuf, TesterSim*);
+  static void process3DEraseFlash(const uint8_t* inbuf, ReplyFrame& outbuf, TesterSim*);
+
+  static void processKWP71CommandToECU(const uint8_t* inbuf, ReplyFrame& outbuf, TesterSim* sim, bool hasVerbosePayload);
+  static void processFIAT9141CommandToECU(const uint8_t* inbuf, ReplyFrame& outbuf, TesterSim* sim, bool hasVerbosePayload);
+  static void processMarelli1AFCommandToECU(const uint8_t* inbuf, ReplyFrame& outbuf, TesterSim* sim, bool hasVerbosePayload);
+  static void processBoschAlarmCommandToECU(const uint8_t* inbuf, ReplyFrame& outbuf, TesterSim* sim, bool hasVerbosePayload);
+  static void processBilsteinSuspensionCommandToECU(const uint8_t* inbuf, ReplyFrame& outbuf, TesterSim* sim, bool hasVerbosePayload);
 };
 
@@ -1,6 +1,43 @@
 #include "TesterSim.h"
+#include <array>
 
-const std::unordered_map<int,ProtocolType> TesterSim::s_protocols =
+namespace
+{
+
+/**
+ * Describes how an ISO keyword sequence in the table below is expected to
+ * look. Sequences of three bytes or fewer carry no checksum; full six-byte
+ * sequences end with a checksum that is the sum of the preceding bytes.
+ * Entries that don't follow this are flagged explicitly, so that a mistyped
+ * byte in a new entry is caught at compile time.
+ */
+enum class KeywordCheck
+{
+  Normal,
+  BadChecksum,
+  Malformed
+};
+
+struct ProtocolEntry
+{
+  int ecuId;
+  ProtocolType protocol;
+};
+
+struct KeywordEntry
+{
+  int ecuId;
+  ByteSpan<MAX_ISO_KEYWORD_LEN> bytes;
+  KeywordCheck check = KeywordCheck::Normal;
+};
+
+struct ExtraInitInfoEntry
+{
+  int ecuId;
+  ByteSpan<MAX_EXTRA_INIT_INFO_LEN> bytes;
+};
+
+constexpr ProtocolEntry s_protocols[] =
 {
   {  83, ProtocolType::FIAT9141 },
   {  84, ProtocolType::Marelli1AF },
@@ -28,26 +65,26 @@ const std::unordered_map<int,ProtocolType> TesterSim::s_protocols =
 // presumably errors in the original SD2 software. We should run some experiments
 // with sending the sequences with a repaired checksum, to see if that has any
 // positive effect on WSDC32 accepting the init sequence.
-const std::unordered_map<int,std::vector<uint8_t>> TesterSim::s_isoBytes =
+constexpr KeywordEntry s_isoBytes[] =
 {
   {50, {0x55, 0xCD, 0x83, 0x01, 0x98, 0x3E} },
   {51, {0x55, 0x16, 0x07, 0x01, 0x98, 0x0B} },
   {52, {0x55, 0x97, 0x07, 0x01, 0x98, 0x8C} },
   {53, {0x55, 0xD6, 0x83, 0x01, 0x15, 0xC4} },
-  {54, {0x55, 0x4A, 0x83, 0x01, 0x98, 0x3B} },
-  {55, {0x55, 0x10, 0x07, 0x01, 0x98, 0x85} },
+  {54, {0x55, 0x4A, 0x83, 0x01, 0x98, 0x3B}, KeywordCheck::BadChecksum },
+  {55, {0x55, 0x10, 0x07, 0x01, 0x98, 0x85}, KeywordCheck::BadChecksum },
   {57, {0x55, 0xEF, 0x8F} },
   {58, {0x55, 0x52, 0x83, 0x01, 0x15, 0x40} },
   {66, {0x55, 0x92, 0x07, 0x01, 0x19, 0x08} },
   {68, {0xE9, 0x8F} },
   {69, {0x55, 0x4F, 0x83, 0x01, 0x15, 0x3D} },
   {71, {0x55, 0x91, 0x07, 0x01, 0x19, 0x07} },
-  {72, {0x55, 0xAB, 0x86, 0x01, 0x01, 0x08} },
+  {72, {0x55, 0xAB, 0x86, 0x01, 0x01, 0x08}, KeywordCheck::BadChecksum },
   {74, {0x55, 0xCD, 0x83, 0x01, 0x98, 0x3E} },
-  {76, {0x55, 0x4A, 0x83, 0x01, 0x19, 0xBC} },
+  {76, {0x55, 0x4A, 0x83, 0x01, 0x19, 0xBC}, KeywordCheck::BadChecksum },
   {77, {0x55, 0x10, 0x07, 0x01, 0x19, 0x86} },
   {79, {0x55, 0xD6, 0x83, 0x01, 0x15, 0xC4} },
-  {80, {0x55, 0x13, 0x07, 0x01, 0x80, 0x70} },
+  {80, {0x55, 0x13, 0x07, 0x01, 0x80, 0x70}, KeywordCheck::BadChecksum },
   {81, {0x55, 0xEF, 0x8F} },
   {83, {0x55, 0x4C, 0x83, 0x04, 0x13, 0x3B} },
   {84, {0x55, 0xD6, 0x83, 0x01, 0x15, 0xC4} },
@@ -64,70 +101,212 @@ const std::unordered_map<int,std::vector<uint8_t>> TesterSim::s_isoBytes =
   {89, {0x55, 0x4C, 0x83, 0x04, 0x13, 0x3B} },
   {90, {0x55, 0x00, 0x81} },
   {91, {0x55, 0x58, 0x83, 0x01, 0x15, 0x46} },
-  {92, {0x55, 0x58, 0x83, 0x01, 0x98, 0x49} },
+  {92, {0x55, 0x58, 0x83, 0x01, 0x98, 0x49}, KeywordCheck::BadChecksum },
   {93, {0x55, 0x4F, 0x83, 0x01, 0x15, 0x3D} },
   {95, {0x55, 0xD0, 0x83, 0x01, 0x94, 0x3D} },
-  {96, {0x55, 0x54, 0x83, 0x01, 0x15, 0xC2} },
-  {97, {0x55, 0x58, 0x83, 0x02, 0x16, 0xC8} },
+  {96, {0x55, 0x54, 0x83, 0x01, 0x15, 0xC2}, KeywordCheck::BadChecksum },
+  {97, {0x55, 0x58, 0x83, 0x02, 0x16, 0xC8}, KeywordCheck::BadChecksum },
   {98, {0x55, 0xEF, 0x8F} },
   {100, {0x55, 0x00, 0x81} },
-  {102, {0x55, 0x4F, 0x83, 0x01, 0x98, 0x40} },
+  {102, {0x55, 0x4F, 0x83, 0x01, 0x98, 0x40}, KeywordCheck::BadChecksum },
   {103, {0x55, 0x8F, 0x07, 0x01, 0x15, 0x01} },
-  {105, {0x55, 0x15, 0x07, 0x01, 0x16, 0x08} },
-  {106, {0x55, 0x4A, 0x83, 0x02, 0x16, 0xB4} },
+  {105, {0x55, 0x15, 0x07, 0x01, 0x16, 0x08}, KeywordCheck::BadChecksum },
+  {106, {0x55, 0x4A, 0x83, 0x02, 0x16, 0xB4}, KeywordCheck::BadChecksum },
   {107, {0x55, 0xD6, 0x83, 0x01, 0x15, 0xC4} },
-  {108, {0x55, 0x49, 0x83, 0x01, 0x92, 0x34} },
-  {109, {0x55, 0x92, 0x07, 0x02, 0x16, 0x86} },
-  {110, {0x55, 0x4A, 0x83, 0x86, 0x92, 0xBA} },
+  {108, {0x55, 0x49, 0x83, 0x01, 0x92, 0x34}, KeywordCheck::BadChecksum },
+  {109, {0x55, 0x92, 0x07, 0x02, 0x16, 0x86}, KeywordCheck::BadChecksum },
+  {110, {0x55, 0x4A, 0x83, 0x86, 0x92, 0xBA}, KeywordCheck::BadChecksum },
   {111, {0x55, 0xD3, 0x83, 0x01, 0x15, 0xC1} },
-  {113, {0x55, 0x58, 0x83, 0x02, 0x98, 0x4A} },
-  {114, {0x55, 0x91, 0x07, 0xD8, 0xEE, 0x00} },
+  {113, {0x55, 0x58, 0x83, 0x02, 0x98, 0x4A}, KeywordCheck::BadChecksum },
+  {114, {0x55, 0x91, 0x07, 0xD8, 0xEE, 0x00}, KeywordCheck::BadChecksum },
   {115, {0x55, 0xD3, 0x83, 0x01, 0x15, 0xC1} },
   {116, {0x55, 0x4A, 0x83, 0x02, 0x98, 0xBC} },
   {117, {0x55, 0x4A, 0x83, 0x83, 0x98, 0x3D} },
-  {118, {0x55, 0x54, 0x83, 0x01, 0x15, 0xC2} },
+  {118, {0x55, 0x54, 0x83, 0x01, 0x15, 0xC2}, KeywordCheck::BadChecksum },
   {119, {0x55, 0x4C, 0x83, 0x04, 0x13, 0x3B} },
   {120, {0x55, 0x0E, 0x07, 0x01, 0x15, 0x80} },
-  {121, {0x55, 0x46, 0x83, 0x02, 0x92, 0x32} },
-  {130, {0x55, 0xAB, 0x86, 0x83, 0x01, 0x8A} },
+  {121, {0x55, 0x46, 0x83, 0x02, 0x92, 0x32}, KeywordCheck::BadChecksum },
+  {130, {0x55, 0xAB, 0x86, 0x83, 0x01, 0x8A}, KeywordCheck::BadChecksum },
   {131, {0x55, 0x7F, 0x86, 0x01, 0x97, 0xF2} },
-  {132, {0x55, 0x4A, 0x83, 0x01, 0x01, 0xA4} },
+  {132, {0x55, 0x4A, 0x83, 0x01, 0x01, 0xA4}, KeywordCheck::BadChecksum },
   {133, {0x55, 0xEF, 0x8F} },
-  {134, {0x55, 0x13, 0x07, 0x01, 0x80, 0x70} },
-  {135, {0x55, 0x92, 0x07, 0x01, 0x01, 0x70} },
+  {134, {0x55, 0x13, 0x07, 0x01, 0x80, 0x70}, KeywordCheck::BadChecksum },
+  {135, {0x55, 0x92, 0x07, 0x01, 0x01, 0x70}, KeywordCheck::BadChecksum },
   {136, {0x55, 0x10, 0x07, 0x01, 0x19, 0x86} },
-  {137, {0x55, 0xCE, 0x83, 0x89, 0x13, 0xC2} },
+  {137, {0x55, 0xCE, 0x83, 0x89, 0x13, 0xC2}, KeywordCheck::BadChecksum },
   {138, {0x55, 0x4F, 0x83, 0x01, 0x15, 0x3D} },
-  {139, {0x55, 0x97, 0x07, 0x01, 0x01, 0x75} },
-  {140, {0x55, 0x98, 0x07, 0x01, 0x01, 0x76} },
+  {139, {0x55, 0x97, 0x07, 0x01, 0x01, 0x75}, KeywordCheck::BadChecksum },
+  {140, {0x55, 0x98, 0x07, 0x01, 0x01, 0x76}, KeywordCheck::BadChecksum },
   {141, {0x55, 0xCD, 0x83, 0x01, 0x02, 0xA8} },
-  {142, {0x55, 0x10, 0x07, 0x01, 0x15, 0x02} },
-  {143, {0x55, 0x49, 0x83, 0x8A, 0x13, 0x3E} },
-  {144, {0x55, 0x49, 0x83, 0x83, 0x13, 0x37} },
+  {142, {0x55, 0x10, 0x07, 0x01, 0x15, 0x02}, KeywordCheck::BadChecksum },
+  {143, {0x55, 0x49, 0x83, 0x8A, 0x13, 0x3E}, KeywordCheck::BadChecksum },
+  {144, {0x55, 0x49, 0x83, 0x83, 0x13, 0x37}, KeywordCheck::BadChecksum },
   {145, {0x55, 0x00, 0x81} },
   {146, {0x55, 0x46, 0x83, 0x01, 0x96, 0xB5} },
-  {147, {0x55, 0x46, 0x83, 0x04, 0x92, 0x34} },
+  {147, {0x55, 0x46, 0x83, 0x04, 0x92, 0x34}, KeywordCheck::BadChecksum },
   {151, {0x55, 0x52, 0x83, 0x01, 0x15, 0x40} },
-  {154, {0x55, 0xCD, 0x83, 0x08, 0x13, 0x40} },
-  {157, {0x55, 0xCE, 0x83, 0x89, 0x13, 0xC2} },
+  {154, {0x55, 0xCD, 0x83, 0x08, 0x13, 0x40}, KeywordCheck::BadChecksum },
+  {157, {0x55, 0xCE, 0x83, 0x89, 0x13, 0xC2}, KeywordCheck::BadChecksum },
   {158, {0x55, 0x52, 0x83, 0x01, 0x15, 0x40} },
-  {161, {0x55, 0x4A, 0x83, 0x04, 0x13, 0xB9} },
+  {161, {0x55, 0x4A, 0x83, 0x04, 0x13, 0xB9}, KeywordCheck::BadChecksum },
   {162, {0x55, 0x46, 0x83, 0x01, 0x13, 0x32} },
   {163, {0x55, 0x46, 0x83, 0x01, 0x89, 0xA8} },
-  {164, {0x55, 0x46, 0x83, 0x02, 0x10, 0xB0} },
-  {168, {0x55, 0x13, 0x07, 0x01, 0x80, 0x70} },
+  {164, {0x55, 0x46, 0x83, 0x02, 0x10, 0xB0}, KeywordCheck::BadChecksum },
+  {168, {0x55, 0x13, 0x07, 0x01, 0x80, 0x70}, KeywordCheck::BadChecksum },
   {188, {0x55, 0xCD, 0x83, 0x04, 0x83, 0x2C} },
   {191, {0x55, 0x92, 0x07, 0x02, 0x83, 0x73} },
   {215, {0x55, 0xCD, 0x83, 0x01, 0x98, 0x3E} },
   {227, {0x55, 0xCD, 0x83, 0x02, 0x04, 0xAB} },
-  {228, {0x55, 0x13, 0x07, 0x01, 0x80, 0x70} },
+  {228, {0x55, 0x13, 0x07, 0x01, 0x80, 0x70}, KeywordCheck::BadChecksum },
   {231, {0x55, 0xD0, 0x83, 0x02, 0x04, 0xAE} },
-  {232, {0x55, 0xD0, 0x83, 0x14, 0xAD} }
+  {232, {0x55, 0xD0, 0x83, 0x14, 0xAD}, KeywordCheck::Malformed }
 };
 
-const std::unordered_map<int, std::vector<uint8_t>> TesterSim::s_moduleExtraInitInfo =
+constexpr ExtraInitInfoEntry s_moduleExtraInitInfo[] =
 {
   {96, { 0x0D, 0x01, 0xF6, 0x32, 0x35, 0x33, 0x30, 0x30, 0x32, 0x31, 0x36, 0x32, 0x30, 0x03,
          0x0D, 0x03, 0xF6, 0x37, 0x33, 0x35, 0x36, 0x35, 0x33, 0x37, 0x36, 0x32, 0x31, 0x03 } }
 };
 
+constexpr bool keywordEntryValid(const KeywordEntry& entry)
+{
+  const ByteSpan<MAX_ISO_KEYWORD_LEN>& seq = entry.bytes;
+  if (seq.len > MAX_ISO_KEYWORD_LEN)
+  {
+    return false;
+  }
+
+  bool checksumOK = false;
+  if (seq.len == MAX_ISO_KEYWORD_LEN)
+  {
+    uint8_t sum = 0;
+    for (int i = 0; i < seq.len - 1; i++)
+    {
+      sum += seq.bytes[i];
+    }
+    checksumOK = (sum == seq.bytes[seq.len - 1]);
+  }
+
+  switch (entry.check)
+  {
+  case KeywordCheck::Normal:
+    return (seq.len > 0) && ((seq.len <= 3) || checksumOK);
+  case KeywordCheck::BadChecksum:
+    return (seq.len == MAX_ISO_KEYWORD_LEN) && !checksumOK;
+  case KeywordCheck::Malformed:
+    return (seq.len > 3) && (seq.len < MAX_ISO_KEYWORD_LEN);
+  }
+  return false;
+}
+
+constexpr bool keywordTableValid()
+{
+  for (const KeywordEntry& entry : s_isoBytes)
+  {
+    if (!keywordEntryValid(entry))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+constexpr bool extraInitInfoTableValid()
+{
+  for (const ExtraInitInfoEntry& entry : s_moduleExtraInitInfo)
+  {
+    if ((entry.bytes.len == 0) || (entry.bytes.len > MAX_EXTRA_INIT_INFO_LEN))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+constexpr int maxTableEcuId()
+{
+  int maxId = 0;
+  for (const ProtocolEntry& entry : s_protocols)
+  {
+    maxId = (entry.ecuId > maxId) ? entry.ecuId : maxId;
+  }
+  for (const KeywordEntry& entry : s_isoBytes)
+  {
+    maxId = (entry.ecuId > maxId) ? entry.ecuId : maxId;
+  }
+  for (const ExtraInitInfoEntry& entry : s_moduleExtraInitInfo)
+  {
+    maxId = (entry.ecuId > maxId) ? entry.ecuId : maxId;
+  }
+  return maxId;
+}
+
+constexpr int MODULE_TABLE_SIZE = maxTableEcuId() + 1;
+
+/**
+ * Merges the three lists above into a single table indexed directly by ECU ID.
+ */
+constexpr std::array<ModuleInfo,MODULE_TABLE_SIZE> buildModuleTable()
+{
+  std::array<ModuleInfo,MODULE_TABLE_SIZE> table {};
+  for (const ProtocolEntry& entry : s_protocols)
+  {
+    table[entry.ecuId].protocolKnown = true;
+    table[entry.ecuId].protocol = entry.protocol;
+  }
+  for (const KeywordEntry& entry : s_isoBytes)
+  {
+    table[entry.ecuId].isoBytes = entry.bytes;
+  }
+  for (const ExtraInitInfoEntry& entry : s_moduleExtraInitInfo)
+  {
+    table[entry.ecuId].extraInitInfo = entry.bytes;
+  }
+  return table;
+}
+
+/**
+ * Returns true if no ECU ID appears more than once in any one of the lists.
+ */
+template <typename Entry, size_t N>
+constexpr bool uniqueIds(const Entry (&entries)[N])
+{
+  for (size_t i = 0; i < N; i++)
+  {
+    for (size_t j = i + 1; j < N; j++)
+    {
+      if (entries[i].ecuId == entries[j].ecuId)
+      {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+static_assert(keywordTableValid(), "ISO keyword sequence is malformed, has a bad checksum, or is flagged incorrectly");
+static_assert(extraInitInfoTableValid(), "extra init info is empty or too long");
+static_assert(uniqueIds(s_protocols) && uniqueIds(s_isoBytes) && uniqueIds(s_moduleExtraInitInfo), "duplicate ECU ID in module table");
+
+constexpr std::array<ModuleInfo,MODULE_TABLE_SIZE> s_moduleTable = buildModuleTable();
+
+}
+
+/**
+ * Returns the hand-maintained information for the given ECU ID, or null if
+ * there is none.
+ */
+const ModuleInfo* TesterSim::moduleInfo(int ecuId)
+{
+  if ((ecuId < 0) || (ecuId >= MODULE_TABLE_SIZE))
+  {
+    return nullptr;
+  }
+
+  const ModuleInfo& info = s_moduleTable[ecuId];
+  if (!info.protocolKnown && info.isoBytes.empty() && info.extraInitInfo.empty())
+  {
+    return nullptr;
+  }
+  return &info;
+}
@@ -0,0 +1,284 @@
+#include "VirtualFilesystem.h"
+#include <QCryptographicHash>
+#include <QMap>
+
+/**
+ * Replaces the contents of each file in the map with a shared copy from the
+ * content store, so that files that are identical to one already mounted
+ * don't take up any additional memory. Files from the upper layer are not
+ * added to the store, since they may be overwritten.
+ */
+void VirtualFilesystem::intern(FileContentsMap& files, bool addToStore)
+{
+  for (auto dir = files.begin(); dir != files.end(); ++dir)
+  {
+    for (auto file = dir.value().begin(); file != dir.value().end(); ++file)
+    {
+      const QVector<quint8>& content = file.value();
+      const QByteArray digest = QCryptographicHash::hash(
+        QByteArray::fromRawData(reinterpret_cast<const char*>(content.constData()), content.size()),
+        QCryptographicHash::Sha1);
+
+      auto stored = m_contentStore.constFind(digest);
+      if (stored == m_contentStore.constEnd())
+      {
+        if (addToStore)
+        {
+          m_contentStore.insert(digest, content);
+        }
+      }
+      else
+      {
+        file.value() = stored.value();
+      }
+    }
+  }
+}
+
+/**
+ * Adds an image as a new read-only lower layer, above any that are already
+ * mounted. The layer is initially active. Returns the index of the new layer,
+ * or -1 if no more layers can be mounted.
+ */
+int VirtualFilesystem::mount(const QString& name, const FileContentsMap& files)
+{
+  if (m_lowers.size() >= MAX_LOWER_LAYERS)
+  {
+    return -1;
+  }
+
+  Layer layer;
+  layer.name = name;
+  layer.files = files;
+  intern(layer.files, true);
+  m_lowers.append(layer);
+
+  const int index = m_lowers.size() - 1;
+  m_activeMask |= (1u << index);
+  return index;
+}
+
+/**
+ * Replaces the contents of the writable upper layer.
+ */
+void VirtualFilesystem::setUpper(const FileContentsMap& files)
+{
+  m_upper = files;
+  intern(m_upper, false);
+}
+
+void VirtualFilesystem::setLayerActive(int layer, bool active)
+{
+  if ((layer >= 0) && (layer < m_lowers.size()))
+  {
+    if (active)
+    {
+      m_activeMask |= (1u << layer);
+    }
+    else
+    {
+      m_activeMask &= ~(1u << layer);
+    }
+  }
+}
+
+/**
+ * Returns the contents of the named file from the topmost layer in which it
+ * is visible, or null if it doesn't exist in any visible layer.
+ */
+const QVector<quint8>* VirtualFilesystem::find(const QString& dir, const QString& file) const
+{
+  if (m_host && m_host->contains(dir, file))
+  {
+    return m_host->open(dir, file);
+  }
+
+  auto upperDir = m_upper.constFind(dir);
+  if (upperDir != m_upper.constEnd())
+  {
+    auto upperFile = upperDir.value().constFind(file);
+    if (upperFile != upperDir.value().constEnd())
+    {
+      return &upperFile.value();
+    }
+  }
+
+  for (int i = m_lowers.size() - 1; i >= 0; i--)
+  {
+    if (m_activeMask & (1u << i))
+    {
+      auto lowerDir = m_lowers[i].files.constFind(dir);
+      if (lowerDir != m_lowers[i].files.constEnd())
+      {
+        auto lowerFile = lowerDir.value().constFind(file);
+        if (lowerFile != lowerDir.value().constEnd())
+        {
+          return &lowerFile.value();
+        }
+      }
+    }
+  }
+
+  return nullptr;
+}
+
+/**
+ * Creates (or truncates) the named file in the upper layer (or in the host
+ * mirror, if there is one) and returns it for writing. A file of the same
+ * name in a lower layer is hidden by it.
+ */
+QVector<quint8>* VirtualFilesystem::create(const QString& dir, const QString& file)
+{
+  if (m_host)
+  {
+    return m_host->create(dir, file);
+  }
+
+  QVector<quint8>* contents = &m_upper[dir][file];
+  contents->clear();
+  return contents;
+}
+
+/**
+ * Returns a file in the upper layer for further writing, without truncating
+ * it, or null if it isn't there. Used to resume writing a file when restoring
+ * a checkpoint. Files in the host mirror can't be reopened this way.
+ */
+QVector<quint8>* VirtualFilesystem::reopen(const QString& dir, const QString& file)
+{
+  if (m_host)
+  {
+    return nullptr;
+  }
+
+  auto upperDir = m_upper.find(dir);
+  if (upperDir == m_upper.end())
+  {
+    return nullptr;
+  }
+  auto upperFile = upperDir.value().find(file);
+  return (upperFile != upperDir.value().end()) ? &upperFile.value() : nullptr;
+}
+
+/**
+ * Called when WSDC32 closes a file. Files in the host mirror are written back
+ * (if they were written) and released from memory. Returns false if a file
+ * could not be written back to the host.
+ */
+bool VirtualFilesystem::close(const QString& dir, const QString& file)
+{
+  return m_host ? m_host->close(dir, file) : true;
+}
+
+/**
+ * Returns the merged listing of a directory across the upper layer and all
+ * active lower layers, sorted by filename.
+ */
+QVector<VirtualFilesystem::DirEntry> VirtualFilesystem::list(const QString& dir) const
+{
+  QMap<QString,uint32_t> merged;
+  if (m_host)
+  {
+    m_host->list(dir, merged);
+  }
+
+  auto upperDir = m_upper.constFind(dir);
+  if (upperDir != m_upper.constEnd())
+  {
+    for (auto file = upperDir.value().constBegin(); file != upperDir.value().constEnd(); ++file)
+    {
+      if (!merged.contains(file.key()))
+      {
+        merged.insert(file.key(), file.value().size());
+      }
+    }
+  }
+
+  for (int i = m_lowers.size() - 1; i >= 0; i--)
+  {
+    if (m_activeMask & (1u << i))
+    {
+      auto lowerDir = m_lowers[i].files.constFind(dir);
+      if (lowerDir != m_lowers[i].files.constEnd())
+      {
+        for (auto file = lowerDir.value().constBegin(); file != lowerDir.value().constEnd(); ++file)
+        {
+          if (!merged.contains(file.key()))
+          {
+            merged.insert(file.key(), file.value().size());
+          }
+        }
+      }
+    }
+  }
+
+  QVector<DirEntry> entries;
+  entries.reserve(merged.size());
+  for (auto it = merged.constBegin(); it != merged.constEnd(); ++it)
+  {
+    entries.append({ it.key(), it.value() });
+  }
+  return entries;
+}
+
+/**
+ * Copies the layers that are currently visible, bottom first, for flattening.
+ * Lower layers are never changed in place, so they are shared. The upper
+ * layer's maps are rebuilt rather than shared, because the file open for
+ * writing is appended to through a pointer into them; the files' contents
+ * are still shared. Files in the host mirror that aren't loaded are listed
+ * rather than read.
+ */
+VirtualFilesystem::Contents VirtualFilesystem::contents() const
+{
+  Contents contents;
+  for (int i = 0; i < m_lowers.size(); i++)
+  {
+    if (m_activeMask & (1u << i))
+    {
+      contents.layers.append(m_lowers[i].files);
+    }
+  }
+
+  FileContentsMap upper;
+  for (auto dir = m_upper.constBegin(); dir != m_upper.constEnd(); ++dir)
+  {
+    QMap<QString,QVector<quint8>>& upperDir = upper[dir.key()];
+    for (auto file = dir.value().constBegin(); file != dir.value().constEnd(); ++file)
+    {
+      upperDir.insert(file.key(), file.value());
+    }
+  }
+  contents.layers.append(upper);
+
+  if (m_host)
+  {
+    FileContentsMap host;
+    m_host->exportTo(host, &contents.hostFiles);
+    contents.layers.append(host);
+  }
+  return contents;
+}
+
+/**
+ * Returns a single map containing everything that is visible in the copied
+ * layers, as it would be seen by WSDC32. This is what gets written when
+ * saving state.
+ */
+FileContentsMap VirtualFilesystem::Contents::flatten() const
+{
+  FileContentsMap result;
+  for (const FileContentsMap& layer : layers)
+  {
+    for (auto dir = layer.constBegin(); dir != layer.constEnd(); ++dir)
+    {
+      for (auto file = dir.value().constBegin(); file != dir.value().constEnd(); ++file)
+      {
+        result[dir.key()][file.key()] = file.value();
+      }
+    }
+  }
+  HostMirror::readPending(result, hostFiles);
+  return result;
+}
+
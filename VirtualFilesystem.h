@@ -0,0 +1,83 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <QByteArray>
+#include <QHash>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include "EcuDatabase.h"
+#include "HostMirror.h"
+
+/**
+ * The Tester's filesystem as seen by WSDC32. It is made up of a single
+ * writable upper layer (which receives all file writes) on top of any number
+ * of read-only lower layers, each of which is typically a saved image for one
+ * car model. Lower layers can be switched in and out of view individually,
+ * which only changes a bitmask, so changing models doesn't require any files
+ * to be reloaded or re-transferred.
+ *
+ * File contents that are identical across layers are stored only once (the
+ * QVectors share the same implicitly-shared buffer).
+ *
+ * A directory on the host may also be mirrored on top of everything else;
+ * when it is, it takes the place of the upper layer for writes.
+ */
+class VirtualFilesystem
+{
+public:
+  static constexpr int MAX_LOWER_LAYERS = 32;
+
+  struct DirEntry
+  {
+    QString name;
+    uint32_t size;
+  };
+
+  // The files that make up the filesystem, copied (without copying their
+  // contents) so that they can be flattened without holding up the thread
+  // that uses the filesystem
+  struct Contents
+  {
+    QVector<FileContentsMap> layers;
+    QVector<HostMirror::PendingFile> hostFiles;
+
+    FileContentsMap flatten() const;
+  };
+
+  int mount(const QString& name, const FileContentsMap& files);
+  void setUpper(const FileContentsMap& files);
+  const FileContentsMap& upper() const { return m_upper; }
+
+  void setLayerActive(int layer, bool active);
+  uint32_t activeMask() const { return m_activeMask; }
+  int layerCount() const { return m_lowers.size(); }
+  QString layerName(int layer) const { return m_lowers[layer].name; }
+
+  void setHostMirror(std::shared_ptr<HostMirror> mirror) { m_host = mirror; }
+  int pollHostChanges() { return m_host ? m_host->pollChanges() : 0; }
+
+  const QVector<quint8>* find(const QString& dir, const QString& file) const;
+  QVector<quint8>* create(const QString& dir, const QString& file);
+  QVector<quint8>* reopen(const QString& dir, const QString& file);
+  bool close(const QString& dir, const QString& file);
+  QVector<DirEntry> list(const QString& dir) const;
+  Contents contents() const;
+  FileContentsMap flatten() const { return contents().flatten(); }
+
+private:
+  struct Layer
+  {
+    QString name;
+    FileContentsMap files;
+  };
+
+  std::shared_ptr<HostMirror> m_host;
+  FileContentsMap m_upper;
+  QVector<Layer> m_lowers;
+  uint32_t m_activeMask = 0;
+  QHash<QByteArray,QVector<quint8>> m_contentStore;
+
+  void intern(FileContentsMap& files, bool addToStore);
+};
+
@@ -0,0 +1,218 @@
+#include "sd2sim.h"
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <QByteArray>
+#include <QString>
+#include "TesterSim.h"
+
+static_assert(SD2SIM_MAX_REPLY == ReplyFrame::CAPACITY, "SD2SIM_MAX_REPLY must match the reply buffer");
+
+struct sd2sim
+{
+  TesterSim tester;
+  sd2sim_log_fn logFn = nullptr;
+  void* logUser = nullptr;
+  sd2sim_frame_fn frameFn = nullptr;
+  void* frameUser = nullptr;
+  bool realtime = false;
+
+  // Reused from one request to the next, to avoid allocating per frame
+  std::vector<uint8_t> reply;
+  std::vector<TesterSim::UnsolicitedFrame> unsolicited;
+};
+
+namespace
+{
+/**
+ * Passes everything the simulator has logged since the last call to the log
+ * callback (or discards it, if there isn't one).
+ */
+void flushLog(sd2sim* sim)
+{
+  const LogBuffer::Batch batch = sim->tester.takeLog();
+  if (sim->logFn)
+  {
+    for (const LogBuffer::Entry& entry : batch.entries)
+    {
+      sim->logFn(sim->logUser, entry.text.toUtf8().constData());
+    }
+  }
+}
+
+int status(sd2sim* sim, bool ok, int error)
+{
+  flushLog(sim);
+  return ok ? SD2SIM_OK : error;
+}
+}
+
+int sd2sim_api_version(void)
+{
+  return SD2SIM_API_VERSION;
+}
+
+sd2sim* sd2sim_create(const char* identity_path)
+{
+  sd2sim* sim = new sd2sim;
+  sim->tester.loadIdentity(identity_path ? QString::fromLocal8Bit(identity_path) : TesterIdentity::defaultPath());
+  flushLog(sim);
+  return sim;
+}
+
+void sd2sim_destroy(sd2sim* sim)
+{
+  delete sim;
+}
+
+void sd2sim_set_log_callback(sd2sim* sim, sd2sim_log_fn fn, void* user)
+{
+  if (sim)
+  {
+    sim->logFn = fn;
+    sim->logUser = user;
+  }
+}
+
+void sd2sim_set_frame_callback(sd2sim* sim, sd2sim_frame_fn fn, void* user)
+{
+  if (sim)
+  {
+    sim->frameFn = fn;
+    sim->frameUser = user;
+  }
+}
+
+void sd2sim_set_realtime(sd2sim* sim, int enabled)
+{
+  if (sim)
+  {
+    sim->realtime = (enabled != 0);
+  }
+}
+
+int sd2sim_transact(sd2sim* sim, const uint8_t* request, size_t request_len,
+                    uint8_t* reply, size_t reply_capacity, size_t* reply_len, uint32_t* delay_ms)
+{
+  if (!sim || !request || !reply_len || (!reply && (reply_capacity > 0)))
+  {
+    return SD2SIM_ERR_ARG;
+  }
+
+  // Checked before the request is processed, since processing it changes
+  // the session's state and the reply couldn't be asked for again
+  if (reply_capacity < SD2SIM_MAX_REPLY)
+  {
+    *reply_len = SD2SIM_MAX_REPLY;
+    return status(sim, false, SD2SIM_ERR_SPACE);
+  }
+
+  uint32_t delayMs = 0;
+  if (!sim->tester.transact(request, static_cast<int>(std::min<size_t>(request_len, MAX_REQUEST_SIZE + 1)),
+                            sim->reply, delayMs, sim->unsolicited))
+  {
+    return status(sim, false, SD2SIM_ERR_FRAME);
+  }
+
+  if (sim->realtime)
+  {
+    std::this_thread::sleep_for(std::chrono::milliseconds(delayMs));
+  }
+  if (delay_ms)
+  {
+    *delay_ms = delayMs;
+  }
+  if (sim->frameFn)
+  {
+    for (const TesterSim::UnsolicitedFrame& frame : sim->unsolicited)
+    {
+      sim->frameFn(sim->frameUser, frame.frame.data(), frame.frame.size(), frame.delayMs, frame.periodMs);
+    }
+  }
+
+  *reply_len = sim->reply.size();
+  std::copy(sim->reply.begin(), sim->reply.end(), reply);
+  return status(sim, true, SD2SIM_OK);
+}
+
+int sd2sim_set_ram(sd2sim* sim, uint16_t start, const uint8_t* bytes, size_t len)
+{
+  if (!sim || (!bytes && (len > 0)) || (start > MemoryImage::SIZE) ||
+      (len > static_cast<size_t>(MemoryImage::SIZE - start)))
+  {
+    return SD2SIM_ERR_ARG;
+  }
+
+  std::shared_ptr<MemoryImage> image = std::make_shared<MemoryImage>();
+  for (size_t i = 0; i < len; i++)
+  {
+    image->set(start + i, bytes[i]);
+  }
+  sim->tester.writeRAM(image);
+  return status(sim, true, SD2SIM_OK);
+}
+
+int sd2sim_set_values(sd2sim* sim, const uint8_t* ids, const uint32_t* values, size_t count)
+{
+  if (!sim || ((!ids || !values) && (count > 0)))
+  {
+    return SD2SIM_ERR_ARG;
+  }
+
+  for (size_t i = 0; i < count; i++)
+  {
+    sim->tester.setValue(ids[i], values[i]);
+  }
+  return status(sim, true, SD2SIM_OK);
+}
+
+int sd2sim_set_snapshot(sd2sim* sim, int index, const uint8_t* bytes, size_t len)
+{
+  if (!sim || (!bytes && (len > 0)))
+  {
+    return SD2SIM_ERR_ARG;
+  }
+
+  sim->tester.setSnapshotContent(index, std::vector<uint8_t>(bytes, bytes + len));
+  return status(sim, true, SD2SIM_OK);
+}
+
+int sd2sim_set_error_memory(sd2sim* sim, const uint8_t* bytes, size_t len)
+{
+  if (!sim || (!bytes && (len > 0)))
+  {
+    return SD2SIM_ERR_ARG;
+  }
+
+  sim->tester.setErrorMemoryContent(std::vector<uint8_t>(bytes, bytes + len));
+  return status(sim, true, SD2SIM_OK);
+}
+
+int sd2sim_load_image(sd2sim* sim, const char* path)
+{
+  if (!sim || !path)
+  {
+    return SD2SIM_ERR_ARG;
+  }
+  return status(sim, sim->tester.loadState(QString::fromLocal8Bit(path)), SD2SIM_ERR_IO);
+}
+
+int sd2sim_mount_image(sd2sim* sim, const char* path)
+{
+  if (!sim || !path)
+  {
+    return SD2SIM_ERR_ARG;
+  }
+  return status(sim, sim->tester.mountImage(QString::fromLocal8Bit(path)) >= 0, SD2SIM_ERR_IO);
+}
+
+int sd2sim_save_image(sd2sim* sim, const char* path)
+{
+  if (!sim || !path)
+  {
+    return SD2SIM_ERR_ARG;
+  }
+  return status(sim, sim->tester.saveState(QString::fromLocal8Bit(path)), SD2SIM_ERR_IO);
+}
@@ -0,0 +1,78 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * C interface to the SD2 Tester simulator, for driving it in-process from
+ * test harnesses (Python via ctypes/cffi, other C or C++ projects) without
+ * the GUI, a socket or a VM.
+ *
+ * A session is a complete simulated Tester. Requests are SD2 frames exactly
+ * as WSDC32 would send them, and are processed synchronously: the reply is
+ * returned from sd2sim_transact() rather than being sent after the Tester's
+ * response time. Sessions are independent, but each must only be used by one
+ * thread at a time.
+ *
+ * Functions that can fail return one of the SD2SIM_* status codes.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SD2SIM_API_VERSION 1
+
+/* Only the functions below are exported; the simulator's C++ symbols aren't */
+#define SD2SIM_EXPORT __attribute__((visibility("default")))
+
+#define SD2SIM_OK 0
+#define SD2SIM_ERR_ARG -1       /* null pointer or value out of range */
+#define SD2SIM_ERR_FRAME -2     /* request isn't a single well-formed frame */
+#define SD2SIM_ERR_SPACE -3     /* reply buffer too small; *reply_len is the size needed */
+#define SD2SIM_ERR_IO -4        /* file couldn't be read or written */
+
+/* The longest reply frame that the SD2 header's 16-bit length can describe */
+#define SD2SIM_MAX_REPLY 0x10000
+
+typedef struct sd2sim sd2sim;
+
+/* Called with each line that the simulator logs */
+typedef void (*sd2sim_log_fn)(void* user, const char* line);
+
+/* Called with each unsolicited frame that follows a reply, delay_ms after it
+ * (and every period_ms, if that is nonzero) */
+typedef void (*sd2sim_frame_fn)(void* user, const uint8_t* frame, size_t len, uint32_t delay_ms, uint32_t period_ms);
+
+SD2SIM_EXPORT int sd2sim_api_version(void);
+
+/* identity_path may be null, for the default Tester identity */
+SD2SIM_EXPORT sd2sim* sd2sim_create(const char* identity_path);
+SD2SIM_EXPORT void sd2sim_destroy(sd2sim* sim);
+
+SD2SIM_EXPORT void sd2sim_set_log_callback(sd2sim* sim, sd2sim_log_fn fn, void* user);
+SD2SIM_EXPORT void sd2sim_set_frame_callback(sd2sim* sim, sd2sim_frame_fn fn, void* user);
+
+/* When real time is enabled, sd2sim_transact() waits for the Tester's response
+ * time before returning. It is disabled by default. */
+SD2SIM_EXPORT void sd2sim_set_realtime(sd2sim* sim, int enabled);
+
+/* Processes one request frame. On success, *reply_len is the length of the
+ * reply frame (0 if there is no reply) and, if delay_ms isn't null, it is set
+ * to the Tester's response time for the reply. The reply buffer must hold at
+ * least SD2SIM_MAX_REPLY bytes; if it doesn't, the request isn't processed. */
+SD2SIM_EXPORT int sd2sim_transact(sd2sim* sim, const uint8_t* request, size_t request_len,
+                                  uint8_t* reply, size_t reply_capacity, size_t* reply_len, uint32_t* delay_ms);
+
+SD2SIM_EXPORT int sd2sim_set_ram(sd2sim* sim, uint16_t start, const uint8_t* bytes, size_t len);
+SD2SIM_EXPORT int sd2sim_set_values(sd2sim* sim, const uint8_t* ids, const uint32_t* values, size_t count);
+SD2SIM_EXPORT int sd2sim_set_snapshot(sd2sim* sim, int index, const uint8_t* bytes, size_t len);
+SD2SIM_EXPORT int sd2sim_set_error_memory(sd2sim* sim, const uint8_t* bytes, size_t len);
+
+/* Filesystem images (.sd2), as loaded, mounted and saved in the GUI */
+SD2SIM_EXPORT int sd2sim_load_image(sd2sim* sim, const char* path);
+SD2SIM_EXPORT int sd2sim_mount_image(sd2sim* sim, const char* path);
+SD2SIM_EXPORT int sd2sim_save_image(sd2sim* sim, const char* path);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,45 @@
+TEMPLATE = lib
+TARGET = sd2sim
+CONFIG += shared c++17 thread hide_symbols
+QT = core
+
+# The library is built from the simulator's core, without any of the GUI
+SIM = ..
+INCLUDEPATH += $$SIM
+
+SOURCES += \
+    sd2sim.cpp \
+    $$SIM/AccessEventRing.cpp \
+    $$SIM/AccessTracer.cpp \
+    $$SIM/Checkpoint.cpp \
+    $$SIM/EcuDatabase.cpp \
+    $$SIM/EcuModule.cpp \
+    $$SIM/FrameScheduler.cpp \
+    $$SIM/GapReport.cpp \
+    $$SIM/HostMirror.cpp \
+    $$SIM/ImageFile.cpp \
+    $$SIM/LearnedResponses.cpp \
+    $$SIM/LogBuffer.cpp \
+    $$SIM/M68kCpu.cpp \
+    $$SIM/MemoryImage.cpp \
+    $$SIM/ModuleRunner.cpp \
+    $$SIM/OutputQueue.cpp \
+    $$SIM/ReplyFrame.cpp \
+    $$SIM/SampleStream.cpp \
+    $$SIM/Scenario.cpp \
+    $$SIM/SpanTracer.cpp \
+    $$SIM/StateUpdateQueue.cpp \
+    $$SIM/TesterIdentity.cpp \
+    $$SIM/TesterSim.cpp \
+    $$SIM/TesterSimModuleInfo.cpp \
+    $$SIM/VirtualFilesystem.cpp \
+    $$SIM/utilities.cpp
+
+HEADERS += \
+    sd2sim.h \
+    $$SIM/TesterSim.h
+
+target.path = /usr/local/lib
+headers.files = sd2sim.h
+headers.path = /usr/local/include
+INSTALLS += target headers
@@ -1,18 +1,259 @@
 #include "simmain.h"
+#include "TesterSim.h"
+#include "EcuDatabase.h"
+#include "AccessTracer.h"
+#include "AllocCheck.h"
+#include "ImageFile.h"
 
+#include <stdio.h>
+#include <string.h>
 #include <QApplication>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QTextStream>
+
+/**
+ * Compiles the ECU database for a filesystem image without starting the GUI,
+ * optionally merging in metadata from WSDC32 .Install files. The result is
+ * written to the same cache file that the simulator reads when the image is
+ * loaded.
+ */
+static int compileEcuDatabase(int argc, char *argv[])
+{
+  if (argc < 3)
+  {
+    fprintf(stderr, "Usage: %s --compile-ecudb <image.sd2> [file.Install ...]\n", argv[0]);
+    return 1;
+  }
+
+  const QString imageFilename = QString::fromLocal8Bit(argv[2]);
+  FileContentsMap contents;
+  if (!TesterSim::readImage(imageFilename, contents))
+  {
+    fprintf(stderr, "Error: unable to read image %s\n", argv[2]);
+    return 1;
+  }
+
+  EcuDatabase db;
+  db.compile(contents);
+
+  for (int i = 3; i < argc; i++)
+  {
+    QFile installFile(QString::fromLocal8Bit(argv[i]));
+    if (!installFile.open(QIODevice::ReadOnly) ||
+        !db.addInstallFile(QFileInfo(installFile.fileName()).fileName(), installFile.readAll()))
+    {
+      fprintf(stderr, "Warning: unable to use install file %s\n", argv[i]);
+    }
+  }
+
+  const QString dbFilename = imageFilename + ".ecudb";
+  if (!db.save(dbFilename))
+  {
+    fprintf(stderr, "Error: unable to write %s\n", dbFilename.toLocal8Bit().constData());
+    return 1;
+  }
+
+  printf("Wrote %d module records to %s\n", db.size(), dbFilename.toLocal8Bit().constData());
+  return 0;
+}
+
+/**
+ * Prints the locations whose access counts differ between two saved memory
+ * access traces.
+ */
+static int diffTraces(int argc, char *argv[])
+{
+  if (argc < 4)
+  {
+    fprintf(stderr, "Usage: %s --diff-trace <a.csv> <b.csv>\n", argv[0]);
+    return 1;
+  }
+
+  QTextStream out(stdout);
+  if (!AccessTracer::diff(QString::fromLocal8Bit(argv[2]), QString::fromLocal8Bit(argv[3]), out))
+  {
+    fprintf(stderr, "Error: unable to read traces %s and %s\n", argv[2], argv[3]);
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * Feeds a scripted polling session to a simulator and reports the heap
+ * allocations made per command. Fails if any frame allocated after warming
+ * up (see AllocCheck.h).
+ */
+static int checkAllocations()
+{
+  QTextStream out(stdout);
+  return AllocCheck::run(out) ? 0 : 1;
+}
+
+/**
+ * Returns the image files named on the command line, starting at argument
+ * first. A directory stands for all of the .sd2 images in it.
+ */
+static QStringList imageArgs(int argc, char *argv[], int first)
+{
+  QStringList filenames;
+  for (int i = first; i < argc; i++)
+  {
+    const QString path = QString::fromLocal8Bit(argv[i]);
+    if (QFileInfo(path).isDir())
+    {
+      const QDir dir(path);
+      foreach (QString name, dir.entryList(QStringList { "*.sd2" }, QDir::Files, QDir::Name))
+      {
+        filenames.append(dir.filePath(name));
+      }
+    }
+    else
+    {
+      filenames.append(path);
+    }
+  }
+  return filenames;
+}
+
+/**
+ * Checks a library of filesystem images, in parallel, and lists each image
+ * that is corrupt along with the files in it that don't match their hashes.
+ */
+static int verifyImages(int argc, char *argv[])
+{
+  const QStringList filenames = imageArgs(argc, argv, 2);
+  if (filenames.isEmpty())
+  {
+    fprintf(stderr, "Usage: %s --verify <image.sd2|dir> ...\n", argv[0]);
+    return 1;
+  }
+
+  QElapsedTimer timer;
+  timer.start();
+  const std::vector<ImageFile::Result> results = ImageFile::readAll(filenames, false);
+  const qint64 elapsedNs = timer.nsecsElapsed();
+
+  QTextStream out(stdout);
+  qint64 totalSize = 0;
+  int corruptCount = 0;
+  int unhashedCount = 0;
+  for (const ImageFile::Result& result : results)
+  {
+    totalSize += result.size;
+    if (result.ok)
+    {
+      out << "ok      " << result.filename << ((result.version == 1) ? " (version 1, no hashes)" : "") << "\n";
+      unhashedCount += (result.version == 1) ? 1 : 0;
+    }
+    else
+    {
+      out << "CORRUPT " << result.filename << ": " << result.error << "\n";
+      foreach (QString file, result.corruptFiles)
+      {
+        out << "          " << file << "\n";
+      }
+      corruptCount++;
+    }
+  }
+
+  out << QString("%1 images (%2 corrupt, %3 without hashes), %4 MB in %5 ms (%6 MB/s)\n").
+    arg(results.size()).arg(corruptCount).arg(unhashedCount).
+    arg(QString::number(totalSize / 1e6, 'f', 1)).
+    arg(QString::number(elapsedNs / 1e6, 'f', 1)).
+    arg(QString::number((elapsedNs > 0) ? (totalSize * 1e3 / elapsedNs) : 0, 'f', 0));
+  return (corruptCount > 0) ? 1 : 0;
+}
+
+/**
+ * Rewrites version 1 filesystem images as version 2, so that they can be
+ * verified. Images that are already version 2, or that can't be read, are
+ * left alone.
+ */
+static int upgradeImages(int argc, char *argv[])
+{
+  const QStringList filenames = imageArgs(argc, argv, 2);
+  if (filenames.isEmpty())
+  {
+    fprintf(stderr, "Usage: %s --upgrade-images <image.sd2|dir> ...\n", argv[0]);
+    return 1;
+  }
+
+  // One image at a time, so that only one is ever held in memory
+  int status = 0;
+  for (const QString& filename : filenames)
+  {
+    const ImageFile::Result result = ImageFile::read(filename);
+    const QByteArray name = result.filename.toLocal8Bit();
+    if (!result.ok)
+    {
+      fprintf(stderr, "Error: %s can't be used (%s)\n", name.constData(), result.error.toLocal8Bit().constData());
+      status = 1;
+    }
+    else if (result.version == ImageFile::VERSION)
+    {
+      printf("%s is already version %d\n", name.constData(), ImageFile::VERSION);
+    }
+    else if (ImageFile::write(result.filename, result.contents))
+    {
+      printf("Upgraded %s\n", name.constData());
+    }
+    else
+    {
+      fprintf(stderr, "Error: unable to write %s\n", name.constData());
+      status = 1;
+    }
+  }
+  return status;
+}
 
 int main(int argc, char *argv[])
 {
+  if ((argc > 1) && (strcmp(argv[1], "--compile-ecudb") == 0))
+  {
+    return compileEcuDatabase(argc, argv);
+  }
+  if ((argc > 1) && (strcmp(argv[1], "--diff-trace") == 0))
+  {
+    return diffTraces(argc, argv);
+  }
+  if ((argc > 1) && (strcmp(argv[1], "--alloc-check") == 0))
+  {
+    return checkAllocations();
+  }
+  if ((argc > 1) && (strcmp(argv[1], "--verify") == 0))
+  {
+    return verifyImages(argc, argv);
+  }
+  if ((argc > 1) && (strcmp(argv[1], "--upgrade-images") == 0))
+  {
+    return upgradeImages(argc, argv);
+  }
+
   QApplication a(argc, argv);
   QString domainSockName;
+  QString identityFile;
+  QString controlSockName;
+  int arg = 1;
 
-  if (argc > 1)
+  if ((argc > arg + 1) && (strcmp(argv[arg], "--identity") == 0))
+  {
+    identityFile = QString::fromLocal8Bit(argv[arg + 1]);
+    arg += 2;
+  }
+  if ((argc > arg + 1) && (strcmp(argv[arg], "--control") == 0))
+  {
+    controlSockName = QString::fromLocal8Bit(argv[arg + 1]);
+    arg += 2;
+  }
+  if (argc > arg)
   {
-    domainSockName = argv[1];
+    domainSockName = argv[arg];
   }
 
-  SimMain w(domainSockName);
+  SimMain w(domainSockName, identityFile, controlSockName);
   w.show();
   return a.exec();
 }
@@ -8,15 +8,75 @@ CONFIG += c++17
 # In order to do so, uncomment the following line.
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 
+# Counts heap allocations, for --alloc-check (qmake CONFIG+=alloc_stats)
+alloc_stats: DEFINES += SD2SIM_ALLOC_STATS
+
+# Compiles out the timed spans that can be recorded for Perfetto (qmake CONFIG+=no_spans)
+no_spans: DEFINES += SD2SIM_NO_SPANS
+
 SOURCES += \
+    AccessEventRing.cpp \
+    AccessTracer.cpp \
+    AllocCheck.cpp \
+    Checkpoint.cpp \
+    ControlServer.cpp \
+    EcuDatabase.cpp \
+    EcuModule.cpp \
+    FrameScheduler.cpp \
+    GapReport.cpp \
+    HexMemoryModel.cpp \
+    HostMirror.cpp \
+    ImageFile.cpp \
+    LearnedResponses.cpp \
+    LogBuffer.cpp \
+    LogModel.cpp \
+    M68kCpu.cpp \
+    MemoryEditor.cpp \
+    MemoryImage.cpp \
+    ModuleRunner.cpp \
+    OutputQueue.cpp \
+    ReplyFrame.cpp \
+    SampleStream.cpp \
+    Scenario.cpp \
+    SpanTracer.cpp \
+    StateUpdateQueue.cpp \
+    TesterIdentity.cpp \
     TesterSim.cpp \
     TesterSimModuleInfo.cpp \
+    VirtualFilesystem.cpp \
     main.cpp \
     simmain.cpp \
     utilities.cpp
 
 HEADERS += \
+    AccessEventRing.h \
+    AccessTracer.h \
+    AllocCheck.h \
+    Checkpoint.h \
+    ControlServer.h \
+    EcuDatabase.h \
+    EcuModule.h \
+    FrameScheduler.h \
+    GapReport.h \
+    HexMemoryModel.h \
+    HostMirror.h \
+    ImageFile.h \
+    LearnedResponses.h \
+    LogBuffer.h \
+    LogModel.h \
+    M68kCpu.h \
+    MemoryEditor.h \
+    MemoryImage.h \
+    ModuleRunner.h \
+    OutputQueue.h \
+    ReplyFrame.h \
+    SampleStream.h \
+    Scenario.h \
+    SpanTracer.h \
+    StateUpdateQueue.h \
+    TesterIdentity.h \
     TesterSim.h \
+    VirtualFilesystem.h \
     simmain.h \
     utilities.h
 
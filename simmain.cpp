@@ -3,24 +3,68 @@
 #include <QString>
 #include <QFile>
 #include <QFileDialog>
+#include <QFileInfo>
+#include <QScrollBar>
 #include <vector>
 #include "ui_simmain.h"
+#include "SpanTracer.h"
 #include <iostream>
 
-SimMain::SimMain(const QString& domainSockName, QWidget* parent)
+namespace
+{
+constexpr int LOG_CAPACITY = 50000;
+constexpr int LOG_REFRESH_MS = 1000 / 30;
+}
+
+SimMain::SimMain(const QString& domainSockName, const QString& identityFile, const QString& controlSockName,
+                 QWidget* parent)
   : QMainWindow(parent)
   , ui(new Ui::SimMain)
+  , m_control(m_sim)
+  , m_logModel(LOG_CAPACITY)
 {
   ui->setupUi(this);
+  SpanTracer::setThreadName("GUI");
   ui->domainSocketLine->setText(domainSockName);
-  connect(&m_sim, &TesterSim::logMsg, this, &SimMain::onLogMsg);
-  connect(&m_sim, &TesterSim::lastLogMsgRepeated, this, &SimMain::onLastLogMsgRepeated);
-  connect(&m_sim, &TesterSim::consecutiveWriteToFileCmd, this, &SimMain::onConsecutiveWriteToFile);
+  m_logFilter.setSourceModel(&m_logModel);
+  m_logFilter.setFilterCaseSensitivity(Qt::CaseInsensitive);
+  ui->logView->setModel(&m_logFilter);
+  m_logTimer.setSingleShot(true);
+  m_logTimer.setInterval(LOG_REFRESH_MS);
+  connect(&m_logTimer, &QTimer::timeout, this, &SimMain::flushLog);
+  connect(&m_sim, &TesterSim::logReady, this, &SimMain::onLogReady);
+  connect(&m_sim, &TesterSim::snapshotChanged, this, [this](int snapshotIndex)
+  {
+    if (snapshotIndex == ui->snapshotNumberBox->value())
+    {
+      updateSnapshotDisplay(snapshotIndex);
+    }
+  });
+  ui->activeModelsButton->setMenu(&m_activeModelsMenu);
   updateSnapshotDisplay(0);
+
+  if (!m_sim.loadIdentity(identityFile.isEmpty() ? TesterIdentity::defaultPath() : identityFile) &&
+      !identityFile.isEmpty())
+  {
+    log(QString("Warning: Tester identity file %1 not found; using defaults").arg(identityFile));
+  }
+
+  if (!controlSockName.isEmpty())
+  {
+    if (m_control.start(controlSockName))
+    {
+      log(QString("Control API listening on %1").arg(controlSockName));
+    }
+    else
+    {
+      log(QString("Error: unable to open control socket %1").arg(controlSockName));
+    }
+  }
 }
 
 SimMain::~SimMain()
 {
+  m_control.stop();
   m_sim.stopListening();
   if (m_simthread.joinable())
   {
@@ -78,6 +122,18 @@ void SimMain::on_ramSetButton_clicked()
   }
 }
 
+void SimMain::on_memoryEditorButton_clicked()
+{
+  if (!m_memoryEditor)
+  {
+    m_memoryEditor = new MemoryEditor(m_sim, this);
+    connect(m_memoryEditor, &MemoryEditor::message, this, [this](const QString& line) { log(line); });
+  }
+  m_memoryEditor->show();
+  m_memoryEditor->raise();
+  m_memoryEditor->activateWindow();
+}
+
 void SimMain::on_valueSetButton_clicked()
 {
   bool idOk = false;
@@ -136,47 +192,319 @@ void SimMain::on_saveStateButton_clicked()
   }
 }
 
+void SimMain::on_saveCheckpointButton_clicked()
+{
+  QString filename = QFileDialog::getSaveFileName(
+    this, "Select filename to save simulator checkpoint", "", "SD2 Simulator Checkpoints (*.sd2c)");
+
+  if (!filename.isEmpty())
+  {
+    if (!filename.endsWith(".sd2c", Qt::CaseInsensitive))
+    {
+      filename += ".sd2c";
+    }
+    if (!m_sim.saveCheckpoint(filename))
+    {
+      log(QString("Failed to save checkpoint to '%1'").arg(filename));
+    }
+  }
+}
+
+void SimMain::on_restoreCheckpointButton_clicked()
+{
+  const QString filename = QFileDialog::getOpenFileName(
+    this, "Open simulator checkpoint", "", "SD2 Simulator Checkpoints (*.sd2c)");
+
+  if (!filename.isEmpty())
+  {
+    if (m_sim.restoreCheckpoint(filename))
+    {
+      updateSnapshotDisplay(ui->snapshotNumberBox->value());
+    }
+    else
+    {
+      log(QString("Failed to restore checkpoint from '%1'").arg(filename));
+    }
+  }
+}
+
+/**
+ * Mounts additional filesystem images as read-only layers, and adds an entry
+ * for each to the Models menu so that it can be shown or hidden. The images
+ * are read and checked in parallel.
+ */
+void SimMain::on_mountImageButton_clicked()
+{
+  const QStringList filenames = QFileDialog::getOpenFileNames(
+    this, "Mount SD2 Tester filesystem images (read-only)", "", "SD2 Filesystem Data (*.sd2)");
+
+  const std::vector<int> layers = m_sim.mountImages(filenames);
+  for (int i = 0; i < filenames.size(); i++)
+  {
+    const int layer = layers[i];
+    if (layer >= 0)
+    {
+      QAction* action = m_activeModelsMenu.addAction(QFileInfo(filenames[i]).completeBaseName());
+      action->setCheckable(true);
+      action->setChecked(true);
+      connect(action, &QAction::toggled, this, [this, layer](bool checked) { m_sim.setImageActive(layer, checked); });
+      ui->activeModelsButton->setEnabled(true);
+      log(QString("Mounted image '%1'").arg(filenames[i]));
+    }
+    else
+    {
+      log(QString("Failed to mount image '%1'").arg(filenames[i]));
+    }
+  }
+}
+
+void SimMain::on_mirrorHostDirButton_clicked()
+{
+  const QString dirname = QFileDialog::getExistingDirectory(
+    this, "Select host directory to mirror as the SD2 Tester filesystem");
+
+  if (!dirname.isEmpty())
+  {
+    if (m_sim.mirrorHostDirectory(dirname))
+    {
+      ui->mirrorHostDirButton->setEnabled(false);
+    }
+    else
+    {
+      log(QString("Failed to mirror host directory '%1'").arg(dirname));
+    }
+  }
+}
+
+void SimMain::on_streamDataLogButton_clicked()
+{
+  const QString filename = QFileDialog::getOpenFileName(
+    this, "Open recorded data log", "", "Data logs (*.csv *.sd2log);;All files (*)");
+
+  if (!filename.isEmpty() && !m_sim.streamDataLog(filename))
+  {
+    log(QString("Failed to open data log '%1'").arg(filename));
+  }
+}
+
+void SimMain::on_loadScenarioButton_clicked()
+{
+  const QString filename = QFileDialog::getOpenFileName(
+    this, "Open ECU scenario", "", "Scenarios (*.scn *.txt);;All files (*)");
+
+  if (!filename.isEmpty() && !m_sim.loadScenario(filename))
+  {
+    log(QString("Failed to load scenario '%1'").arg(filename));
+  }
+}
+
+void SimMain::on_learnCaptureButton_clicked()
+{
+  const QString filename = QFileDialog::getOpenFileName(
+    this, "Open capture of a Tester session", "", "Captures (*.txt *.log);;All files (*)");
+
+  if (!filename.isEmpty() && !m_sim.learnFromCapture(filename))
+  {
+    log(QString("Failed to read capture '%1'").arg(filename));
+  }
+}
+
+void SimMain::on_traceAccessesButton_toggled(bool checked)
+{
+  m_sim.setTracing(checked);
+}
+
+void SimMain::on_runModulesButton_toggled(bool checked)
+{
+  m_sim.setRunModules(checked);
+}
+
+void SimMain::on_saveTraceButton_clicked()
+{
+  const QString filename = QFileDialog::getSaveFileName(
+    this, "Save memory access trace", "", "Access trace reports (*.txt);;All files (*)");
+
+  if (!filename.isEmpty())
+  {
+    if (m_sim.saveTrace(filename))
+    {
+      log(QString("Saved access trace to '%1' (and CSV alongside it)").arg(filename));
+    }
+    else
+    {
+      log(QString("Failed to save access trace to '%1'").arg(filename));
+    }
+  }
+}
+
+void SimMain::on_saveGapReportButton_clicked()
+{
+  const QString filename = QFileDialog::getSaveFileName(
+    this, "Save gap report", "", "CSV files (*.csv);;All files (*)");
+
+  if (!filename.isEmpty())
+  {
+    if (m_sim.saveGapReport(filename))
+    {
+      log(QString("Saved gap report to '%1'").arg(filename));
+    }
+    else
+    {
+      log(QString("Failed to save gap report to '%1'").arg(filename));
+    }
+  }
+}
+
+/**
+ * Starts recording spans (see SpanTracer) afresh, or stops recording. What
+ * was recorded is kept until recording starts again, so it can be saved
+ * after stopping.
+ */
+void SimMain::on_recordSpansButton_toggled(bool checked)
+{
+  if (checked)
+  {
+    SpanTracer::clear();
+  }
+  SpanTracer::setEnabled(checked);
+}
+
+void SimMain::on_saveSpansButton_clicked()
+{
+  const QString filename = QFileDialog::getSaveFileName(
+    this, "Save spans", "", "Chrome trace files (*.json);;All files (*)");
+
+  if (!filename.isEmpty())
+  {
+    if (SpanTracer::save(filename))
+    {
+      log(QString("Saved spans to '%1' (open with ui.perfetto.dev)").arg(filename));
+    }
+    else
+    {
+      log(QString("Failed to save spans to '%1'").arg(filename));
+    }
+  }
+}
+
+/**
+ * Logs a message from the GUI itself, along with anything that the simulator
+ * has logged but that hasn't been collected yet (so that order is kept).
+ */
 void SimMain::log(const QString& line)
 {
+  LogBuffer::Batch batch = m_sim.takeLog();
   const auto duration = std::chrono::system_clock::now().time_since_epoch();
-  const double secs = std::chrono::duration_cast<std::chrono::milliseconds>(duration).count() / 1000.0;
-  const QString formattedLine = QString("[%1] %2").arg(secs, 0, 'f', 3).arg(line);
-  ui->logView->appendPlainText(formattedLine);
-  std::cout << formattedLine.toStdString() << std::endl;
+  batch.entries.append(LogBuffer::Entry { std::chrono::duration_cast<std::chrono::milliseconds>(duration).count(), line, 0 });
+  showLog(batch);
+}
+
+void SimMain::onLogReady()
+{
+  TRACE_SPAN("onLogReady");
+  if (!m_logTimer.isActive())
+  {
+    m_logTimer.start();
+  }
 }
 
-void SimMain::onLogMsg(const QString& line)
+void SimMain::flushLog()
 {
-  log(line);
+  TRACE_SPAN("flushLog");
+  showLog(m_sim.takeLog());
 }
 
-void SimMain::onLastLogMsgRepeated()
+/**
+ * Adds a batch of log output to the view and echoes it to stdout. The view
+ * follows the end of the log unless it has been scrolled back.
+ */
+void SimMain::showLog(const LogBuffer::Batch& batch)
 {
-  const int currentVal = ui->progressBar->value();
+  QScrollBar* scrollBar = ui->logView->verticalScrollBar();
+  const bool atEnd = (scrollBar->value() == scrollBar->maximum());
 
-  if (m_heartbeatBarIncreasing && (currentVal < ui->progressBar->maximum()))
+  m_logModel.append(batch);
+  for (const LogBuffer::Entry& entry : batch.entries)
   {
-    ui->progressBar->setValue(currentVal + 1);
+    std::cout << LogModel::format(entry).toStdString() << std::endl;
   }
-  else if (!m_heartbeatBarIncreasing && (currentVal > ui->progressBar->minimum()))
+  if (batch.repeats > 0)
   {
-    ui->progressBar->setValue(currentVal - 1);
+    stepHeartbeat(batch.repeats);
   }
 
-  if (ui->progressBar->value() == 0)
+  if (atEnd)
   {
-    m_heartbeatBarIncreasing = true;
+    ui->logView->scrollToBottom();
   }
-  else if (ui->progressBar->value() == ui->progressBar->maximum())
+}
+
+void SimMain::on_logFilterBox_textChanged(const QString& text)
+{
+  m_logFilter.setFilterFixedString(text);
+  ui->logView->scrollToBottom();
+}
+
+/**
+ * Selects the next line (after the current one, wrapping around) that
+ * contains the search text.
+ */
+void SimMain::on_logSearchBox_returnPressed()
+{
+  const QString text = ui->logSearchBox->text();
+  const int rows = m_logFilter.rowCount();
+  if (text.isEmpty() || (rows == 0))
+  {
+    return;
+  }
+
+  const QModelIndex current = ui->logView->currentIndex();
+  const int start = current.isValid() ? (current.row() + 1) : 0;
+  for (int i = 0; i < rows; i++)
   {
-    m_heartbeatBarIncreasing = false;
+    const QModelIndex index = m_logFilter.index((start + i) % rows, 0);
+    if (index.data().toString().contains(text, Qt::CaseInsensitive))
+    {
+      ui->logView->setCurrentIndex(index);
+      ui->logView->scrollTo(index);
+      return;
+    }
   }
 }
 
-void SimMain::onConsecutiveWriteToFile()
+/**
+ * Moves the heartbeat bar back and forth by the given number of steps, one
+ * for each repeated packet.
+ */
+void SimMain::stepHeartbeat(int steps)
 {
-  ui->logView->textCursor().movePosition(QTextCursor::End);
-  ui->logView->textCursor().insertText(".");
+  const int minimum = ui->progressBar->minimum();
+  const int maximum = ui->progressBar->maximum();
+  int val = ui->progressBar->value();
+
+  // Only the position within one back-and-forth cycle matters
+  const int cycle = 2 * (maximum - minimum);
+  for (int i = 0; i < ((cycle > 0) ? (steps % cycle) : 0); i++)
+  {
+    if (m_heartbeatBarIncreasing && (val < maximum))
+    {
+      val++;
+    }
+    else if (!m_heartbeatBarIncreasing && (val > minimum))
+    {
+      val--;
+    }
+
+    if (val == minimum)
+    {
+      m_heartbeatBarIncreasing = true;
+    }
+    else if (val == maximum)
+    {
+      m_heartbeatBarIncreasing = false;
+    }
+  }
+  ui->progressBar->setValue(val);
 }
 
 void SimMain::on_snapshotNumberBox_valueChanged(int snapshotIndex)
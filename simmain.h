@@ -2,8 +2,14 @@
 #define SIMMAIN_H
 
 #include <QMainWindow>
+#include <QMenu>
+#include <QSortFilterProxyModel>
 #include <QString>
+#include <QTimer>
 #include <thread>
+#include "ControlServer.h"
+#include "LogModel.h"
+#include "MemoryEditor.h"
 #include "TesterSim.h"
 
 QT_BEGIN_NAMESPACE
@@ -15,7 +21,8 @@ class SimMain : public QMainWindow
   Q_OBJECT
 
 public:
-  SimMain(const QString& domainSockName, QWidget* parent = nullptr);
+  SimMain(const QString& domainSockName, const QString& identityFile, const QString& controlSockName,
+          QWidget* parent = nullptr);
   ~SimMain();
 
 private slots:
@@ -23,14 +30,29 @@ private slots:
   void on_stopListeningButton_clicked();
   void on_loadStateButton_clicked();
   void on_saveStateButton_clicked();
-  void onLogMsg(const QString& line);
-  void onLastLogMsgRepeated();
-  void onConsecutiveWriteToFile();
+  void on_saveCheckpointButton_clicked();
+  void on_restoreCheckpointButton_clicked();
+  void on_mountImageButton_clicked();
+  void on_mirrorHostDirButton_clicked();
+  void on_streamDataLogButton_clicked();
+  void on_loadScenarioButton_clicked();
+  void on_learnCaptureButton_clicked();
+  void on_traceAccessesButton_toggled(bool checked);
+  void on_runModulesButton_toggled(bool checked);
+  void on_saveTraceButton_clicked();
+  void on_saveGapReportButton_clicked();
+  void on_recordSpansButton_toggled(bool checked);
+  void on_saveSpansButton_clicked();
+  void onLogReady();
+  void flushLog();
+  void on_logFilterBox_textChanged(const QString& text);
+  void on_logSearchBox_returnPressed();
   void on_snapshotNumberBox_valueChanged(int arg1);
   void on_snapshotSetButton_clicked();
   void on_snapshotAddButton_clicked();
   void on_snapshotRemoveButton_clicked();
   void on_ramSetButton_clicked();
+  void on_memoryEditorButton_clicked();
   void on_valueSetButton_clicked();
   void on_errorMemorySetButton_clicked();
 
@@ -38,9 +60,23 @@ private:
   Ui::SimMain *ui;
   TesterSim m_sim;
   std::thread m_simthread;
+  ControlServer m_control;
+  QMenu m_activeModelsMenu;
   bool m_heartbeatBarIncreasing = true;
+
+  // Log output is collected from the simulator at most once per refresh
+  // period, however quickly it arrives
+  LogModel m_logModel;
+  QSortFilterProxyModel m_logFilter;
+  QTimer m_logTimer;
+
+  // Created when first opened
+  MemoryEditor* m_memoryEditor = nullptr;
+
   static void listenOnSock(SimMain* sim);
   void log(const QString& line);
+  void showLog(const LogBuffer::Batch& batch);
+  void stepHeartbeat(int steps);
   void updateSnapshotDisplay(int snapshotIndex);
 };
 #endif // SIMMAIN_H
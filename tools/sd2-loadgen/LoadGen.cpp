@@ -0,0 +1,479 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <algorithm>
+#include <thread>
+#include "LoadGen.h"
+
+namespace
+{
+constexpr uint8_t HOST_PREFIX = 0x50;
+constexpr uint8_t TESTER_PREFIX = 0x54;
+constexpr int WRITE_CHUNK_SIZE = 110;
+constexpr uint8_t POLL_PIPE = 4;
+constexpr int REPLY_TIMEOUT_SECS = 5;
+
+const std::map<LoadOp,std::string> s_opNames =
+{
+  { LoadOp::TabletInfo, "tablet" },
+  { LoadOp::DirWalk, "dir" },
+  { LoadOp::Upload, "upload" },
+  { LoadOp::Readback, "readback" },
+  { LoadOp::SlowInit, "init" },
+  { LoadOp::Poll, "poll" }
+};
+}
+
+LoadSession::LoadSession(const LoadGenConfig& config, const std::string& path, int sessionNum) :
+  m_config(config),
+  m_path(path),
+  m_rng(sessionNum + 1)
+{
+  memset(m_reply, 0, sizeof(m_reply));
+  memset(m_checksumBuf, 0, sizeof(m_checksumBuf));
+
+  // Expand the weighted mix into a flat table so that choosing the next
+  // operation is a single uniform random index.
+  for (const auto& entry : m_config.mix)
+  {
+    for (int i = 0; i < entry.second; i++)
+    {
+      m_opTable.push_back(entry.first);
+    }
+  }
+}
+
+LoadSession::~LoadSession()
+{
+  if (m_fd >= 0)
+  {
+    close(m_fd);
+  }
+  if (m_listenFd >= 0)
+  {
+    close(m_listenFd);
+    unlink(m_path.c_str());
+  }
+}
+
+/**
+ * Creates the listening socket for this session and blocks until a simulator
+ * instance connects to it.
+ */
+bool LoadSession::waitForSimulator()
+{
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(struct sockaddr_un));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, m_path.c_str(), sizeof(addr.sun_path) - 1);
+
+  unlink(m_path.c_str());
+  m_listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if ((m_listenFd < 0) ||
+      (bind(m_listenFd, (const struct sockaddr*)&addr, sizeof(struct sockaddr_un)) != 0) ||
+      (::listen(m_listenFd, 1) != 0))
+  {
+    perror(m_path.c_str());
+    return false;
+  }
+
+  printf("Waiting for simulator to connect to '%s'...\n", m_path.c_str());
+  m_fd = accept(m_listenFd, nullptr, nullptr);
+  if (m_fd >= 0)
+  {
+    // Don't hang forever if the simulator stops replying mid-transaction
+    struct timeval timeout = { REPLY_TIMEOUT_SECS, 0 };
+    setsockopt(m_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  }
+  return (m_fd >= 0);
+}
+
+bool LoadSession::readFully(uint8_t* buf, int count)
+{
+  int pos = 0;
+  while (pos < count)
+  {
+    const int result = read(m_fd, buf + pos, count - pos);
+    if (result <= 0)
+    {
+      return false;
+    }
+    pos += result;
+  }
+  return true;
+}
+
+/**
+ * Returns the number of bytes in the last reply following the 3-byte
+ * prefix/length header.
+ */
+int LoadSession::replyPayloadLen() const
+{
+  return (m_reply[1] << 8) | m_reply[2];
+}
+
+/**
+ * Sends a single request frame and waits for the matching reply. The Tester
+ * builds its replies (and any unsolicited frames) from a copy of the request
+ * header, so each request carries a 16-bit sequence number at positions 03
+ * and 04, and the reply is the first frame from the Tester with the same
+ * sequence number, pipe and command byte. Anything else is counted as
+ * unsolicited and skipped; in particular, a periodic cmd 0x13 frame keeps
+ * the header of the request that started it, so it can't be mistaken for a
+ * later reply. The round-trip time is recorded as this frame's latency.
+ */
+bool LoadSession::exchange(uint8_t cmd, const uint8_t* payload, int payloadLen, uint8_t pipe)
+{
+  if (m_config.framesPerSec > 0)
+  {
+    std::this_thread::sleep_until(m_nextSend);
+    m_nextSend += std::chrono::microseconds(static_cast<int64_t>(1000000.0 / m_config.framesPerSec));
+  }
+
+  uint8_t frame[0x10003];
+  const int len = 6 + payloadLen;
+  frame[0] = HOST_PREFIX;
+  frame[1] = (len >> 8) & 0xff;
+  frame[2] = len & 0xff;
+  frame[3] = (m_seq >> 8) & 0xff;
+  frame[4] = m_seq & 0xff;
+  m_seq++;
+  frame[5] = pipe;
+  frame[6] = cmd;
+  if (payloadLen > 0)
+  {
+    memcpy(frame + 7, payload, payloadLen);
+  }
+
+  const auto start = std::chrono::steady_clock::now();
+  if (write(m_fd, frame, len + 1) != (len + 1))
+  {
+    m_stats.errors++;
+    return false;
+  }
+
+  bool gotReply = false;
+  while (!gotReply)
+  {
+    if (!readFully(m_reply, 3) || !readFully(m_reply + 3, replyPayloadLen() - 2))
+    {
+      m_stats.errors++;
+      return false;
+    }
+    if ((m_reply[0] == TESTER_PREFIX) && (m_reply[3] == frame[3]) && (m_reply[4] == frame[4]) &&
+        (m_reply[5] == pipe) && (m_reply[6] == cmd))
+    {
+      gotReply = true;
+    }
+    else
+    {
+      m_stats.unsolicitedFrames++;
+    }
+  }
+
+  const auto elapsed = std::chrono::steady_clock::now() - start;
+  m_stats.latenciesUs.push_back(std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+  m_stats.frames++;
+  return true;
+}
+
+bool LoadSession::exchangePath(uint8_t cmd, const std::string& path)
+{
+  return exchange(cmd, reinterpret_cast<const uint8_t*>(path.data()), path.size());
+}
+
+bool LoadSession::doTabletInfo()
+{
+  return exchange(0x01, nullptr, 0);
+}
+
+bool LoadSession::doDirWalk()
+{
+  if (!exchangePath(0x2A, m_config.dir))
+  {
+    return false;
+  }
+
+  uint32_t entrySeq = 0;
+  bool endOfDir = false;
+  while (!endOfDir)
+  {
+    const uint8_t payload[4] =
+    {
+      static_cast<uint8_t>(entrySeq >> 24), static_cast<uint8_t>(entrySeq >> 16),
+      static_cast<uint8_t>(entrySeq >> 8), static_cast<uint8_t>(entrySeq)
+    };
+    if (!exchange(0x2B, payload, sizeof(payload)))
+    {
+      return false;
+    }
+    endOfDir = (m_reply[7] != 1);
+    entrySeq++;
+  }
+  return true;
+}
+
+bool LoadSession::doUpload(const std::string& filename)
+{
+  if (!exchangePath(0x20, m_config.dir + "/" + filename))
+  {
+    return false;
+  }
+
+  // Each write carries a 4-byte file offset, up to 110 bytes of data, and a
+  // trailing checksum byte.
+  uint8_t payload[4 + WRITE_CHUNK_SIZE + 1];
+  for (int offset = 0; offset < m_config.uploadSize; offset += WRITE_CHUNK_SIZE)
+  {
+    const int chunkLen = std::min(WRITE_CHUNK_SIZE, m_config.uploadSize - offset);
+    payload[0] = offset >> 24;
+    payload[1] = offset >> 16;
+    payload[2] = offset >> 8;
+    payload[3] = offset;
+    uint8_t sum = 0;
+    for (int i = 0; i < chunkLen; i++)
+    {
+      payload[4 + i] = static_cast<uint8_t>((offset + i) * 7 + 3);
+      sum += payload[4 + i];
+    }
+    payload[4 + chunkLen] = ~sum;
+    if (!exchange(0x21, payload, 4 + chunkLen + 1))
+    {
+      return false;
+    }
+  }
+
+  return exchange(0x1E, nullptr, 0);
+}
+
+/**
+ * Reads back a file in chunks, checking each chunk's checksum and then the
+ * position-wise accumulated checksum returned by cmd 0x25, as WSDC32 does
+ * after transferring a module.
+ */
+bool LoadSession::doReadback(const std::string& filename)
+{
+  if (!exchangePath(0x23, m_config.dir + "/" + filename))
+  {
+    return false;
+  }
+
+  memset(m_checksumBuf, 0, sizeof(m_checksumBuf));
+  uint32_t chunkNum = 0;
+  bool endOfFile = false;
+  while (!endOfFile)
+  {
+    const uint8_t payload[4] =
+    {
+      static_cast<uint8_t>(chunkNum >> 24), static_cast<uint8_t>(chunkNum >> 16),
+      static_cast<uint8_t>(chunkNum >> 8), static_cast<uint8_t>(chunkNum)
+    };
+    if (!exchange(0x24, payload, sizeof(payload)))
+    {
+      return false;
+    }
+
+    const int dataLen = replyPayloadLen() - 0xc;
+    if (dataLen <= 0)
+    {
+      endOfFile = true;
+    }
+    else
+    {
+      uint8_t sum = 0;
+      for (int i = 0; i < dataLen; i++)
+      {
+        sum += m_reply[12 + i];
+        m_checksumBuf[i % sizeof(m_checksumBuf)] += m_reply[12 + i];
+      }
+      if (static_cast<uint8_t>(~sum) != m_reply[12 + dataLen])
+      {
+        m_stats.checksumMismatches++;
+      }
+      chunkNum++;
+    }
+  }
+
+  if (!exchange(0x25, nullptr, 0))
+  {
+    return false;
+  }
+  for (unsigned int i = 0; i < sizeof(m_checksumBuf); i++)
+  {
+    if (m_reply[8 + i] != static_cast<uint8_t>(~m_checksumBuf[i]))
+    {
+      m_stats.checksumMismatches++;
+      break;
+    }
+  }
+
+  return exchange(0x1E, nullptr, 0);
+}
+
+bool LoadSession::doSlowInit()
+{
+  const uint8_t startPayload[3] =
+  {
+    static_cast<uint8_t>(m_config.ecuId >> 8), static_cast<uint8_t>(m_config.ecuId), POLL_PIPE
+  };
+  const uint8_t initPayload[2] = { 0x10, 0x06 };
+
+  return exchange(0x0B, startPayload, sizeof(startPayload)) &&
+         exchange(0x11, initPayload, sizeof(initPayload), POLL_PIPE) &&
+         exchange(0x1C, nullptr, 0, POLL_PIPE);
+}
+
+/**
+ * Issues a non-verbose KWP71 "read RAM" block (title 01, one byte) through
+ * cmd 0x13, which is what WSDC32 does continually on live data screens.
+ */
+bool LoadSession::doPoll()
+{
+  const uint16_t addr = m_rng() & 0xffff;
+  const uint8_t payload[4] = { 0x01, 0x01, static_cast<uint8_t>(addr >> 8), static_cast<uint8_t>(addr) };
+  return exchange(0x13, payload, sizeof(payload), POLL_PIPE);
+}
+
+void LoadSession::run(const std::atomic<bool>& stop)
+{
+  const std::string filename = "LOAD" + std::to_string(m_rng() % 10000) + ".BIN";
+  bool uploaded = false;
+  bool ok = !m_opTable.empty();
+  m_nextSend = std::chrono::steady_clock::now();
+
+  // The ECU must be selected (cmd 0x0B) before cmd 0x13 polling is meaningful.
+  const uint8_t startPayload[3] =
+  {
+    static_cast<uint8_t>(m_config.ecuId >> 8), static_cast<uint8_t>(m_config.ecuId), POLL_PIPE
+  };
+  ok = ok && exchange(0x0B, startPayload, sizeof(startPayload));
+
+  while (ok && !stop)
+  {
+    const LoadOp op = m_opTable[m_rng() % m_opTable.size()];
+    switch (op)
+    {
+    case LoadOp::TabletInfo:
+      ok = doTabletInfo();
+      break;
+    case LoadOp::DirWalk:
+      ok = doDirWalk();
+      break;
+    case LoadOp::Upload:
+      ok = doUpload(filename);
+      uploaded = uploaded || ok;
+      break;
+    case LoadOp::Readback:
+      if (!uploaded)
+      {
+        ok = doUpload(filename);
+        uploaded = ok;
+      }
+      ok = ok && doReadback(filename);
+      break;
+    case LoadOp::SlowInit:
+      ok = doSlowInit() && exchange(0x0B, startPayload, sizeof(startPayload));
+      break;
+    case LoadOp::Poll:
+      ok = doPoll();
+      break;
+    }
+    if (ok)
+    {
+      m_stats.opCounts[op]++;
+    }
+  }
+
+  if (!ok && !stop)
+  {
+    fprintf(stderr, "%s: session ended early (connection closed or bad reply)\n", m_path.c_str());
+  }
+}
+
+/**
+ * Parses a frame mix specification of the form "poll=10,upload=1,...".
+ * Operations that are not named keep their default weight.
+ */
+bool parseMix(const std::string& spec, std::map<LoadOp,int>& mix)
+{
+  size_t pos = 0;
+  while (pos < spec.size())
+  {
+    const size_t comma = spec.find(',', pos);
+    const std::string item = spec.substr(pos, (comma == std::string::npos) ? std::string::npos : comma - pos);
+    const size_t eq = item.find('=');
+    if (eq == std::string::npos)
+    {
+      return false;
+    }
+
+    const std::string name = item.substr(0, eq);
+    const auto op = std::find_if(s_opNames.begin(), s_opNames.end(),
+                                 [&name](const std::pair<const LoadOp,std::string>& p) { return p.second == name; });
+    if (op == s_opNames.end())
+    {
+      return false;
+    }
+    mix[op->first] = std::max(0, atoi(item.c_str() + eq + 1));
+    pos = (comma == std::string::npos) ? spec.size() : comma + 1;
+  }
+  return true;
+}
+
+void printReport(const LoadGenConfig& config, const std::vector<SessionStats>& stats, double elapsedSecs)
+{
+  std::vector<uint32_t> latencies;
+  uint64_t frames = 0;
+  uint64_t unsolicited = 0;
+  uint64_t mismatches = 0;
+  uint64_t errors = 0;
+  std::map<LoadOp,uint64_t> opCounts;
+
+  for (const SessionStats& s : stats)
+  {
+    frames += s.frames;
+    unsolicited += s.unsolicitedFrames;
+    mismatches += s.checksumMismatches;
+    errors += s.errors;
+    latencies.insert(latencies.end(), s.latenciesUs.begin(), s.latenciesUs.end());
+    for (const auto& op : s.opCounts)
+    {
+      opCounts[op.first] += op.second;
+    }
+  }
+  std::sort(latencies.begin(), latencies.end());
+
+  const auto percentile = [&latencies](double p) -> double
+  {
+    if (latencies.empty())
+    {
+      return 0.0;
+    }
+    const size_t index = std::min(latencies.size() - 1, static_cast<size_t>(p * latencies.size()));
+    return latencies[index] / 1000.0;
+  };
+
+  printf("\n=== sd2-loadgen report ===\n");
+  printf("sessions:          %d\n", config.sessions);
+  printf("elapsed:           %.2f s\n", elapsedSecs);
+  printf("frames:            %llu\n", static_cast<unsigned long long>(frames));
+  printf("sustained rate:    %.1f frames/s (%.1f per session)\n",
+         frames / elapsedSecs, frames / elapsedSecs / config.sessions);
+  printf("latency p50:       %.3f ms\n", percentile(0.50));
+  printf("latency p90:       %.3f ms\n", percentile(0.90));
+  printf("latency p99:       %.3f ms\n", percentile(0.99));
+  printf("latency p99.9:     %.3f ms\n", percentile(0.999));
+  printf("latency max:       %.3f ms\n", latencies.empty() ? 0.0 : latencies.back() / 1000.0);
+  printf("unsolicited:       %llu\n", static_cast<unsigned long long>(unsolicited));
+  printf("checksum errors:   %llu\n", static_cast<unsigned long long>(mismatches));
+  printf("link errors:       %llu\n", static_cast<unsigned long long>(errors));
+  printf("completed operations:\n");
+  for (const auto& op : opCounts)
+  {
+    printf("  %-10s %llu\n", s_opNames.at(op.first).c_str(), static_cast<unsigned long long>(op.second));
+  }
+}
+
@@ -0,0 +1,98 @@
+#pragma once
+#include <cstdint>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <map>
+#include <random>
+#include <atomic>
+
+/**
+ * Types of host-side (WSDC32) transactions that the load generator can issue.
+ * Each transaction consists of one or more request/reply frame exchanges.
+ */
+enum class LoadOp
+{
+  TabletInfo, // cmd 0x01
+  DirWalk,    // cmd 0x2A followed by repeated 0x2B until end-of-directory
+  Upload,     // cmd 0x20, a series of 0x21, and 0x1E
+  Readback,   // cmd 0x23, a series of 0x24, 0x25 checksum verification, and 0x1E
+  SlowInit,   // cmd 0x0B, 0x11, and 0x1C
+  Poll        // cmd 0x13 (KWP71 RAM read)
+};
+
+struct LoadGenConfig
+{
+  std::string socketPath;
+  int sessions = 1;
+  int durationSecs = 10;
+  double framesPerSec = 0.0; // per session; 0 means "as fast as the simulator replies"
+  int ecuId = 90;
+  int uploadSize = 4096;
+  std::string dir = "/FN0/ecu";
+  std::map<LoadOp,int> mix =
+  {
+    { LoadOp::TabletInfo, 1 },
+    { LoadOp::DirWalk, 1 },
+    { LoadOp::Upload, 1 },
+    { LoadOp::Readback, 1 },
+    { LoadOp::SlowInit, 1 },
+    { LoadOp::Poll, 10 }
+  };
+};
+
+struct SessionStats
+{
+  uint64_t frames = 0;
+  uint64_t unsolicitedFrames = 0;
+  uint64_t checksumMismatches = 0;
+  uint64_t errors = 0;
+  std::map<LoadOp,uint64_t> opCounts;
+  std::vector<uint32_t> latenciesUs;
+};
+
+/**
+ * Emulates the host side of the SD2 serial link. The simulator connects to a
+ * UNIX domain socket as a client (just as it would to a VirtualBox host pipe),
+ * so each load generator session listens on its own socket path and waits for
+ * one simulator instance to connect to it.
+ */
+class LoadSession
+{
+public:
+  LoadSession(const LoadGenConfig& config, const std::string& path, int sessionNum);
+  ~LoadSession();
+  bool waitForSimulator();
+  void run(const std::atomic<bool>& stop);
+  const SessionStats& stats() const { return m_stats; }
+  const std::string& path() const { return m_path; }
+
+private:
+  const LoadGenConfig& m_config;
+  std::string m_path;
+  int m_listenFd = -1;
+  int m_fd = -1;
+  uint16_t m_seq = 0;
+  std::mt19937 m_rng;
+  std::vector<LoadOp> m_opTable;
+  SessionStats m_stats;
+  uint8_t m_reply[0x10003];
+  uint8_t m_checksumBuf[110];
+  std::chrono::steady_clock::time_point m_nextSend;
+
+  bool exchange(uint8_t cmd, const uint8_t* payload, int payloadLen, uint8_t pipe = 0);
+  bool exchangePath(uint8_t cmd, const std::string& path);
+  bool readFully(uint8_t* buf, int count);
+  int replyPayloadLen() const;
+
+  bool doTabletInfo();
+  bool doDirWalk();
+  bool doUpload(const std::string& filename);
+  bool doReadback(const std::string& filename);
+  bool doSlowInit();
+  bool doPoll();
+};
+
+bool parseMix(const std::string& spec, std::map<LoadOp,int>& mix);
+void printReport(const LoadGenConfig& config, const std::vector<SessionStats>& stats, double elapsedSecs);
+
@@ -0,0 +1,135 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <getopt.h>
+#include <memory>
+#include <thread>
+#include "LoadGen.h"
+
+static std::atomic<bool> s_stop(false);
+
+static void onSignal(int)
+{
+  s_stop = true;
+}
+
+static void usage(const char* prog)
+{
+  printf("Usage: %s [options] <socket-path>\n"
+         "Emulates the WSDC32 side of the SD2 link to generate load on sd2-tester-sim.\n"
+         "\n"
+         "  -n, --sessions N     number of concurrent sessions (default 1); with more than\n"
+         "                       one, session i listens on <socket-path>.i\n"
+         "  -d, --duration S     test duration in seconds (default 10)\n"
+         "  -r, --rate F         target frames/s per session (default 0: unthrottled)\n"
+         "  -m, --mix SPEC       operation weights, e.g. poll=10,upload=1,readback=1,\n"
+         "                       dir=1,tablet=1,init=1\n"
+         "  -e, --ecu ID         ECU ID selected for slow init and polling (default 90)\n"
+         "  -u, --upload-size N  size in bytes of uploaded test files (default 4096)\n"
+         "  -D, --dir PATH       Tester directory used for uploads and walks (default /FN0/ecu)\n",
+         prog);
+}
+
+int main(int argc, char* argv[])
+{
+  LoadGenConfig config;
+  const struct option longOpts[] =
+  {
+    { "sessions", required_argument, nullptr, 'n' },
+    { "duration", required_argument, nullptr, 'd' },
+    { "rate", required_argument, nullptr, 'r' },
+    { "mix", required_argument, nullptr, 'm' },
+    { "ecu", required_argument, nullptr, 'e' },
+    { "upload-size", required_argument, nullptr, 'u' },
+    { "dir", required_argument, nullptr, 'D' },
+    { "help", no_argument, nullptr, 'h' },
+    { nullptr, 0, nullptr, 0 }
+  };
+
+  int opt = 0;
+  while ((opt = getopt_long(argc, argv, "n:d:r:m:e:u:D:h", longOpts, nullptr)) != -1)
+  {
+    switch (opt)
+    {
+    case 'n':
+      config.sessions = atoi(optarg);
+      break;
+    case 'd':
+      config.durationSecs = atoi(optarg);
+      break;
+    case 'r':
+      config.framesPerSec = atof(optarg);
+      break;
+    case 'm':
+      if (!parseMix(optarg, config.mix))
+      {
+        fprintf(stderr, "Invalid frame mix '%s'\n", optarg);
+        return 1;
+      }
+      break;
+    case 'e':
+      config.ecuId = atoi(optarg);
+      break;
+    case 'u':
+      config.uploadSize = atoi(optarg);
+      break;
+    case 'D':
+      config.dir = optarg;
+      break;
+    default:
+      usage(argv[0]);
+      return (opt == 'h') ? 0 : 1;
+    }
+  }
+
+  if ((optind >= argc) || (config.sessions < 1) || (config.durationSecs < 1))
+  {
+    usage(argv[0]);
+    return 1;
+  }
+  config.socketPath = argv[optind];
+
+  signal(SIGINT, onSignal);
+  signal(SIGPIPE, SIG_IGN);
+
+  std::vector<std::unique_ptr<LoadSession>> sessions;
+  for (int i = 0; i < config.sessions; i++)
+  {
+    const std::string path = (config.sessions == 1) ? config.socketPath : (config.socketPath + "." + std::to_string(i));
+    sessions.emplace_back(new LoadSession(config, path, i));
+    if (!sessions.back()->waitForSimulator())
+    {
+      return 1;
+    }
+  }
+
+  printf("All %d session(s) connected; running for %d s.\n", config.sessions, config.durationSecs);
+  const auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+  for (auto& session : sessions)
+  {
+    threads.emplace_back(&LoadSession::run, session.get(), std::cref(s_stop));
+  }
+
+  const auto deadline = start + std::chrono::seconds(config.durationSecs);
+  while (!s_stop && (std::chrono::steady_clock::now() < deadline))
+  {
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  }
+  s_stop = true;
+
+  for (std::thread& t : threads)
+  {
+    t.join();
+  }
+  const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  std::vector<SessionStats> stats;
+  for (const auto& session : sessions)
+  {
+    stats.push_back(session->stats());
+  }
+  printReport(config, stats, elapsed);
+  return 0;
+}
+
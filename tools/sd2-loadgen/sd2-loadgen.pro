@@ -0,0 +1,10 @@
+TEMPLATE = app
+CONFIG += console c++17 thread
+CONFIG -= app_bundle qt
+
+SOURCES += \
+    LoadGen.cpp \
+    main.cpp
+
+HEADERS += \
+    LoadGen.h
@@ -1,4 +1,6 @@
 #include "utilities.h"
+#include <QByteArray>
+#include <QString>
 
 /**
  * Computes a 8-bit checksum by iterating over the contents of a frame, using
@@ -46,3 +48,29 @@ void add16BitChecksum(uint8_t* frame)
   frame[bytecount] = checksum & 0xff;
 }
 
+/**
+ * Returns the two least significant decimal digits of a value in BCD.
+ */
+uint8_t toBCD(int val)
+{
+  return static_cast<uint8_t>((((val / 10) % 10) << 4) | (val % 10));
+}
+
+/**
+ * Returns the text as UTF-8, cut to fit a field of the given number of bytes
+ * without splitting a character.
+ */
+std::string fieldText(const QString& text, int fieldLen)
+{
+  QByteArray bytes = text.toUtf8();
+  if (bytes.size() > fieldLen)
+  {
+    int len = fieldLen;
+    while ((len > 0) && ((static_cast<uint8_t>(bytes.at(len)) & 0xc0) == 0x80))
+    {
+      len--;
+    }
+    bytes.truncate(len);
+  }
+  return bytes.toStdString();
+}
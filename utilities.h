@@ -1,7 +1,11 @@
 #pragma once
 
 #include <cstdint>
+#include <string>
+
+class QString;
 
 void add8BitChecksum(uint8_t* frame);
 void add16BitChecksum(uint8_t* frame);
-
+uint8_t toBCD(int val);
+std::string fieldText(const QString& text, int fieldLen);